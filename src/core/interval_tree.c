@@ -68,13 +68,17 @@ static int interval_tree_cmp(const struct rb_node *rb_lhs,
   struct interval_node *lhs = rb_entry(rb_lhs, struct interval_node, base);
   struct interval_node *rhs = rb_entry(rb_rhs, struct interval_node, base);
 
-  int cmp = (int)(lhs->low - rhs->low);
+  // note, the difference between two intervals doesn't necessarily fit in an
+  // int, so compare explicitly
+  if (lhs->low != rhs->low) {
+    return lhs->low < rhs->low ? -1 : 1;
+  }
 
-  if (!cmp) {
-    cmp = (int)(lhs->high - rhs->high);
+  if (lhs->high != rhs->high) {
+    return lhs->high < rhs->high ? -1 : 1;
   }
 
-  return cmp;
+  return 0;
 }
 
 static int interval_tree_intersects(const struct interval_node *n,
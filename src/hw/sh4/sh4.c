@@ -11,7 +11,11 @@
 #include "hw/memory.h"
 #include "hw/scheduler.h"
 #include "hw/sh4/sh4_code_cache.h"
+#include "hw/sh4/sh4_profiler.h"
 #include "jit/frontend/sh4/sh4_analyze.h"
+#include "jit/frontend/sh4/sh4_interp.h"
+#include "jit/frontend/sh4/sh4_translate.h"
+#include "jit/ir/passes/pass_manager.h"
 #include "sys/time.h"
 #include "ui/nuklear.h"
 
@@ -28,8 +32,6 @@ static struct sh4_interrupt_info sh4_interrupts[NUM_SH_INTERRUPTS] = {
 #undef SH4_INT
 };
 
-static struct sh4 *g_sh4;
-
 static void sh4_sr_updated(struct sh4_ctx *ctx, uint64_t old_sr);
 
 //
@@ -165,27 +167,39 @@ static void sh4_intc_update_pending(struct sh4 *sh4) {
   int min_priority = (sh4->ctx.sr & I) >> 4;
   uint64_t priority_mask =
       (sh4->ctx.sr & BL) ? 0 : ~sh4->priority_mask[min_priority];
-  sh4->pending_interrupts = sh4->requested_interrupts & priority_mask;
+  sh4->ctx.pending_interrupts = sh4->requested_interrupts & priority_mask;
 }
 
 static void sh4_intc_check_pending(struct sh4 *sh4) {
-  if (!sh4->pending_interrupts) {
+  if (!sh4->ctx.pending_interrupts) {
     return;
   }
 
   // process the highest priority in the pending vector
-  int n = 63 - clz64(sh4->pending_interrupts);
+  int n = 63 - clz64(sh4->ctx.pending_interrupts);
   enum sh4_interrupt intr = sh4->sorted_interrupts[n];
   struct sh4_interrupt_info *int_info = &sh4_interrupts[intr];
 
   *sh4->INTEVT = int_info->intevt;
-  sh4->ctx.ssr = sh4->ctx.sr;
+  sh4->ctx.ssr = sh4_ctx_load_sr(&sh4->ctx);
   sh4->ctx.spc = sh4->ctx.pc;
   sh4->ctx.sgr = sh4->ctx.r[15];
   sh4->ctx.sr |= (BL | MD | RB);
   sh4->ctx.pc = sh4->ctx.vbr + 0x600;
 
   sh4_sr_updated(&sh4->ctx, sh4->ctx.ssr);
+
+  // the handler is profiled as if it were called from the interrupted code,
+  // its RTE returning to spc
+  if (sh4->ctx.ProfileCall) {
+    sh4->ctx.ProfileCall(&sh4->ctx, (uint64_t)sh4->ctx.pc |
+                                        ((uint64_t)sh4->ctx.spc << 32));
+  }
+}
+
+static void sh4_intc_interrupt(void *data) {
+  struct sh4_ctx *ctx = data;
+  sh4_intc_check_pending(ctx->sh4);
 }
 
 // Generate a sorted set of interrupts based on their priority. These sorted
@@ -274,22 +288,29 @@ static void sh4_ccn_reset(struct sh4 *sh4) {
   sh4_cache_unlink_blocks(sh4->code_cache);
 }
 
-static uint32_t sh4_compile_pc() {
-  uint32_t guest_addr = g_sh4->ctx.pc;
-  uint8_t *guest_ptr = as_translate(g_sh4->base.memory->space, guest_addr);
+static void sh4_compile_pc(void *data) {
+  struct sh4_ctx *ctx = data;
+  struct sh4 *sh4 = ctx->sh4;
+
+  uint32_t guest_addr = ctx->pc;
+  uint8_t *guest_ptr = as_translate(sh4->base.memory->space, guest_addr);
+
+  // interpret the block until it's proven hot enough to be worth compiling.
+  // the dispatcher picks up from the updated pc either way
+  if (!sh4_cache_promote_code(sh4->code_cache, guest_addr)) {
+    sh4_interp_block(&sh4->memory_if, ctx, guest_addr, guest_ptr);
+    return;
+  }
 
   int flags = 0;
-  if (g_sh4->ctx.fpscr & PR) {
+  if (ctx->fpscr & PR) {
     flags |= SH4_DOUBLE_PR;
   }
-  if (g_sh4->ctx.fpscr & SZ) {
+  if (ctx->fpscr & SZ) {
     flags |= SH4_DOUBLE_SZ;
   }
 
-  code_pointer_t code =
-      sh4_cache_compile_code(g_sh4->code_cache, guest_addr, guest_ptr, flags);
-
-  return code();
+  sh4_cache_compile_code(sh4->code_cache, guest_addr, guest_ptr, flags);
 }
 
 static void sh4_invalid_instr(struct sh4_ctx *ctx, uint64_t data) {
@@ -367,6 +388,19 @@ static void sh4_fpscr_updated(struct sh4_ctx *ctx, uint64_t old_fpscr) {
   }
 }
 
+static void sh4_profile_call(struct sh4_ctx *ctx, uint64_t target_ret) {
+  struct sh4 *sh4 = ctx->sh4;
+
+  sh4_profiler_call(sh4->code_cache->profiler, (uint32_t)target_ret,
+                    (uint32_t)(target_ret >> 32));
+}
+
+static void sh4_profile_return(struct sh4_ctx *ctx, uint64_t ret_addr) {
+  struct sh4 *sh4 = ctx->sh4;
+
+  sh4_profiler_return(sh4->code_cache->profiler, (uint32_t)ret_addr);
+}
+
 // static int sh4_debug_num_registers() {
 //   return 59;
 // }
@@ -714,7 +748,12 @@ static bool sh4_init(struct device *dev) {
                                     &as_write16,
                                     &as_write32,
                                     &as_write64};
-  sh4->code_cache = sh4_cache_create(&sh4->memory_if, &sh4_compile_pc);
+  sh4->guest.offset_pc = offsetof(struct sh4_ctx, pc);
+  sh4->guest.offset_cycles = offsetof(struct sh4_ctx, num_cycles);
+  sh4->guest.offset_interrupts = offsetof(struct sh4_ctx, pending_interrupts);
+  sh4->guest.compile_code = &sh4_compile_pc;
+  sh4->guest.interrupt = &sh4_intc_interrupt;
+  sh4->code_cache = sh4_cache_create(&sh4->memory_if, &sh4->guest);
 
   // initialize context
   sh4->ctx.sh4 = sh4;
@@ -722,10 +761,15 @@ static bool sh4_init(struct device *dev) {
   sh4->ctx.Prefetch = &sh4_prefetch;
   sh4->ctx.SRUpdated = &sh4_sr_updated;
   sh4->ctx.FPSCRUpdated = &sh4_fpscr_updated;
+  if (sh4->code_cache->profiler) {
+    sh4->ctx.ProfileCall = &sh4_profile_call;
+    sh4->ctx.ProfileReturn = &sh4_profile_return;
+  }
+  sh4->ctx.fsca_table = sh4_fsca_table;
   sh4->ctx.pc = 0xa0000000;
   sh4->ctx.r[15] = 0x8d000000;
   sh4->ctx.pr = 0x0;
-  sh4->ctx.sr = 0x700000f0;
+  sh4_ctx_store_sr(&sh4->ctx, 0x700000f0);
   sh4->ctx.fpscr = 0x00040001;
 
 // initialize registers
@@ -777,6 +821,72 @@ static void sh4_paint_debug_menu(struct device *dev, struct nk_context *ctx) {
 
   if (nk_tree_push(ctx, NK_TREE_TAB, "sh4", NK_MINIMIZED)) {
     nk_value_int(ctx, "mips", perf->mips);
+
+    if (sh4->code_cache) {
+      nk_value_int(ctx, "interpreted blocks",
+                   sh4->code_cache->num_interpreted);
+      nk_value_int(ctx, "promoted blocks", sh4->code_cache->num_promoted);
+      nk_value_int(ctx, "evicted regions", sh4->code_cache->num_evictions);
+      nk_value_int(ctx, "evicted blocks", sh4->code_cache->num_evicted_blocks);
+    }
+
+    if (sh4->code_cache &&
+        nk_tree_push(ctx, NK_TREE_TAB, "compile stats", NK_MINIMIZED)) {
+      struct sh4_cache *cache = sh4->code_cache;
+
+      nk_value_int(ctx, "compiled blocks", cache->num_compiled);
+      nk_value_int(ctx, "recompiled blocks", cache->num_recompiled);
+      nk_value_int(ctx, "slowmem recompiles", cache->num_slowmem_recompiles);
+      nk_value_int(ctx, "invalidated blocks", cache->num_invalidated);
+      nk_value_int(ctx, "cache flushes", cache->num_flushes);
+      nk_value_int(ctx, "code buffer resets", cache->num_resets);
+      nk_labelf(ctx, NK_TEXT_LEFT, "host code emitted: %.1f kb",
+                cache->host_bytes_emitted / 1024.0);
+
+      // latencies are shown in microseconds
+      for (int i = 0; i < SH4_NUM_COMPILE_STAGES; i++) {
+        struct jit_histogram *hist = &cache->compile_times[i];
+
+        nk_labelf(ctx, NK_TEXT_LEFT,
+                  "%s: %d runs, mean %.1f, p99 %.1f, max %.1f",
+                  sh4_compile_stage_names[i], (int)hist->count,
+                  jit_histogram_mean(hist) / 1000.0,
+                  jit_histogram_percentile(hist, 99) / 1000.0,
+                  hist->max / 1000.0);
+      }
+
+      for (int i = 0; i < cache->passes->num_passes; i++) {
+        struct pass_manager_pass *pass = &cache->passes->passes[i];
+        struct jit_histogram *hist = &pass->times;
+
+        nk_labelf(ctx, NK_TEXT_LEFT,
+                  "  %s: %d runs, mean %.1f, p99 %.1f, max %.1f",
+                  pass->info->name, (int)hist->count,
+                  jit_histogram_mean(hist) / 1000.0,
+                  jit_histogram_percentile(hist, 99) / 1000.0,
+                  hist->max / 1000.0);
+      }
+
+      nk_tree_pop(ctx);
+    }
+
+    // show the code pages which have had blocks invalidated by writes
+    if (sh4->code_cache &&
+        nk_tree_push(ctx, NK_TREE_TAB, "code page writes", NK_MINIMIZED)) {
+      for (int i = 0; i < NUM_CODE_PAGES; i++) {
+        struct sh4_code_page *page = &sh4->code_cache->pages[i];
+
+        if (!page->num_writes) {
+          continue;
+        }
+
+        nk_labelf(ctx, NK_TEXT_LEFT, "0x%08x: %d writes, %d invalidations",
+                  page->addr, page->num_writes, page->num_invalidations);
+      }
+
+      nk_tree_pop(ctx);
+    }
+
     nk_tree_pop(ctx);
   }
 
@@ -815,12 +925,9 @@ static void sh4_run_inner(struct device *dev, int64_t ns) {
   // each block's epilog will decrement the remaining cycles as they run
   sh4->ctx.num_cycles = (int)cycles;
 
-  while (sh4->ctx.num_cycles > 0) {
-    code_pointer_t code = sh4_cache_get_code(sh4->code_cache, sh4->ctx.pc);
-    sh4->ctx.pc = code();
-
-    sh4_intc_check_pending(sh4);
-  }
+  // run the generated dispatch loop until the cycles are exhausted. it calls
+  // back into sh4_compile_pc and sh4_intc_interrupt as needed
+  sh4_cache_run_code(sh4->code_cache);
 
   // track mips
   int64_t now = time_nanoseconds();
@@ -936,14 +1043,10 @@ struct sh4 *sh4_create(struct dreamcast *dc) {
   sh4->base.memory = memory_interface_create(dc, &sh4_data_map);
   sh4->base.window = window_interface_create(NULL, &sh4_paint_debug_menu, NULL);
 
-  g_sh4 = sh4;
-
   return sh4;
 }
 
 void sh4_destroy(struct sh4 *sh4) {
-  g_sh4 = NULL;
-
   if (sh4->code_cache) {
     sh4_cache_destroy(sh4->code_cache);
   }
@@ -39,6 +39,7 @@ struct sh4 {
   struct address_space *space;
 
   struct jit_memory_interface memory_if;
+  struct jit_guest guest;
   struct sh4_cache *code_cache;
   struct sh4_ctx ctx;
   uint8_t cache[0x2000];  // 8kb cache
@@ -57,7 +58,6 @@ struct sh4 {
   uint64_t sort_id[NUM_SH_INTERRUPTS];
   uint64_t priority_mask[16];
   uint64_t requested_interrupts;
-  uint64_t pending_interrupts;
 
   struct timer *tmu_timers[3];
 
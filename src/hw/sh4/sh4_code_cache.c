@@ -1,105 +1,468 @@
+#include <inttypes.h>
+#include <time.h>
 #include "hw/sh4/sh4_code_cache.h"
 #include "core/core.h"
+#include "core/math.h"
+#include "core/option.h"
 #include "core/profiler.h"
+#include "hw/memory.h"
+#include "hw/sh4/sh4_profiler.h"
 #include "jit/backend/backend.h"
 #include "jit/backend/x64/x64_backend.h"
 #include "jit/frontend/frontend.h"
 #include "jit/frontend/sh4/sh4_analyze.h"
+#include "jit/frontend/sh4/sh4_context.h"
 #include "jit/frontend/sh4/sh4_frontend.h"
 #include "jit/ir/ir.h"
-// #include "jit/ir/passes/constant_propagation_pass.h"
-// #include "jit/ir/passes/conversion_elimination_pass.h"
-#include "jit/ir/passes/dead_code_elimination_pass.h"
-#include "jit/ir/passes/load_store_elimination_pass.h"
-#include "jit/ir/passes/register_allocation_pass.h"
+#include "jit/ir/ir_cache.h"
+#include "jit/ir/passes/pass_manager.h"
+#include "jit/ir/passes/pass_stat.h"
+#include "jit/jit_perf.h"
+#include "jit/jit_stats.h"
 #include "sys/exception_handler.h"
 #include "sys/filesystem.h"
+#include "sys/memory.h"
+#include "sys/time.h"
+
+DEFINE_OPTION_BOOL(ir_cache, false,
+                   "Cache compiled code on disk to speed up future runs");
+DEFINE_OPTION_BOOL(ir_corpus, false,
+                   "Write each translated block's unoptimized IR and guest code "
+                   "to the corpus directory in the app directory");
+DEFINE_OPTION_INT(jit_threshold, 16,
+                  "Number of times a block is interpreted before it's compiled");
+DEFINE_OPTION_INT(jit_code_size, 8, "Size of the JIT's code buffer in MB");
+DEFINE_OPTION_INT(jit_code_regions, 8,
+                  "Number of regions the JIT's code buffer is evicted in");
+DEFINE_OPTION_INT(slowmem_threshold, 8,
+                  "Number of fastmem faults before a block is recompiled with "
+                  "slowmem");
+DEFINE_OPTION_STRING(jit_isa, "auto",
+                     "Highest tier of host instruction set extensions used by "
+                     "the JIT (auto, sse2, sse41, avx, avx2)");
+DEFINE_OPTION_BOOL(jit_exact_fpu, false,
+                   "Round each multiply and add separately like the SH4, "
+                   "instead of fusing them into host multiply-adds");
+DEFINE_OPTION_BOOL(perf_map, false,
+                   "Write /tmp/perf-<pid>.map so perf can symbolize compiled "
+                   "code");
+DEFINE_OPTION_BOOL(perf_jitdump, false,
+                   "Write /tmp/jit-<pid>.dump with compiled code and the guest "
+                   "address of each instruction, for use with perf inject");
+DEFINE_OPTION_BOOL(jit_stats, false,
+                   "Write compile latencies and counts to jit_stats.txt in the "
+                   "app directory on exit");
+DEFINE_OPTION_BOOL(profile_guest, false,
+                   "Sample the guest's pc and call stack, writing a report and "
+                   "a flamegraph stack file to the app directory on exit");
+DEFINE_OPTION_STRING(profile_symbols, "",
+                     "File of \"address name\" lines naming the guest's "
+                     "functions in the profile");
+
+const char *sh4_compile_stage_names[SH4_NUM_COMPILE_STAGES] = {
+    "analyze", "translate", "optimize", "assemble", "total",
+};
+
+// the address regions each code page is watched through
+static const uint32_t sh4_code_page_regions[NUM_CODE_PAGE_REGIONS] = {
+    0x00000000, 0x80000000, 0xa0000000,
+};
 
-static int block_map_cmp(const struct rb_node *rb_lhs,
-                         const struct rb_node *rb_rhs) {
-  const struct sh4_block *lhs =
-      container_of(rb_lhs, const struct sh4_block, it);
-  const struct sh4_block *rhs =
-      container_of(rb_rhs, const struct sh4_block, it);
+#define CODE_PAGE_REGION_MASK 0xe0000000
+#define CODE_PAGE_ADDR_MASK (~CODE_PAGE_REGION_MASK & ~(CODE_PAGE_SIZE - 1))
 
-  return (int)((int64_t)lhs->guest_addr - (int64_t)rhs->guest_addr);
+// the guest is sampled once per millisecond of cpu time used running it
+#define SH4_PROFILE_INTERVAL_US 1000
+
+static int sh4_block_guest_span(const struct sh4_block *block) {
+  uint32_t last = block->guest_addr + MAX(block->guest_size, 1) - 1;
+  return (int)((last >> GUEST_BUCKET_BITS) -
+               (block->guest_addr >> GUEST_BUCKET_BITS));
 }
 
-static int reverse_block_map_cmp(const struct rb_node *rb_lhs,
-                                 const struct rb_node *rb_rhs) {
-  const struct sh4_block *lhs =
-      container_of(rb_lhs, const struct sh4_block, rit);
-  const struct sh4_block *rhs =
-      container_of(rb_rhs, const struct sh4_block, rit);
+static int sh4_block_host_span(const struct sh4_block *block) {
+  uintptr_t first = (uintptr_t)block->host_addr;
+  uintptr_t last = first + MAX(block->host_size, 1) - 1;
+  return (int)((last >> HOST_BUCKET_BITS) - (first >> HOST_BUCKET_BITS));
+}
 
-  return (int)(lhs->host_addr - rhs->host_addr);
+void sh4_block_map_insert(struct sh4_block_map *map, struct sh4_block *block) {
+  list_add(&map->blocks, &block->it);
+  list_add(&map->guest_buckets[GUEST_BUCKET(block->guest_addr)],
+           &block->bucket_it);
+  list_add(&map->host_buckets[HOST_BUCKET(block->host_addr)],
+           &block->host_bucket_it);
+
+  map->max_guest_span = MAX(map->max_guest_span, sh4_block_guest_span(block));
+  map->max_host_span = MAX(map->max_host_span, sh4_block_host_span(block));
 }
 
-static struct rb_callbacks block_map_cb = {
-    &block_map_cmp, NULL, NULL,
-};
+void sh4_block_map_remove(struct sh4_block_map *map, struct sh4_block *block) {
+  list_remove(&map->blocks, &block->it);
+  list_remove(&map->guest_buckets[GUEST_BUCKET(block->guest_addr)],
+              &block->bucket_it);
+  list_remove(&map->host_buckets[HOST_BUCKET(block->host_addr)],
+              &block->host_bucket_it);
 
-static struct rb_callbacks reverse_block_map_cb = {
-    &reverse_block_map_cmp, NULL, NULL,
-};
+  if (list_empty(&map->blocks)) {
+    map->max_guest_span = 0;
+    map->max_host_span = 0;
+  }
+}
+
+struct sh4_block *sh4_block_map_find(struct sh4_block_map *map,
+                                     uint32_t guest_addr) {
+  struct list *bucket = &map->guest_buckets[GUEST_BUCKET(guest_addr)];
+
+  list_for_each_entry(block, bucket, struct sh4_block, bucket_it) {
+    if (block->guest_addr == guest_addr) {
+      return block;
+    }
+  }
+
+  return NULL;
+}
+
+struct sh4_block *sh4_block_map_lookup(struct sh4_block_map *map,
+                                       uint32_t guest_addr) {
+  // find a block containing guest_addr, starting in either its bucket or one
+  // of the preceding buckets
+  for (int i = 0; i <= map->max_guest_span; i++) {
+    uint32_t bucket_addr = guest_addr - (i << GUEST_BUCKET_BITS);
+    struct list *bucket = &map->guest_buckets[GUEST_BUCKET(bucket_addr)];
+
+    list_for_each_entry(block, bucket, struct sh4_block, bucket_it) {
+      if (guest_addr - block->guest_addr < (uint32_t)block->guest_size) {
+        return block;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+struct sh4_block *sh4_block_map_lookup_reverse(struct sh4_block_map *map,
+                                               const uint8_t *host_addr) {
+  // note, this is called from the exception handler, so it must not allocate
+  // memory
+  for (int i = 0; i <= map->max_host_span; i++) {
+    uintptr_t bucket_addr = (uintptr_t)host_addr - (i << HOST_BUCKET_BITS);
+    struct list *bucket = &map->host_buckets[HOST_BUCKET(bucket_addr)];
+
+    list_for_each_entry(block, bucket, struct sh4_block, host_bucket_it) {
+      if ((uintptr_t)(host_addr - block->host_addr) <
+          (uintptr_t)block->host_size) {
+        return block;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static struct sh4_code_table *sh4_cache_alloc_table(struct sh4_cache *cache,
+                                                    uint32_t guest_addr) {
+  struct sh4_code_table **table = &cache->tables[CODE_TABLE(guest_addr)];
+
+  // give the range its own copy of the default table the first time it's
+  // written to
+  if (*table == &cache->default_table) {
+    *table = malloc(sizeof(struct sh4_code_table));
+    memcpy(*table, &cache->default_table, sizeof(struct sh4_code_table));
+    cache->num_tables++;
+  }
+
+  return *table;
+}
+
+static bool sh4_cache_block_linked(struct sh4_cache *cache,
+                                   struct sh4_block *block) {
+  return sh4_cache_get_code(cache, block->guest_addr) ==
+         (code_pointer_t)block->host_addr;
+}
+
+static struct list *sh4_cache_edge_list(struct sh4_cache *cache,
+                                        struct sh4_edge *edge) {
+  if (edge->dst) {
+    return &edge->dst->in_edges;
+  }
+
+  return &cache->unresolved_edges[EDGE_BUCKET(edge->dst_addr)];
+}
+
+static void sh4_cache_link_edge(struct sh4_cache *cache, struct sh4_edge *edge,
+                                struct sh4_block *dst) {
+  list_remove(sh4_cache_edge_list(cache, edge), &edge->in_it);
+  edge->dst = dst;
+  list_add(sh4_cache_edge_list(cache, edge), &edge->in_it);
+
+  cache->backend->link_code(cache->backend, edge->branch, dst->host_addr);
+}
+
+static void sh4_cache_unlink_edge(struct sh4_cache *cache,
+                                  struct sh4_edge *edge) {
+  cache->backend->unlink_code(cache->backend, edge->branch);
+
+  list_remove(sh4_cache_edge_list(cache, edge), &edge->in_it);
+  edge->dst = NULL;
+  list_add(sh4_cache_edge_list(cache, edge), &edge->in_it);
+}
+
+static void sh4_cache_link_block(struct sh4_cache *cache,
+                                 struct sh4_block *block,
+                                 const struct jit_exit *exits, int num_exits) {
+  // add an unresolved edge for each of the block's static exits
+  for (int i = 0; i < num_exits; i++) {
+    struct sh4_edge *edge = calloc(1, sizeof(struct sh4_edge));
+    edge->src = block;
+    edge->dst_addr = exits[i].dst;
+    edge->branch = exits[i].branch;
+    list_add(&block->out_edges, &edge->out_it);
+    list_add(sh4_cache_edge_list(cache, edge), &edge->in_it);
+  }
+
+  // resolve edges from other blocks which were waiting on this block. edges
+  // belonging to blocks that have since been unlinked are left alone, they'll
+  // be removed when their block is recompiled
+  struct list *bucket =
+      &cache->unresolved_edges[EDGE_BUCKET(block->guest_addr)];
+
+  list_for_each_entry_safe(edge, bucket, struct sh4_edge, in_it) {
+    if (edge->dst_addr != block->guest_addr ||
+        !sh4_cache_block_linked(cache, edge->src)) {
+      continue;
+    }
+
+    sh4_cache_link_edge(cache, edge, block);
+  }
+
+  // resolve the block's own exits to any blocks which have already been
+  // compiled
+  list_for_each_entry(edge, &block->out_edges, struct sh4_edge, out_it) {
+    if (edge->dst) {
+      continue;
+    }
+
+    struct sh4_block *dst = sh4_cache_get_block(cache, edge->dst_addr);
+
+    if (!dst || !sh4_cache_block_linked(cache, dst)) {
+      continue;
+    }
+
+    sh4_cache_link_edge(cache, edge, dst);
+  }
+}
 
 static void sh4_cache_unlink_block(struct sh4_cache *cache,
                                    struct sh4_block *block) {
-  cache->code[BLOCK_OFFSET(block->guest_addr)] = cache->default_code;
+  // the block's table has already been allocated, compiling it wrote to it
+  struct sh4_code_table *table = cache->tables[CODE_TABLE(block->guest_addr)];
+  table->code[CODE_TABLE_OFFSET(block->guest_addr)] = cache->default_code;
+
+  // any block jumping directly to this one must now go through the dispatch
+  // loop. note, this is called from the exception handler, so it must not
+  // allocate or free memory
+  list_for_each_entry_safe(edge, &block->in_edges, struct sh4_edge, in_it) {
+    sh4_cache_unlink_edge(cache, edge);
+  }
 }
 
 static void sh4_cache_remove_block(struct sh4_cache *cache,
                                    struct sh4_block *block) {
   sh4_cache_unlink_block(cache, block);
 
-  rb_unlink(&cache->blocks, &block->it, &block_map_cb);
-  rb_unlink(&cache->reverse_blocks, &block->rit, &reverse_block_map_cb);
+  // remove the block's own exits
+  list_for_each_entry_safe(edge, &block->out_edges, struct sh4_edge, out_it) {
+    if (edge->dst) {
+      cache->backend->unlink_code(cache->backend, edge->branch);
+    }
 
+    list_remove(sh4_cache_edge_list(cache, edge), &edge->in_it);
+    list_remove(&block->out_edges, &edge->out_it);
+    free(edge);
+  }
+
+  if (block->invalid) {
+    list_remove(&cache->invalid_blocks, &block->invalid_it);
+  }
+
+  sh4_block_map_remove(&cache->blocks, block);
+
+  free(block->lines);
   free(block);
 }
 
-static struct sh4_block *sh4_cache_lookup_block(struct sh4_cache *cache,
-                                                uint32_t guest_addr) {
-  // find the first block who's address is greater than guest_addr
-  struct sh4_block search;
-  search.guest_addr = guest_addr;
+static void sh4_cache_remove_invalid_blocks(struct sh4_cache *cache) {
+  list_for_each_entry_safe(block, &cache->invalid_blocks, struct sh4_block,
+                           invalid_it) {
+    sh4_cache_remove_block(cache, block);
+  }
+}
+
+static int sh4_cache_code_page_view(struct sh4_cache *cache,
+                                    uintptr_t host_addr, uint32_t *addr) {
+  // map a host address back to the guest address and code page view it was
+  // accessed through
+  int view = 0;
+  uintptr_t offset = host_addr - (uintptr_t)cache->space->base;
 
-  struct rb_node *first = rb_first(&cache->blocks);
-  struct rb_node *last = rb_last(&cache->blocks);
-  struct rb_node *it =
-      rb_upper_bound(&cache->blocks, &search.it, &block_map_cb);
+  if (offset >= ADDRESS_SPACE_SIZE) {
+    view = NUM_CODE_PAGE_REGIONS;
+    offset = host_addr - (uintptr_t)cache->space->protected_base;
 
-  // if all addresses are greater than guest_addr, there is no block
-  // for this address
-  if (it == first) {
-    return NULL;
+    if (offset >= ADDRESS_SPACE_SIZE) {
+      return -1;
+    }
+  }
+
+  *addr = (uint32_t)offset;
+
+  for (int i = 0; i < NUM_CODE_PAGE_REGIONS; i++) {
+    if ((*addr & CODE_PAGE_REGION_MASK) == sh4_code_page_regions[i]) {
+      return view + i;
+    }
+  }
+
+  return -1;
+}
+
+static bool sh4_cache_code_page_watched(struct sh4_cache *cache,
+                                        uintptr_t host_addr) {
+  uint32_t addr;
+  int view = sh4_cache_code_page_view(cache, host_addr, &addr);
+
+  if (view < 0) {
+    return false;
   }
 
-  // the actual block is the previous one
-  it = it ? rb_prev(it) : last;
+  struct sh4_code_page *page = &cache->pages[CODE_PAGE(addr)];
 
-  struct sh4_block *block = container_of(it, struct sh4_block, it);
-  return block;
+  return page->watches[view] && page->addr == (addr & CODE_PAGE_ADDR_MASK);
 }
 
-static struct sh4_block *sh4_cache_lookup_block_reverse(
-    struct sh4_cache *cache, const uint8_t *host_addr) {
-  struct sh4_block search;
-  search.host_addr = host_addr;
+static void sh4_cache_invalidate_page(struct sh4_cache *cache, uint32_t addr) {
+  struct sh4_code_page *page = &cache->pages[CODE_PAGE(addr)];
+  uint32_t begin = (addr & BLOCK_ADDR_MASK) & ~(CODE_PAGE_SIZE - 1);
+  uint32_t end = begin + CODE_PAGE_SIZE;
+
+  // unlink each block overlapping the page, checking the buckets for the page
+  // as well as those before it for blocks spanning into it. note, this is
+  // called from the exception handler, so the blocks can't be freed here
+  int first = MAX((int)GUEST_BUCKET(begin) - cache->blocks.max_guest_span, 0);
+  int last = GUEST_BUCKET(end - 1);
+
+  for (int i = first; i <= last; i++) {
+    struct list *bucket = &cache->blocks.guest_buckets[i];
+
+    list_for_each_entry(block, bucket, struct sh4_block, bucket_it) {
+      uint32_t block_begin = block->guest_addr & BLOCK_ADDR_MASK;
+      uint32_t block_end = block_begin + block->guest_size;
 
-  struct rb_node *first = rb_first(&cache->reverse_blocks);
-  struct rb_node *last = rb_last(&cache->reverse_blocks);
-  struct rb_node *rit = rb_upper_bound(&cache->reverse_blocks, &search.rit,
-                                       &reverse_block_map_cb);
+      if (block->invalid || block_end <= begin || block_begin >= end) {
+        continue;
+      }
 
-  if (rit == first) {
-    return NULL;
+      sh4_cache_unlink_block(cache, block);
+
+      // the block's new code starts out cold again
+      struct sh4_code_table *table =
+          cache->tables[CODE_TABLE(block->guest_addr)];
+      table->run_counts[CODE_TABLE_OFFSET(block->guest_addr)] = 0;
+
+      block->invalid = 1;
+      list_add(&cache->invalid_blocks, &block->invalid_it);
+
+      page->num_invalidations++;
+      cache->num_invalidated++;
+    }
   }
+}
+
+static void sh4_cache_handle_write(const struct exception *ex, void *data) {
+  struct sh4_cache *cache = data;
 
-  rit = rit ? rb_prev(rit) : last;
+  uint32_t addr;
+  int view = sh4_cache_code_page_view(cache, ex->fault_addr, &addr);
+  CHECK_GE(view, 0);
 
-  struct sh4_block *block = container_of(rit, struct sh4_block, rit);
-  return block;
+  // the watch is removed once it fires, it will be added back when code is
+  // next compiled for the page
+  struct sh4_code_page *page = &cache->pages[CODE_PAGE(addr)];
+  page->watches[view] = NULL;
+  page->num_writes++;
+
+  sh4_cache_invalidate_page(cache, addr);
+}
+
+static void sh4_cache_watch_page(struct sh4_cache *cache, uint32_t addr) {
+  struct sh4_code_page *page = &cache->pages[CODE_PAGE(addr)];
+  int num_watches = 0;
+
+  for (int i = 0; i < NUM_CODE_PAGE_VIEWS; i++) {
+    num_watches += page->watches[i] ? 1 : 0;
+  }
+
+  // area mirrors of the same physical page share an entry, keep watching
+  // whichever one was watched first
+  if (!num_watches) {
+    page->addr = addr & CODE_PAGE_ADDR_MASK;
+  }
+
+  for (int i = 0; i < NUM_CODE_PAGE_VIEWS; i++) {
+    if (page->watches[i]) {
+      continue;
+    }
+
+    uint32_t view_addr =
+        page->addr | sh4_code_page_regions[i % NUM_CODE_PAGE_REGIONS];
+
+    // only physical memory can be written through directly
+    uint8_t *ptr;
+    struct physical_region *physical_region;
+    uint32_t physical_offset;
+    struct mmio_region *mmio_region;
+    uint32_t mmio_offset;
+    as_lookup(cache->space, view_addr, &ptr, &physical_region,
+              &physical_offset, &mmio_region, &mmio_offset);
+
+    if (!physical_region) {
+      continue;
+    }
+
+    if (i >= NUM_CODE_PAGE_REGIONS) {
+      ptr = as_translate_protected(cache->space, view_addr);
+    }
+
+    // if the watcher is out of watches, the page will be retried the next time
+    // code is compiled for it
+    page->watches[i] = add_single_write_watch(ptr, CODE_PAGE_SIZE,
+                                              &sh4_cache_handle_write, cache);
+  }
+}
+
+static void sh4_cache_watch_block(struct sh4_cache *cache,
+                                  struct sh4_block *block) {
+  uint32_t begin = block->guest_addr & ~(CODE_PAGE_SIZE - 1);
+  uint32_t end = block->guest_addr + MAX(block->guest_size, 1);
+
+  for (uint32_t addr = begin; addr < end; addr += CODE_PAGE_SIZE) {
+    sh4_cache_watch_page(cache, addr);
+  }
+}
+
+static void sh4_cache_unwatch_pages(struct sh4_cache *cache) {
+  for (int i = 0; i < NUM_CODE_PAGES; i++) {
+    struct sh4_code_page *page = &cache->pages[i];
+
+    for (int j = 0; j < NUM_CODE_PAGE_VIEWS; j++) {
+      if (!page->watches[j]) {
+        continue;
+      }
+
+      remove_memory_watch(page->watches[j]);
+      page->watches[j] = NULL;
+    }
+  }
 }
 
 static bool sh4_cache_handle_exception(void *data, struct exception *ex) {
@@ -107,52 +470,271 @@ static bool sh4_cache_handle_exception(void *data, struct exception *ex) {
 
   // see if there is an assembled block corresponding to the current pc
   struct sh4_block *block =
-      sh4_cache_lookup_block_reverse(cache, (const uint8_t *)ex->pc);
+      sh4_block_map_lookup_reverse(&cache->blocks, (const uint8_t *)ex->pc);
 
   if (!block) {
     return false;
   }
 
+  // writes to watched code pages are handled by the memory watcher
+  if (sh4_cache_code_page_watched(cache, ex->fault_addr)) {
+    return false;
+  }
+
   // let the backend attempt to handle the exception
   if (!cache->backend->handle_exception(cache->backend, ex)) {
     return false;
   }
 
-  // exception was handled, unlink the code pointer and flag the block to be
-  // recompiled without fastmem optimizations on the next access. note, the
-  // block can't be removed from the lookup maps at this point because it's
-  // still executing and may trigger subsequent exceptions
-  sh4_cache_unlink_block(cache, block);
+  // exception was handled, and the backend has patched the faulting access to
+  // take the slow path from now on. if the block keeps faulting though, it's
+  // likely accessing mmio throughout, so unlink the code pointer and flag the
+  // block to be recompiled without fastmem optimizations on the next access.
+  // note, the block can't be removed from the lookup maps at this point
+  // because it's still executing and may trigger subsequent exceptions
+  if (++block->num_faults >= cache->slowmem_threshold &&
+      !(block->flags & SH4_SLOWMEM)) {
+    sh4_cache_unlink_block(cache, block);
+
+    block->flags |= SH4_SLOWMEM;
 
-  block->flags |= SH4_SLOWMEM;
+    cache->num_slowmem_recompiles++;
+  }
 
   return true;
 }
 
+static void sh4_cache_evict_region(struct sh4_cache *cache, int region) {
+  // remove every block assembled to the region. removing a block unlinks any
+  // edges from other regions into it, so nothing jumps into the overwritten
+  // code. the code pages they were compiled from are left watched, a write to
+  // them will simply find no blocks to invalidate
+  list_for_each_entry_safe(block, &cache->blocks.blocks, struct sh4_block,
+                           it) {
+    if (block->region != region) {
+      continue;
+    }
+
+    sh4_cache_remove_block(cache, block);
+
+    cache->num_evicted_blocks++;
+  }
+
+  // with no blocks left referencing it, have the backend reclaim the region's
+  // code, along with the slow path stubs it patched the blocks to call, and
+  // start assembling into it
+  cache->backend->begin_region(cache->backend, region);
+
+  cache->num_evictions++;
+}
+
+static void *sh4_cache_mmio_handler(struct mmio_region *region, bool load,
+                                    enum ir_type type) {
+  switch (type) {
+    case VALUE_I8:
+      return load ? (void *)region->read8 : (void *)region->write8;
+    case VALUE_I16:
+      return load ? (void *)region->read16 : (void *)region->write16;
+    case VALUE_I32:
+      return load ? (void *)region->read32 : (void *)region->write32;
+    case VALUE_I64:
+      return load ? (void *)region->read64 : (void *)region->write64;
+    default:
+      return NULL;
+  }
+}
+
+static void sh4_cache_specialize_mmio(struct sh4_cache *cache, struct ir *ir) {
+  // resolve guest memory accesses to constant addresses through the address
+  // space's page table at compile time. accesses to mmio regions become direct
+  // calls to the region's handler, and slowmem accesses to physical memory
+  // become direct host accesses. fastmem accesses to physical memory are
+  // already direct and are left alone. note, this is ran on the IR after it's
+  // been cached, as the host pointers it introduces are only valid for the
+  // current run
+  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
+    bool load = instr->op == OP_LOAD_FAST || instr->op == OP_LOAD_SLOW;
+    bool store = instr->op == OP_STORE_FAST || instr->op == OP_STORE_SLOW;
+
+    if ((!load && !store) || !ir_is_constant(instr->arg[0])) {
+      continue;
+    }
+
+    uint32_t addr = (uint32_t)instr->arg[0]->i32;
+    enum ir_type type = load ? instr->result->type : instr->arg[1]->type;
+
+    // the page table is only consulted for the first byte of the access
+    if ((addr & PAGE_OFFSET_MASK) + ir_type_size(type) > PAGE_SIZE) {
+      continue;
+    }
+
+    uint8_t *ptr;
+    struct physical_region *physical_region;
+    uint32_t physical_offset;
+    struct mmio_region *mmio_region;
+    uint32_t mmio_offset;
+    as_lookup(cache->space, addr, &ptr, &physical_region, &physical_offset,
+              &mmio_region, &mmio_offset);
+
+    if (mmio_region) {
+      void *fn = sh4_cache_mmio_handler(mmio_region, load, type);
+
+      if (!fn) {
+        continue;
+      }
+
+      struct ir_value *value = store ? instr->arg[1] : NULL;
+
+      // the register allocator has already run, rewrite the instruction in
+      // place so its result keeps its register. the new arguments are all
+      // constants, which don't need one. the allocator didn't see the access
+      // as a call, so values may be live across it in caller saved registers.
+      // the backend calls mmio handlers through a thunk which preserves them
+      instr->op = load ? OP_LOAD_MMIO : OP_STORE_MMIO;
+      ir_set_arg0(ir, instr, ir_alloc_i64(ir, (int64_t)(intptr_t)fn));
+      ir_set_arg1(ir, instr,
+                  ir_alloc_i64(ir, (int64_t)(intptr_t)mmio_region->data));
+      ir_set_arg2(ir, instr, ir_alloc_i32(ir, (int32_t)mmio_offset));
+      ir_set_arg3(ir, instr, value);
+    } else if (physical_region &&
+               (instr->op == OP_LOAD_SLOW || instr->op == OP_STORE_SLOW)) {
+      instr->op = load ? OP_LOAD_HOST : OP_STORE_HOST;
+      ir_set_arg0(ir, instr, ir_alloc_i64(ir, (int64_t)(intptr_t)ptr));
+    }
+  }
+}
+
+static void sh4_cache_record_lines(struct sh4_block *block, struct ir *ir) {
+  // the backend tags the source info marking each instr with the address of
+  // the code following it. the tags are in code order, as the instrs are
+  int num_lines = 0;
+  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
+    if (instr->op == OP_SOURCE_INFO) {
+      num_lines++;
+    }
+  }
+
+  block->lines = malloc(MAX(num_lines, 1) * sizeof(struct sh4_block_line));
+  block->num_lines = num_lines;
+
+  int i = 0;
+  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
+    if (instr->op == OP_SOURCE_INFO) {
+      block->lines[i].host_offset =
+          (int)((const uint8_t *)instr->tag - block->host_addr);
+      block->lines[i].guest_addr = (uint32_t)instr->arg[0]->i32;
+      i++;
+    }
+  }
+}
+
+static void sh4_cache_export_block(struct sh4_cache *cache,
+                                   struct sh4_block *block) {
+  // attribute the code for each instr to its guest address, with the region
+  // it's mirrored to stripped so that it's a valid line number
+  struct jit_perf_line *lines =
+      malloc(MAX(block->num_lines, 1) * sizeof(struct jit_perf_line));
+
+  for (int i = 0; i < block->num_lines; i++) {
+    lines[i].host_addr = block->host_addr + block->lines[i].host_offset;
+    lines[i].line = (int)(block->lines[i].guest_addr & ~CODE_PAGE_REGION_MASK);
+  }
+
+  char name[32];
+  snprintf(name, sizeof(name), "sh4_0x%08x", block->guest_addr);
+  jit_perf_add_code(cache->perf, name, block->host_addr, block->host_size,
+                    lines, block->num_lines);
+
+  free(lines);
+}
+
+static bool sh4_cache_resolve_sample(void *data, uintptr_t host_pc,
+                                     uint32_t *guest_pc) {
+  struct sh4_cache *cache = data;
+  struct sh4_block *block =
+      sh4_block_map_lookup_reverse(&cache->blocks, (const uint8_t *)host_pc);
+
+  if (!block) {
+    return false;
+  }
+
+  // find the last instr whose code starts at or before the sample. samples in
+  // the block's prolog are attributed to its first instr
+  int offset = (int)(host_pc - (uintptr_t)block->host_addr);
+  int lo = 0;
+  int hi = block->num_lines;
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+
+    if (block->lines[mid].host_offset <= offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  *guest_pc = lo ? block->lines[lo - 1].guest_addr : block->guest_addr;
+
+  return true;
+}
+
+static void sh4_cache_flush_samples(struct sh4_cache *cache) {
+  // samples are resolved against the blocks they were taken in, this must be
+  // called before any of them are removed
+  if (cache->profiler) {
+    sh4_profiler_flush(cache->profiler, &sh4_cache_resolve_sample, cache);
+  }
+}
+
+static int64_t sh4_cache_end_stage(struct sh4_cache *cache,
+                                   enum sh4_compile_stage stage,
+                                   int64_t begin) {
+  int64_t end = time_nanoseconds();
+  jit_histogram_add(&cache->compile_times[stage], end - begin);
+  return end;
+}
+
 static code_pointer_t sh4_cache_compile_code_inner(struct sh4_cache *cache,
                                                    uint32_t guest_addr,
                                                    uint8_t *guest_ptr,
                                                    int flags) {
-  int offset = BLOCK_OFFSET(guest_addr);
-  CHECK_LT(offset, MAX_BLOCKS);
-  code_pointer_t *code = &cache->code[offset];
+  int64_t begin = time_nanoseconds();
+  struct sh4_code_table *table = sh4_cache_alloc_table(cache, guest_addr);
+  code_pointer_t *code = &table->code[CODE_TABLE_OFFSET(guest_addr)];
+
+  // blocks may be removed or evicted below
+  sh4_cache_flush_samples(cache);
+
+  // no code is executing at this point, finish removing any blocks whose guest
+  // code was written to
+  sh4_cache_remove_invalid_blocks(cache);
 
   // make sure there's not a valid code pointer
   CHECK_EQ(*code, cache->default_code);
 
+  // line info for perf is gathered from source info marking each instr
+  if (cache->perf && OPTION_perf_jitdump) {
+    flags |= SH4_SOURCE_INFO;
+  }
+
+  // the profiler maps samples back to instrs the same way, and tracks calls
+  // made by compiled code
+  if (cache->profiler) {
+    flags |= SH4_SOURCE_INFO | SH4_PROFILE;
+  }
+
   // if the block being compiled had previously been unlinked by a
   // fastmem exception, reuse the block's flags and finish removing
   // it at this time;
-  struct sh4_block search;
-  search.guest_addr = guest_addr;
-
-  struct sh4_block *unlinked = rb_find_entry(
-      &cache->blocks, &search, struct sh4_block, it, &block_map_cb);
+  struct sh4_block *unlinked = sh4_block_map_find(&cache->blocks, guest_addr);
 
   if (unlinked) {
     flags |= unlinked->flags;
 
     sh4_cache_remove_block(cache, unlinked);
+
+    cache->num_recompiled++;
   }
 
   // translate the SH4 into IR
@@ -161,46 +743,72 @@ static code_pointer_t sh4_cache_compile_code_inner(struct sh4_cache *cache,
   ir.capacity = sizeof(cache->ir_buffer);
 
   int guest_size = 0;
-  cache->frontend->translate_code(cache->frontend, guest_addr, guest_ptr, flags,
-                                  &guest_size, &ir);
 
-#if 0
-  const char *appdir = fs_appdir();
-
-  char irdir[PATH_MAX];
-  snprintf(irdir, sizeof(irdir), "%s" PATH_SEPARATOR "ir", appdir);
-  fs_mkdir(irdir);
+  // try to load the optimized IR from the persistent cache before translating
+  // and optimizing it from scratch
+  if (!cache->ir_cache ||
+      !ir_cache_lookup(cache->ir_cache, guest_addr, guest_ptr, flags,
+                       &guest_size, &ir)) {
+    int64_t t = time_nanoseconds();
+    int code_size = 0;
+    cache->frontend->analyze_code(cache->frontend, guest_addr, guest_ptr,
+                                  flags, &guest_size, &code_size);
+    t = sh4_cache_end_stage(cache, SH4_STAGE_ANALYZE, t);
+
+    cache->frontend->translate_code(cache->frontend, guest_addr, guest_ptr,
+                                    code_size, flags, &ir);
+    t = sh4_cache_end_stage(cache, SH4_STAGE_TRANSLATE, t);
+
+    // capture the IR before it's optimized, so passes can be tested and
+    // benchmarked offline with recc. the write isn't counted as compile time
+    if (cache->corpus) {
+      if (!ir_write_file(&ir, guest_addr, guest_ptr, guest_size, flags,
+                         cache->corpus)) {
+        LOG_WARNING("Failed to write IR for 0x%08x to corpus", guest_addr);
+      }
+      t = time_nanoseconds();
+    }
 
-  char filename[PATH_MAX];
-  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "0x%08x.ir", irdir, guest_addr);
+    // run optimization passes
+    pass_manager_run(cache->passes, &ir);
+    sh4_cache_end_stage(cache, SH4_STAGE_OPTIMIZE, t);
 
-  std::ofstream output(filename);
-  builder.Dump(output);
-#endif
+    if (cache->ir_cache) {
+      ir_cache_insert(cache->ir_cache, guest_addr, guest_ptr, flags, guest_size,
+                      &ir);
+    }
+  }
 
-  // run optimization passes
-  lse_run(&ir);
-  dce_run(&ir);
-  ra_run(&ir, cache->backend->registers, cache->backend->num_registers);
+  // resolve accesses to constant addresses now that the IR won't be cached
+  sh4_cache_specialize_mmio(cache, &ir);
 
-  // assemble the IR into native code
+  // assemble the IR into native code. the time taken includes evicting a
+  // region when the current one overflows
+  int64_t assemble_begin = time_nanoseconds();
   int host_size = 0;
-  const uint8_t *host_addr =
-      cache->backend->assemble_code(cache->backend, &ir, &host_size);
+  struct jit_exit exits[MAX_BLOCK_EXITS];
+  int num_exits = 0;
+  const uint8_t *host_addr = cache->backend->assemble_code(
+      cache->backend, &ir, &host_size, exits, &num_exits);
 
   if (!host_addr) {
-    LOG_INFO("Assembler overflow, resetting block cache");
+    // the current region overflowed, evict the oldest region and move on to
+    // assembling into it. no code is executing at this point, so it's safe to
+    // overwrite
+    cache->region = (cache->region + 1) % cache->backend->num_regions;
 
-    // the backend overflowed, completely clear the block cache
-    sh4_cache_clear_blocks(cache);
+    sh4_cache_evict_region(cache, cache->region);
 
-    // if the backend fails to assemble on an empty cache, there's nothing to be
-    // done
-    host_addr = cache->backend->assemble_code(cache->backend, &ir, &host_size);
+    // if the backend fails to assemble to an empty region, there's nothing to
+    // be done
+    host_addr = cache->backend->assemble_code(cache->backend, &ir, &host_size,
+                                              exits, &num_exits);
 
-    CHECK(host_addr, "Backend assembler buffer overflow");
+    CHECK(host_addr, "Backend assembler region overflow");
   }
 
+  sh4_cache_end_stage(cache, SH4_STAGE_ASSEMBLE, assemble_begin);
+
   // allocate the new block
   struct sh4_block *block = calloc(1, sizeof(struct sh4_block));
   block->host_addr = host_addr;
@@ -208,28 +816,46 @@ static code_pointer_t sh4_cache_compile_code_inner(struct sh4_cache *cache,
   block->guest_addr = guest_addr;
   block->guest_size = guest_size;
   block->flags = flags;
-  rb_insert(&cache->blocks, &block->it, &block_map_cb);
-  rb_insert(&cache->reverse_blocks, &block->rit, &reverse_block_map_cb);
+  block->region = cache->region;
+  sh4_block_map_insert(&cache->blocks, block);
+
+  if (flags & SH4_SOURCE_INFO) {
+    sh4_cache_record_lines(block, &ir);
+  }
+
+  // write-protect the guest code the block was compiled from
+  sh4_cache_watch_block(cache, block);
+
+  if (cache->perf) {
+    sh4_cache_export_block(cache, block);
+  }
 
   // update code pointer
   *code = (code_pointer_t)block->host_addr;
 
+  // patch static exits to and from the new block to jump directly between
+  // the compiled code
+  sh4_cache_link_block(cache, block, exits, num_exits);
+
+  cache->num_compiled++;
+  cache->guest_bytes_compiled += guest_size;
+  cache->host_bytes_emitted += host_size;
+  sh4_cache_end_stage(cache, SH4_STAGE_TOTAL, begin);
+
   return *code;
 }
 
 struct sh4_block *sh4_cache_get_block(struct sh4_cache *cache,
                                       uint32_t guest_addr) {
-  struct sh4_block search;
-  search.guest_addr = guest_addr;
-
-  return rb_find_entry(&cache->blocks, &search, struct sh4_block, it,
-                       &block_map_cb);
+  return sh4_block_map_find(&cache->blocks, guest_addr);
 }
 
 void sh4_cache_remove_blocks(struct sh4_cache *cache, uint32_t guest_addr) {
+  sh4_cache_flush_samples(cache);
+
   // remove any block which overlaps the address
   while (true) {
-    struct sh4_block *block = sh4_cache_lookup_block(cache, guest_addr);
+    struct sh4_block *block = sh4_block_map_lookup(&cache->blocks, guest_addr);
 
     if (!block) {
       break;
@@ -242,34 +868,51 @@ void sh4_cache_remove_blocks(struct sh4_cache *cache, uint32_t guest_addr) {
 void sh4_cache_unlink_blocks(struct sh4_cache *cache) {
   // unlink all code pointers, but don't remove the block entries. this is used
   // when clearing the cache while code is currently executing
-  struct rb_node *it = rb_first(&cache->blocks);
+  cache->num_flushes++;
 
-  while (it) {
-    struct rb_node *next = rb_next(it);
-
-    struct sh4_block *block = container_of(it, struct sh4_block, it);
+  list_for_each_entry(block, &cache->blocks.blocks, struct sh4_block, it) {
     sh4_cache_unlink_block(cache, block);
-
-    it = next;
   }
 }
 
 void sh4_cache_clear_blocks(struct sh4_cache *cache) {
   // unlink all code pointers and remove all block entries. this is only safe to
   // use when no code is currently executing
-  struct rb_node *it = rb_first(&cache->blocks);
+  sh4_cache_flush_samples(cache);
 
-  while (it) {
-    struct rb_node *next = rb_next(it);
-
-    struct sh4_block *block = container_of(it, struct sh4_block, it);
+  list_for_each_entry_safe(block, &cache->blocks.blocks, struct sh4_block,
+                           it) {
     sh4_cache_remove_block(cache, block);
-
-    it = next;
   }
 
-  // have the backend reset its codegen buffers as well
+  // stop watching the now code-less pages
+  sh4_cache_unwatch_pages(cache);
+
+  // have the backend reset its codegen buffers as well, which starts it over
+  // at the first region
   cache->backend->reset(cache->backend);
+  cache->region = 0;
+  cache->num_resets++;
+}
+
+bool sh4_cache_promote_code(struct sh4_cache *cache, uint32_t guest_addr) {
+  struct sh4_code_table *table = sh4_cache_alloc_table(cache, guest_addr);
+  uint8_t *count = &table->run_counts[CODE_TABLE_OFFSET(guest_addr)];
+
+  if (*count >= cache->compile_threshold) {
+    return true;
+  }
+
+  if (!*count) {
+    cache->num_interpreted++;
+  }
+
+  // the block will be compiled the next time it's run
+  if (++(*count) == cache->compile_threshold) {
+    cache->num_promoted++;
+  }
+
+  return false;
 }
 
 code_pointer_t sh4_cache_compile_code(struct sh4_cache *cache,
@@ -282,31 +925,225 @@ code_pointer_t sh4_cache_compile_code(struct sh4_cache *cache,
   return code;
 }
 
+void sh4_cache_run_code(struct sh4_cache *cache) {
+  // the profiler samples the thread running the guest, which isn't the thread
+  // the cache was created on
+  if (cache->profiler) {
+    sh4_profiler_start(cache->profiler, SH4_PROFILE_INTERVAL_US);
+  }
+
+  cache->backend->run_code(cache->backend);
+
+  sh4_cache_flush_samples(cache);
+}
+
+static void sh4_cache_write_stats(struct sh4_cache *cache) {
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "jit_stats.txt",
+           fs_appdir());
+
+  FILE *output = fopen(filename, "w");
+
+  if (!output) {
+    LOG_WARNING("Failed to write JIT stats to %s", filename);
+    return;
+  }
+
+  fprintf(output, "blocks interpreted       %d\n", cache->num_interpreted);
+  fprintf(output, "blocks promoted          %d\n", cache->num_promoted);
+  fprintf(output, "blocks compiled          %d\n", cache->num_compiled);
+  fprintf(output, "blocks recompiled        %d\n", cache->num_recompiled);
+  fprintf(output, "slowmem recompiles       %d\n",
+          cache->num_slowmem_recompiles);
+  fprintf(output, "blocks invalidated       %d\n", cache->num_invalidated);
+  fprintf(output, "cache flushes            %d\n", cache->num_flushes);
+  fprintf(output, "code buffer resets       %d\n", cache->num_resets);
+  fprintf(output, "regions evicted          %d\n", cache->num_evictions);
+  fprintf(output, "blocks evicted           %d\n", cache->num_evicted_blocks);
+  fprintf(output, "guest bytes compiled     %" PRId64 "\n",
+          cache->guest_bytes_compiled);
+  fprintf(output, "host bytes emitted       %" PRId64 "\n",
+          cache->host_bytes_emitted);
+
+  fprintf(output, "\n%-16s %8s %10s %10s %10s %10s %12s\n", "stage (us)",
+          "count", "mean", "p50", "p99", "max", "total");
+
+  for (int i = 0; i < SH4_NUM_COMPILE_STAGES; i++) {
+    jit_histogram_write(&cache->compile_times[i], sh4_compile_stage_names[i],
+                        output);
+  }
+
+  for (int i = 0; i < cache->passes->num_passes; i++) {
+    struct pass_manager_pass *pass = &cache->passes->passes[i];
+    char name[32];
+    snprintf(name, sizeof(name), "  %s", pass->info->name);
+    jit_histogram_write(&pass->times, name, output);
+  }
+
+  fprintf(output, "\n");
+  pass_stat_write(output);
+
+  fclose(output);
+
+  LOG_INFO("Wrote JIT stats to %s", filename);
+}
+
+static void sh4_cache_write_profile(struct sh4_cache *cache) {
+  char report[PATH_MAX];
+  snprintf(report, sizeof(report), "%s" PATH_SEPARATOR "sh4_profile.txt",
+           fs_appdir());
+
+  char folded[PATH_MAX];
+  snprintf(folded, sizeof(folded), "%s" PATH_SEPARATOR "sh4_profile.folded",
+           fs_appdir());
+
+  if (sh4_profiler_write(cache->profiler, report, folded)) {
+    LOG_INFO("Wrote guest profile to %s and %s", report, folded);
+  }
+}
+
 struct sh4_cache *sh4_cache_create(struct jit_memory_interface *memory_if,
-                                   code_pointer_t default_code) {
+                                   struct jit_guest *guest) {
   struct sh4_cache *cache = calloc(1, sizeof(struct sh4_cache));
+  cache->space = memory_if->mem_self;
+  cache->compile_threshold = MIN(MAX(OPTION_jit_threshold, 0), UINT8_MAX);
+  cache->slowmem_threshold = MAX(OPTION_slowmem_threshold, 1);
 
   // add exception handler to help recompile blocks when protected memory is
   // accessed
   cache->exc_handler =
       exception_handler_add(cache, &sh4_cache_handle_exception);
 
-  // setup parser and emitter
+  // setup parser and emitter. the backend's dispatcher jumps through the
+  // cache's code table
+  guest->code = (void ***)cache->tables;
+  guest->code_bits = CODE_TABLE_BITS;
+
   cache->frontend = sh4_frontend_create();
-  cache->backend = x64_backend_create(memory_if);
+  int code_size = MAX(OPTION_jit_code_size, 1) * 1024 * 1024;
+  int num_regions = MAX(OPTION_jit_code_regions, 1);
+  cache->backend = x64_backend_create(memory_if, guest, code_size, num_regions,
+                                      OPTION_jit_isa);
+
+  // fused multiply-adds round differently than the separate operations
+  cache->passes = pass_manager_create(OPTION_jit_passes, OPTION_jit_print_after,
+                                      cache->backend->registers,
+                                      cache->backend->num_registers);
+  if (OPTION_jit_exact_fpu) {
+    pass_manager_remove(cache->passes, "fma");
+  }
 
-  // initialize all entries in block cache to reference the default block
+  // the backend needs each value to have been assigned a register, with no
+  // later pass invalidating the assignments
+  if (!pass_manager_run_last(cache->passes, "ra")) {
+    LOG_WARNING("jit_passes must end with ra, running it last");
+  }
+
+  // the cached IR references context offsets and backend registers, and has
+  // been through the configured passes. make sure a cache written for a
+  // different layout or pass list isn't used
+  if (OPTION_ir_cache) {
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "sh4.ircache",
+             fs_appdir());
+
+    uint64_t signature = (uint64_t)sizeof(struct sh4_ctx) |
+                         ((uint64_t)cache->backend->num_registers << 16) |
+                         ((uint64_t)pass_manager_hash(cache->passes) << 32);
+    cache->ir_cache = ir_cache_create(filename, signature);
+  }
+
+  // each session is captured to its own file, so the corpora of different
+  // games can be kept apart or concatenated
+  if (OPTION_ir_corpus) {
+    const char *appdir = fs_appdir();
+
+    char corpusdir[PATH_MAX];
+    snprintf(corpusdir, sizeof(corpusdir), "%s" PATH_SEPARATOR "corpus",
+             appdir);
+    fs_mkdir(corpusdir);
+
+    char timestamp[32];
+    time_t now = time(NULL);
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", localtime(&now));
+
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename),
+             "%s" PATH_SEPARATOR "corpus" PATH_SEPARATOR "sh4-%s.irb", appdir,
+             timestamp);
+
+    cache->corpus = fopen(filename, "wb");
+
+    if (cache->corpus) {
+      LOG_INFO("Writing IR corpus to %s", filename);
+    } else {
+      LOG_WARNING("Failed to open IR corpus %s", filename);
+    }
+  }
+
+  // the perf map and jitdump cover the entire session. blocks compiled after
+  // sh4_cache_clear_blocks or a region eviction reuse the code addresses of
+  // the blocks removed, whose records are left in place for the samples taken
+  // before then. perf inject tells them apart by the jitdump's timestamps
+  if (OPTION_perf_map || OPTION_perf_jitdump) {
+    cache->perf = jit_perf_create(OPTION_perf_map, OPTION_perf_jitdump);
+  }
+
+  if (OPTION_profile_guest) {
+    cache->profiler = sh4_profiler_create(OPTION_profile_symbols);
+  }
+
+  // initialize the default table to reference the default block, which
+  // compiles the code for the current pc, and point every range at it
+  code_pointer_t default_code =
+      (code_pointer_t)cache->backend->compile_thunk(cache->backend);
   cache->default_code = default_code;
 
-  for (int i = 0; i < MAX_BLOCKS; i++) {
-    cache->code[i] = default_code;
+  for (int i = 0; i < NUM_CODE_TABLE_ENTRIES; i++) {
+    cache->default_table.code[i] = default_code;
+  }
+
+  for (int i = 0; i < NUM_CODE_TABLES; i++) {
+    cache->tables[i] = &cache->default_table;
   }
 
   return cache;
 }
 
 void sh4_cache_destroy(struct sh4_cache *cache) {
+  if (OPTION_jit_stats) {
+    sh4_cache_write_stats(cache);
+  }
+
   sh4_cache_clear_blocks(cache);
+
+  if (cache->ir_cache) {
+    ir_cache_destroy(cache->ir_cache);
+  }
+
+  if (cache->passes) {
+    pass_manager_destroy(cache->passes);
+  }
+
+  if (cache->corpus) {
+    fclose(cache->corpus);
+  }
+
+  if (cache->perf) {
+    jit_perf_destroy(cache->perf);
+  }
+
+  if (cache->profiler) {
+    sh4_cache_write_profile(cache);
+    sh4_profiler_destroy(cache->profiler);
+  }
+
+  for (int i = 0; i < NUM_CODE_TABLES; i++) {
+    if (cache->tables[i] != &cache->default_table) {
+      free(cache->tables[i]);
+    }
+  }
+
   x64_backend_destroy(cache->backend);
   sh4_frontend_destroy(cache->frontend);
   exception_handler_remove(cache->exc_handler);
@@ -2,20 +2,118 @@
 #define SH4_CODE_CACHE_H
 
 #include "core/assert.h"
-#include "core/rb_tree.h"
+#include "core/list.h"
+#include "core/option.h"
+#include "jit/jit_stats.h"
 
-// executable code sits between 0x0c000000 and 0x0d000000 (16mb). each instr
-// is 2 bytes, making for a maximum of 0x1000000 >> 1 blocks
+// executable code sits between 0x0c000000 and 0x0d000000 (16mb), mirrored
+// through the upper bits of the address
 #define BLOCK_ADDR_MASK (~0xfc000000)
-#define BLOCK_OFFSET(addr) ((addr & BLOCK_ADDR_MASK) >> 1)
-#define MAX_BLOCKS (0x1000000 >> 1)
 
+// compiled code is looked up through a two-level table indexed by the full
+// guest pc, so blocks compiled for different mirrors don't alias. the first
+// level is indexed by the upper bits of the pc, and points to a second level
+// table covering the next 64kb of guest addresses, with an entry for each
+// 2 byte instr. second level tables are only allocated once code has been run
+// from their range, until then their first level entries all point to a
+// shared default table which is never written to
+#define CODE_TABLE_BITS 16
+#define NUM_CODE_TABLES (1 << (32 - CODE_TABLE_BITS))
+#define NUM_CODE_TABLE_ENTRIES (1 << (CODE_TABLE_BITS - 1))
+#define CODE_TABLE(addr) ((addr) >> CODE_TABLE_BITS)
+#define CODE_TABLE_OFFSET(addr) (((addr) & ((1 << CODE_TABLE_BITS) - 1)) >> 1)
+
+// blocks are bucketed by the range of guest addresses they start in, and by
+// the range of host addresses their code starts in. the buckets are kept
+// small enough to only contain a handful of blocks each. guest buckets are
+// indexed by the masked guest address, while host buckets are indexed by the
+// low bits of the address, which doesn't collide for a code buffer of up to
+// NUM_HOST_BUCKETS << HOST_BUCKET_BITS bytes
+#define GUEST_BUCKET_BITS 8
+#define NUM_GUEST_BUCKETS ((BLOCK_ADDR_MASK >> GUEST_BUCKET_BITS) + 1)
+#define GUEST_BUCKET(addr) (((addr) & BLOCK_ADDR_MASK) >> GUEST_BUCKET_BITS)
+#define HOST_BUCKET_BITS 9
+#define NUM_HOST_BUCKETS 32768
+#define HOST_BUCKET(addr) \
+  (((uintptr_t)(addr) >> HOST_BUCKET_BITS) & (NUM_HOST_BUCKETS - 1))
+
+// edges whose destination block hasn't been compiled yet are bucketed by their
+// destination address, so they can be resolved once it is
+#define EDGE_BUCKET_BITS 12
+#define NUM_EDGE_BUCKETS (1 << EDGE_BUCKET_BITS)
+#define EDGE_BUCKET(addr) ((addr >> 1) & (NUM_EDGE_BUCKETS - 1))
+
+// guest code pages are write-protected while blocks compiled from them exist,
+// so that a write to one (self-modifying code, or new code being loaded over
+// old) invalidates the blocks on that page. a page is watched through the
+// views code is normally written through: the P0, P1 and P2 mirrors of the
+// physical page, in both the regular and the protected (fastmem) address space
+#define CODE_PAGE_BITS 12
+#define CODE_PAGE_SIZE (1 << CODE_PAGE_BITS)
+#define NUM_CODE_PAGES ((int)(BLOCK_ADDR_MASK >> CODE_PAGE_BITS) + 1)
+#define CODE_PAGE(addr) (((addr) & BLOCK_ADDR_MASK) >> CODE_PAGE_BITS)
+#define NUM_CODE_PAGE_REGIONS 3
+#define NUM_CODE_PAGE_VIEWS (NUM_CODE_PAGE_REGIONS * 2)
+
+DECLARE_OPTION_INT(jit_threshold);
+DECLARE_OPTION_INT(jit_code_size);
+DECLARE_OPTION_INT(jit_code_regions);
+DECLARE_OPTION_INT(slowmem_threshold);
+DECLARE_OPTION_STRING(jit_isa);
+DECLARE_OPTION_BOOL(jit_exact_fpu);
+
+// each stage of compiling a block is timed separately, along with the compile
+// as a whole. the optimization passes making up the optimize stage are each
+// timed by the pass manager
+enum sh4_compile_stage {
+  SH4_STAGE_ANALYZE,
+  SH4_STAGE_TRANSLATE,
+  SH4_STAGE_OPTIMIZE,
+  SH4_STAGE_ASSEMBLE,
+  SH4_STAGE_TOTAL,
+  SH4_NUM_COMPILE_STAGES,
+};
+
+extern const char *sh4_compile_stage_names[SH4_NUM_COMPILE_STAGES];
+
+struct address_space;
 struct exception_handler;
+struct ir_cache;
 struct jit_backend;
 struct jit_frontend;
+struct jit_guest;
 struct jit_memory_interface;
+struct jit_perf;
+struct memory_watch;
+struct pass_manager;
+struct sh4_profiler;
+
+typedef void (*code_pointer_t)();
 
-typedef uint32_t (*code_pointer_t)();
+struct sh4_block;
+
+// the start of the host code translated from a guest instr. these are only
+// recorded for blocks compiled with SH4_SOURCE_INFO
+struct sh4_block_line {
+  int host_offset;
+  uint32_t guest_addr;
+};
+
+// a static exit from one block to another. while linked, the exit's branch
+// jumps directly to the destination block's code
+struct sh4_edge {
+  struct sh4_block *src;
+  struct sh4_block *dst;
+  uint32_t dst_addr;
+  uint8_t *branch;
+
+  // node in the destination block's in_edges list when linked, or in the
+  // cache's unresolved_edges bucket for dst_addr when not
+  struct list_node in_it;
+
+  // node in the source block's out_edges list
+  struct list_node out_it;
+};
 
 struct sh4_block {
   const uint8_t *host_addr;
@@ -23,24 +121,128 @@ struct sh4_block {
   uint32_t guest_addr;
   int guest_size;
   int flags;
-  struct rb_node it;
-  struct rb_node rit;
+  int region;
+
+  // number of fastmem accesses in the block which have faulted. each faulting
+  // access is patched to take the slow path on its own, but once enough of
+  // them have, the block is recompiled with SH4_SLOWMEM instead
+  int num_faults;
+
+  // sorted by host_offset
+  struct sh4_block_line *lines;
+  int num_lines;
+
+  struct list in_edges;
+  struct list out_edges;
+
+  // set once the block's guest code has been written to. invalid blocks are
+  // unlinked immediately, and removed the next time code is compiled
+  int invalid;
+  struct list_node invalid_it;
+
+  struct list_node it;
+  struct list_node bucket_it;
+  struct list_node host_bucket_it;
+};
+
+struct sh4_block_map {
+  struct list blocks;
+  struct list guest_buckets[NUM_GUEST_BUCKETS];
+  struct list host_buckets[NUM_HOST_BUCKETS];
+
+  // the largest number of additional buckets spanned by any block. lookups for
+  // an address check the bucket containing it, as well as this many buckets
+  // before it for blocks which started there
+  int max_guest_span;
+  int max_host_span;
+};
+
+struct sh4_code_page {
+  // physical address of the page being watched
+  uint32_t addr;
+  struct memory_watch *watches[NUM_CODE_PAGE_VIEWS];
+
+  // number of writes caught to the page, and the number of blocks invalidated
+  // by them
+  int num_writes;
+  int num_invalidations;
+};
+
+struct sh4_code_table {
+  // the backend's dispatcher expects code to be the first member
+  code_pointer_t code[NUM_CODE_TABLE_ENTRIES];
+  uint8_t run_counts[NUM_CODE_TABLE_ENTRIES];
 };
 
 struct sh4_cache {
+  struct address_space *space;
   struct exception_handler *exc_handler;
   struct jit_frontend *frontend;
   struct jit_backend *backend;
+  struct ir_cache *ir_cache;
+  FILE *corpus;
+  struct pass_manager *passes;
+  struct jit_perf *perf;
+  struct sh4_profiler *profiler;
 
   code_pointer_t default_code;
-  code_pointer_t code[MAX_BLOCKS];
+  struct sh4_code_table default_table;
+  struct sh4_code_table *tables[NUM_CODE_TABLES];
+  int num_tables;
+
+  struct sh4_block_map blocks;
+  struct list unresolved_edges[NUM_EDGE_BUCKETS];
+  struct list invalid_blocks;
+  struct sh4_code_page pages[NUM_CODE_PAGES];
+
+  // blocks are interpreted until they've been run compile_threshold times,
+  // avoiding the cost of compiling code which only runs a handful of times
+  // (e.g. initialization code run while booting or loading a level). counts
+  // saturate at the threshold, and are reset when a block's code is written to
+  int compile_threshold;
+
+  // number of fastmem faults a block can take before it's recompiled with
+  // SH4_SLOWMEM
+  int slowmem_threshold;
 
-  struct rb_tree blocks;
-  struct rb_tree reverse_blocks;
+  // number of distinct blocks which have been interpreted, and how many of
+  // those were eventually promoted to compiled code
+  int num_interpreted;
+  int num_promoted;
+
+  // the backend's code buffer is filled one region at a time. when the current
+  // region overflows, the next one (the oldest) is evicted along with all of
+  // the blocks assembled to it, instead of throwing away every block at once
+  int region;
+  int num_evictions;
+  int num_evicted_blocks;
+
+  // compile latencies, and counts of the events causing code to be compiled
+  // again. flushes unlink every block at once (e.g. when the guest resets its
+  // instruction cache through CCR), while resets throw away every block along
+  // with the contents of the code buffer
+  struct jit_histogram compile_times[SH4_NUM_COMPILE_STAGES];
+  int num_compiled;
+  int num_recompiled;
+  int num_slowmem_recompiles;
+  int num_invalidated;
+  int num_flushes;
+  int num_resets;
+  int64_t guest_bytes_compiled;
+  int64_t host_bytes_emitted;
 
   uint8_t ir_buffer[1024 * 1024];
 };
 
+void sh4_block_map_insert(struct sh4_block_map *map, struct sh4_block *block);
+void sh4_block_map_remove(struct sh4_block_map *map, struct sh4_block *block);
+struct sh4_block *sh4_block_map_find(struct sh4_block_map *map,
+                                     uint32_t guest_addr);
+struct sh4_block *sh4_block_map_lookup(struct sh4_block_map *map,
+                                       uint32_t guest_addr);
+struct sh4_block *sh4_block_map_lookup_reverse(struct sh4_block_map *map,
+                                               const uint8_t *host_addr);
+
 struct sh4_block *sh4_cache_get_block(struct sh4_cache *cache,
                                       uint32_t guest_addr);
 void sh4_cache_remove_blocks(struct sh4_cache *cache, uint32_t guest_addr);
@@ -49,16 +251,18 @@ void sh4_cache_clear_blocks(struct sh4_cache *cache);
 
 static inline code_pointer_t sh4_cache_get_code(struct sh4_cache *cache,
                                                 uint32_t guest_addr) {
-  int offset = BLOCK_OFFSET(guest_addr);
-  DCHECK_LT(offset, MAX_BLOCKS);
-  return cache->code[offset];
+  struct sh4_code_table *table = cache->tables[CODE_TABLE(guest_addr)];
+  return table->code[CODE_TABLE_OFFSET(guest_addr)];
 }
+bool sh4_cache_promote_code(struct sh4_cache *cache, uint32_t guest_addr);
 code_pointer_t sh4_cache_compile_code(struct sh4_cache *cache,
                                       uint32_t guest_addr, uint8_t *guest_ptr,
                                       int flags);
 
+void sh4_cache_run_code(struct sh4_cache *cache);
+
 struct sh4_cache *sh4_cache_create(struct jit_memory_interface *memory_if,
-                                   code_pointer_t default_code);
+                                   struct jit_guest *guest);
 void sh4_cache_destroy(struct sh4_cache *cache);
 
 #endif
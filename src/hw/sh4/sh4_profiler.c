@@ -0,0 +1,541 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include "hw/sh4/sh4_profiler.h"
+#include "core/assert.h"
+#include "core/log.h"
+#include "core/math.h"
+#include "core/string.h"
+#include "sys/sampler.h"
+
+// depth of the shadow call stack. once full, the outer half of it is dropped,
+// as the stack has most likely lost track of returns made by other means than
+// a return instr (e.g. a thread switch in the game's kernel)
+#define MAX_STACK_DEPTH 256
+
+// number of innermost frames recorded for each sample
+#define MAX_SAMPLE_FRAMES 32
+
+// number of samples buffered between flushes
+#define MAX_SAMPLES 4096
+
+// pseudo function addresses, these are odd and can't be mistaken for code.
+// samples taken outside of compiled code (e.g. while interpreting, compiling
+// or emulating hardware) are attributed to HOST_FUNCTION, called from the
+// guest function being run. samples taken in compiled code before any call
+// has been seen are attributed to UNKNOWN_FUNCTION
+#define HOST_FUNCTION 0x1
+#define UNKNOWN_FUNCTION 0x3
+
+// symbols are matched against physical addresses, ignoring the region of the
+// address space they're accessed through
+#define SYMBOL_ADDR_MASK 0x1fffffff
+
+#define MAX_REPORT_INSTRS 100
+
+struct sh4_profile_frame {
+  uint32_t target;
+  uint32_t ret_addr;
+};
+
+struct sh4_profile_sample {
+  uintptr_t host_pc;
+  int num_frames;
+  uint32_t frames[MAX_SAMPLE_FRAMES];
+};
+
+// samples are aggregated in hash tables keyed by a function address, an instr
+// address or an entire stack of function addresses
+struct sh4_profile_entry {
+  uint64_t hash;
+  uint32_t *key;
+  int key_len;
+  int self;
+  int total;
+};
+
+struct sh4_profile_table {
+  struct sh4_profile_entry *entries;
+  int capacity;
+  int size;
+};
+
+struct sh4_symbol {
+  uint32_t addr;
+  char *name;
+};
+
+struct sh4_profiler {
+  struct sampler *sampler;
+  bool started;
+
+  // the shadow stack is updated by the guest, and read by the signal handler
+  // which may interrupt it at any point. volatile keeps the compiler from
+  // reordering the updates across each other
+  volatile struct sh4_profile_frame stack[MAX_STACK_DEPTH];
+  volatile int depth;
+
+  // samples waiting to be resolved and aggregated. the signal handler is the
+  // only writer of num_written, and sh4_profiler_flush the only writer of
+  // num_read
+  volatile struct sh4_profile_sample samples[MAX_SAMPLES];
+  volatile unsigned num_written;
+  volatile unsigned num_read;
+  volatile int num_dropped;
+
+  int num_samples;
+  int num_compiled_samples;
+  struct sh4_profile_table functions;
+  struct sh4_profile_table instrs;
+  struct sh4_profile_table stacks;
+
+  struct sh4_symbol *symbols;
+  int num_symbols;
+};
+
+static uint64_t sh4_profile_hash(const uint32_t *key, int key_len) {
+  // 64-bit fnv-1a
+  uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+  for (int i = 0; i < key_len; i++) {
+    hash ^= key[i];
+    hash *= UINT64_C(0x100000001b3);
+  }
+
+  return hash;
+}
+
+static struct sh4_profile_entry *sh4_profile_table_find_slot(
+    struct sh4_profile_table *table, uint64_t hash, const uint32_t *key,
+    int key_len) {
+  int mask = table->capacity - 1;
+  int i = (int)(hash & mask);
+
+  while (true) {
+    struct sh4_profile_entry *entry = &table->entries[i];
+
+    if (!entry->key ||
+        (entry->hash == hash && entry->key_len == key_len &&
+         !memcmp(entry->key, key, key_len * sizeof(key[0])))) {
+      return entry;
+    }
+
+    i = (i + 1) & mask;
+  }
+}
+
+static void sh4_profile_table_grow(struct sh4_profile_table *table) {
+  struct sh4_profile_entry *old_entries = table->entries;
+  int old_capacity = table->capacity;
+
+  table->capacity = MAX(old_capacity * 2, 256);
+  table->entries = calloc(table->capacity, sizeof(struct sh4_profile_entry));
+
+  for (int i = 0; i < old_capacity; i++) {
+    struct sh4_profile_entry *entry = &old_entries[i];
+
+    if (!entry->key) {
+      continue;
+    }
+
+    *sh4_profile_table_find_slot(table, entry->hash, entry->key,
+                                 entry->key_len) = *entry;
+  }
+
+  free(old_entries);
+}
+
+static struct sh4_profile_entry *sh4_profile_table_get(
+    struct sh4_profile_table *table, const uint32_t *key, int key_len) {
+  // keep the table at most half full
+  if (2 * (table->size + 1) > table->capacity) {
+    sh4_profile_table_grow(table);
+  }
+
+  uint64_t hash = sh4_profile_hash(key, key_len);
+  struct sh4_profile_entry *entry =
+      sh4_profile_table_find_slot(table, hash, key, key_len);
+
+  if (!entry->key) {
+    entry->hash = hash;
+    entry->key = malloc(key_len * sizeof(key[0]));
+    entry->key_len = key_len;
+    memcpy(entry->key, key, key_len * sizeof(key[0]));
+    table->size++;
+  }
+
+  return entry;
+}
+
+static void sh4_profile_table_destroy(struct sh4_profile_table *table) {
+  for (int i = 0; i < table->capacity; i++) {
+    free(table->entries[i].key);
+  }
+
+  free(table->entries);
+}
+
+// returns the table's entries, sorted by the number of samples taken in them
+static int sh4_profile_entry_cmp(const void *a, const void *b) {
+  const struct sh4_profile_entry *ea = *(const struct sh4_profile_entry **)a;
+  const struct sh4_profile_entry *eb = *(const struct sh4_profile_entry **)b;
+
+  if (ea->self != eb->self) {
+    return eb->self - ea->self;
+  }
+
+  return eb->total - ea->total;
+}
+
+static struct sh4_profile_entry **sh4_profile_table_sort(
+    struct sh4_profile_table *table) {
+  struct sh4_profile_entry **sorted =
+      malloc(MAX(table->size, 1) * sizeof(struct sh4_profile_entry *));
+  int n = 0;
+
+  for (int i = 0; i < table->capacity; i++) {
+    if (table->entries[i].key) {
+      sorted[n++] = &table->entries[i];
+    }
+  }
+
+  qsort(sorted, n, sizeof(sorted[0]), &sh4_profile_entry_cmp);
+
+  return sorted;
+}
+
+static int sh4_symbol_cmp(const void *a, const void *b) {
+  const struct sh4_symbol *sa = a;
+  const struct sh4_symbol *sb = b;
+  return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+static void sh4_profiler_load_symbols(struct sh4_profiler *prof,
+                                      const char *filename) {
+  FILE *file = fopen(filename, "r");
+
+  if (!file) {
+    LOG_WARNING("Failed to open profiler symbols %s", filename);
+    return;
+  }
+
+  int capacity = 0;
+  char line[512];
+
+  while (fgets(line, sizeof(line), file)) {
+    unsigned addr;
+    char name[256];
+
+    if (sscanf(line, "%x %255s", &addr, name) != 2) {
+      continue;
+    }
+
+    if (prof->num_symbols == capacity) {
+      capacity = MAX(capacity * 2, 256);
+      prof->symbols =
+          realloc(prof->symbols, capacity * sizeof(struct sh4_symbol));
+    }
+
+    struct sh4_symbol *sym = &prof->symbols[prof->num_symbols++];
+    sym->addr = addr & SYMBOL_ADDR_MASK;
+    sym->name = strdup(name);
+  }
+
+  fclose(file);
+
+  qsort(prof->symbols, prof->num_symbols, sizeof(struct sh4_symbol),
+        &sh4_symbol_cmp);
+
+  LOG_INFO("Loaded %d profiler symbols from %s", prof->num_symbols, filename);
+}
+
+// finds the closest symbol at or before addr
+static const struct sh4_symbol *sh4_profiler_lookup_symbol(
+    struct sh4_profiler *prof, uint32_t addr) {
+  addr &= SYMBOL_ADDR_MASK;
+
+  int lo = 0;
+  int hi = prof->num_symbols;
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+
+    if (prof->symbols[mid].addr <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo ? &prof->symbols[lo - 1] : NULL;
+}
+
+static void sh4_profiler_name(struct sh4_profiler *prof, uint32_t addr,
+                              char *name, size_t size) {
+  if (addr == HOST_FUNCTION) {
+    snprintf(name, size, "[host]");
+    return;
+  }
+
+  if (addr == UNKNOWN_FUNCTION) {
+    snprintf(name, size, "[unknown]");
+    return;
+  }
+
+  const struct sh4_symbol *sym = sh4_profiler_lookup_symbol(prof, addr);
+  uint32_t offset = sym ? (addr & SYMBOL_ADDR_MASK) - sym->addr : 0;
+
+  if (!sym) {
+    snprintf(name, size, "sub_%08x", addr);
+  } else if (!offset) {
+    snprintf(name, size, "%s", sym->name);
+  } else {
+    snprintf(name, size, "%s+0x%x", sym->name, offset);
+  }
+}
+
+static void sh4_profiler_add_sample(struct sh4_profiler *prof,
+                                    uint32_t *frames, int num_frames,
+                                    bool compiled, uint32_t guest_pc) {
+  prof->num_samples++;
+
+  if (compiled) {
+    prof->num_compiled_samples++;
+
+    struct sh4_profile_entry *instr =
+        sh4_profile_table_get(&prof->instrs, &guest_pc, 1);
+    instr->self++;
+  }
+
+  if (!compiled) {
+    frames[num_frames++] = HOST_FUNCTION;
+  } else if (!num_frames) {
+    frames[num_frames++] = UNKNOWN_FUNCTION;
+  }
+
+  struct sh4_profile_entry *stack =
+      sh4_profile_table_get(&prof->stacks, frames, num_frames);
+  stack->self++;
+
+  // the sample counts towards the total of each function on the stack once,
+  // regardless of how many times it recursed
+  for (int i = 0; i < num_frames; i++) {
+    struct sh4_profile_entry *func =
+        sh4_profile_table_get(&prof->functions, &frames[i], 1);
+
+    if (i == num_frames - 1) {
+      func->self++;
+    }
+
+    int j = i + 1;
+    while (j < num_frames && frames[j] != frames[i]) {
+      j++;
+    }
+
+    if (j == num_frames) {
+      func->total++;
+    }
+  }
+}
+
+bool sh4_profiler_write(struct sh4_profiler *prof, const char *report_filename,
+                        const char *folded_filename) {
+  FILE *report = fopen(report_filename, "w");
+  FILE *folded = fopen(folded_filename, "w");
+
+  if (!report || !folded) {
+    LOG_WARNING("Failed to write profile to %s", report_filename);
+
+    if (report) {
+      fclose(report);
+    }
+
+    if (folded) {
+      fclose(folded);
+    }
+
+    return false;
+  }
+
+  double scale = 100.0 / MAX(prof->num_samples, 1);
+  char name[512];
+
+  fprintf(report, "# %d samples, %d in compiled code, %d dropped\n",
+          prof->num_samples, prof->num_compiled_samples, prof->num_dropped);
+
+  // functions, by the samples taken in them directly
+  fprintf(report, "\n#   self   total  samples  address     function\n");
+
+  struct sh4_profile_entry **funcs = sh4_profile_table_sort(&prof->functions);
+
+  for (int i = 0; i < prof->functions.size; i++) {
+    struct sh4_profile_entry *func = funcs[i];
+    uint32_t addr = func->key[0];
+
+    sh4_profiler_name(prof, addr, name, sizeof(name));
+    fprintf(report, "%7.2f%% %6.2f%% %8d  0x%08x  %s\n", func->self * scale,
+            func->total * scale, func->self, addr, name);
+  }
+
+  free(funcs);
+
+  // and the hottest instrs in compiled code
+  fprintf(report, "\n#   self  samples  address     location\n");
+
+  struct sh4_profile_entry **instrs = sh4_profile_table_sort(&prof->instrs);
+  int num_instrs = MIN(prof->instrs.size, MAX_REPORT_INSTRS);
+
+  for (int i = 0; i < num_instrs; i++) {
+    struct sh4_profile_entry *instr = instrs[i];
+    uint32_t addr = instr->key[0];
+
+    sh4_profiler_name(prof, addr, name, sizeof(name));
+    fprintf(report, "%7.2f%% %8d  0x%08x  %s\n", instr->self * scale,
+            instr->self, addr, name);
+  }
+
+  free(instrs);
+
+  // each stack is written outermost function first, followed by its count
+  for (int i = 0; i < prof->stacks.capacity; i++) {
+    struct sh4_profile_entry *stack = &prof->stacks.entries[i];
+
+    if (!stack->key) {
+      continue;
+    }
+
+    for (int j = 0; j < stack->key_len; j++) {
+      sh4_profiler_name(prof, stack->key[j], name, sizeof(name));
+      fprintf(folded, "%s%s", j ? ";" : "", name);
+    }
+
+    fprintf(folded, " %d\n", stack->self);
+  }
+
+  fclose(report);
+  fclose(folded);
+
+  return true;
+}
+
+void sh4_profiler_flush(struct sh4_profiler *prof,
+                        sh4_profiler_resolve_cb resolve, void *data) {
+  while (prof->num_read != prof->num_written) {
+    volatile struct sh4_profile_sample *sample =
+        &prof->samples[prof->num_read % MAX_SAMPLES];
+
+    // leave room for the pseudo function appended by add_sample
+    uint32_t frames[MAX_SAMPLE_FRAMES + 1];
+    int num_frames = sample->num_frames;
+
+    for (int i = 0; i < num_frames; i++) {
+      frames[i] = sample->frames[i];
+    }
+
+    uint32_t guest_pc = 0;
+    bool compiled = resolve(data, sample->host_pc, &guest_pc);
+
+    prof->num_read++;
+
+    sh4_profiler_add_sample(prof, frames, num_frames, compiled, guest_pc);
+  }
+}
+
+void sh4_profiler_sample(struct sh4_profiler *prof, uintptr_t host_pc) {
+  unsigned n = prof->num_written;
+
+  if (n - prof->num_read >= MAX_SAMPLES) {
+    prof->num_dropped++;
+    return;
+  }
+
+  volatile struct sh4_profile_sample *sample = &prof->samples[n % MAX_SAMPLES];
+  int depth = prof->depth;
+  int num_frames = MIN(depth, MAX_SAMPLE_FRAMES);
+
+  sample->host_pc = host_pc;
+  sample->num_frames = num_frames;
+
+  for (int i = 0; i < num_frames; i++) {
+    sample->frames[i] = prof->stack[depth - num_frames + i].target;
+  }
+
+  prof->num_written = n + 1;
+}
+
+void sh4_profiler_return(struct sh4_profiler *prof, uint32_t ret_addr) {
+  // pop the innermost frame returning to ret_addr, along with any frames above
+  // it which have been left without returning. returns which don't match any
+  // frame (e.g. from a call made before profiling started, or a return address
+  // written to pr by hand) are ignored
+  for (int i = prof->depth - 1; i >= 0; i--) {
+    if (prof->stack[i].ret_addr == ret_addr) {
+      prof->depth = i;
+      return;
+    }
+  }
+}
+
+void sh4_profiler_call(struct sh4_profiler *prof, uint32_t target,
+                       uint32_t ret_addr) {
+  int depth = prof->depth;
+
+  if (depth == MAX_STACK_DEPTH) {
+    int half = MAX_STACK_DEPTH / 2;
+
+    for (int i = 0; i < half; i++) {
+      prof->stack[i].target = prof->stack[half + i].target;
+      prof->stack[i].ret_addr = prof->stack[half + i].ret_addr;
+    }
+
+    depth = half;
+  }
+
+  prof->stack[depth].target = target;
+  prof->stack[depth].ret_addr = ret_addr;
+  prof->depth = depth + 1;
+}
+
+static void sh4_profiler_sample_thread(void *data, uintptr_t pc) {
+  sh4_profiler_sample(data, pc);
+}
+
+void sh4_profiler_start(struct sh4_profiler *prof, int interval_us) {
+  if (prof->started) {
+    return;
+  }
+
+  prof->started = true;
+  prof->sampler =
+      sampler_create(interval_us, &sh4_profiler_sample_thread, prof);
+
+  if (!prof->sampler) {
+    LOG_WARNING("Failed to start sampling the guest");
+  }
+}
+
+void sh4_profiler_destroy(struct sh4_profiler *prof) {
+  if (prof->sampler) {
+    sampler_destroy(prof->sampler);
+  }
+
+  for (int i = 0; i < prof->num_symbols; i++) {
+    free(prof->symbols[i].name);
+  }
+  free(prof->symbols);
+
+  sh4_profile_table_destroy(&prof->stacks);
+  sh4_profile_table_destroy(&prof->instrs);
+  sh4_profile_table_destroy(&prof->functions);
+
+  free(prof);
+}
+
+struct sh4_profiler *sh4_profiler_create(const char *symbols_filename) {
+  struct sh4_profiler *prof = calloc(1, sizeof(struct sh4_profiler));
+
+  if (symbols_filename && *symbols_filename) {
+    sh4_profiler_load_symbols(prof, symbols_filename);
+  }
+
+  return prof;
+}
@@ -0,0 +1,41 @@
+#ifndef SH4_PROFILER_H
+#define SH4_PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// sampling profiler for guest code. the guest's calls and returns are tracked
+// on a shadow call stack, and each sample taken is attributed to the stack of
+// guest functions being run at the time. samples are taken from a signal
+// handler, which only records the host address interrupted along with the
+// stack. they're resolved to guest addresses by sh4_profiler_flush, which must
+// be called while the compiled code they were taken in still exists
+struct sh4_profiler;
+
+// resolves the host address a sample was taken at to the guest instruction
+// being run, returning false if it isn't inside of compiled code
+typedef bool (*sh4_profiler_resolve_cb)(void *data, uintptr_t host_pc,
+                                        uint32_t *guest_pc);
+
+// symbols_filename optionally names a file of "address name" lines, used to
+// name the functions in the profile
+struct sh4_profiler *sh4_profiler_create(const char *symbols_filename);
+void sh4_profiler_destroy(struct sh4_profiler *prof);
+
+// starts sampling the calling thread, once per interval_us of cpu time used
+void sh4_profiler_start(struct sh4_profiler *prof, int interval_us);
+
+void sh4_profiler_call(struct sh4_profiler *prof, uint32_t target,
+                       uint32_t ret_addr);
+void sh4_profiler_return(struct sh4_profiler *prof, uint32_t ret_addr);
+
+void sh4_profiler_sample(struct sh4_profiler *prof, uintptr_t host_pc);
+void sh4_profiler_flush(struct sh4_profiler *prof,
+                        sh4_profiler_resolve_cb resolve, void *data);
+
+// writes a report of the samples taken per function and per instruction, as
+// well as each sampled stack in the folded format read by flamegraph.pl
+bool sh4_profiler_write(struct sh4_profiler *prof, const char *report_filename,
+                        const char *folded_filename);
+
+#endif
@@ -8,9 +8,16 @@ struct address_space;
 struct ir;
 struct exception;
 
+// registers available to the register allocator are either preserved across
+// the calls made by compiled code, or clobbered by them. values in caller
+// saved registers must not be live across a call
+#define JIT_CALLEE_SAVED 0x1
+#define JIT_CALLER_SAVED 0x2
+
 struct jit_register {
   const char *name;
   int value_types;
+  int flags;
   const void *data;
 };
 
@@ -28,15 +35,67 @@ struct jit_memory_interface {
   void (*w64)(struct address_space *, uint32_t, uint64_t);
 };
 
+// description of the guest used by the backend's generated dispatch loop. the
+// dispatcher runs blocks while there are cycles left, jumping through the
+// two-level code table at code[pc >> code_bits][(pc & code_mask) >> 1], where
+// code_mask is (1 << code_bits) - 1. blocks exit back to it with the next pc,
+// or jump directly to their successor when linked
+struct jit_guest {
+  // offsets into the guest context
+  int offset_pc;
+  int offset_cycles;
+  int offset_interrupts;
+
+  void ***code;
+  int code_bits;
+
+  // called with the guest context when the code for the current pc needs to
+  // be compiled, and when the pending interrupts need to be processed
+  void (*compile_code)(void *ctx);
+  void (*interrupt)(void *ctx);
+};
+
+// static exits from an assembled block. the branch emitted for each exit
+// initially jumps back to the dispatcher, and can be patched with link_code
+// to jump straight to the code of the block at dst
+#define MAX_BLOCK_EXITS 2
+
+struct jit_exit {
+  uint32_t dst;
+  uint8_t *branch;
+};
+
 struct jit_backend;
 
 struct jit_backend {
   const struct jit_register *registers;
   int num_registers;
 
+  // the code buffer is split into num_regions regions, which code is assembled
+  // into one at a time. once the current region is full, assemble_code fails
+  // and begin_region must be called to move on to another region, overwriting
+  // any code previously assembled to it, as well as any code the backend
+  // generated on its behalf after assembly. reset starts over at the first
+  // region
+  int num_regions;
+
   void (*reset)(struct jit_backend *base);
+  void (*begin_region)(struct jit_backend *base, int region);
+
+  // once assembled, each OP_SOURCE_INFO instr in the IR is tagged with the
+  // address of the code emitted after it
   const uint8_t *(*assemble_code)(struct jit_backend *, struct ir *ir,
-                                  int *size);
+                                  int *size, struct jit_exit *exits,
+                                  int *num_exits);
+  void (*link_code)(struct jit_backend *base, uint8_t *branch,
+                    const uint8_t *dst);
+  void (*unlink_code)(struct jit_backend *base, uint8_t *branch);
+
+  // run_code enters the dispatch loop at the current guest pc, returning once
+  // the guest's cycles are exhausted. compile_thunk returns the dispatcher's
+  // entry point for code which has yet to be compiled
+  void (*run_code)(struct jit_backend *base);
+  const uint8_t *(*compile_thunk)(struct jit_backend *base);
   void (*dump_code)(struct jit_backend *base, const uint8_t *host_addr,
                     int size);
   bool (*handle_exception)(struct jit_backend *base, struct exception *ex);
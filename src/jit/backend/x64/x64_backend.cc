@@ -3,6 +3,7 @@
 
 #define XBYAK_NO_OP_NAMES
 #include <xbyak/xbyak.h>
+#include <xbyak/xbyak_util.h>
 
 extern "C" {
 #include "core/profiler.h"
@@ -23,8 +24,12 @@ static const int STACK_SHADOW_SPACE = 32;
 #else
 static const int STACK_SHADOW_SPACE = 0;
 #endif
+// compiled blocks don't have their own stack frames. a single frame is setup
+// by the dispatcher on entry and shared by all blocks, so it must be large
+// enough to fit the locals of any block
+static const int STACK_MAX_LOCALS = 8192;
 static const int STACK_OFFSET_LOCALS = STACK_SHADOW_SPACE;
-static const int STACK_SIZE = STACK_OFFSET_LOCALS;
+static const int STACK_SIZE = STACK_OFFSET_LOCALS + STACK_MAX_LOCALS;
 
 //
 // x64 register layout
@@ -55,9 +60,17 @@ static const int STACK_SIZE = STACK_OFFSET_LOCALS;
 // amd64 is left with rax, rcx, r8-r11 available on amd64
 
 // rax is used as a scratch register
+// rcx is used for the count of variable shifts
 // r10, r11, xmm1 are used for constant not eliminated by const propagation
 // r14, r15 are reserved for the context and memory pointers
 
+// the remaining argument registers (r9 on msvc, r8 and r9 on amd64) and xmm
+// registers are handed out alongside the callee saved registers. the register
+// allocator won't keep a value in a caller saved register across an op which
+// calls out to C. fastmem accesses patched into slow path calls aren't known
+// to it though, so the thunk they call through preserves them instead. note,
+// xmm6-xmm15 are only callee saved on msvc
+
 #if PLATFORM_WINDOWS
 const int x64_arg0_idx = Xbyak::Operand::RCX;
 const int x64_arg1_idx = Xbyak::Operand::RDX;
@@ -76,46 +89,131 @@ const Xbyak::Reg64 arg2(x64_arg2_idx);
 const Xbyak::Reg64 tmp0(x64_tmp0_idx);
 const Xbyak::Reg64 tmp1(x64_tmp1_idx);
 
+#if PLATFORM_WINDOWS
+#define XMM_SAVED JIT_CALLEE_SAVED
+#else
+#define XMM_SAVED JIT_CALLER_SAVED
+#endif
+
 const struct jit_register x64_registers[] = {
-    {"rbx", VALUE_INT_MASK, reinterpret_cast<const void *>(&Xbyak::util::rbx)},
-    {"rbp", VALUE_INT_MASK, reinterpret_cast<const void *>(&Xbyak::util::rbp)},
-    {"r12", VALUE_INT_MASK, reinterpret_cast<const void *>(&Xbyak::util::r12)},
-    {"r13", VALUE_INT_MASK, reinterpret_cast<const void *>(&Xbyak::util::r13)},
-    // {"r14", VALUE_INT_MASK,
+    {"rbx", VALUE_INT_MASK, JIT_CALLEE_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::rbx)},
+    {"rbp", VALUE_INT_MASK, JIT_CALLEE_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::rbp)},
+#if PLATFORM_WINDOWS
+    {"rdi", VALUE_INT_MASK, JIT_CALLEE_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::rdi)},
+    {"rsi", VALUE_INT_MASK, JIT_CALLEE_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::rsi)},
+#endif
+    {"r12", VALUE_INT_MASK, JIT_CALLEE_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::r12)},
+    {"r13", VALUE_INT_MASK, JIT_CALLEE_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::r13)},
+    // {"r14", VALUE_INT_MASK, JIT_CALLEE_SAVED,
     //  reinterpret_cast<const void *>(&Xbyak::util::r14)},
-    // {"r15", VALUE_INT_MASK,
+    // {"r15", VALUE_INT_MASK, JIT_CALLEE_SAVED,
     //  reinterpret_cast<const void *>(&Xbyak::util::r15)},
-    {"xmm6", VALUE_FLOAT_MASK,
+#if !PLATFORM_WINDOWS
+    {"r8", VALUE_INT_MASK, JIT_CALLER_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::r8)},
+#endif
+    {"r9", VALUE_INT_MASK, JIT_CALLER_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::r9)},
+    {"xmm0", VALUE_FLOAT_MASK, JIT_CALLER_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::xmm0)},
+    {"xmm2", VALUE_FLOAT_MASK, JIT_CALLER_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::xmm2)},
+    {"xmm3", VALUE_FLOAT_MASK, JIT_CALLER_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::xmm3)},
+    {"xmm4", VALUE_VECTOR_MASK, JIT_CALLER_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::xmm4)},
+    {"xmm5", VALUE_VECTOR_MASK, JIT_CALLER_SAVED,
+     reinterpret_cast<const void *>(&Xbyak::util::xmm5)},
+    {"xmm6", VALUE_FLOAT_MASK, XMM_SAVED,
      reinterpret_cast<const void *>(&Xbyak::util::xmm6)},
-    {"xmm7", VALUE_FLOAT_MASK,
+    {"xmm7", VALUE_FLOAT_MASK, XMM_SAVED,
      reinterpret_cast<const void *>(&Xbyak::util::xmm7)},
-    {"xmm8", VALUE_FLOAT_MASK,
+    {"xmm8", VALUE_FLOAT_MASK, XMM_SAVED,
      reinterpret_cast<const void *>(&Xbyak::util::xmm8)},
-    {"xmm9", VALUE_FLOAT_MASK,
+    {"xmm9", VALUE_FLOAT_MASK, XMM_SAVED,
      reinterpret_cast<const void *>(&Xbyak::util::xmm9)},
-    {"xmm10", VALUE_FLOAT_MASK,
+    {"xmm10", VALUE_FLOAT_MASK, XMM_SAVED,
      reinterpret_cast<const void *>(&Xbyak::util::xmm10)},
-    {"xmm11", VALUE_VECTOR_MASK,
+    {"xmm11", VALUE_VECTOR_MASK, XMM_SAVED,
      reinterpret_cast<const void *>(&Xbyak::util::xmm11)},
-    {"xmm12", VALUE_VECTOR_MASK,
+    {"xmm12", VALUE_VECTOR_MASK, XMM_SAVED,
      reinterpret_cast<const void *>(&Xbyak::util::xmm12)},
-    {"xmm13", VALUE_VECTOR_MASK,
+    {"xmm13", VALUE_VECTOR_MASK, XMM_SAVED,
      reinterpret_cast<const void *>(&Xbyak::util::xmm13)},
-    {"xmm14", VALUE_VECTOR_MASK,
+    {"xmm14", VALUE_VECTOR_MASK, XMM_SAVED,
      reinterpret_cast<const void *>(&Xbyak::util::xmm14)},
-    {"xmm15", VALUE_VECTOR_MASK,
+    {"xmm15", VALUE_VECTOR_MASK, XMM_SAVED,
      reinterpret_cast<const void *>(&Xbyak::util::xmm15)}};
 
 const int x64_num_registers =
     sizeof(x64_registers) / sizeof(struct jit_register);
 
 //
-// x64 code buffer. this will break down if running two instances of the x64
-// backend, but it's extremely useful when profiling to group JITd blocks of
-// code with an actual symbol name
+// x64 instruction set extensions. the emitters target an sse2 baseline, with
+// separate paths for the extensions detected at runtime. the tier of
+// extensions used can be capped with the jit_isa option, so that each path can
+// be tested on a single machine
+//
+enum x64_feature {
+  X64_SSE41 = 0x1,
+  X64_AVX = 0x2,
+  X64_AVX2 = 0x4,
+  X64_BMI2 = 0x8,
+  X64_FMA = 0x10,
+};
+
+struct x64_tier {
+  const char *name;
+  int features;
+};
+
+static const struct x64_tier x64_tiers[] = {
+    {"sse2", 0},
+    {"sse41", X64_SSE41},
+    {"avx", X64_SSE41 | X64_AVX},
+    {"avx2", X64_SSE41 | X64_AVX | X64_AVX2 | X64_BMI2 | X64_FMA},
+};
+
+//
+// x64 code buffer. the thunks, dispatcher and constants are emitted to the
+// start of the buffer, and the rest of it is split into equally sized regions
+// which blocks are assembled into. the code generator's maximum size is moved
+// to the end of the current region, so that overflowing it fails the same way
+// as overflowing the entire buffer
 //
-static const size_t x64_code_size = 1024 * 1024 * 8;
-static uint8_t x64_code[x64_code_size];
+// the tail of each region is set aside for the cold code of its blocks, the
+// paths back to the dispatcher which are only taken when leaving a linked
+// chain of blocks. keeping them apart leaves the hot paths of the blocks
+// packed together, using fewer cache lines and pages
+//
+// after the cold area, the very end of each region holds the slow path stubs
+// its blocks' fastmem accesses are patched to call. the stubs are discarded
+// along with the blocks calling them when the region is reused
+//
+static const size_t X64_MAX_STUB_SIZE = 64;
+static const int X64_COLD_AREA_SHIFT = 3;
+static const int X64_STUB_AREA_SHIFT = 5;
+
+// fastmem accesses are padded to at least the size of a call rel32, so they
+// can be patched into a call to a slow path stub
+static const int X64_PATCH_SIZE = 5;
+
+class x64_codegen : public Xbyak::CodeGenerator {
+ public:
+  x64_codegen(size_t max_size, void *ptr)
+      : Xbyak::CodeGenerator(max_size, ptr) {}
+
+  void set_region(size_t begin, size_t end) {
+    maxSize_ = end;
+    setSize(begin);
+  }
+};
 
 //
 // x64 emitters for each ir op
@@ -154,18 +252,68 @@ enum xmm_constant {
 struct x64_backend {
   struct jit_backend base;
   struct jit_memory_interface *memory_if;
-
-  Xbyak::CodeGenerator *codegen;
+  struct jit_guest *guest;
+
+  // the code buffer is a shared memory object mapped twice, writable for the
+  // code generators and executable for running the code, so that no page is
+  // ever both. code is addressed through the writable mapping internally, and
+  // through the executable one by everything outside of the backend
+  shmem_handle_t code_shmem;
+  uint8_t *code;
+  const uint8_t *exec_code;
+  size_t code_size;
+  x64_codegen *codegen;
   csh capstone_handle;
 
+  // instruction set extensions used by the emitters
+  int features;
+
+  // offset of the first region, and the size of each region
+  size_t region_begin;
+  size_t region_size;
+
+  // slow path stubs are emitted by their own code generator, limited to the
+  // stub area of the region the patched block belongs to. the next free
+  // offset in each region's stub area is tracked separately, as accesses
+  // fault long after their region stopped being the current one
+  x64_codegen *stubgen;
+  size_t *stub_next;
+
+  // cold code is emitted by its own code generator, limited to the cold area
+  // of the current region
+  x64_codegen *coldgen;
+
   Xbyak::Label xmm_const[NUM_XMM_CONST];
-  void (*load_thunk[16])();
-  void (*store_thunk)();
+  const uint8_t *call_thunk;
+  const uint8_t *load_thunk[16];
+  const uint8_t *store_thunk;
+
+  // dispatch loop entry points
+  const uint8_t *dispatch_enter;
+  const uint8_t *dispatch_dynamic;
+  const uint8_t *dispatch_compile;
+  const uint8_t *dispatch_interrupt;
+  const uint8_t *dispatch_exit;
 
-  bool modified[x64_num_registers];
   int num_temps;
+
+  // static exits of the block currently being emitted
+  struct jit_exit *exits;
+  int num_exits;
 };
 
+// translate the address of code in the writable mapping of the code buffer to
+// the address it's executed from, and back
+static const uint8_t *x64_backend_exec_addr(struct x64_backend *backend,
+                                            const uint8_t *addr) {
+  return backend->exec_code + (addr - backend->code);
+}
+
+static uint8_t *x64_backend_write_addr(struct x64_backend *backend,
+                                       const uint8_t *addr) {
+  return backend->code + (addr - backend->exec_code);
+}
+
 const Xbyak::Reg x64_backend_register(struct x64_backend *backend,
                                       const struct ir_value *v) {
   auto &e = *backend->codegen;
@@ -234,11 +382,19 @@ const Xbyak::Xmm x64_backend_xmm_register(struct x64_backend *backend,
     if (v->type == VALUE_F32) {
       float val = v->f32;
       e.mov(e.eax, *(int32_t *)&val);
-      e.vmovd(e.xmm1, e.eax);
+      if (backend->features & X64_AVX) {
+        e.vmovd(e.xmm1, e.eax);
+      } else {
+        e.movd(e.xmm1, e.eax);
+      }
     } else {
       double val = v->f64;
       e.mov(e.rax, *(int64_t *)&val);
-      e.vmovq(e.xmm1, e.rax);
+      if (backend->features & X64_AVX) {
+        e.vmovq(e.xmm1, e.rax);
+      } else {
+        e.movq(e.xmm1, e.rax);
+      }
     }
     return e.xmm1;
   }
@@ -259,111 +415,395 @@ const Xbyak::Address x64_backend_xmm_constant(struct x64_backend *backend,
   return e.ptr[e.rip + backend->xmm_const[c]];
 }
 
+static void x64_backend_load_xmm(struct x64_backend *backend,
+                                 const Xbyak::Xmm &dst,
+                                 const Xbyak::RegExp &src, enum ir_type type) {
+  auto &e = *backend->codegen;
+  bool avx = backend->features & X64_AVX;
+
+  switch (type) {
+    case VALUE_F32:
+      if (avx) {
+        e.vmovss(dst, e.dword[src]);
+      } else {
+        e.movss(dst, e.dword[src]);
+      }
+      break;
+    case VALUE_F64:
+      if (avx) {
+        e.vmovsd(dst, e.qword[src]);
+      } else {
+        e.movsd(dst, e.qword[src]);
+      }
+      break;
+    case VALUE_V128:
+      if (avx) {
+        e.vmovups(dst, e.ptr[src]);
+      } else {
+        e.movups(dst, e.ptr[src]);
+      }
+      break;
+    default:
+      LOG_FATAL("Unexpected value type");
+      break;
+  }
+}
+
+static void x64_backend_store_xmm(struct x64_backend *backend,
+                                  const Xbyak::RegExp &dst,
+                                  const Xbyak::Xmm &src, enum ir_type type) {
+  auto &e = *backend->codegen;
+  bool avx = backend->features & X64_AVX;
+
+  switch (type) {
+    case VALUE_F32:
+      if (avx) {
+        e.vmovss(e.dword[dst], src);
+      } else {
+        e.movss(e.dword[dst], src);
+      }
+      break;
+    case VALUE_F64:
+      if (avx) {
+        e.vmovsd(e.qword[dst], src);
+      } else {
+        e.movsd(e.qword[dst], src);
+      }
+      break;
+    case VALUE_V128:
+      if (avx) {
+        e.vmovups(e.ptr[dst], src);
+      } else {
+        e.movups(e.ptr[dst], src);
+      }
+      break;
+    default:
+      LOG_FATAL("Unexpected value type");
+      break;
+  }
+}
+
+// sse instructions are destructive, copy the first source to the destination
+// before operating on it in place
+static void x64_backend_copy_xmm(struct x64_backend *backend,
+                                 const Xbyak::Xmm &dst, const Xbyak::Xmm &src) {
+  auto &e = *backend->codegen;
+
+  if (dst != src) {
+    e.movaps(dst, src);
+  }
+}
+
+// constants can be encoded directly as an instruction's immediate operand
+// when they fit in 32-bits. 64-bit operations sign extend their immediate
 static bool x64_backend_can_encode_imm(const struct ir_value *v) {
   if (!ir_is_constant(v)) {
     return false;
   }
 
+  if (v->type == VALUE_I64) {
+    return v->i64 >= INT32_MIN && v->i64 <= INT32_MAX;
+  }
+
   return v->type <= VALUE_I32;
 }
 
-static bool x64_backend_callee_saved(const Xbyak::Reg &reg) {
-  if (reg.isXMM()) {
-    return false;
+//
+// x64 condition codes. pairs of opposite conditions are adjacent, so a
+// condition is negated by flipping its low bit
+//
+enum x64_cond {
+  X64_COND_E,
+  X64_COND_NE,
+  X64_COND_L,
+  X64_COND_GE,
+  X64_COND_LE,
+  X64_COND_G,
+  X64_COND_B,
+  X64_COND_AE,
+  X64_COND_BE,
+  X64_COND_A,
+  NUM_X64_CONDS,
+};
+
+typedef void (Xbyak::CodeGenerator::*x64_setcc)(const Xbyak::Operand &);
+typedef void (Xbyak::CodeGenerator::*x64_cmovcc)(const Xbyak::Reg &,
+                                                const Xbyak::Operand &);
+typedef void (Xbyak::CodeGenerator::*x64_jcc)(
+    const Xbyak::Label &, Xbyak::CodeGenerator::LabelType);
+
+struct x64_cond_ops {
+  x64_setcc setcc;
+  x64_cmovcc cmovcc;
+  x64_jcc jcc;
+};
+
+static const struct x64_cond_ops x64_conds[NUM_X64_CONDS] = {
+    {&Xbyak::CodeGenerator::sete, &Xbyak::CodeGenerator::cmove,
+     &Xbyak::CodeGenerator::je},
+    {&Xbyak::CodeGenerator::setne, &Xbyak::CodeGenerator::cmovne,
+     &Xbyak::CodeGenerator::jne},
+    {&Xbyak::CodeGenerator::setl, &Xbyak::CodeGenerator::cmovl,
+     &Xbyak::CodeGenerator::jl},
+    {&Xbyak::CodeGenerator::setge, &Xbyak::CodeGenerator::cmovge,
+     &Xbyak::CodeGenerator::jge},
+    {&Xbyak::CodeGenerator::setle, &Xbyak::CodeGenerator::cmovle,
+     &Xbyak::CodeGenerator::jle},
+    {&Xbyak::CodeGenerator::setg, &Xbyak::CodeGenerator::cmovg,
+     &Xbyak::CodeGenerator::jg},
+    {&Xbyak::CodeGenerator::setb, &Xbyak::CodeGenerator::cmovb,
+     &Xbyak::CodeGenerator::jb},
+    {&Xbyak::CodeGenerator::setae, &Xbyak::CodeGenerator::cmovae,
+     &Xbyak::CodeGenerator::jae},
+    {&Xbyak::CodeGenerator::setbe, &Xbyak::CodeGenerator::cmovbe,
+     &Xbyak::CodeGenerator::jbe},
+    {&Xbyak::CodeGenerator::seta, &Xbyak::CodeGenerator::cmova,
+     &Xbyak::CodeGenerator::ja},
+};
+
+static enum x64_cond x64_backend_negate_cond(enum x64_cond cond) {
+  return (enum x64_cond)(cond ^ 1);
+}
+
+// condition code set by the cmp / fcmp emitted for instr. comiss / comisd
+// set the flags like an unsigned integer compare
+static enum x64_cond x64_backend_cmp_cond(const struct ir_instr *instr) {
+  enum ir_cmp cmp = (enum ir_cmp)instr->arg[2]->i32;
+  bool is_float = instr->op == OP_FCMP;
+
+  switch (cmp) {
+    case CMP_EQ:
+      return X64_COND_E;
+    case CMP_NE:
+      return X64_COND_NE;
+    case CMP_SGE:
+      return is_float ? X64_COND_AE : X64_COND_GE;
+    case CMP_SGT:
+      return is_float ? X64_COND_A : X64_COND_G;
+    case CMP_UGE:
+      CHECK(!is_float);
+      return X64_COND_AE;
+    case CMP_UGT:
+      CHECK(!is_float);
+      return X64_COND_A;
+    case CMP_SLE:
+      return is_float ? X64_COND_BE : X64_COND_LE;
+    case CMP_SLT:
+      return is_float ? X64_COND_B : X64_COND_L;
+    case CMP_ULE:
+      CHECK(!is_float);
+      return X64_COND_BE;
+    case CMP_ULT:
+      CHECK(!is_float);
+      return X64_COND_B;
+    default:
+      LOG_FATAL("Unexpected comparison type");
   }
+}
 
-  static bool callee_saved[16] = {
-    false,  // RAX
-    false,  // RCX
-    false,  // RDX
-    true,   // RBX
-    false,  // RSP
-    true,   // RBP
-#if PLATFORM_WINDOWS
-    true,  // RSI
-    true,  // RDI
-#else
-    false,  // RSI
-    false,  // RDI
-#endif
-    false,  // R8
-    false,  // R9
-    false,  // R10
-    false,  // R11
-    true,   // R12
-    true,   // R13
-    true,   // R14
-    true,   // R15
-  };
+// find the cmp / fcmp defining a branch or select's condition, looking
+// through the zext the sh4 frontend widens t-bit comparisons with
+static struct ir_instr *x64_backend_cond_def(struct ir_value *v) {
+  struct ir_instr *def = v->def;
+
+  if (def && def->op == OP_ZEXT) {
+    def = def->arg[0]->def;
+  }
 
-  return callee_saved[reg.getIdx()];
+  if (!def || (def->op != OP_CMP && def->op != OP_FCMP)) {
+    return nullptr;
+  }
+
+  return def;
 }
 
-static void x64_backend_emit_prolog(struct x64_backend *backend, struct ir *ir,
-                                    int *out_stack_size) {
-  auto &e = *backend->codegen;
+//
+// x64 instruction selection. before a block is emitted, patterns of
+// instructions which map to a single x64 instruction are matched, and the
+// instructions are tagged with how they're to be emitted. the tags are only
+// valid while the block is being emitted
+//
+enum {
+  // the instruction is emitted as part of its only user, and emits no code
+  // of its own
+  X64_SEL_FOLDED = 0x1,
+  // the access' address operand includes the add defining its address
+  X64_SEL_FOLD_ADDR = 0x2,
+  // the branch / select is conditional on the flags left by the comparison
+  // defining its condition, instead of on its value
+  X64_SEL_FUSE_FLAGS = 0x4,
+  // the comparison's result is only consumed through the flags, and isn't
+  // materialized with a setcc
+  X64_SEL_NO_RESULT = 0x8,
+  // the flags are live across the instruction, it must leave them intact
+  X64_SEL_KEEP_FLAGS = 0x10,
+};
 
-  int stack_size = STACK_SIZE + ir->locals_size;
+static bool x64_backend_has_one_use(struct ir_value *v) {
+  return !list_empty(&v->uses) &&
+         list_first_entry(&v->uses, struct ir_use, it) ==
+             list_last_entry(&v->uses, struct ir_use, it);
+}
 
-  // stack must be 16 byte aligned
-  stack_size = align_up(stack_size, 16);
+// adds and subtracts of 32 and 64-bit values can be emitted as a lea, which
+// writes a different register than its operand and leaves the flags intact.
+// subtracts can only when their operand is a constant, folding its negation
+// into the displacement
+static bool x64_backend_can_lea(const struct ir_instr *instr) {
+  if (instr->result->type != VALUE_I32 && instr->result->type != VALUE_I64) {
+    return false;
+  }
 
-  // add 8 for return address which will be pushed when this is called
-  stack_size += 8;
+  const struct ir_value *b = instr->arg[1];
 
-  CHECK_EQ((stack_size + 8) % 16, 0);
+  if (instr->op == OP_ADD) {
+    return !ir_is_constant(b) || x64_backend_can_encode_imm(b);
+  }
 
-  // mark which registers have been modified
-  memset(backend->modified, 0, sizeof(backend->modified));
+  return x64_backend_can_encode_imm(b) &&
+         (b->type != VALUE_I64 || b->i64 != INT32_MIN);
+}
 
-  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
-    struct ir_value *result = instr->result;
+static int32_t x64_backend_lea_disp(const struct ir_instr *instr) {
+  uint32_t imm = (uint32_t)ir_zext_constant(instr->arg[1]);
+  return (int32_t)(instr->op == OP_ADD ? imm : 0u - imm);
+}
 
-    if (!result) {
-      continue;
-    }
+// instructions which are never emitted with a flag clobbering instruction.
+// fastmem accesses aren't, as the slow path a faulting access is patched to
+// call out to doesn't preserve them
+static bool x64_backend_keeps_flags(const struct ir_instr *instr) {
+  switch (instr->op) {
+    case OP_LOAD_HOST:
+    case OP_STORE_HOST:
+    case OP_LOAD_CONTEXT:
+    case OP_STORE_CONTEXT:
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL:
+    case OP_SEXT:
+    case OP_ZEXT:
+    case OP_TRUNC:
+    case OP_FEXT:
+    case OP_FTRUNC:
+    case OP_SOURCE_INFO:
+      return true;
+    case OP_ADD:
+    case OP_SUB:
+      return (instr->tag & X64_SEL_FOLDED) || x64_backend_can_lea(instr);
+    default:
+      return false;
+  }
+}
+
+// fold the add computing a memory access' address into the access' own
+// address operand. the add must immediately precede the access, so that its
+// operands are still in their registers
+static void x64_backend_select_addr(struct ir_instr *instr,
+                                    enum ir_type addr_type) {
+  struct ir_value *addr = instr->arg[0];
+  struct ir_instr *def = addr->def;
 
-    backend->modified[result->reg] = true;
+  if (!def || def->op != OP_ADD || addr->type != addr_type ||
+      list_prev_entry(instr, struct ir_instr, it) != def ||
+      !x64_backend_has_one_use(addr)) {
+    return;
+  }
+
+  if (ir_is_constant(def->arg[0]) ||
+      (ir_is_constant(def->arg[1]) &&
+       !x64_backend_can_encode_imm(def->arg[1]))) {
+    return;
   }
 
-  // push the callee-saved registers which have been modified
-  int pushed = 2;
+  def->tag |= X64_SEL_FOLDED;
+  instr->tag |= X64_SEL_FOLD_ADDR;
+}
 
-  // always used by guest ctx and memory pointers
-  e.push(e.r15);
-  e.push(e.r14);
+// branch / select directly on the flags of the comparison defining their
+// condition, when nothing emitted in between clobbers them
+static void x64_backend_select_flags(struct ir_instr *instr,
+                                     struct ir_value *cond) {
+  struct ir_instr *cmp = x64_backend_cond_def(cond);
 
-  for (int i = 0; i < x64_num_registers; i++) {
-    const Xbyak::Reg &reg =
-        *reinterpret_cast<const Xbyak::Reg *>(x64_registers[i].data);
+  if (!cmp) {
+    return;
+  }
 
-    if (x64_backend_callee_saved(reg) && backend->modified[i]) {
-      e.push(reg);
-      pushed++;
+  for (struct ir_instr *it = list_next_entry(cmp, struct ir_instr, it);
+       it != instr; it = list_next_entry(it, struct ir_instr, it)) {
+    if (!x64_backend_keeps_flags(it)) {
+      return;
     }
   }
 
-  // if an odd amount of push instructions are emitted stack_size needs to be
-  // adjusted to keep the stack aligned
-  if ((pushed % 2) == 1) {
-    stack_size += 8;
+  for (struct ir_instr *it = list_next_entry(cmp, struct ir_instr, it);
+       it != instr; it = list_next_entry(it, struct ir_instr, it)) {
+    it->tag |= X64_SEL_KEEP_FLAGS;
   }
 
-  // adjust stack pointer
-  e.sub(e.rsp, stack_size);
+  instr->tag |= X64_SEL_FUSE_FLAGS;
 
-  // copy guest context and memory base to argument registers
-  e.mov(e.r14, reinterpret_cast<uint64_t>(backend->memory_if->ctx_base));
-  e.mov(e.r15, reinterpret_cast<uint64_t>(backend->memory_if->mem_base));
+  // if nothing else needs the condition's value, don't materialize it
+  if (!x64_backend_has_one_use(cond)) {
+    return;
+  }
+
+  if (cond->def != cmp) {
+    if (!x64_backend_has_one_use(cmp->result)) {
+      return;
+    }
+
+    cond->def->tag |= X64_SEL_FOLDED;
+  }
+
+  cmp->tag |= X64_SEL_NO_RESULT;
+}
+
+static void x64_backend_select(struct x64_backend *backend, struct ir *ir) {
+  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
+    instr->tag = 0;
+  }
 
-  *out_stack_size = stack_size;
+  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
+    switch (instr->op) {
+      case OP_LOAD_HOST:
+      case OP_STORE_HOST:
+        x64_backend_select_addr(instr, VALUE_I64);
+        break;
+      case OP_LOAD_FAST:
+      case OP_STORE_FAST:
+        x64_backend_select_addr(instr, VALUE_I32);
+        break;
+      case OP_SELECT:
+        x64_backend_select_flags(instr, instr->arg[2]);
+        break;
+      case OP_BRANCH_COND:
+        x64_backend_select_flags(instr, instr->arg[0]);
+        break;
+      default:
+        break;
+    }
+  }
 }
 
 static void x64_backend_emit_body(struct x64_backend *backend, struct ir *ir) {
+  x64_backend_select(backend, ir);
+
   list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
     x64_emit_cb emit = x64_backend_emitters[instr->op];
     CHECK(emit, "Failed to find emitter for %s", ir_op_names[instr->op]);
 
+    if (instr->tag & X64_SEL_FOLDED) {
+      continue;
+    }
+
+    // source info emits no code, it's tagged with the address of the code
+    // following it instead
+    if (instr->op == OP_SOURCE_INFO) {
+      instr->tag = reinterpret_cast<intptr_t>(
+          x64_backend_exec_addr(backend, backend->codegen->getCurr()));
+    }
+
     // reset temp count used by GetRegister
     backend->num_temps = 0;
 
@@ -371,57 +811,145 @@ static void x64_backend_emit_body(struct x64_backend *backend, struct ir *ir) {
   }
 }
 
-static void x64_backend_emit_epilog(struct x64_backend *backend, struct ir *ir,
-                                    int stack_size) {
+static void x64_backend_emit_static_exit(struct x64_backend *backend,
+                                         uint32_t dst) {
   auto &e = *backend->codegen;
+  auto &cold = *backend->coldgen;
 
-  // adjust stack pointer
-  e.add(e.rsp, stack_size);
+  // the path back to the dispatcher with dst as the next pc is cold
+  const uint8_t *to_dispatch = cold.getCurr();
 
-  // pop callee-saved registers which have been modified
-  for (int i = x64_num_registers - 1; i >= 0; i--) {
-    const Xbyak::Reg &reg =
-        *reinterpret_cast<const Xbyak::Reg *>(x64_registers[i].data);
+  cold.mov(cold.eax, dst);
+  cold.jmp(backend->dispatch_dynamic);
 
-    if (x64_backend_callee_saved(reg) && backend->modified[i]) {
-      e.pop(reg);
-    }
-  }
+  // only jump directly to the next block while there are cycles left to run
+  // and no interrupts are pending, else let the dispatcher handle it
+  e.cmp(e.dword[e.r14 + backend->guest->offset_cycles], 0);
+  e.jle(to_dispatch);
+  e.cmp(e.qword[e.r14 + backend->guest->offset_interrupts], 0);
+  e.jne(to_dispatch);
 
-  // pop r14 and r15
-  e.pop(e.r14);
-  e.pop(e.r15);
+  // emit a jmp rel32 which initially goes to the dispatcher as well. once the
+  // block at dst is compiled, the displacement is patched to jump straight to
+  // it. note, unlink_code relies on the jne rel32 preceding it to find the way
+  // back to the dispatcher
+  CHECK_LT(backend->num_exits, MAX_BLOCK_EXITS);
+  struct jit_exit *exit = &backend->exits[backend->num_exits++];
+  exit->dst = dst;
+  exit->branch =
+      const_cast<uint8_t *>(x64_backend_exec_addr(backend, e.getCurr()));
 
-  e.ret();
+  e.db(0xe9);
+  e.dd(static_cast<uint32_t>(to_dispatch - (e.getCurr() + 4)));
 }
 
 const uint8_t *x64_backend_emit(struct x64_backend *backend, struct ir *ir,
-                                int *size) {
+                                int *size, struct jit_exit *exits,
+                                int *num_exits) {
   // PROFILER_RUNTIME("X64Emitter::Emit");
 
+  CHECK_LE(ir->locals_size, STACK_MAX_LOCALS,
+           "Block locals exceed the dispatcher's stack frame");
+
   const uint8_t *fn = backend->codegen->getCurr();
 
-  int stack_size = 0;
-  x64_backend_emit_prolog(backend, ir, &stack_size);
+  backend->exits = exits;
+  backend->num_exits = 0;
+
   x64_backend_emit_body(backend, ir);
-  x64_backend_emit_epilog(backend, ir, stack_size);
 
   *size = (int)(backend->codegen->getCurr() - fn);
+  *num_exits = backend->num_exits;
 
-  return fn;
+  return x64_backend_exec_addr(backend, fn);
 }
 
 static void x64_backend_emit_thunks(struct x64_backend *backend) {
   auto &e = *backend->codegen;
 
+  // calls the function in rax, preserving the caller saved registers handed
+  // out by the register allocator. entered with the stack aligned as it is on
+  // entry to any function, and returns the function's result in rax
+  {
+    int num_saved = 0;
+    int num_saved_xmm = 0;
+
+    for (int i = 0; i < x64_num_registers; i++) {
+      const struct jit_register *r = &x64_registers[i];
+
+      if (!(r->flags & JIT_CALLER_SAVED)) {
+        continue;
+      }
+
+      if (r->value_types == VALUE_INT_MASK) {
+        num_saved++;
+      } else {
+        num_saved_xmm++;
+      }
+    }
+
+    int stack_size = STACK_SHADOW_SPACE + num_saved_xmm * 16;
+    if ((8 + num_saved * 8 + stack_size) % 16) {
+      stack_size += 8;
+    }
+
+    e.align(32);
+
+    backend->call_thunk = e.getCurr();
+
+    for (int i = 0; i < x64_num_registers; i++) {
+      const struct jit_register *r = &x64_registers[i];
+
+      if ((r->flags & JIT_CALLER_SAVED) && r->value_types == VALUE_INT_MASK) {
+        e.push(*reinterpret_cast<const Xbyak::Reg64 *>(r->data));
+      }
+    }
+
+    e.sub(e.rsp, stack_size);
+
+    for (int i = 0, n = 0; i < x64_num_registers; i++) {
+      const struct jit_register *r = &x64_registers[i];
+
+      if ((r->flags & JIT_CALLER_SAVED) && r->value_types != VALUE_INT_MASK) {
+        const Xbyak::Xmm &xmm = *reinterpret_cast<const Xbyak::Xmm *>(r->data);
+        x64_backend_store_xmm(backend, e.rsp + STACK_SHADOW_SPACE + n++ * 16,
+                              xmm, VALUE_V128);
+      }
+    }
+
+    e.call(e.rax);
+
+    for (int i = 0, n = 0; i < x64_num_registers; i++) {
+      const struct jit_register *r = &x64_registers[i];
+
+      if ((r->flags & JIT_CALLER_SAVED) && r->value_types != VALUE_INT_MASK) {
+        const Xbyak::Xmm &xmm = *reinterpret_cast<const Xbyak::Xmm *>(r->data);
+        x64_backend_load_xmm(backend, xmm, e.rsp + STACK_SHADOW_SPACE + n++ * 16,
+                             VALUE_V128);
+      }
+    }
+
+    e.add(e.rsp, stack_size);
+
+    for (int i = x64_num_registers - 1; i >= 0; i--) {
+      const struct jit_register *r = &x64_registers[i];
+
+      if ((r->flags & JIT_CALLER_SAVED) && r->value_types == VALUE_INT_MASK) {
+        e.pop(*reinterpret_cast<const Xbyak::Reg64 *>(r->data));
+      }
+    }
+
+    e.ret();
+  }
+
   {
     for (int i = 0; i < 16; i++) {
       e.align(32);
 
-      backend->load_thunk[i] = e.getCurr<void (*)()>();
+      backend->load_thunk[i] = e.getCurr();
 
       Xbyak::Reg64 dst(i);
-      e.call(e.rax);
+      e.call(backend->call_thunk);
       e.mov(dst, e.rax);
       e.add(e.rsp, STACK_SHADOW_SPACE + 8);
       e.ret();
@@ -431,17 +959,109 @@ static void x64_backend_emit_thunks(struct x64_backend *backend) {
   {
     e.align(32);
 
-    backend->store_thunk = e.getCurr<void (*)()>();
+    backend->store_thunk = e.getCurr();
 
-    e.call(e.rax);
+    e.call(backend->call_thunk);
     e.add(e.rsp, STACK_SHADOW_SPACE + 8);
     e.ret();
   }
 }
 
+static void x64_backend_emit_dispatch(struct x64_backend *backend) {
+  auto &e = *backend->codegen;
+  struct jit_guest *guest = backend->guest;
+
+  // the callee-saved registers used by compiled code are all saved once when
+  // entering the dispatcher, instead of in each block
+#if PLATFORM_WINDOWS
+  const Xbyak::Reg64 saved[] = {e.rbx, e.rbp, e.rdi, e.rsi,
+                                e.r12, e.r13, e.r14, e.r15};
+#else
+  const Xbyak::Reg64 saved[] = {e.rbx, e.rbp, e.r12, e.r13, e.r14, e.r15};
+#endif
+  const int num_saved = (int)array_size(saved);
+
+  // keep the stack 16 byte aligned, accounting for the return address
+  int stack_size = STACK_SIZE;
+  if ((8 + num_saved * 8 + stack_size) % 16) {
+    stack_size += 8;
+  }
+
+  // dispatch_dynamic expects the next guest pc in eax. it ends the run once
+  // the cycles have been exhausted, and otherwise jumps through the code
+  // tables to the block for the pc, or to dispatch_compile if it has yet to be
+  // compiled
+  Xbyak::Label exit;
+  Xbyak::Label interrupt;
+
+  e.align(32);
+  backend->dispatch_dynamic = e.getCurr();
+
+  e.mov(e.dword[e.r14 + guest->offset_pc], e.eax);
+  e.cmp(e.dword[e.r14 + guest->offset_cycles], 0);
+  e.jle(exit, Xbyak::CodeGenerator::T_NEAR);
+  e.cmp(e.qword[e.r14 + guest->offset_interrupts], 0);
+  e.jne(interrupt, Xbyak::CodeGenerator::T_NEAR);
+  e.mov(e.ecx, e.eax);
+  e.shr(e.ecx, guest->code_bits);
+  e.mov(e.rdx, reinterpret_cast<uint64_t>(guest->code));
+  e.mov(e.rdx, e.qword[e.rdx + e.rcx * 8]);
+  e.and_(e.eax, (1 << guest->code_bits) - 1);
+  e.jmp(e.qword[e.rdx + e.rax * 4]);
+
+  // compile the code for the current pc and dispatch to it
+  e.align(32);
+  backend->dispatch_compile = e.getCurr();
+
+  e.mov(arg0, reinterpret_cast<uint64_t>(backend->memory_if->ctx_base));
+  e.mov(e.rax, reinterpret_cast<uint64_t>(guest->compile_code));
+  e.call(e.rax);
+  e.mov(e.eax, e.dword[e.r14 + guest->offset_pc]);
+  e.jmp(backend->dispatch_dynamic);
+
+  // take the pending interrupt, updating the pc to the interrupt's handler
+  e.align(32);
+  e.L(interrupt);
+  backend->dispatch_interrupt = e.getCurr();
+
+  e.mov(arg0, reinterpret_cast<uint64_t>(backend->memory_if->ctx_base));
+  e.mov(e.rax, reinterpret_cast<uint64_t>(guest->interrupt));
+  e.call(e.rax);
+  e.mov(e.eax, e.dword[e.r14 + guest->offset_pc]);
+  e.jmp(backend->dispatch_dynamic);
+
+  // entry point called from C, sets up the stack frame and the guest context
+  // and memory pointers used by all compiled code
+  e.align(32);
+  backend->dispatch_enter = e.getCurr();
+
+  for (int i = 0; i < num_saved; i++) {
+    e.push(saved[i]);
+  }
+  e.sub(e.rsp, stack_size);
+  e.mov(e.r14, reinterpret_cast<uint64_t>(backend->memory_if->ctx_base));
+  e.mov(e.r15, reinterpret_cast<uint64_t>(backend->memory_if->mem_base));
+  e.mov(e.eax, e.dword[e.r14 + guest->offset_pc]);
+  e.jmp(backend->dispatch_dynamic);
+
+  // return to C once the cycles for this run have been exhausted
+  e.align(32);
+  e.L(exit);
+  backend->dispatch_exit = e.getCurr();
+
+  e.add(e.rsp, stack_size);
+  for (int i = num_saved - 1; i >= 0; i--) {
+    e.pop(saved[i]);
+  }
+  e.ret();
+}
+
 static void x64_backend_emit_constants(struct x64_backend *backend) {
   auto &e = *backend->codegen;
 
+  // sse instructions require memory operands to be 16 byte aligned
+  e.align(16);
+
   e.L(backend->xmm_const[XMM_CONST_ABS_MASK_PS]);
   e.dq(INT64_C(0x7fffffff7fffffff));
   e.dq(INT64_C(0x7fffffff7fffffff));
@@ -459,25 +1079,98 @@ static void x64_backend_emit_constants(struct x64_backend *backend) {
   e.dq(INT64_C(0x8000000000000000));
 }
 
+static void x64_backend_region_bounds(struct x64_backend *backend, int region,
+                                      size_t *begin, size_t *cold_begin,
+                                      size_t *stub_begin, size_t *end) {
+  // the last region absorbs any remainder left by the division
+  *begin = backend->region_begin + region * backend->region_size;
+  *end = region == backend->base.num_regions - 1
+             ? backend->code_size
+             : *begin + backend->region_size;
+  *stub_begin = *end - ((*end - *begin) >> X64_STUB_AREA_SHIFT);
+  *cold_begin = *stub_begin - ((*end - *begin) >> X64_COLD_AREA_SHIFT);
+}
+
+static int x64_backend_region_of(struct x64_backend *backend,
+                                 const uint8_t *site) {
+  size_t offset = site - backend->code;
+  CHECK_GE(offset, backend->region_begin);
+  int region = (int)((offset - backend->region_begin) / backend->region_size);
+  return MIN(region, backend->base.num_regions - 1);
+}
+
+static void x64_backend_begin_region(struct jit_backend *base, int region) {
+  struct x64_backend *backend = container_of(base, struct x64_backend, base);
+
+  CHECK(region >= 0 && region < base->num_regions);
+
+  size_t begin, cold_begin, stub_begin, end;
+  x64_backend_region_bounds(backend, region, &begin, &cold_begin, &stub_begin,
+                            &end);
+
+  backend->codegen->set_region(begin, cold_begin);
+  backend->coldgen->set_region(cold_begin, stub_begin);
+
+  // the blocks previously assembled to the region have been evicted, reclaim
+  // the stubs they were calling
+  backend->stub_next[region] = stub_begin;
+}
+
 static void x64_backend_reset(struct jit_backend *base) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
 
   backend->codegen->reset();
+  backend->codegen->set_region(0, backend->code_size);
 
   x64_backend_emit_thunks(backend);
+  x64_backend_emit_dispatch(backend);
   x64_backend_emit_constants(backend);
+
+  // split what's left of the buffer into regions, and start assembling blocks
+  // into the first one. any stubs emitted previously are discarded along with
+  // the blocks calling them
+  backend->region_begin = backend->codegen->getSize();
+  CHECK_LT(backend->region_begin, backend->code_size);
+  backend->region_size =
+      (backend->code_size - backend->region_begin) / base->num_regions;
+
+  for (int i = 0; i < base->num_regions; i++) {
+    size_t begin, cold_begin, stub_begin, end;
+    x64_backend_region_bounds(backend, i, &begin, &cold_begin, &stub_begin,
+                              &end);
+    backend->stub_next[i] = stub_begin;
+  }
+
+  x64_backend_begin_region(base, 0);
+}
+
+static void x64_backend_run_code(struct jit_backend *base) {
+  struct x64_backend *backend = container_of(base, struct x64_backend, base);
+
+  void (*dispatch_enter)() = reinterpret_cast<void (*)()>(
+      x64_backend_exec_addr(backend, backend->dispatch_enter));
+
+  dispatch_enter();
+}
+
+static const uint8_t *x64_backend_compile_thunk(struct jit_backend *base) {
+  struct x64_backend *backend = container_of(base, struct x64_backend, base);
+
+  return x64_backend_exec_addr(backend, backend->dispatch_compile);
 }
 
 static const uint8_t *x64_backend_assemble_code(struct jit_backend *base,
-                                                struct ir *ir, int *size) {
+                                                struct ir *ir, int *size,
+                                                struct jit_exit *exits,
+                                                int *num_exits) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
 
-  // try to generate the x64 code. if the code buffer overflows let the backend
-  // know so it can reset the cache and try again
+  // try to generate the x64 code. if the current region overflows let the
+  // cache know so it can free up a region and try again
   const uint8_t *fn = nullptr;
 
   try {
-    fn = x64_backend_emit(backend, ir, size);
+    fn = x64_backend_emit(backend, ir, size, exits, num_exits);
   } catch (const Xbyak::Error &e) {
     if (e != Xbyak::ERR_CODE_IS_TOO_BIG) {
       LOG_FATAL("X64 codegen failure, %s", e.what());
@@ -487,6 +1180,25 @@ static const uint8_t *x64_backend_assemble_code(struct jit_backend *base,
   return fn;
 }
 
+static void x64_backend_link_code(struct jit_backend *base, uint8_t *branch,
+                                  const uint8_t *dst) {
+  struct x64_backend *backend = container_of(base, struct x64_backend, base);
+
+  // patch the displacement of the jmp rel32 emitted for the exit
+  int64_t disp = dst - (branch + 5);
+  CHECK(disp >= INT32_MIN && disp <= INT32_MAX);
+  uint8_t *site = x64_backend_write_addr(backend, branch);
+  *reinterpret_cast<int32_t *>(site + 1) = static_cast<int32_t>(disp);
+}
+
+static void x64_backend_unlink_code(struct jit_backend *base,
+                                    uint8_t *branch) {
+  // restore the jump back to the dispatcher, through the same cold path the
+  // jne rel32 right before the branch takes
+  int32_t disp = *reinterpret_cast<const int32_t *>(branch - 4);
+  x64_backend_link_code(base, branch, branch + disp);
+}
+
 static void x64_backend_dump_code(struct jit_backend *base,
                                   const uint8_t *host_addr, int size) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
@@ -505,11 +1217,135 @@ static void x64_backend_dump_code(struct jit_backend *base,
   cs_free(insns, count);
 }
 
+static const uint8_t *x64_backend_emit_stub(struct x64_backend *backend,
+                                            int region,
+                                            const struct x64_mov *mov,
+                                            int addr_reg) {
+  auto &e = *backend->stubgen;
+
+  // note, this is called from the exception handler, so it must not allocate
+  // memory or throw. check for space up front instead of relying on xbyak
+  size_t begin, cold_begin, stub_begin, end;
+  x64_backend_region_bounds(backend, region, &begin, &cold_begin, &stub_begin,
+                            &end);
+
+  if (backend->stub_next[region] + X64_MAX_STUB_SIZE > end) {
+    return nullptr;
+  }
+
+  e.set_region(backend->stub_next[region], end);
+
+  const uint8_t *stub = e.getCurr();
+  const Xbyak::Reg64 reg(mov->reg);
+  const Xbyak::Reg32 addr(addr_reg);
+
+  // the stub is called from the block, realign the stack for the return
+  // address before calling out to the memory interface. the argument
+  // registers aren't available to the register allocator, so loading them
+  // won't clobber the access's own registers, and the registers which are
+  // available are preserved by the call thunk
+  e.sub(e.rsp, STACK_SHADOW_SPACE + 8);
+  e.mov(arg0, reinterpret_cast<uint64_t>(backend->memory_if->mem_self));
+  e.mov(arg1.cvt32(), addr);
+
+  void *fn = nullptr;
+
+  if (mov->is_load) {
+    switch (mov->operand_size) {
+      case 1:
+        fn = reinterpret_cast<void *>(backend->memory_if->r8);
+        break;
+      case 2:
+        fn = reinterpret_cast<void *>(backend->memory_if->r16);
+        break;
+      case 4:
+        fn = reinterpret_cast<void *>(backend->memory_if->r32);
+        break;
+      case 8:
+        fn = reinterpret_cast<void *>(backend->memory_if->r64);
+        break;
+    }
+  } else {
+    e.mov(arg2, reg);
+
+    switch (mov->operand_size) {
+      case 1:
+        fn = reinterpret_cast<void *>(backend->memory_if->w8);
+        break;
+      case 2:
+        fn = reinterpret_cast<void *>(backend->memory_if->w16);
+        break;
+      case 4:
+        fn = reinterpret_cast<void *>(backend->memory_if->w32);
+        break;
+      case 8:
+        fn = reinterpret_cast<void *>(backend->memory_if->w64);
+        break;
+    }
+  }
+
+  e.mov(e.rax, reinterpret_cast<uint64_t>(fn));
+  e.call(backend->call_thunk);
+
+  if (mov->is_load) {
+    e.mov(reg, e.rax);
+  }
+
+  e.add(e.rsp, STACK_SHADOW_SPACE + 8);
+  e.ret();
+
+  backend->stub_next[region] = e.getSize();
+
+  return stub;
+}
+
+static bool x64_backend_patch_access(struct x64_backend *backend,
+                                     uint8_t *site, const struct x64_mov *mov) {
+  // only accesses emitted by LOAD_FAST / STORE_FAST, addressing memory with
+  // [guest_addr + r15], are patched
+  if (!mov->has_base || !mov->has_index || mov->has_imm ||
+      (mov->base != Xbyak::Operand::R15 &&
+       mov->index != Xbyak::Operand::R15)) {
+    return false;
+  }
+
+  int addr_reg = mov->base == Xbyak::Operand::R15 ? mov->index : mov->base;
+
+  // include the padding emitted after the access
+  int site_size = mov->length;
+  while (site_size < X64_PATCH_SIZE && site[site_size] == 0x90) {
+    site_size++;
+  }
+
+  if (site_size < X64_PATCH_SIZE) {
+    return false;
+  }
+
+  // emit the stub to the same region as the access, so it's discarded along
+  // with it
+  int region = x64_backend_region_of(backend, site);
+  const uint8_t *stub = x64_backend_emit_stub(backend, region, mov, addr_reg);
+
+  if (!stub) {
+    return false;
+  }
+
+  // overwrite the access with a call rel32 to the stub, filling the rest of
+  // the site with nops
+  int64_t disp = stub - (site + X64_PATCH_SIZE);
+  CHECK(disp >= INT32_MIN && disp <= INT32_MAX);
+  site[0] = 0xe8;
+  *reinterpret_cast<int32_t *>(site + 1) = static_cast<int32_t>(disp);
+  memset(site + X64_PATCH_SIZE, 0x90, site_size - X64_PATCH_SIZE);
+
+  return true;
+}
+
 static bool x64_backend_handle_exception(struct jit_backend *base,
                                          struct exception *ex) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
 
-  const uint8_t *data = reinterpret_cast<const uint8_t *>(ex->thread_state.rip);
+  uint8_t *data = reinterpret_cast<uint8_t *>(ex->thread_state.rip);
 
   // it's assumed a mov has triggered the exception
   struct x64_mov mov;
@@ -517,6 +1353,18 @@ static bool x64_backend_handle_exception(struct jit_backend *base,
     return false;
   }
 
+  // patch the access into a call to a slow path stub. once the exception
+  // handler exits, execution resumes at the same rip, now calling the stub,
+  // and all future executions of the access take the slow path without
+  // faulting
+  if (x64_backend_patch_access(backend, x64_backend_write_addr(backend, data),
+                               &mov)) {
+    return true;
+  }
+
+  // if the access couldn't be patched, service just this one access, it
+  // will fault again the next time it's executed
+
   // figure out the guest address that was being accessed
   const uint8_t *fault_addr = reinterpret_cast<const uint8_t *>(ex->fault_addr);
   const uint8_t *protected_start =
@@ -563,8 +1411,8 @@ static bool x64_backend_handle_exception(struct jit_backend *base,
     }
 
     // resume execution in the thunk once the exception handler exits
-    ex->thread_state.rip =
-        reinterpret_cast<uint64_t>(backend->load_thunk[mov.reg]);
+    ex->thread_state.rip = reinterpret_cast<uint64_t>(
+        x64_backend_exec_addr(backend, backend->load_thunk[mov.reg]));
   } else {
     // prep argument registers (memory object, guest_addr, value) for write
     // function
@@ -594,29 +1442,38 @@ static bool x64_backend_handle_exception(struct jit_backend *base,
     }
 
     // resume execution in the thunk once the exception handler exits
-    ex->thread_state.rip = reinterpret_cast<uint64_t>(backend->store_thunk);
+    ex->thread_state.rip = reinterpret_cast<uint64_t>(
+        x64_backend_exec_addr(backend, backend->store_thunk));
   }
 
   return true;
 }
 
+// address operand of a host access, including the add defining it when it's
+// been folded in
+static Xbyak::RegExp x64_backend_host_addr(struct x64_backend *backend,
+                                           const struct ir_instr *instr) {
+  if (!(instr->tag & X64_SEL_FOLD_ADDR)) {
+    return x64_backend_register(backend, instr->arg[0]);
+  }
+
+  const struct ir_instr *add = instr->arg[0]->def;
+  const Xbyak::Reg a = x64_backend_register(backend, add->arg[0]);
+
+  if (x64_backend_can_encode_imm(add->arg[1])) {
+    return a + x64_backend_lea_disp(add);
+  }
+
+  const Xbyak::Reg b = x64_backend_register(backend, add->arg[1]);
+  return a + b;
+}
+
 EMITTER(LOAD_HOST) {
-  const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
+  const Xbyak::RegExp a = x64_backend_host_addr(backend, instr);
 
   if (ir_is_float(instr->result->type)) {
     const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
-
-    switch (instr->result->type) {
-      case VALUE_F32:
-        e.vmovss(result, e.dword[a]);
-        break;
-      case VALUE_F64:
-        e.vmovsd(result, e.qword[a]);
-        break;
-      default:
-        LOG_FATAL("Unexpected result type");
-        break;
-    }
+    x64_backend_load_xmm(backend, result, a, instr->result->type);
   } else {
     const Xbyak::Reg result = x64_backend_register(backend, instr->result);
 
@@ -641,22 +1498,11 @@ EMITTER(LOAD_HOST) {
 }
 
 EMITTER(STORE_HOST) {
-  const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
+  const Xbyak::RegExp a = x64_backend_host_addr(backend, instr);
 
   if (ir_is_float(instr->arg[1]->type)) {
     const Xbyak::Xmm b = x64_backend_xmm_register(backend, instr->arg[1]);
-
-    switch (instr->arg[1]->type) {
-      case VALUE_F32:
-        e.vmovss(e.dword[a], b);
-        break;
-      case VALUE_F64:
-        e.vmovsd(e.qword[a], b);
-        break;
-      default:
-        LOG_FATAL("Unexpected value type");
-        break;
-    }
+    x64_backend_store_xmm(backend, a, b, instr->arg[1]->type);
   } else {
     const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
 
@@ -680,50 +1526,91 @@ EMITTER(STORE_HOST) {
   }
 }
 
+static void x64_backend_pad_access(struct x64_backend *backend,
+                                   const uint8_t *start) {
+  auto &e = *backend->codegen;
+
+  while (e.getCurr() - start < X64_PATCH_SIZE) {
+    e.nop();
+  }
+}
+
+// register holding the guest address of a fastmem access. when the add
+// defining the address has been folded in, it's computed into eax with a lea.
+// this wraps at 32-bits like the add would, whereas folding it into the
+// access' own displacement could reach past the end of the address space,
+// and leaves the access as [guest_addr + r15] for it to still be patchable
+static Xbyak::Reg64 x64_backend_fast_addr(struct x64_backend *backend,
+                                          const struct ir_instr *instr) {
+  auto &e = *backend->codegen;
+
+  if (!(instr->tag & X64_SEL_FOLD_ADDR)) {
+    return x64_backend_register(backend, instr->arg[0]).cvt64();
+  }
+
+  const struct ir_instr *add = instr->arg[0]->def;
+  const Xbyak::Reg a = x64_backend_register(backend, add->arg[0]);
+
+  if (x64_backend_can_encode_imm(add->arg[1])) {
+    e.lea(e.eax, e.ptr[a.cvt64() + x64_backend_lea_disp(add)]);
+  } else {
+    const Xbyak::Reg b = x64_backend_register(backend, add->arg[1]);
+    e.lea(e.eax, e.ptr[a.cvt64() + b.cvt64()]);
+  }
+
+  return e.rax;
+}
+
 EMITTER(LOAD_FAST) {
   const Xbyak::Reg result = x64_backend_register(backend, instr->result);
-  const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
+  const Xbyak::Reg64 a = x64_backend_fast_addr(backend, instr);
+  const uint8_t *start = e.getCurr();
 
   switch (instr->result->type) {
     case VALUE_I8:
-      e.mov(result, e.byte[a.cvt64() + e.r15]);
+      e.mov(result, e.byte[a + e.r15]);
       break;
     case VALUE_I16:
-      e.mov(result, e.word[a.cvt64() + e.r15]);
+      e.mov(result, e.word[a + e.r15]);
       break;
     case VALUE_I32:
-      e.mov(result, e.dword[a.cvt64() + e.r15]);
+      e.mov(result, e.dword[a + e.r15]);
       break;
     case VALUE_I64:
-      e.mov(result, e.qword[a.cvt64() + e.r15]);
+      e.mov(result, e.qword[a + e.r15]);
       break;
     default:
       LOG_FATAL("Unexpected load result type");
       break;
   }
+
+  x64_backend_pad_access(backend, start);
 }
 
 EMITTER(STORE_FAST) {
-  const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
+  const Xbyak::Reg64 a = x64_backend_fast_addr(backend, instr);
   const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
+  const uint8_t *start = e.getCurr();
 
   switch (instr->arg[1]->type) {
     case VALUE_I8:
-      e.mov(e.byte[a.cvt64() + e.r15], b);
+      e.mov(e.byte[a + e.r15], b);
       break;
     case VALUE_I16:
-      e.mov(e.word[a.cvt64() + e.r15], b);
+      e.mov(e.word[a + e.r15], b);
       break;
     case VALUE_I32:
-      e.mov(e.dword[a.cvt64() + e.r15], b);
+      e.mov(e.dword[a + e.r15], b);
       break;
     case VALUE_I64:
-      e.mov(e.qword[a.cvt64() + e.r15], b);
+      e.mov(e.qword[a + e.r15], b);
       break;
     default:
       LOG_FATAL("Unexpected store value type");
       break;
   }
+
+  x64_backend_pad_access(backend, start);
 }
 
 EMITTER(LOAD_SLOW) {
@@ -749,9 +1636,12 @@ EMITTER(LOAD_SLOW) {
       break;
   }
 
+  // the code is executed from a different mapping than it's assembled to, so
+  // calls out of the code buffer go through a register instead of a rel32
   e.mov(arg0, reinterpret_cast<uint64_t>(backend->memory_if->mem_self));
   e.mov(arg1, a);
-  e.call(reinterpret_cast<void *>(fn));
+  e.mov(e.rax, reinterpret_cast<uint64_t>(fn));
+  e.call(e.rax);
   e.mov(result, e.rax);
 }
 
@@ -781,37 +1671,56 @@ EMITTER(STORE_SLOW) {
   e.mov(arg0, reinterpret_cast<uint64_t>(backend->memory_if->mem_self));
   e.mov(arg1, a);
   e.mov(arg2, b);
-  e.call(reinterpret_cast<void *>(fn));
+  e.mov(e.rax, reinterpret_cast<uint64_t>(fn));
+  e.call(e.rax);
+}
+
+// mmio accesses are specialized from fastmem and slowmem accesses after
+// register allocation, so values in caller saved registers may be live across
+// them. the handler is called through the call thunk to preserve them
+EMITTER(LOAD_MMIO) {
+  const Xbyak::Reg result = x64_backend_register(backend, instr->result);
+
+  e.mov(arg0, instr->arg[1]->i64);
+  e.mov(arg1.cvt32(), instr->arg[2]->i32);
+  e.mov(e.rax, instr->arg[0]->i64);
+  e.call(backend->call_thunk);
+
+  switch (instr->result->type) {
+    case VALUE_I8:
+      e.mov(result, e.al);
+      break;
+    case VALUE_I16:
+      e.mov(result, e.ax);
+      break;
+    case VALUE_I32:
+      e.mov(result, e.eax);
+      break;
+    case VALUE_I64:
+      e.mov(result, e.rax);
+      break;
+    default:
+      LOG_FATAL("Unexpected load result type");
+      break;
+  }
+}
+
+EMITTER(STORE_MMIO) {
+  const Xbyak::Reg b = x64_backend_register(backend, instr->arg[3]);
+
+  e.mov(arg0, instr->arg[1]->i64);
+  e.mov(arg1.cvt32(), instr->arg[2]->i32);
+  e.mov(arg2, b.cvt64());
+  e.mov(e.rax, instr->arg[0]->i64);
+  e.call(backend->call_thunk);
 }
 
 EMITTER(LOAD_CONTEXT) {
   int offset = instr->arg[0]->i32;
 
-  if (ir_is_vector(instr->result->type)) {
-    const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
-
-    switch (instr->result->type) {
-      case VALUE_V128:
-        e.movups(result, e.ptr[e.r14 + offset]);
-        break;
-      default:
-        LOG_FATAL("Unexpected result type");
-        break;
-    }
-  } else if (ir_is_float(instr->result->type)) {
+  if (ir_is_vector(instr->result->type) || ir_is_float(instr->result->type)) {
     const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
-
-    switch (instr->result->type) {
-      case VALUE_F32:
-        e.vmovss(result, e.dword[e.r14 + offset]);
-        break;
-      case VALUE_F64:
-        e.vmovsd(result, e.qword[e.r14 + offset]);
-        break;
-      default:
-        LOG_FATAL("Unexpected result type");
-        break;
-    }
+    x64_backend_load_xmm(backend, result, e.r14 + offset, instr->result->type);
   } else {
     const Xbyak::Reg result = x64_backend_register(backend, instr->result);
 
@@ -852,38 +1761,23 @@ EMITTER(STORE_CONTEXT) {
         break;
       case VALUE_I64:
       case VALUE_F64:
-        e.mov(e.qword[e.r14 + offset], instr->arg[1]->i64);
+        // mov only takes a sign extended 32-bit immediate for a qword
+        if (instr->arg[1]->i64 >= INT32_MIN &&
+            instr->arg[1]->i64 <= INT32_MAX) {
+          e.mov(e.qword[e.r14 + offset], instr->arg[1]->i64);
+        } else {
+          e.mov(e.rax, instr->arg[1]->i64);
+          e.mov(e.qword[e.r14 + offset], e.rax);
+        }
         break;
       default:
         LOG_FATAL("Unexpected value type");
         break;
     }
   } else {
-    if (ir_is_vector(instr->arg[1]->type)) {
-      const Xbyak::Xmm src = x64_backend_xmm_register(backend, instr->arg[1]);
-
-      switch (instr->arg[1]->type) {
-        case VALUE_V128:
-          e.vmovups(e.ptr[e.r14 + offset], src);
-          break;
-        default:
-          LOG_FATAL("Unexpected result type");
-          break;
-      }
-    } else if (ir_is_float(instr->arg[1]->type)) {
+    if (ir_is_vector(instr->arg[1]->type) || ir_is_float(instr->arg[1]->type)) {
       const Xbyak::Xmm src = x64_backend_xmm_register(backend, instr->arg[1]);
-
-      switch (instr->arg[1]->type) {
-        case VALUE_F32:
-          e.vmovss(e.dword[e.r14 + offset], src);
-          break;
-        case VALUE_F64:
-          e.vmovsd(e.qword[e.r14 + offset], src);
-          break;
-        default:
-          LOG_FATAL("Unexpected value type");
-          break;
-      }
+      x64_backend_store_xmm(backend, e.r14 + offset, src, instr->arg[1]->type);
     } else {
       const Xbyak::Reg src = x64_backend_register(backend, instr->arg[1]);
 
@@ -911,31 +1805,9 @@ EMITTER(STORE_CONTEXT) {
 EMITTER(LOAD_LOCAL) {
   int offset = STACK_OFFSET_LOCALS + instr->arg[0]->i32;
 
-  if (ir_is_vector(instr->result->type)) {
+  if (ir_is_vector(instr->result->type) || ir_is_float(instr->result->type)) {
     const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
-
-    switch (instr->result->type) {
-      case VALUE_V128:
-        e.movups(result, e.ptr[e.rsp + offset]);
-        break;
-      default:
-        LOG_FATAL("Unexpected result type");
-        break;
-    }
-  } else if (ir_is_float(instr->result->type)) {
-    const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
-
-    switch (instr->result->type) {
-      case VALUE_F32:
-        e.vmovss(result, e.dword[e.rsp + offset]);
-        break;
-      case VALUE_F64:
-        e.vmovsd(result, e.qword[e.rsp + offset]);
-        break;
-      default:
-        LOG_FATAL("Unexpected result type");
-        break;
-    }
+    x64_backend_load_xmm(backend, result, e.rsp + offset, instr->result->type);
   } else {
     const Xbyak::Reg result = x64_backend_register(backend, instr->result);
 
@@ -964,31 +1836,9 @@ EMITTER(STORE_LOCAL) {
 
   CHECK(!ir_is_constant(instr->arg[1]));
 
-  if (ir_is_vector(instr->arg[1]->type)) {
-    const Xbyak::Xmm src = x64_backend_xmm_register(backend, instr->arg[1]);
-
-    switch (instr->arg[1]->type) {
-      case VALUE_V128:
-        e.vmovups(e.ptr[e.rsp + offset], src);
-        break;
-      default:
-        LOG_FATAL("Unexpected result type");
-        break;
-    }
-  } else if (ir_is_float(instr->arg[1]->type)) {
+  if (ir_is_vector(instr->arg[1]->type) || ir_is_float(instr->arg[1]->type)) {
     const Xbyak::Xmm src = x64_backend_xmm_register(backend, instr->arg[1]);
-
-    switch (instr->arg[1]->type) {
-      case VALUE_F32:
-        e.vmovss(e.dword[e.rsp + offset], src);
-        break;
-      case VALUE_F64:
-        e.vmovsd(e.qword[e.rsp + offset], src);
-        break;
-      default:
-        LOG_FATAL("Unexpected value type");
-        break;
-    }
+    x64_backend_store_xmm(backend, e.rsp + offset, src, instr->arg[1]->type);
   } else {
     const Xbyak::Reg src = x64_backend_register(backend, instr->arg[1]);
 
@@ -1134,76 +1984,45 @@ EMITTER(SELECT) {
   const Xbyak::Reg result = x64_backend_register(backend, instr->result);
   const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
   const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
-  const Xbyak::Reg cond = x64_backend_register(backend, instr->arg[2]);
 
   // convert result to Reg32e to please xbyak
   CHECK_GE(result.getBit(), 32);
   Xbyak::Reg32e result_32e(result.getIdx(), result.getBit());
 
-  e.test(cond, cond);
-  if (result_32e != a) {
-    e.cmovnz(result_32e, a);
-  }
-  e.cmovz(result_32e, b);
-}
-
-EMITTER(CMP) {
-  const Xbyak::Reg result = x64_backend_register(backend, instr->result);
-  const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
-
-  if (x64_backend_can_encode_imm(instr->arg[1])) {
-    e.cmp(a, static_cast<uint32_t>(ir_zext_constant(instr->arg[1])));
-  } else {
-    const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
-    e.cmp(a, b);
-  }
-
-  enum ir_cmp cmp = (enum ir_cmp)instr->arg[2]->i32;
-
-  switch (cmp) {
-    case CMP_EQ:
-      e.sete(result);
-      break;
-
-    case CMP_NE:
-      e.setne(result);
-      break;
-
-    case CMP_SGE:
-      e.setge(result);
-      break;
-
-    case CMP_SGT:
-      e.setg(result);
-      break;
-
-    case CMP_UGE:
-      e.setae(result);
-      break;
-
-    case CMP_UGT:
-      e.seta(result);
-      break;
-
-    case CMP_SLE:
-      e.setle(result);
-      break;
+  enum x64_cond cond = X64_COND_NE;
 
-    case CMP_SLT:
-      e.setl(result);
-      break;
+  if (instr->tag & X64_SEL_FUSE_FLAGS) {
+    cond = x64_backend_cmp_cond(x64_backend_cond_def(instr->arg[2]));
+  } else {
+    const Xbyak::Reg c = x64_backend_register(backend, instr->arg[2]);
+    e.test(c, c);
+  }
 
-    case CMP_ULE:
-      e.setbe(result);
-      break;
+  if (result_32e != a) {
+    (e.*x64_conds[cond].cmovcc)(result_32e, a);
+  }
+  if (result_32e != b) {
+    (e.*x64_conds[x64_backend_negate_cond(cond)].cmovcc)(result_32e, b);
+  }
+}
 
-    case CMP_ULT:
-      e.setb(result);
-      break;
+EMITTER(CMP) {
+  const Xbyak::Reg result = x64_backend_register(backend, instr->result);
+  const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
 
-    default:
-      LOG_FATAL("Unexpected comparison type");
+  if (x64_backend_can_encode_imm(instr->arg[1])) {
+    e.cmp(a, static_cast<uint32_t>(ir_zext_constant(instr->arg[1])));
+  } else {
+    const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
+    e.cmp(a, b);
+  }
+
+  if (instr->tag & X64_SEL_NO_RESULT) {
+    return;
   }
+
+  enum x64_cond cond = x64_backend_cmp_cond(instr);
+  (e.*x64_conds[cond].setcc)(result);
 }
 
 EMITTER(FCMP) {
@@ -1217,42 +2036,31 @@ EMITTER(FCMP) {
     e.comisd(a, b);
   }
 
-  enum ir_cmp cmp = (enum ir_cmp)instr->arg[2]->i32;
-
-  switch (cmp) {
-    case CMP_EQ:
-      e.sete(result);
-      break;
-
-    case CMP_NE:
-      e.setne(result);
-      break;
-
-    case CMP_SGE:
-      e.setae(result);
-      break;
-
-    case CMP_SGT:
-      e.seta(result);
-      break;
-
-    case CMP_SLE:
-      e.setbe(result);
-      break;
-
-    case CMP_SLT:
-      e.setb(result);
-      break;
-
-    default:
-      LOG_FATAL("Unexpected comparison type");
+  if (instr->tag & X64_SEL_NO_RESULT) {
+    return;
   }
+
+  enum x64_cond cond = x64_backend_cmp_cond(instr);
+  (e.*x64_conds[cond].setcc)(result);
 }
 
 EMITTER(ADD) {
   const Xbyak::Reg result = x64_backend_register(backend, instr->result);
   const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
 
+  // a lea saves copying a to the result first, and is required to leave the
+  // flags intact
+  if ((result != a || (instr->tag & X64_SEL_KEEP_FLAGS)) &&
+      x64_backend_can_lea(instr)) {
+    if (ir_is_constant(instr->arg[1])) {
+      e.lea(result, e.ptr[a.cvt64() + x64_backend_lea_disp(instr)]);
+    } else {
+      const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
+      e.lea(result, e.ptr[a.cvt64() + b.cvt64()]);
+    }
+    return;
+  }
+
   if (result != a) {
     e.mov(result, a);
   }
@@ -1269,6 +2077,12 @@ EMITTER(SUB) {
   const Xbyak::Reg result = x64_backend_register(backend, instr->result);
   const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
 
+  if ((result != a || (instr->tag & X64_SEL_KEEP_FLAGS)) &&
+      x64_backend_can_lea(instr)) {
+    e.lea(result, e.ptr[a.cvt64() + x64_backend_lea_disp(instr)]);
+    return;
+  }
+
   if (result != a) {
     e.mov(result, a);
   }
@@ -1332,10 +2146,20 @@ EMITTER(FADD) {
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
   const Xbyak::Xmm b = x64_backend_xmm_register(backend, instr->arg[1]);
 
-  if (instr->result->type == VALUE_F32) {
-    e.vaddss(result, a, b);
+  if (backend->features & X64_AVX) {
+    if (instr->result->type == VALUE_F32) {
+      e.vaddss(result, a, b);
+    } else {
+      e.vaddsd(result, a, b);
+    }
   } else {
-    e.vaddsd(result, a, b);
+    x64_backend_copy_xmm(backend, result, a);
+
+    if (instr->result->type == VALUE_F32) {
+      e.addss(result, b);
+    } else {
+      e.addsd(result, b);
+    }
   }
 }
 
@@ -1344,10 +2168,20 @@ EMITTER(FSUB) {
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
   const Xbyak::Xmm b = x64_backend_xmm_register(backend, instr->arg[1]);
 
-  if (instr->result->type == VALUE_F32) {
-    e.vsubss(result, a, b);
+  if (backend->features & X64_AVX) {
+    if (instr->result->type == VALUE_F32) {
+      e.vsubss(result, a, b);
+    } else {
+      e.vsubsd(result, a, b);
+    }
   } else {
-    e.vsubsd(result, a, b);
+    x64_backend_copy_xmm(backend, result, a);
+
+    if (instr->result->type == VALUE_F32) {
+      e.subss(result, b);
+    } else {
+      e.subsd(result, b);
+    }
   }
 }
 
@@ -1356,10 +2190,88 @@ EMITTER(FMUL) {
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
   const Xbyak::Xmm b = x64_backend_xmm_register(backend, instr->arg[1]);
 
-  if (instr->result->type == VALUE_F32) {
-    e.vmulss(result, a, b);
+  if (backend->features & X64_AVX) {
+    if (instr->result->type == VALUE_F32) {
+      e.vmulss(result, a, b);
+    } else {
+      e.vmulsd(result, a, b);
+    }
+  } else {
+    x64_backend_copy_xmm(backend, result, a);
+
+    if (instr->result->type == VALUE_F32) {
+      e.mulss(result, b);
+    } else {
+      e.mulsd(result, b);
+    }
+  }
+}
+
+typedef void (Xbyak::CodeGenerator::*x64_fmadd)(const Xbyak::Xmm &,
+                                               const Xbyak::Xmm &,
+                                               const Xbyak::Operand &);
+
+// compute result = a * b + c with a single vfmadd. each form overwrites one of
+// its operands, so pick the one which overwrites the operand already sharing
+// the result's register
+static void x64_backend_fmadd(struct x64_backend *backend, x64_fmadd fmadd213,
+                              x64_fmadd fmadd231, const Xbyak::Xmm &result,
+                              const Xbyak::Xmm &a, const Xbyak::Xmm &b,
+                              const Xbyak::Xmm &c) {
+  auto &e = *backend->codegen;
+
+  if (result == c) {
+    (e.*fmadd231)(result, a, b);
+  } else if (result == a) {
+    (e.*fmadd213)(result, b, c);
+  } else if (result == b) {
+    (e.*fmadd213)(result, a, c);
+  } else {
+    e.vmovaps(result, c);
+    (e.*fmadd231)(result, a, b);
+  }
+}
+
+EMITTER(FMADD) {
+  const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
+  const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
+  const Xbyak::Xmm b = x64_backend_xmm_register(backend, instr->arg[1]);
+  const Xbyak::Xmm c = x64_backend_xmm_register(backend, instr->arg[2]);
+
+  if (backend->features & X64_FMA) {
+    if (instr->result->type == VALUE_F32) {
+      x64_backend_fmadd(backend, &Xbyak::CodeGenerator::vfmadd213ss,
+                        &Xbyak::CodeGenerator::vfmadd231ss, result, a, b, c);
+    } else {
+      x64_backend_fmadd(backend, &Xbyak::CodeGenerator::vfmadd213sd,
+                        &Xbyak::CodeGenerator::vfmadd231sd, result, a, b, c);
+    }
+    return;
+  }
+
+  // without fma, fall back to a separately rounded multiply and add. the
+  // operands of a fused multiply-add are never constant, so xmm1 is free to
+  // hold the product
+  if (backend->features & X64_AVX) {
+    if (instr->result->type == VALUE_F32) {
+      e.vmulss(e.xmm1, a, b);
+      e.vaddss(result, e.xmm1, c);
+    } else {
+      e.vmulsd(e.xmm1, a, b);
+      e.vaddsd(result, e.xmm1, c);
+    }
   } else {
-    e.vmulsd(result, a, b);
+    e.movaps(e.xmm1, a);
+
+    if (instr->result->type == VALUE_F32) {
+      e.mulss(e.xmm1, b);
+      e.addss(e.xmm1, c);
+    } else {
+      e.mulsd(e.xmm1, b);
+      e.addsd(e.xmm1, c);
+    }
+
+    e.movaps(result, e.xmm1);
   }
 }
 
@@ -1368,10 +2280,20 @@ EMITTER(FDIV) {
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
   const Xbyak::Xmm b = x64_backend_xmm_register(backend, instr->arg[1]);
 
-  if (instr->result->type == VALUE_F32) {
-    e.vdivss(result, a, b);
+  if (backend->features & X64_AVX) {
+    if (instr->result->type == VALUE_F32) {
+      e.vdivss(result, a, b);
+    } else {
+      e.vdivsd(result, a, b);
+    }
   } else {
-    e.vdivsd(result, a, b);
+    x64_backend_copy_xmm(backend, result, a);
+
+    if (instr->result->type == VALUE_F32) {
+      e.divss(result, b);
+    } else {
+      e.divsd(result, b);
+    }
   }
 }
 
@@ -1379,12 +2301,22 @@ EMITTER(FNEG) {
   const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
 
-  if (instr->result->type == VALUE_F32) {
-    e.vxorps(result, a,
-             x64_backend_xmm_constant(backend, XMM_CONST_SIGN_MASK_PS));
+  if (backend->features & X64_AVX) {
+    if (instr->result->type == VALUE_F32) {
+      e.vxorps(result, a,
+               x64_backend_xmm_constant(backend, XMM_CONST_SIGN_MASK_PS));
+    } else {
+      e.vxorpd(result, a,
+               x64_backend_xmm_constant(backend, XMM_CONST_SIGN_MASK_PD));
+    }
   } else {
-    e.vxorpd(result, a,
-             x64_backend_xmm_constant(backend, XMM_CONST_SIGN_MASK_PD));
+    x64_backend_copy_xmm(backend, result, a);
+
+    if (instr->result->type == VALUE_F32) {
+      e.xorps(result, x64_backend_xmm_constant(backend, XMM_CONST_SIGN_MASK_PS));
+    } else {
+      e.xorpd(result, x64_backend_xmm_constant(backend, XMM_CONST_SIGN_MASK_PD));
+    }
   }
 }
 
@@ -1392,12 +2324,22 @@ EMITTER(FABS) {
   const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
 
-  if (instr->result->type == VALUE_F32) {
-    e.vandps(result, a,
-             x64_backend_xmm_constant(backend, XMM_CONST_ABS_MASK_PS));
+  if (backend->features & X64_AVX) {
+    if (instr->result->type == VALUE_F32) {
+      e.vandps(result, a,
+               x64_backend_xmm_constant(backend, XMM_CONST_ABS_MASK_PS));
+    } else {
+      e.vandpd(result, a,
+               x64_backend_xmm_constant(backend, XMM_CONST_ABS_MASK_PD));
+    }
   } else {
-    e.vandpd(result, a,
-             x64_backend_xmm_constant(backend, XMM_CONST_ABS_MASK_PD));
+    x64_backend_copy_xmm(backend, result, a);
+
+    if (instr->result->type == VALUE_F32) {
+      e.andps(result, x64_backend_xmm_constant(backend, XMM_CONST_ABS_MASK_PS));
+    } else {
+      e.andpd(result, x64_backend_xmm_constant(backend, XMM_CONST_ABS_MASK_PD));
+    }
   }
 }
 
@@ -1405,10 +2347,18 @@ EMITTER(SQRT) {
   const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
 
-  if (instr->result->type == VALUE_F32) {
-    e.vsqrtss(result, a);
+  if (backend->features & X64_AVX) {
+    if (instr->result->type == VALUE_F32) {
+      e.vsqrtss(result, a);
+    } else {
+      e.vsqrtsd(result, a);
+    }
   } else {
-    e.vsqrtsd(result, a);
+    if (instr->result->type == VALUE_F32) {
+      e.sqrtss(result, a);
+    } else {
+      e.sqrtsd(result, a);
+    }
   }
 }
 
@@ -1416,7 +2366,15 @@ EMITTER(VBROADCAST) {
   const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
 
-  e.vbroadcastss(result, a);
+  // the register source form of vbroadcastss was only added with avx2
+  if (backend->features & X64_AVX2) {
+    e.vbroadcastss(result, a);
+  } else if (backend->features & X64_AVX) {
+    e.vpermilps(result, a, 0);
+  } else {
+    x64_backend_copy_xmm(backend, result, a);
+    e.shufps(result, result, 0);
+  }
 }
 
 EMITTER(VADD) {
@@ -1424,7 +2382,12 @@ EMITTER(VADD) {
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
   const Xbyak::Xmm b = x64_backend_xmm_register(backend, instr->arg[1]);
 
-  e.vaddps(result, a, b);
+  if (backend->features & X64_AVX) {
+    e.vaddps(result, a, b);
+  } else {
+    x64_backend_copy_xmm(backend, result, a);
+    e.addps(result, b);
+  }
 }
 
 EMITTER(VDOT) {
@@ -1432,7 +2395,24 @@ EMITTER(VDOT) {
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
   const Xbyak::Xmm b = x64_backend_xmm_register(backend, instr->arg[1]);
 
-  e.vdpps(result, a, b, 0b11110001);
+  if (backend->features & X64_AVX) {
+    e.vdpps(result, a, b, 0b11110001);
+  } else if (backend->features & X64_SSE41) {
+    x64_backend_copy_xmm(backend, result, a);
+    e.dpps(result, b, 0b11110001);
+  } else {
+    // multiply, and then sum the products in the same order as dpps, adding
+    // the pairs (0, 1) and (2, 3) before adding the two sums together. note,
+    // vectors are never constant, so xmm1 is free to use as a temporary
+    x64_backend_copy_xmm(backend, result, a);
+    e.mulps(result, b);
+    e.movaps(e.xmm1, result);
+    e.shufps(e.xmm1, e.xmm1, 0b10110001);
+    e.addps(result, e.xmm1);
+    e.movaps(e.xmm1, result);
+    e.shufps(e.xmm1, e.xmm1, 0b01001110);
+    e.addss(result, e.xmm1);
+  }
 }
 
 EMITTER(VMUL) {
@@ -1440,7 +2420,32 @@ EMITTER(VMUL) {
   const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
   const Xbyak::Xmm b = x64_backend_xmm_register(backend, instr->arg[1]);
 
-  e.vmulps(result, a, b);
+  if (backend->features & X64_AVX) {
+    e.vmulps(result, a, b);
+  } else {
+    x64_backend_copy_xmm(backend, result, a);
+    e.mulps(result, b);
+  }
+}
+
+EMITTER(VFMADD) {
+  const Xbyak::Xmm result = x64_backend_xmm_register(backend, instr->result);
+  const Xbyak::Xmm a = x64_backend_xmm_register(backend, instr->arg[0]);
+  const Xbyak::Xmm b = x64_backend_xmm_register(backend, instr->arg[1]);
+  const Xbyak::Xmm c = x64_backend_xmm_register(backend, instr->arg[2]);
+
+  if (backend->features & X64_FMA) {
+    x64_backend_fmadd(backend, &Xbyak::CodeGenerator::vfmadd213ps,
+                      &Xbyak::CodeGenerator::vfmadd231ps, result, a, b, c);
+  } else if (backend->features & X64_AVX) {
+    e.vmulps(e.xmm1, a, b);
+    e.vaddps(result, e.xmm1, c);
+  } else {
+    e.movaps(e.xmm1, a);
+    e.mulps(e.xmm1, b);
+    e.addps(e.xmm1, c);
+    e.movaps(result, e.xmm1);
+  }
 }
 
 EMITTER(AND) {
@@ -1502,6 +2507,25 @@ EMITTER(NOT) {
   e.not_(result);
 }
 
+typedef void (Xbyak::CodeGenerator::*x64_shiftx)(const Xbyak::Reg32e &,
+                                                const Xbyak::Operand &,
+                                                const Xbyak::Reg32e &);
+
+// shift result in place by the count in n with a bmi2 shlx / sarx / shrx.
+// unlike the legacy shifts, the count can be in any register, not just cl.
+// like them, only the low bits of the count are used, so it's read at the
+// width of the result regardless of its own type
+static void x64_backend_shift_bmi2(struct x64_backend *backend, x64_shiftx op,
+                                   const Xbyak::Reg &result,
+                                   const Xbyak::Reg &n) {
+  auto &e = *backend->codegen;
+
+  Xbyak::Reg32e dst(result.getIdx(), result.getBit());
+  Xbyak::Reg32e count(n.getIdx(), result.getBit());
+
+  (e.*op)(dst, dst, count);
+}
+
 EMITTER(SHL) {
   const Xbyak::Reg result = x64_backend_register(backend, instr->result);
   const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
@@ -1512,6 +2536,9 @@ EMITTER(SHL) {
 
   if (x64_backend_can_encode_imm(instr->arg[1])) {
     e.shl(result, (int)ir_zext_constant(instr->arg[1]));
+  } else if ((backend->features & X64_BMI2) && result.getBit() >= 32) {
+    const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
+    x64_backend_shift_bmi2(backend, &Xbyak::CodeGenerator::shlx, result, b);
   } else {
     const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
     e.mov(e.cl, b);
@@ -1529,6 +2556,9 @@ EMITTER(ASHR) {
 
   if (x64_backend_can_encode_imm(instr->arg[1])) {
     e.sar(result, (int)ir_zext_constant(instr->arg[1]));
+  } else if ((backend->features & X64_BMI2) && result.getBit() >= 32) {
+    const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
+    x64_backend_shift_bmi2(backend, &Xbyak::CodeGenerator::sarx, result, b);
   } else {
     const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
     e.mov(e.cl, b);
@@ -1546,6 +2576,9 @@ EMITTER(LSHR) {
 
   if (x64_backend_can_encode_imm(instr->arg[1])) {
     e.shr(result, (int)ir_zext_constant(instr->arg[1]));
+  } else if ((backend->features & X64_BMI2) && result.getBit() >= 32) {
+    const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
+    x64_backend_shift_bmi2(backend, &Xbyak::CodeGenerator::shrx, result, b);
   } else {
     const Xbyak::Reg b = x64_backend_register(backend, instr->arg[1]);
     e.mov(e.cl, b);
@@ -1553,11 +2586,60 @@ EMITTER(LSHR) {
   }
 }
 
+// bmi2 version of ASHD, shifting straight from v into result with the
+// count in any register. the count is only copied for right shifts, which
+// need it negated
+static void x64_backend_emit_ashd_bmi2(struct x64_backend *backend,
+                                       const Xbyak::Reg &result,
+                                       const Xbyak::Reg &v,
+                                       const Xbyak::Reg &n) {
+  auto &e = *backend->codegen;
+
+  Xbyak::Reg32e dst(result.getIdx(), result.getBit());
+  Xbyak::Reg32e src(v.getIdx(), v.getBit());
+
+  e.inLocalLabel();
+
+  // check if we're shifting left or right
+  e.test(n, 0x80000000);
+  e.jnz(".shr");
+
+  // perform shift left
+  e.shlx(dst, src, Xbyak::Reg32e(n.getIdx(), result.getBit()));
+  e.jmp(".end");
+
+  // perform right shift
+  e.L(".shr");
+  e.test(n, 0x1f);
+  e.jz(".shr_overflow");
+  e.mov(e.eax, n);
+  e.neg(e.eax);
+  e.sarx(dst, src, e.eax);
+  e.jmp(".end");
+
+  // right shift overflowed
+  e.L(".shr_overflow");
+  if (result != v) {
+    e.mov(result, v);
+  }
+  e.sar(result, 31);
+
+  // shift is done
+  e.L(".end");
+
+  e.outLocalLabel();
+}
+
 EMITTER(ASHD) {
   const Xbyak::Reg result = x64_backend_register(backend, instr->result);
   const Xbyak::Reg v = x64_backend_register(backend, instr->arg[0]);
   const Xbyak::Reg n = x64_backend_register(backend, instr->arg[1]);
 
+  if (backend->features & X64_BMI2) {
+    x64_backend_emit_ashd_bmi2(backend, result, v, n);
+    return;
+  }
+
   e.inLocalLabel();
 
   if (result != v) {
@@ -1592,11 +2674,60 @@ EMITTER(ASHD) {
   e.outLocalLabel();
 }
 
+// bmi2 version of LSHD, shifting straight from v into result with the
+// count in any register. the count is only copied for right shifts, which
+// need it negated
+static void x64_backend_emit_lshd_bmi2(struct x64_backend *backend,
+                                       const Xbyak::Reg &result,
+                                       const Xbyak::Reg &v,
+                                       const Xbyak::Reg &n) {
+  auto &e = *backend->codegen;
+
+  Xbyak::Reg32e dst(result.getIdx(), result.getBit());
+  Xbyak::Reg32e src(v.getIdx(), v.getBit());
+
+  e.inLocalLabel();
+
+  // check if we're shifting left or right
+  e.test(n, 0x80000000);
+  e.jnz(".shr");
+
+  // perform shift left
+  e.shlx(dst, src, Xbyak::Reg32e(n.getIdx(), result.getBit()));
+  e.jmp(".end");
+
+  // perform right shift
+  e.L(".shr");
+  e.test(n, 0x1f);
+  e.jz(".shr_overflow");
+  e.mov(e.eax, n);
+  e.neg(e.eax);
+  e.shrx(dst, src, e.eax);
+  e.jmp(".end");
+
+  // right shift overflowed
+  e.L(".shr_overflow");
+  if (result != v) {
+    e.mov(result, v);
+  }
+  e.mov(result, 0x0);
+
+  // shift is done
+  e.L(".end");
+
+  e.outLocalLabel();
+}
+
 EMITTER(LSHD) {
   const Xbyak::Reg result = x64_backend_register(backend, instr->result);
   const Xbyak::Reg v = x64_backend_register(backend, instr->arg[0]);
   const Xbyak::Reg n = x64_backend_register(backend, instr->arg[1]);
 
+  if (backend->features & X64_BMI2) {
+    x64_backend_emit_lshd_bmi2(backend, result, v, n);
+    return;
+  }
+
   e.inLocalLabel();
 
   if (result != v) {
@@ -1632,19 +2763,45 @@ EMITTER(LSHD) {
 }
 
 EMITTER(BRANCH) {
+  if (ir_is_constant(instr->arg[0])) {
+    x64_backend_emit_static_exit(backend, instr->arg[0]->i32);
+    return;
+  }
+
   const Xbyak::Reg a = x64_backend_register(backend, instr->arg[0]);
 
   e.mov(e.rax, a);
+  e.jmp(backend->dispatch_dynamic);
 }
 
 EMITTER(BRANCH_COND) {
-  const Xbyak::Reg cond = x64_backend_register(backend, instr->arg[0]);
+  enum x64_cond cond = X64_COND_NE;
+
+  if (instr->tag & X64_SEL_FUSE_FLAGS) {
+    cond = x64_backend_cmp_cond(x64_backend_cond_def(instr->arg[0]));
+  } else {
+    const Xbyak::Reg c = x64_backend_register(backend, instr->arg[0]);
+    e.test(c, c);
+  }
+
+  enum x64_cond false_cond = x64_backend_negate_cond(cond);
+
+  if (ir_is_constant(instr->arg[1]) && ir_is_constant(instr->arg[2])) {
+    Xbyak::Label false_exit;
+
+    (e.*x64_conds[false_cond].jcc)(false_exit, Xbyak::CodeGenerator::T_AUTO);
+    x64_backend_emit_static_exit(backend, instr->arg[1]->i32);
+    e.L(false_exit);
+    x64_backend_emit_static_exit(backend, instr->arg[2]->i32);
+    return;
+  }
+
   const Xbyak::Reg true_addr = x64_backend_register(backend, instr->arg[1]);
   const Xbyak::Reg false_addr = x64_backend_register(backend, instr->arg[2]);
 
-  e.test(cond, cond);
-  e.cmovnz(e.eax, true_addr);
-  e.cmove(e.eax, false_addr);
+  (e.*x64_conds[cond].cmovcc)(e.eax, true_addr);
+  (e.*x64_conds[false_cond].cmovcc)(e.eax, false_addr);
+  e.jmp(backend->dispatch_dynamic);
 }
 
 EMITTER(CALL_EXTERNAL) {
@@ -1659,32 +2816,120 @@ EMITTER(CALL_EXTERNAL) {
   e.call(e.rax);
 }
 
-struct jit_backend *x64_backend_create(struct jit_memory_interface *memory_if) {
+EMITTER(SOURCE_INFO) {}
+
+static int x64_backend_detect_features() {
+  Xbyak::util::Cpu cpu;
+  int features = 0;
+
+  if (cpu.has(Xbyak::util::Cpu::tSSE41)) {
+    features |= X64_SSE41;
+  }
+  if (cpu.has(Xbyak::util::Cpu::tAVX)) {
+    features |= X64_AVX;
+  }
+  if (cpu.has(Xbyak::util::Cpu::tAVX2)) {
+    features |= X64_AVX2;
+  }
+  if (cpu.has(Xbyak::util::Cpu::tBMI2)) {
+    features |= X64_BMI2;
+  }
+  // fma is vex encoded, and needs the same os support as avx
+  if (cpu.has(Xbyak::util::Cpu::tAVX) && cpu.has(Xbyak::util::Cpu::tFMA)) {
+    features |= X64_FMA;
+  }
+
+  return features;
+}
+
+static void x64_backend_init_features(struct x64_backend *backend,
+                                      const char *isa) {
+  int detected = x64_backend_detect_features();
+  int allowed = -1;
+
+  if (strcmp(isa, "auto")) {
+    int i = 0;
+    int num_tiers = (int)array_size(x64_tiers);
+
+    while (i < num_tiers && strcmp(x64_tiers[i].name, isa)) {
+      i++;
+    }
+
+    if (i < num_tiers) {
+      allowed = x64_tiers[i].features;
+
+      if ((allowed & detected) != allowed) {
+        LOG_WARNING("Host doesn't support all of the %s tier", isa);
+      }
+    } else {
+      LOG_WARNING("Unknown instruction set tier %s", isa);
+    }
+  }
+
+  backend->features = detected & allowed;
+
+  // report the highest tier which is fully supported
+  const char *tier = x64_tiers[0].name;
+
+  for (int i = 0; i < (int)array_size(x64_tiers); i++) {
+    if ((x64_tiers[i].features & backend->features) == x64_tiers[i].features) {
+      tier = x64_tiers[i].name;
+    }
+  }
+
+  LOG_INFO("x64 backend using the %s tier%s", tier,
+           (backend->features & X64_BMI2) ? " with bmi2" : "");
+}
+
+struct jit_backend *x64_backend_create(struct jit_memory_interface *memory_if,
+                                       struct jit_guest *guest, int code_size,
+                                       int num_regions, const char *isa) {
   struct x64_backend *backend = reinterpret_cast<struct x64_backend *>(
       calloc(1, sizeof(struct x64_backend)));
 
   backend->base.registers = x64_registers;
   backend->base.num_registers = array_size(x64_registers);
+  backend->base.num_regions = num_regions;
   backend->base.reset = &x64_backend_reset;
+  backend->base.begin_region = &x64_backend_begin_region;
   backend->base.assemble_code = &x64_backend_assemble_code;
+  backend->base.link_code = &x64_backend_link_code;
+  backend->base.unlink_code = &x64_backend_unlink_code;
+  backend->base.run_code = &x64_backend_run_code;
+  backend->base.compile_thunk = &x64_backend_compile_thunk;
   backend->base.dump_code = &x64_backend_dump_code;
   backend->base.handle_exception = &x64_backend_handle_exception;
 
   backend->memory_if = memory_if;
+  backend->guest = guest;
+
+  CHECK_GT(num_regions, 0);
+
+  x64_backend_init_features(backend, isa);
 
-  backend->codegen = new Xbyak::CodeGenerator(x64_code_size, x64_code);
+  // map the code buffer once for writing and once for executing
+  backend->code_size = align_up(code_size, (int)get_allocation_granularity());
+  backend->code_shmem = create_shared_memory(
+      "/redream_code", backend->code_size, ACC_READWRITEEXEC);
+  CHECK_NE(backend->code_shmem, SHMEM_INVALID);
+
+  backend->code = reinterpret_cast<uint8_t *>(map_shared_memory(
+      backend->code_shmem, 0, NULL, backend->code_size, ACC_READWRITE));
+  CHECK_NOTNULL(backend->code);
+
+  backend->exec_code = reinterpret_cast<const uint8_t *>(map_shared_memory(
+      backend->code_shmem, 0, NULL, backend->code_size, ACC_READEXEC));
+  CHECK_NOTNULL(backend->exec_code);
+
+  backend->codegen = new x64_codegen(backend->code_size, backend->code);
+  backend->stubgen = new x64_codegen(backend->code_size, backend->code);
+  backend->coldgen = new x64_codegen(backend->code_size, backend->code);
+  backend->stub_next =
+      reinterpret_cast<size_t *>(calloc(num_regions, sizeof(size_t)));
 
   int res = cs_open(CS_ARCH_X86, CS_MODE_64, &backend->capstone_handle);
   CHECK_EQ(res, CS_ERR_OK);
 
-  // make the code buffer executable
-  int page_size = (int)get_page_size();
-  void *aligned_code = (void *)align_down((intptr_t)x64_code, page_size);
-  int aligned_code_size = align_up(x64_code_size, page_size);
-  bool success =
-      protect_pages(aligned_code, aligned_code_size, ACC_READWRITEEXEC);
-  CHECK(success);
-
   // do an initial reset to emit constants and thinks
   x64_backend_reset((jit_backend *)backend);
 
@@ -1697,6 +2942,15 @@ void x64_backend_destroy(struct jit_backend *jit_backend) {
   cs_close(&backend->capstone_handle);
 
   delete backend->codegen;
+  delete backend->stubgen;
+  delete backend->coldgen;
+  free(backend->stub_next);
+
+  unmap_shared_memory(backend->code_shmem,
+                      const_cast<uint8_t *>(backend->exec_code),
+                      backend->code_size);
+  unmap_shared_memory(backend->code_shmem, backend->code, backend->code_size);
+  destroy_shared_memory(backend->code_shmem);
 
   free(backend);
 }
@@ -6,7 +6,9 @@
 extern const struct jit_register x64_registers[];
 extern const int x64_num_registers;
 
-struct jit_backend *x64_backend_create(struct jit_memory_interface *memory_if);
+struct jit_backend *x64_backend_create(struct jit_memory_interface *memory_if,
+                                       struct jit_guest *guest, int code_size,
+                                       int num_regions, const char *isa);
 void x64_backend_destroy(struct jit_backend *b);
 
 #endif
@@ -7,8 +7,14 @@ struct ir;
 struct jit_frontend;
 
 struct jit_frontend {
+  // finds the extent of the block starting at guest_addr. size covers all of
+  // the guest memory the block depends on, while code_size only covers the
+  // code to be translated, excluding any data read from past its end
+  void (*analyze_code)(struct jit_frontend *base, uint32_t guest_addr,
+                       uint8_t *guest_ptr, int flags, int *size,
+                       int *code_size);
   void (*translate_code)(struct jit_frontend *base, uint32_t guest_addr,
-                         uint8_t *guest_ptr, int flags, int *size,
+                         uint8_t *guest_ptr, int code_size, int flags,
                          struct ir *ir);
   void (*dump_code)(struct jit_frontend *base, uint32_t guest_addr,
                     uint8_t *guest_ptr, int size);
@@ -1,24 +1,127 @@
 #include "jit/frontend/sh4/sh4_analyze.h"
+#include "core/math.h"
 #include "jit/frontend/sh4/sh4_disasm.h"
 
+DEFINE_OPTION_INT(superblock_instrs, 0,
+                  "Maximum number of instructions in a block formed by "
+                  "following static branches, 0 to disable");
+
+bool sh4_analyze_merge_branch(uint32_t block_addr, uint32_t end_addr,
+                              const struct sh4_instr *instr,
+                              const struct sh4_instr *delay, int flags,
+                              int num_instrs, uint32_t *dest_addr) {
+  if ((flags & SH4_SINGLE_INSTR) || num_instrs >= OPTION_superblock_instrs) {
+    return false;
+  }
+
+  // only unconditional branches and calls with a static destination can be
+  // followed
+  if (instr->op != SH4_OP_BRA && instr->op != SH4_OP_BSR) {
+    return false;
+  }
+
+  // the delay slot is emitted before the destination's code, so it must not
+  // end the block itself
+  if (delay->op == SH4_OP_INVALID ||
+      (delay->flags & (SH4_FLAG_SET_FPSCR | SH4_FLAG_SET_SR))) {
+    return false;
+  }
+
+  // 12-bit displacement must be sign extended
+  int32_t disp = ((instr->disp & 0xfff) << 20) >> 20;
+  uint32_t dest = (disp * 2) + instr->addr + 4;
+
+  // only follow branches forward past the code already in the block, keeping
+  // the block a single range of guest memory which can't loop back on itself.
+  // in addition, don't follow branches off of the block's page, which may not
+  // be mapped contiguously
+  if (dest < end_addr || (dest >> SH4_SUPERBLOCK_PAGE_BITS) !=
+                             (block_addr >> SH4_SUPERBLOCK_PAGE_BITS)) {
+    return false;
+  }
+
+  *dest_addr = dest;
+  return true;
+}
+
+bool sh4_analyze_literal(uint32_t block_addr, const struct sh4_instr *instr,
+                         uint32_t *lit_addr, int *lit_size) {
+  uint32_t addr;
+  int size;
+
+  if (instr->op == SH4_OP_MOVWLPC) {
+    addr = (instr->disp * 2) + instr->addr + 4;
+    size = 2;
+  } else if (instr->op == SH4_OP_MOVLLPC) {
+    addr = (instr->disp * 4) + (instr->addr & ~3) + 4;
+    size = 4;
+  } else {
+    return false;
+  }
+
+  // pc-relative loads read from the literal pool following the code. the
+  // literal can be folded into a constant when it's on the same page as the
+  // block, where it's covered by the block's write watch once the block's
+  // range is extended to include it
+  if ((addr >> SH4_SUPERBLOCK_PAGE_BITS) !=
+      (block_addr >> SH4_SUPERBLOCK_PAGE_BITS)) {
+    return false;
+  }
+
+  *lit_addr = addr;
+  *lit_size = size;
+  return true;
+}
+
 void sh4_analyze_block(uint32_t guest_addr, uint8_t *guest_ptr, int flags,
-                       int *size) {
+                       int *size, int *code_size) {
+  uint32_t addr = guest_addr;
+  int num_instrs = 0;
+
+  // code_size covers the instructions translated for the block, while size
+  // also covers any literals folded into it
   *size = 0;
+  *code_size = 0;
 
   while (true) {
     struct sh4_instr instr = {0};
-    instr.addr = guest_addr;
-    instr.opcode = *(uint16_t *)guest_ptr;
+    instr.addr = addr;
+    instr.opcode = *(uint16_t *)(guest_ptr + (addr - guest_addr));
 
     // end block on invalid instruction
     if (!sh4_disasm(&instr)) {
       break;
     }
 
-    int step = (instr.flags & SH4_FLAG_DELAYED) ? 4 : 2;
-    guest_addr += step;
-    guest_ptr += step;
-    *size += step;
+    struct sh4_instr delay = {0};
+    int step = 2;
+
+    if (instr.flags & SH4_FLAG_DELAYED) {
+      delay.addr = addr + 2;
+      delay.opcode = *(uint16_t *)(guest_ptr + (delay.addr - guest_addr));
+      sh4_disasm(&delay);
+      step = 4;
+    }
+
+    addr += step;
+    num_instrs += step >> 1;
+    *code_size = (int)(addr - guest_addr);
+    *size = MAX(*size, *code_size);
+
+    uint32_t lit_addr;
+    int lit_size;
+    if (sh4_analyze_literal(guest_addr, &instr, &lit_addr, &lit_size)) {
+      *size = MAX(*size, (int)(lit_addr + lit_size - guest_addr));
+    }
+
+    // when forming superblocks, continue through static branches at their
+    // destination. note, the block's size covers any code skipped over
+    uint32_t dest_addr;
+    if (sh4_analyze_merge_branch(guest_addr, addr, &instr, &delay, flags,
+                                 num_instrs, &dest_addr)) {
+      addr = dest_addr;
+      continue;
+    }
 
     // stop emitting once a branch has been hit. in addition, if fpscr has
     // changed, stop emitting since the fpu state is invalidated. also, if
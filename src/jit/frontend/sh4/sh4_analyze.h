@@ -1,17 +1,36 @@
 #ifndef SH4_ANALYZER_H
 #define SH4_ANALYZER_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include "core/option.h"
+
+struct sh4_instr;
 
 enum {
   SH4_SLOWMEM = 0x1,
   SH4_DOUBLE_PR = 0x2,
   SH4_DOUBLE_SZ = 0x4,
   SH4_SINGLE_INSTR = 0x8,
+  SH4_SOURCE_INFO = 0x10,
+  SH4_PROFILE = 0x20,
 };
 
+// static branches are only merged into a block when their destination is on
+// the same page as the start of the block. the same goes for folding literal
+// pool loads into the block
+#define SH4_SUPERBLOCK_PAGE_BITS 12
+
+DECLARE_OPTION_INT(superblock_instrs);
+
+bool sh4_analyze_merge_branch(uint32_t block_addr, uint32_t end_addr,
+                              const struct sh4_instr *instr,
+                              const struct sh4_instr *delay, int flags,
+                              int num_instrs, uint32_t *dest_addr);
+bool sh4_analyze_literal(uint32_t block_addr, const struct sh4_instr *instr,
+                         uint32_t *lit_addr, int *lit_size);
 void sh4_analyze_block(uint32_t guest_addr, uint8_t *guest_ptr, int flags,
-                       int *size);
+                       int *size, int *code_size);
 
 #endif
@@ -34,13 +34,30 @@ struct sh4_ctx {
   void (*SRUpdated)(struct sh4_ctx *, uint64_t old_sr);
   void (*FPSCRUpdated)(struct sh4_ctx *, uint64_t old_fpscr);
 
+  // only set while the guest is being profiled. calls pass the call's target
+  // in the low 32 bits of the argument and its return address in the high 32
+  void (*ProfileCall)(struct sh4_ctx *, uint64_t target_ret);
+  void (*ProfileReturn)(struct sh4_ctx *, uint64_t ret_addr);
+
+  // host data is referenced through the context rather than by address in the
+  // generated code, keeping the code the same between runs
+  const uint32_t *fsca_table;
+
   // the main dispatch loop is ran until num_cycles is <= 0
   int32_t num_cycles;
 
   // used for debug performance monitoring
   uint32_t num_instrs;
 
-  uint32_t pc, pr, sr, sr_qm, fpscr;
+  // requested interrupts which aren't currently masked. compiled blocks only
+  // jump directly to their successor while this is zero
+  uint64_t pending_interrupts;
+
+  // the T bit is kept in sr_t (as either 0 or 1) rather than in sr, letting
+  // compiled code update it with a single store instead of a read-modify-write
+  // of sr followed by a call to SRUpdated. the T bit of sr itself is stale,
+  // sh4_ctx_load_sr / sh4_ctx_store_sr must be used to access the full value
+  uint32_t pc, pr, sr, sr_t, sr_qm, fpscr;
   uint32_t dbr, gbr, vbr;
   uint32_t fpul, mach, macl;
   uint32_t sgr, spc, ssr;
@@ -77,4 +94,13 @@ struct sh4_ctx {
   uint32_t fr[16], xf[16];
 };
 
+static inline uint32_t sh4_ctx_load_sr(const struct sh4_ctx *ctx) {
+  return (ctx->sr & ~T) | ctx->sr_t;
+}
+
+static inline void sh4_ctx_store_sr(struct sh4_ctx *ctx, uint32_t sr) {
+  ctx->sr = sr;
+  ctx->sr_t = sr & T;
+}
+
 #endif
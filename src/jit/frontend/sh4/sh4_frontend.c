@@ -9,16 +9,22 @@ struct sh4_frontend {
   struct jit_frontend base;
 };
 
+static void sh4_frontend_analyze_code(struct jit_frontend *base,
+                                      uint32_t guest_addr, uint8_t *guest_ptr,
+                                      int flags, int *size, int *code_size) {
+  struct sh4_frontend *frontend = container_of(base, struct sh4_frontend, base);
+
+  sh4_analyze_block(guest_addr, guest_ptr, flags, size, code_size);
+}
+
 static void sh4_frontend_translate_code(struct jit_frontend *base,
                                         uint32_t guest_addr, uint8_t *guest_ptr,
-                                        int flags, int *size, struct ir *ir) {
+                                        int code_size, int flags,
+                                        struct ir *ir) {
   struct sh4_frontend *frontend = container_of(base, struct sh4_frontend, base);
 
-  // get the block size
-  sh4_analyze_block(guest_addr, guest_ptr, flags, size);
-
   // emit IR for the SH4 code
-  sh4_translate(guest_addr, guest_ptr, *size, flags, ir);
+  sh4_translate(guest_addr, guest_ptr, code_size, flags, ir);
 }
 
 static void sh4_frontend_dump_code(struct jit_frontend *base,
@@ -28,29 +34,46 @@ static void sh4_frontend_dump_code(struct jit_frontend *base,
 
   char buffer[128];
 
-  int i = 0;
+  // the block's size includes any literals folded into it, only disassemble
+  // its code
+  int block_size, code_size;
+  sh4_analyze_block(guest_addr, guest_ptr, 0, &block_size, &code_size);
 
-  while (i < size) {
+  uint32_t addr = guest_addr;
+  uint32_t end_addr = guest_addr + code_size;
+  int num_instrs = 0;
+
+  while (addr < end_addr) {
     struct sh4_instr instr = {0};
-    instr.addr = guest_addr + i;
-    instr.opcode = *(uint16_t *)(guest_ptr + i);
+    instr.addr = addr;
+    instr.opcode = *(uint16_t *)(guest_ptr + (addr - guest_addr));
     sh4_disasm(&instr);
 
     sh4_format(&instr, buffer, sizeof(buffer));
     LOG_INFO(buffer);
 
-    i += 2;
+    addr += 2;
+    num_instrs++;
+
+    struct sh4_instr delay = {0};
 
     if (instr.flags & SH4_FLAG_DELAYED) {
-      struct sh4_instr delay = {0};
-      delay.addr = guest_addr + i;
-      delay.opcode = *(uint16_t *)(guest_ptr + i);
+      delay.addr = addr;
+      delay.opcode = *(uint16_t *)(guest_ptr + (addr - guest_addr));
       sh4_disasm(&delay);
 
       sh4_format(&delay, buffer, sizeof(buffer));
       LOG_INFO(buffer);
 
-      i += 2;
+      addr += 2;
+      num_instrs++;
+    }
+
+    // skip over the code between merged branches and their destination
+    uint32_t dest_addr;
+    if (sh4_analyze_merge_branch(guest_addr, addr, &instr, &delay, 0,
+                                 num_instrs, &dest_addr)) {
+      addr = dest_addr;
     }
   }
 }
@@ -58,6 +81,7 @@ static void sh4_frontend_dump_code(struct jit_frontend *base,
 struct jit_frontend *sh4_frontend_create() {
   struct sh4_frontend *frontend = calloc(1, sizeof(struct sh4_frontend));
 
+  frontend->base.analyze_code = &sh4_frontend_analyze_code;
   frontend->base.translate_code = &sh4_frontend_translate_code;
   frontend->base.dump_code = &sh4_frontend_dump_code;
 
@@ -0,0 +1,1649 @@
+#include <math.h>
+#include "jit/frontend/sh4/sh4_interp.h"
+#include "core/assert.h"
+#include "jit/backend/backend.h"
+#include "jit/frontend/sh4/sh4_context.h"
+#include "jit/frontend/sh4/sh4_disasm.h"
+
+//
+// callbacks for interpreting each sh4 op
+//
+typedef void (*interp_cb)(struct jit_memory_interface *, struct sh4_ctx *,
+                          const struct sh4_instr *, const struct sh4_instr *);
+
+#define INTERPRETER(name)                                             \
+  void sh4_interp_OP_##name(struct jit_memory_interface *memory_if,   \
+                            struct sh4_ctx *ctx, const struct sh4_instr *i, \
+                            const struct sh4_instr *delay)
+
+#define SH4_INSTR(name, desc, instr_code, cycles, flags) \
+  static INTERPRETER(name);
+#include "jit/frontend/sh4/sh4_instr.inc"
+#undef SH4_INSTR
+
+static interp_cb interp_callbacks[NUM_SH4_OPS] = {
+    NULL,  // SH4_OP_INVALID
+#define SH4_INSTR(name, desc, instr_code, cycles, flags) &sh4_interp_OP_##name,
+#include "jit/frontend/sh4/sh4_instr.inc"
+#undef SH4_INSTR
+};
+
+// helper functions for accessing guest memory and the sh4 context, mirroring
+// those used by the translator. guest memory is always accessed through the
+// memory interface's slow path, there's no compiled code for the fastmem
+// exception handler to recover
+#define read8(addr) memory_if->r8(memory_if->mem_self, addr)
+#define read16(addr) memory_if->r16(memory_if->mem_self, addr)
+#define read32(addr) memory_if->r32(memory_if->mem_self, addr)
+#define write8(addr, v) memory_if->w8(memory_if->mem_self, addr, v)
+#define write16(addr, v) memory_if->w16(memory_if->mem_self, addr, v)
+#define write32(addr, v) memory_if->w32(memory_if->mem_self, addr, v)
+
+// swizzle 32-bit fp registers, see notes in sh4_context.h
+#define fpr_i32(n) ctx->fr[(n) ^ 1]
+#define xfr_i32(n) ctx->xf[(n) ^ 1]
+
+#define load_fpr_f32(n) sh4_interp_f32(fpr_i32(n))
+#define store_fpr_f32(n, v) fpr_i32(n) = sh4_interp_i32(v)
+#define load_fpr_f64(n) sh4_interp_load_f64(&ctx->fr[n])
+#define store_fpr_f64(n, v) sh4_interp_store_f64(&ctx->fr[n], v)
+#define load_xfr_f32(n) sh4_interp_f32(xfr_i32(n))
+
+#define load_sr() sh4_ctx_load_sr(ctx)
+
+#define store_sr(v)              \
+  do {                           \
+    uint32_t old_sr = ctx->sr;   \
+    sh4_ctx_store_sr(ctx, v);    \
+    ctx->SRUpdated(ctx, old_sr); \
+  } while (0)
+
+#define load_t() ctx->sr_t
+
+#define store_t(v)           \
+  do {                       \
+    ctx->sr_t = (v) ? 1 : 0; \
+  } while (0)
+
+#define load_fpscr() (ctx->fpscr & 0x003fffff)
+
+#define store_fpscr(v)                      \
+  do {                                      \
+    uint32_t old_fpscr = load_fpscr();      \
+    ctx->fpscr = (v)&0x003fffff;            \
+    ctx->FPSCRUpdated(ctx, old_fpscr);      \
+  } while (0)
+
+#define double_pr() (ctx->fpscr & PR)
+#define double_sz() (ctx->fpscr & SZ)
+
+#define run_delay_instr() sh4_interp_instr(memory_if, ctx, delay, NULL)
+
+#define profile_call(target, ret_addr)                    \
+  do {                                                    \
+    if (ctx->ProfileCall) {                               \
+      uint64_t target_ret = (uint64_t)(target) |          \
+                            ((uint64_t)(ret_addr) << 32); \
+      ctx->ProfileCall(ctx, target_ret);                  \
+    }                                                     \
+  } while (0)
+
+#define profile_return(ret_addr)                     \
+  do {                                               \
+    if (ctx->ProfileReturn) {                        \
+      ctx->ProfileReturn(ctx, (uint64_t)(ret_addr)); \
+    }                                                \
+  } while (0)
+
+static inline float sh4_interp_f32(uint32_t v) {
+  float f;
+  memcpy(&f, &v, sizeof(f));
+  return f;
+}
+
+static inline uint32_t sh4_interp_i32(float f) {
+  uint32_t v;
+  memcpy(&v, &f, sizeof(v));
+  return v;
+}
+
+static inline double sh4_interp_load_f64(const uint32_t *r) {
+  double d;
+  memcpy(&d, r, sizeof(d));
+  return d;
+}
+
+static inline void sh4_interp_store_f64(uint32_t *r, double d) {
+  memcpy(r, &d, sizeof(d));
+}
+
+// register pair used by double-precision moves, odd register numbers select
+// the xf bank. note, the pair is stored swizzled, with the word at the lower
+// guest address in the second element
+static inline uint32_t *sh4_interp_pair(struct sh4_ctx *ctx, int n) {
+  return (n & 1) ? &ctx->xf[n & 0xe] : &ctx->fr[n];
+}
+
+// convert to an integer the same way the x64 backend does, so a block gives
+// the same result before and after it's promoted to the jit. single precision
+// values are converted to a 32-bit integer, with out of range values and nans
+// producing 0x80000000 like cvttss2si. double precision values are converted
+// to a 64-bit integer like cvttsd2si, producing 0x8000000000000000 when out of
+// range, and then truncated
+static inline uint32_t sh4_interp_ftrc_f32(float v) {
+  if (!(v >= -2147483648.0f && v < 2147483648.0f)) {
+    return 0x80000000;
+  }
+  return (uint32_t)(int32_t)v;
+}
+
+static inline uint32_t sh4_interp_ftrc_f64(double v) {
+  if (!(v >= -9223372036854775808.0 && v < 9223372036854775808.0)) {
+    return 0;
+  }
+  return (uint32_t)(int64_t)v;
+}
+
+static void sh4_interp_instr(struct jit_memory_interface *memory_if,
+                             struct sh4_ctx *ctx, const struct sh4_instr *instr,
+                             const struct sh4_instr *delay) {
+  (interp_callbacks[instr->op])(memory_if, ctx, instr, delay);
+}
+
+// MOV     #imm,Rn
+INTERPRETER(MOVI) {
+  ctx->r[i->Rn] = (int32_t)(int8_t)i->imm;
+}
+
+// MOV.W   @(disp,PC),Rn
+INTERPRETER(MOVWLPC) {
+  uint32_t addr = (i->disp * 2) + i->addr + 4;
+  ctx->r[i->Rn] = (int32_t)(int16_t)read16(addr);
+}
+
+// MOV.L   @(disp,PC),Rn
+INTERPRETER(MOVLLPC) {
+  uint32_t addr = (i->disp * 4) + (i->addr & ~3) + 4;
+  ctx->r[i->Rn] = read32(addr);
+}
+
+// MOV     Rm,Rn
+INTERPRETER(MOV) {
+  ctx->r[i->Rn] = ctx->r[i->Rm];
+}
+
+// MOV.B   Rm,@Rn
+INTERPRETER(MOVBS) {
+  write8(ctx->r[i->Rn], (uint8_t)ctx->r[i->Rm]);
+}
+
+// MOV.W   Rm,@Rn
+INTERPRETER(MOVWS) {
+  write16(ctx->r[i->Rn], (uint16_t)ctx->r[i->Rm]);
+}
+
+// MOV.L   Rm,@Rn
+INTERPRETER(MOVLS) {
+  write32(ctx->r[i->Rn], ctx->r[i->Rm]);
+}
+
+// MOV.B   @Rm,Rn
+INTERPRETER(MOVBL) {
+  ctx->r[i->Rn] = (int32_t)(int8_t)read8(ctx->r[i->Rm]);
+}
+
+// MOV.W   @Rm,Rn
+INTERPRETER(MOVWL) {
+  ctx->r[i->Rn] = (int32_t)(int16_t)read16(ctx->r[i->Rm]);
+}
+
+// MOV.L   @Rm,Rn
+INTERPRETER(MOVLL) {
+  ctx->r[i->Rn] = read32(ctx->r[i->Rm]);
+}
+
+// MOV.B   Rm,@-Rn
+INTERPRETER(MOVBM) {
+  ctx->r[i->Rn] -= 1;
+  write8(ctx->r[i->Rn], (uint8_t)ctx->r[i->Rm]);
+}
+
+// MOV.W   Rm,@-Rn
+INTERPRETER(MOVWM) {
+  ctx->r[i->Rn] -= 2;
+  write16(ctx->r[i->Rn], (uint16_t)ctx->r[i->Rm]);
+}
+
+// MOV.L   Rm,@-Rn
+INTERPRETER(MOVLM) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->r[i->Rm]);
+}
+
+// MOV.B   @Rm+,Rn
+INTERPRETER(MOVBP) {
+  uint32_t addr = ctx->r[i->Rm];
+  ctx->r[i->Rn] = (int32_t)(int8_t)read8(addr);
+  if (i->Rm != i->Rn) {
+    ctx->r[i->Rm] = addr + 1;
+  }
+}
+
+// MOV.W   @Rm+,Rn
+INTERPRETER(MOVWP) {
+  uint32_t addr = ctx->r[i->Rm];
+  ctx->r[i->Rn] = (int32_t)(int16_t)read16(addr);
+  if (i->Rm != i->Rn) {
+    ctx->r[i->Rm] = addr + 2;
+  }
+}
+
+// MOV.L   @Rm+,Rn
+INTERPRETER(MOVLP) {
+  uint32_t addr = ctx->r[i->Rm];
+  ctx->r[i->Rn] = read32(addr);
+  if (i->Rm != i->Rn) {
+    ctx->r[i->Rm] = addr + 4;
+  }
+}
+
+// MOV.B   R0,@(disp,Rn)
+INTERPRETER(MOVBS0D) {
+  write8(ctx->r[i->Rn] + i->disp, (uint8_t)ctx->r[0]);
+}
+
+// MOV.W   R0,@(disp,Rn)
+INTERPRETER(MOVWS0D) {
+  write16(ctx->r[i->Rn] + i->disp * 2, (uint16_t)ctx->r[0]);
+}
+
+// MOV.L Rm,@(disp,Rn)
+INTERPRETER(MOVLSMD) {
+  write32(ctx->r[i->Rn] + i->disp * 4, ctx->r[i->Rm]);
+}
+
+// MOV.B   @(disp,Rm),R0
+INTERPRETER(MOVBLD0) {
+  ctx->r[0] = (int32_t)(int8_t)read8(ctx->r[i->Rm] + i->disp);
+}
+
+// MOV.W   @(disp,Rm),R0
+INTERPRETER(MOVWLD0) {
+  ctx->r[0] = (int32_t)(int16_t)read16(ctx->r[i->Rm] + i->disp * 2);
+}
+
+// MOV.L   @(disp,Rm),Rn
+INTERPRETER(MOVLLDN) {
+  ctx->r[i->Rn] = read32(ctx->r[i->Rm] + i->disp * 4);
+}
+
+// MOV.B   Rm,@(R0,Rn)
+INTERPRETER(MOVBS0) {
+  write8(ctx->r[0] + ctx->r[i->Rn], (uint8_t)ctx->r[i->Rm]);
+}
+
+// MOV.W   Rm,@(R0,Rn)
+INTERPRETER(MOVWS0) {
+  write16(ctx->r[0] + ctx->r[i->Rn], (uint16_t)ctx->r[i->Rm]);
+}
+
+// MOV.L   Rm,@(R0,Rn)
+INTERPRETER(MOVLS0) {
+  write32(ctx->r[0] + ctx->r[i->Rn], ctx->r[i->Rm]);
+}
+
+// MOV.B   @(R0,Rm),Rn
+INTERPRETER(MOVBL0) {
+  ctx->r[i->Rn] = (int32_t)(int8_t)read8(ctx->r[0] + ctx->r[i->Rm]);
+}
+
+// MOV.W   @(R0,Rm),Rn
+INTERPRETER(MOVWL0) {
+  ctx->r[i->Rn] = (int32_t)(int16_t)read16(ctx->r[0] + ctx->r[i->Rm]);
+}
+
+// MOV.L   @(R0,Rm),Rn
+INTERPRETER(MOVLL0) {
+  ctx->r[i->Rn] = read32(ctx->r[0] + ctx->r[i->Rm]);
+}
+
+// MOV.B   R0,@(disp,GBR)
+INTERPRETER(MOVBS0G) {
+  write8(ctx->gbr + i->disp, (uint8_t)ctx->r[0]);
+}
+
+// MOV.W   R0,@(disp,GBR)
+INTERPRETER(MOVWS0G) {
+  write16(ctx->gbr + i->disp * 2, (uint16_t)ctx->r[0]);
+}
+
+// MOV.L   R0,@(disp,GBR)
+INTERPRETER(MOVLS0G) {
+  write32(ctx->gbr + i->disp * 4, ctx->r[0]);
+}
+
+// MOV.B   @(disp,GBR),R0
+INTERPRETER(MOVBLG0) {
+  ctx->r[0] = (int32_t)(int8_t)read8(ctx->gbr + i->disp);
+}
+
+// MOV.W   @(disp,GBR),R0
+INTERPRETER(MOVWLG0) {
+  ctx->r[0] = (int32_t)(int16_t)read16(ctx->gbr + i->disp * 2);
+}
+
+// MOV.L   @(disp,GBR),R0
+INTERPRETER(MOVLLG0) {
+  ctx->r[0] = read32(ctx->gbr + i->disp * 4);
+}
+
+// MOVA    (disp,PC),R0
+INTERPRETER(MOVA) {
+  ctx->r[0] = (i->disp * 4) + (i->addr & ~3) + 4;
+}
+
+// MOVT    Rn
+INTERPRETER(MOVT) {
+  ctx->r[i->Rn] = load_t();
+}
+
+// SWAP.B  Rm,Rn
+INTERPRETER(SWAPB) {
+  uint32_t v = ctx->r[i->Rm];
+  ctx->r[i->Rn] = (v & 0xffff0000) | ((v & 0xff) << 8) | ((v >> 8) & 0xff);
+}
+
+// SWAP.W  Rm,Rn
+INTERPRETER(SWAPW) {
+  uint32_t v = ctx->r[i->Rm];
+  ctx->r[i->Rn] = (v << 16) | (v >> 16);
+}
+
+// XTRCT   Rm,Rn
+INTERPRETER(XTRCT) {
+  ctx->r[i->Rn] = (ctx->r[i->Rn] >> 16) | (ctx->r[i->Rm] << 16);
+}
+
+// ADD     Rm,Rn
+INTERPRETER(ADD) {
+  ctx->r[i->Rn] += ctx->r[i->Rm];
+}
+
+// ADD     #imm,Rn
+INTERPRETER(ADDI) {
+  ctx->r[i->Rn] += (int32_t)(int8_t)i->imm;
+}
+
+// ADDC    Rm,Rn
+INTERPRETER(ADDC) {
+  uint64_t v = (uint64_t)ctx->r[i->Rn] + ctx->r[i->Rm] + load_t();
+  ctx->r[i->Rn] = (uint32_t)v;
+  store_t(v >> 32);
+}
+
+// ADDV    Rm,Rn
+INTERPRETER(ADDV) {
+  uint32_t rn = ctx->r[i->Rn];
+  uint32_t rm = ctx->r[i->Rm];
+  uint32_t v = rn + rm;
+  ctx->r[i->Rn] = v;
+  store_t(((v ^ rn) & (v ^ rm)) >> 31);
+}
+
+// CMP/EQ #imm,R0
+INTERPRETER(CMPEQI) {
+  store_t(ctx->r[0] == (uint32_t)(int32_t)(int8_t)i->imm);
+}
+
+// CMP/EQ  Rm,Rn
+INTERPRETER(CMPEQ) {
+  store_t(ctx->r[i->Rn] == ctx->r[i->Rm]);
+}
+
+// CMP/HS  Rm,Rn
+INTERPRETER(CMPHS) {
+  store_t(ctx->r[i->Rn] >= ctx->r[i->Rm]);
+}
+
+// CMP/GE  Rm,Rn
+INTERPRETER(CMPGE) {
+  store_t((int32_t)ctx->r[i->Rn] >= (int32_t)ctx->r[i->Rm]);
+}
+
+// CMP/HI  Rm,Rn
+INTERPRETER(CMPHI) {
+  store_t(ctx->r[i->Rn] > ctx->r[i->Rm]);
+}
+
+// CMP/GT  Rm,Rn
+INTERPRETER(CMPGT) {
+  store_t((int32_t)ctx->r[i->Rn] > (int32_t)ctx->r[i->Rm]);
+}
+
+// CMP/PZ  Rn
+INTERPRETER(CMPPZ) {
+  store_t((int32_t)ctx->r[i->Rn] >= 0);
+}
+
+// CMP/PL  Rn
+INTERPRETER(CMPPL) {
+  store_t((int32_t)ctx->r[i->Rn] > 0);
+}
+
+// CMP/STR  Rm,Rn
+INTERPRETER(CMPSTR) {
+  uint32_t diff = ctx->r[i->Rn] ^ ctx->r[i->Rm];
+
+  // if any diff is zero, the bytes match
+  store_t(!(diff & 0xff000000) || !(diff & 0x00ff0000) ||
+          !(diff & 0x0000ff00) || !(diff & 0x000000ff));
+}
+
+// the Q and M bits aren't tracked individually. as in the translator, the msb
+// of sr_qm holds Q == M, see DIV0S, DIV0U and DIV1 in sh4_translate.c
+
+// DIV0S   Rm,Rn
+INTERPRETER(DIV0S) {
+  uint32_t qm = ctx->r[i->Rn] ^ ctx->r[i->Rm];
+  ctx->sr_qm = ~qm;
+  store_t(qm >> 31);
+}
+
+// DIV0U
+INTERPRETER(DIV0U) {
+  ctx->sr_qm = 0x80000000;
+  store_t(0);
+}
+
+// DIV1 Rm,Rn
+INTERPRETER(DIV1) {
+  uint32_t rn = ctx->r[i->Rn];
+  uint32_t rm = ctx->r[i->Rm];
+
+  // if Q == M, r0 = ~Rm and C = 1; else, r0 = Rm and C = 0
+  uint32_t qm = (uint32_t)((int32_t)ctx->sr_qm >> 31);
+  uint32_t r0 = rm ^ qm;
+  uint32_t carry = qm >> 31;
+
+  // initialize output bit as (Q == M) ^ Rn
+  qm ^= rn;
+
+  // shift Rn left by 1 and add T
+  rn = (rn << 1) | load_t();
+
+  // add or subtract Rm based on r0 and C
+  uint32_t rd = rn + r0 + carry;
+  ctx->r[i->Rn] = rd;
+
+  // if C is cleared, invert output bit
+  carry = ((rn & r0) | ((rn | r0) & ~rd)) >> 31;
+  qm = carry ? qm : ~qm;
+  ctx->sr_qm = qm;
+
+  // set T to output bit (which happens to be Q == M)
+  store_t(qm >> 31);
+}
+
+// DMULS.L Rm,Rn
+INTERPRETER(DMULS) {
+  int64_t p = (int64_t)(int32_t)ctx->r[i->Rm] * (int32_t)ctx->r[i->Rn];
+  ctx->macl = (uint32_t)p;
+  ctx->mach = (uint32_t)((uint64_t)p >> 32);
+}
+
+// DMULU.L Rm,Rn
+INTERPRETER(DMULU) {
+  uint64_t p = (uint64_t)ctx->r[i->Rm] * ctx->r[i->Rn];
+  ctx->macl = (uint32_t)p;
+  ctx->mach = (uint32_t)(p >> 32);
+}
+
+// DT      Rn
+INTERPRETER(DT) {
+  ctx->r[i->Rn] -= 1;
+  store_t(ctx->r[i->Rn] == 0);
+}
+
+// EXTS.B  Rm,Rn
+INTERPRETER(EXTSB) {
+  ctx->r[i->Rn] = (int32_t)(int8_t)ctx->r[i->Rm];
+}
+
+// EXTS.W  Rm,Rn
+INTERPRETER(EXTSW) {
+  ctx->r[i->Rn] = (int32_t)(int16_t)ctx->r[i->Rm];
+}
+
+// EXTU.B  Rm,Rn
+INTERPRETER(EXTUB) {
+  ctx->r[i->Rn] = (uint8_t)ctx->r[i->Rm];
+}
+
+// EXTU.W  Rm,Rn
+INTERPRETER(EXTUW) {
+  ctx->r[i->Rn] = (uint16_t)ctx->r[i->Rm];
+}
+
+// MAC.L   @Rm+,@Rn+
+INTERPRETER(MACL) {
+  int32_t rn = (int32_t)read32(ctx->r[i->Rn]);
+  ctx->r[i->Rn] += 4;
+  int32_t rm = (int32_t)read32(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 4;
+
+  int64_t mac = (int64_t)(((uint64_t)ctx->mach << 32) | ctx->macl);
+  mac += (int64_t)rn * rm;
+
+  // with S set, the result saturates to 48 bits
+  if (ctx->sr & S) {
+    const int64_t max = (INT64_C(1) << 47) - 1;
+    mac = mac > max ? max : mac < -max - 1 ? -max - 1 : mac;
+  }
+
+  ctx->macl = (uint32_t)mac;
+  ctx->mach = (uint32_t)((uint64_t)mac >> 32);
+}
+
+// MAC.W   @Rm+,@Rn+
+INTERPRETER(MACW) {
+  int16_t rn = (int16_t)read16(ctx->r[i->Rn]);
+  ctx->r[i->Rn] += 2;
+  int16_t rm = (int16_t)read16(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 2;
+
+  int32_t p = (int32_t)rn * rm;
+
+  // with S set, only MACL is accumulated into, saturating to 32 bits and
+  // flagging the overflow in MACH
+  if (ctx->sr & S) {
+    int64_t mac = (int64_t)(int32_t)ctx->macl + p;
+
+    if (mac > INT32_MAX || mac < INT32_MIN) {
+      mac = mac > INT32_MAX ? INT32_MAX : INT32_MIN;
+      ctx->mach |= 1;
+    }
+
+    ctx->macl = (uint32_t)mac;
+    return;
+  }
+
+  int64_t mac = (int64_t)(((uint64_t)ctx->mach << 32) | ctx->macl);
+  mac += p;
+  ctx->macl = (uint32_t)mac;
+  ctx->mach = (uint32_t)((uint64_t)mac >> 32);
+}
+
+// MUL.L   Rm,Rn
+INTERPRETER(MULL) {
+  ctx->macl = ctx->r[i->Rn] * ctx->r[i->Rm];
+}
+
+// MULS    Rm,Rn
+INTERPRETER(MULS) {
+  ctx->macl = (uint32_t)((int32_t)(int16_t)ctx->r[i->Rn] *
+                         (int32_t)(int16_t)ctx->r[i->Rm]);
+}
+
+// MULU    Rm,Rn
+INTERPRETER(MULU) {
+  ctx->macl = (uint32_t)(uint16_t)ctx->r[i->Rn] * (uint16_t)ctx->r[i->Rm];
+}
+
+// NEG     Rm,Rn
+INTERPRETER(NEG) {
+  ctx->r[i->Rn] = 0 - ctx->r[i->Rm];
+}
+
+// NEGC    Rm,Rn
+INTERPRETER(NEGC) {
+  uint32_t rm = ctx->r[i->Rm];
+  uint32_t t = load_t();
+  ctx->r[i->Rn] = 0 - rm - t;
+  store_t(rm || t);
+}
+
+// SUB     Rm,Rn
+INTERPRETER(SUB) {
+  ctx->r[i->Rn] -= ctx->r[i->Rm];
+}
+
+// SUBC    Rm,Rn
+INTERPRETER(SUBC) {
+  uint64_t v = (uint64_t)ctx->r[i->Rn] - ctx->r[i->Rm] - load_t();
+  ctx->r[i->Rn] = (uint32_t)v;
+  store_t((v >> 32) & 1);
+}
+
+// SUBV    Rm,Rn
+INTERPRETER(SUBV) {
+  uint32_t rn = ctx->r[i->Rn];
+  uint32_t rm = ctx->r[i->Rm];
+  uint32_t v = rn - rm;
+  ctx->r[i->Rn] = v;
+  store_t(((rn ^ rm) & (v ^ rn)) >> 31);
+}
+
+// AND     Rm,Rn
+INTERPRETER(AND) {
+  ctx->r[i->Rn] &= ctx->r[i->Rm];
+}
+
+// AND     #imm,R0
+INTERPRETER(ANDI) {
+  ctx->r[0] &= i->imm;
+}
+
+// AND.B   #imm,@(R0,GBR)
+INTERPRETER(ANDB) {
+  uint32_t addr = ctx->r[0] + ctx->gbr;
+  write8(addr, read8(addr) & (uint8_t)i->imm);
+}
+
+// NOT     Rm,Rn
+INTERPRETER(NOT) {
+  ctx->r[i->Rn] = ~ctx->r[i->Rm];
+}
+
+// OR      Rm,Rn
+INTERPRETER(OR) {
+  ctx->r[i->Rn] |= ctx->r[i->Rm];
+}
+
+// OR      #imm,R0
+INTERPRETER(ORI) {
+  ctx->r[0] |= i->imm;
+}
+
+// OR.B    #imm,@(R0,GBR)
+INTERPRETER(ORB) {
+  uint32_t addr = ctx->r[0] + ctx->gbr;
+  write8(addr, read8(addr) | (uint8_t)i->imm);
+}
+
+// TAS.B   @Rn
+INTERPRETER(TAS) {
+  uint32_t addr = ctx->r[i->Rn];
+  uint8_t v = read8(addr);
+  write8(addr, v | 0x80);
+  store_t(v == 0);
+}
+
+// TST     Rm,Rn
+INTERPRETER(TST) {
+  store_t((ctx->r[i->Rn] & ctx->r[i->Rm]) == 0);
+}
+
+// TST     #imm,R0
+INTERPRETER(TSTI) {
+  store_t((ctx->r[0] & i->imm) == 0);
+}
+
+// TST.B   #imm,@(R0,GBR)
+INTERPRETER(TSTB) {
+  uint8_t v = read8(ctx->r[0] + ctx->gbr);
+  store_t((v & (uint8_t)i->imm) == 0);
+}
+
+// XOR     Rm,Rn
+INTERPRETER(XOR) {
+  ctx->r[i->Rn] ^= ctx->r[i->Rm];
+}
+
+// XOR     #imm,R0
+INTERPRETER(XORI) {
+  ctx->r[0] ^= i->imm;
+}
+
+// XOR.B   #imm,@(R0,GBR)
+INTERPRETER(XORB) {
+  uint32_t addr = ctx->r[0] + ctx->gbr;
+  write8(addr, read8(addr) ^ (uint8_t)i->imm);
+}
+
+// ROTL    Rn
+INTERPRETER(ROTL) {
+  uint32_t rn = ctx->r[i->Rn];
+  ctx->r[i->Rn] = (rn << 1) | (rn >> 31);
+  store_t(rn >> 31);
+}
+
+// ROTR    Rn
+INTERPRETER(ROTR) {
+  uint32_t rn = ctx->r[i->Rn];
+  ctx->r[i->Rn] = (rn << 31) | (rn >> 1);
+  store_t(rn & 1);
+}
+
+// ROTCL   Rn
+INTERPRETER(ROTCL) {
+  uint32_t rn = ctx->r[i->Rn];
+  ctx->r[i->Rn] = (rn << 1) | load_t();
+  store_t(rn >> 31);
+}
+
+// ROTCR   Rn
+INTERPRETER(ROTCR) {
+  uint32_t rn = ctx->r[i->Rn];
+  ctx->r[i->Rn] = (load_t() << 31) | (rn >> 1);
+  store_t(rn & 1);
+}
+
+// SHAD    Rm,Rn
+INTERPRETER(SHAD) {
+  // when Rm >= 0, Rn << Rm
+  // when Rm < 0, Rn >> Rm
+  // when shifting right > 32, Rn = (Rn >= 0 ? 0 : -1)
+  int32_t rn = (int32_t)ctx->r[i->Rn];
+  uint32_t rm = ctx->r[i->Rm];
+
+  if (!(rm & 0x80000000)) {
+    ctx->r[i->Rn] = (uint32_t)rn << (rm & 0x1f);
+  } else if (!(rm & 0x1f)) {
+    ctx->r[i->Rn] = rn < 0 ? 0xffffffff : 0;
+  } else {
+    ctx->r[i->Rn] = (uint32_t)(rn >> ((~rm & 0x1f) + 1));
+  }
+}
+
+// SHAL    Rn      (same as SHLL)
+INTERPRETER(SHAL) {
+  uint32_t rn = ctx->r[i->Rn];
+  ctx->r[i->Rn] = rn << 1;
+  store_t(rn >> 31);
+}
+
+// SHAR    Rn
+INTERPRETER(SHAR) {
+  uint32_t rn = ctx->r[i->Rn];
+  ctx->r[i->Rn] = (uint32_t)((int32_t)rn >> 1);
+  store_t(rn & 1);
+}
+
+// SHLD    Rm,Rn
+INTERPRETER(SHLD) {
+  // when Rm >= 0, Rn << Rm
+  // when Rm < 0, Rn >> Rm
+  // when shifting right >= 32, Rn = 0
+  uint32_t rn = ctx->r[i->Rn];
+  uint32_t rm = ctx->r[i->Rm];
+
+  if (!(rm & 0x80000000)) {
+    ctx->r[i->Rn] = rn << (rm & 0x1f);
+  } else if (!(rm & 0x1f)) {
+    ctx->r[i->Rn] = 0;
+  } else {
+    ctx->r[i->Rn] = rn >> ((~rm & 0x1f) + 1);
+  }
+}
+
+// SHLL    Rn      (same as SHAL)
+INTERPRETER(SHLL) {
+  uint32_t rn = ctx->r[i->Rn];
+  ctx->r[i->Rn] = rn << 1;
+  store_t(rn >> 31);
+}
+
+// SHLR    Rn
+INTERPRETER(SHLR) {
+  uint32_t rn = ctx->r[i->Rn];
+  ctx->r[i->Rn] = rn >> 1;
+  store_t(rn & 1);
+}
+
+// SHLL2   Rn
+INTERPRETER(SHLL2) {
+  ctx->r[i->Rn] <<= 2;
+}
+
+// SHLR2   Rn
+INTERPRETER(SHLR2) {
+  ctx->r[i->Rn] >>= 2;
+}
+
+// SHLL8   Rn
+INTERPRETER(SHLL8) {
+  ctx->r[i->Rn] <<= 8;
+}
+
+// SHLR8   Rn
+INTERPRETER(SHLR8) {
+  ctx->r[i->Rn] >>= 8;
+}
+
+// SHLL16  Rn
+INTERPRETER(SHLL16) {
+  ctx->r[i->Rn] <<= 16;
+}
+
+// SHLR16  Rn
+INTERPRETER(SHLR16) {
+  ctx->r[i->Rn] >>= 16;
+}
+
+// branches write the next pc to the context. when not taken, the pc set by
+// sh4_interp_block for the following instruction is left as is
+
+// BF      disp
+INTERPRETER(BF) {
+  if (!load_t()) {
+    ctx->pc = ((int8_t)i->disp * 2) + i->addr + 4;
+  }
+}
+
+// BFS     disp
+INTERPRETER(BFS) {
+  uint32_t cond = load_t();
+  run_delay_instr();
+  if (!cond) {
+    ctx->pc = ((int8_t)i->disp * 2) + i->addr + 4;
+  }
+}
+
+// BT      disp
+INTERPRETER(BT) {
+  if (load_t()) {
+    ctx->pc = ((int8_t)i->disp * 2) + i->addr + 4;
+  }
+}
+
+// BTS     disp
+INTERPRETER(BTS) {
+  uint32_t cond = load_t();
+  run_delay_instr();
+  if (cond) {
+    ctx->pc = ((int8_t)i->disp * 2) + i->addr + 4;
+  }
+}
+
+// BRA     disp
+INTERPRETER(BRA) {
+  run_delay_instr();
+  // 12-bit displacement must be sign extended
+  int32_t disp = ((i->disp & 0xfff) << 20) >> 20;
+  ctx->pc = (disp * 2) + i->addr + 4;
+}
+
+// BRAF    Rn
+INTERPRETER(BRAF) {
+  uint32_t rn = ctx->r[i->Rn];
+  run_delay_instr();
+  ctx->pc = i->addr + 4 + rn;
+}
+
+// BSR     disp
+INTERPRETER(BSR) {
+  run_delay_instr();
+  // 12-bit displacement must be sign extended
+  int32_t disp = ((i->disp & 0xfff) << 20) >> 20;
+  ctx->pr = i->addr + 4;
+  ctx->pc = ctx->pr + disp * 2;
+  profile_call(ctx->pc, ctx->pr);
+}
+
+// BSRF    Rn
+INTERPRETER(BSRF) {
+  uint32_t rn = ctx->r[i->Rn];
+  run_delay_instr();
+  ctx->pr = i->addr + 4;
+  ctx->pc = ctx->pr + rn;
+  profile_call(ctx->pc, ctx->pr);
+}
+
+// JMP     @Rm
+INTERPRETER(JMP) {
+  uint32_t dest_addr = ctx->r[i->Rn];
+  run_delay_instr();
+  ctx->pc = dest_addr;
+}
+
+// JSR     @Rn
+INTERPRETER(JSR) {
+  uint32_t dest_addr = ctx->r[i->Rn];
+  run_delay_instr();
+  ctx->pr = i->addr + 4;
+  ctx->pc = dest_addr;
+  profile_call(ctx->pc, ctx->pr);
+}
+
+// RTS
+INTERPRETER(RTS) {
+  uint32_t dest_addr = ctx->pr;
+  run_delay_instr();
+  ctx->pc = dest_addr;
+  profile_return(dest_addr);
+}
+
+// CLRMAC
+INTERPRETER(CLRMAC) {
+  ctx->mach = 0;
+  ctx->macl = 0;
+}
+
+// CLRS
+INTERPRETER(CLRS) {
+  store_sr(load_sr() & ~S);
+}
+
+// CLRT
+INTERPRETER(CLRT) {
+  store_t(0);
+}
+
+// LDC     Rm,SR
+INTERPRETER(LDCSR) {
+  store_sr(ctx->r[i->Rm]);
+}
+
+// LDC     Rm,GBR
+INTERPRETER(LDCGBR) {
+  ctx->gbr = ctx->r[i->Rm];
+}
+
+// LDC     Rm,VBR
+INTERPRETER(LDCVBR) {
+  ctx->vbr = ctx->r[i->Rm];
+}
+
+// LDC     Rm,SSR
+INTERPRETER(LDCSSR) {
+  ctx->ssr = ctx->r[i->Rm];
+}
+
+// LDC     Rm,SPC
+INTERPRETER(LDCSPC) {
+  ctx->spc = ctx->r[i->Rm];
+}
+
+// LDC     Rm,DBR
+INTERPRETER(LDCDBR) {
+  ctx->dbr = ctx->r[i->Rm];
+}
+
+// LDC.L   Rm,Rn_BANK
+INTERPRETER(LDCRBANK) {
+  ctx->ralt[i->Rn & 0x7] = ctx->r[i->Rm];
+}
+
+// LDC.L   @Rm+,SR
+INTERPRETER(LDCMSR) {
+  // the sr store could swap banks, the incremented address is written to Rm
+  // in the new bank, the same as the jit does
+  uint32_t addr = ctx->r[i->Rm];
+  store_sr(read32(addr));
+  ctx->r[i->Rm] = addr + 4;
+}
+
+// LDC.L   @Rm+,GBR
+INTERPRETER(LDCMGBR) {
+  ctx->gbr = read32(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 4;
+}
+
+// LDC.L   @Rm+,VBR
+INTERPRETER(LDCMVBR) {
+  ctx->vbr = read32(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 4;
+}
+
+// LDC.L   @Rm+,SSR
+INTERPRETER(LDCMSSR) {
+  ctx->ssr = read32(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 4;
+}
+
+// LDC.L   @Rm+,SPC
+INTERPRETER(LDCMSPC) {
+  ctx->spc = read32(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 4;
+}
+
+// LDC.L   @Rm+,DBR
+INTERPRETER(LDCMDBR) {
+  ctx->dbr = read32(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 4;
+}
+
+// LDC.L   @Rm+,Rn_BANK
+INTERPRETER(LDCMRBANK) {
+  uint32_t addr = ctx->r[i->Rm];
+  ctx->r[i->Rm] = addr + 4;
+  ctx->ralt[i->Rn & 0x7] = read32(addr);
+}
+
+// LDS     Rm,MACH
+INTERPRETER(LDSMACH) {
+  ctx->mach = ctx->r[i->Rm];
+}
+
+// LDS     Rm,MACL
+INTERPRETER(LDSMACL) {
+  ctx->macl = ctx->r[i->Rm];
+}
+
+// LDS     Rm,PR
+INTERPRETER(LDSPR) {
+  ctx->pr = ctx->r[i->Rm];
+}
+
+// LDS.L   @Rm+,MACH
+INTERPRETER(LDSMMACH) {
+  ctx->mach = read32(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 4;
+}
+
+// LDS.L   @Rm+,MACL
+INTERPRETER(LDSMMACL) {
+  ctx->macl = read32(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 4;
+}
+
+// LDS.L   @Rm+,PR
+INTERPRETER(LDSMPR) {
+  ctx->pr = read32(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 4;
+}
+
+// MOVCA.L     R0,@Rn
+INTERPRETER(MOVCAL) {
+  write32(ctx->r[i->Rn], ctx->r[0]);
+}
+
+// NOP
+INTERPRETER(NOP) {}
+
+// OCBI
+INTERPRETER(OCBI) {}
+
+// OCBP
+INTERPRETER(OCBP) {}
+
+// OCBWB
+INTERPRETER(OCBWB) {}
+
+// PREF     @Rn
+INTERPRETER(PREF) {
+  ctx->Prefetch(ctx, (uint64_t)ctx->r[i->Rn]);
+}
+
+// RTE
+INTERPRETER(RTE) {
+  uint32_t spc = ctx->spc;
+  store_sr(ctx->ssr);
+  run_delay_instr();
+  ctx->pc = spc;
+  profile_return(spc);
+}
+
+// SETS
+INTERPRETER(SETS) {
+  store_sr(load_sr() | S);
+}
+
+// SETT
+INTERPRETER(SETT) {
+  store_t(1);
+}
+
+// SLEEP
+INTERPRETER(SLEEP) {
+  LOG_FATAL("SLEEP not implemented");
+}
+
+// STC     SR,Rn
+INTERPRETER(STCSR) {
+  ctx->r[i->Rn] = load_sr();
+}
+
+// STC     GBR,Rn
+INTERPRETER(STCGBR) {
+  ctx->r[i->Rn] = ctx->gbr;
+}
+
+// STC     VBR,Rn
+INTERPRETER(STCVBR) {
+  ctx->r[i->Rn] = ctx->vbr;
+}
+
+// STC     SSR,Rn
+INTERPRETER(STCSSR) {
+  ctx->r[i->Rn] = ctx->ssr;
+}
+
+// STC     SPC,Rn
+INTERPRETER(STCSPC) {
+  ctx->r[i->Rn] = ctx->spc;
+}
+
+// STC     SGR,Rn
+INTERPRETER(STCSGR) {
+  ctx->r[i->Rn] = ctx->sgr;
+}
+
+// STC     DBR,Rn
+INTERPRETER(STCDBR) {
+  ctx->r[i->Rn] = ctx->dbr;
+}
+
+// STC     Rm_BANK,Rn
+INTERPRETER(STCRBANK) {
+  ctx->r[i->Rn] = ctx->ralt[i->Rm & 0x7];
+}
+
+// STC.L   SR,@-Rn
+INTERPRETER(STCMSR) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], load_sr());
+}
+
+// STC.L   GBR,@-Rn
+INTERPRETER(STCMGBR) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->gbr);
+}
+
+// STC.L   VBR,@-Rn
+INTERPRETER(STCMVBR) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->vbr);
+}
+
+// STC.L   SSR,@-Rn
+INTERPRETER(STCMSSR) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->ssr);
+}
+
+// STC.L   SPC,@-Rn
+INTERPRETER(STCMSPC) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->spc);
+}
+
+// STC.L   SGR,@-Rn
+INTERPRETER(STCMSGR) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->sgr);
+}
+
+// STC.L   DBR,@-Rn
+INTERPRETER(STCMDBR) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->dbr);
+}
+
+// STC.L   Rm_BANK,@-Rn
+INTERPRETER(STCMRBANK) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->ralt[i->Rm & 0x7]);
+}
+
+// STS     MACH,Rn
+INTERPRETER(STSMACH) {
+  ctx->r[i->Rn] = ctx->mach;
+}
+
+// STS     MACL,Rn
+INTERPRETER(STSMACL) {
+  ctx->r[i->Rn] = ctx->macl;
+}
+
+// STS     PR,Rn
+INTERPRETER(STSPR) {
+  ctx->r[i->Rn] = ctx->pr;
+}
+
+// STS.L   MACH,@-Rn
+INTERPRETER(STSMMACH) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->mach);
+}
+
+// STS.L   MACL,@-Rn
+INTERPRETER(STSMMACL) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->macl);
+}
+
+// STS.L   PR,@-Rn
+INTERPRETER(STSMPR) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->pr);
+}
+
+// TRAPA   #imm
+INTERPRETER(TRAPA) {
+  LOG_FATAL("TRAPA not implemented");
+}
+
+// FLDI0  FRn 1111nnnn10001101
+INTERPRETER(FLDI0) {
+  fpr_i32(i->Rn) = 0;
+}
+
+// FLDI1  FRn 1111nnnn10011101
+INTERPRETER(FLDI1) {
+  fpr_i32(i->Rn) = 0x3F800000;
+}
+
+// FMOV    FRm,FRn 1111nnnnmmmm1100
+// FMOV    DRm,DRn 1111nnn0mmm01100
+// FMOV    XDm,DRn 1111nnn0mmm11100
+// FMOV    DRm,XDn 1111nnn1mmm01100
+// FMOV    XDm,XDn 1111nnn1mmm11100
+INTERPRETER(FMOV) {
+  if (double_sz()) {
+    uint32_t *rm = sh4_interp_pair(ctx, i->Rm);
+    uint32_t *rn = sh4_interp_pair(ctx, i->Rn);
+    rn[0] = rm[0];
+    rn[1] = rm[1];
+  } else {
+    fpr_i32(i->Rn) = fpr_i32(i->Rm);
+  }
+}
+
+// FMOV.S  @Rm,FRn 1111nnnnmmmm1000
+// FMOV    @Rm,DRn 1111nnn0mmmm1000
+// FMOV    @Rm,XDn 1111nnn1mmmm1000
+INTERPRETER(FMOV_LOAD) {
+  uint32_t addr = ctx->r[i->Rm];
+
+  if (double_sz()) {
+    uint32_t *rn = sh4_interp_pair(ctx, i->Rn);
+    rn[1] = read32(addr);
+    rn[0] = read32(addr + 4);
+  } else {
+    fpr_i32(i->Rn) = read32(addr);
+  }
+}
+
+// FMOV.S  @(R0,Rm),FRn 1111nnnnmmmm0110
+// FMOV    @(R0,Rm),DRn 1111nnn0mmmm0110
+// FMOV    @(R0,Rm),XDn 1111nnn1mmmm0110
+INTERPRETER(FMOV_INDEX_LOAD) {
+  uint32_t addr = ctx->r[0] + ctx->r[i->Rm];
+
+  if (double_sz()) {
+    uint32_t *rn = sh4_interp_pair(ctx, i->Rn);
+    rn[1] = read32(addr);
+    rn[0] = read32(addr + 4);
+  } else {
+    fpr_i32(i->Rn) = read32(addr);
+  }
+}
+
+// FMOV.S  FRm,@Rn 1111nnnnmmmm1010
+// FMOV    DRm,@Rn 1111nnnnmmm01010
+// FMOV    XDm,@Rn 1111nnnnmmm11010
+INTERPRETER(FMOV_STORE) {
+  uint32_t addr = ctx->r[i->Rn];
+
+  if (double_sz()) {
+    uint32_t *rm = sh4_interp_pair(ctx, i->Rm);
+    write32(addr, rm[1]);
+    write32(addr + 4, rm[0]);
+  } else {
+    write32(addr, fpr_i32(i->Rm));
+  }
+}
+
+// FMOV.S  FRm,@(R0,Rn) 1111nnnnmmmm0111
+// FMOV    DRm,@(R0,Rn) 1111nnnnmmm00111
+// FMOV    XDm,@(R0,Rn) 1111nnnnmmm10111
+INTERPRETER(FMOV_INDEX_STORE) {
+  uint32_t addr = ctx->r[0] + ctx->r[i->Rn];
+
+  if (double_sz()) {
+    uint32_t *rm = sh4_interp_pair(ctx, i->Rm);
+    write32(addr, rm[1]);
+    write32(addr + 4, rm[0]);
+  } else {
+    write32(addr, fpr_i32(i->Rm));
+  }
+}
+
+// FMOV.S  FRm,@-Rn 1111nnnnmmmm1011
+// FMOV    DRm,@-Rn 1111nnnnmmm01011
+// FMOV    XDm,@-Rn 1111nnnnmmm11011
+INTERPRETER(FMOV_SAVE) {
+  if (double_sz()) {
+    uint32_t *rm = sh4_interp_pair(ctx, i->Rm);
+    ctx->r[i->Rn] -= 8;
+    write32(ctx->r[i->Rn], rm[1]);
+    write32(ctx->r[i->Rn] + 4, rm[0]);
+  } else {
+    ctx->r[i->Rn] -= 4;
+    write32(ctx->r[i->Rn], fpr_i32(i->Rm));
+  }
+}
+
+// FMOV.S  @Rm+,FRn 1111nnnnmmmm1001
+// FMOV    @Rm+,DRn 1111nnn0mmmm1001
+// FMOV    @Rm+,XDn 1111nnn1mmmm1001
+INTERPRETER(FMOV_RESTORE) {
+  uint32_t addr = ctx->r[i->Rm];
+
+  if (double_sz()) {
+    uint32_t *rn = sh4_interp_pair(ctx, i->Rn);
+    rn[1] = read32(addr);
+    rn[0] = read32(addr + 4);
+    ctx->r[i->Rm] = addr + 8;
+  } else {
+    fpr_i32(i->Rn) = read32(addr);
+    ctx->r[i->Rm] = addr + 4;
+  }
+}
+
+// FLDS FRm,FPUL 1111mmmm00011101
+INTERPRETER(FLDS) {
+  ctx->fpul = fpr_i32(i->Rm);
+}
+
+// FSTS FPUL,FRn 1111nnnn00001101
+INTERPRETER(FSTS) {
+  fpr_i32(i->Rn) = ctx->fpul;
+}
+
+// FABS FRn PR=0 1111nnnn01011101
+// FABS DRn PR=1 1111nnn001011101
+INTERPRETER(FABS) {
+  if (double_pr()) {
+    int n = i->Rn & 0xe;
+    store_fpr_f64(n, fabs(load_fpr_f64(n)));
+  } else {
+    store_fpr_f32(i->Rn, fabsf(load_fpr_f32(i->Rn)));
+  }
+}
+
+// FSRRA FRn PR=0 1111nnnn01111101
+INTERPRETER(FSRRA) {
+  store_fpr_f32(i->Rn, 1.0f / sqrtf(load_fpr_f32(i->Rn)));
+}
+
+// FADD FRm,FRn PR=0 1111nnnnmmmm0000
+// FADD DRm,DRn PR=1 1111nnn0mmm00000
+INTERPRETER(FADD) {
+  if (double_pr()) {
+    int n = i->Rn & 0xe;
+    int m = i->Rm & 0xe;
+    store_fpr_f64(n, load_fpr_f64(n) + load_fpr_f64(m));
+  } else {
+    store_fpr_f32(i->Rn, load_fpr_f32(i->Rn) + load_fpr_f32(i->Rm));
+  }
+}
+
+// FCMP/EQ FRm,FRn PR=0 1111nnnnmmmm0100
+// FCMP/EQ DRm,DRn PR=1 1111nnn0mmm00100
+INTERPRETER(FCMPEQ) {
+  if (double_pr()) {
+    store_t(load_fpr_f64(i->Rn & 0xe) == load_fpr_f64(i->Rm & 0xe));
+  } else {
+    store_t(load_fpr_f32(i->Rn) == load_fpr_f32(i->Rm));
+  }
+}
+
+// FCMP/GT FRm,FRn PR=0 1111nnnnmmmm0101
+// FCMP/GT DRm,DRn PR=1 1111nnn0mmm00101
+INTERPRETER(FCMPGT) {
+  if (double_pr()) {
+    store_t(load_fpr_f64(i->Rn & 0xe) > load_fpr_f64(i->Rm & 0xe));
+  } else {
+    store_t(load_fpr_f32(i->Rn) > load_fpr_f32(i->Rm));
+  }
+}
+
+// FDIV FRm,FRn PR=0 1111nnnnmmmm0011
+// FDIV DRm,DRn PR=1 1111nnn0mmm00011
+INTERPRETER(FDIV) {
+  if (double_pr()) {
+    int n = i->Rn & 0xe;
+    int m = i->Rm & 0xe;
+    store_fpr_f64(n, load_fpr_f64(n) / load_fpr_f64(m));
+  } else {
+    store_fpr_f32(i->Rn, load_fpr_f32(i->Rn) / load_fpr_f32(i->Rm));
+  }
+}
+
+// FLOAT FPUL,FRn PR=0 1111nnnn00101101
+// FLOAT FPUL,DRn PR=1 1111nnn000101101
+INTERPRETER(FLOAT) {
+  if (double_pr()) {
+    store_fpr_f64(i->Rn & 0xe, (double)(int32_t)ctx->fpul);
+  } else {
+    store_fpr_f32(i->Rn, (float)(int32_t)ctx->fpul);
+  }
+}
+
+// FMAC FR0,FRm,FRn PR=0 1111nnnnmmmm1110
+INTERPRETER(FMAC) {
+  CHECK(!double_pr());
+
+  float v = load_fpr_f32(0) * load_fpr_f32(i->Rm) + load_fpr_f32(i->Rn);
+  store_fpr_f32(i->Rn, v);
+}
+
+// FMUL FRm,FRn PR=0 1111nnnnmmmm0010
+// FMUL DRm,DRn PR=1 1111nnn0mmm00010
+INTERPRETER(FMUL) {
+  if (double_pr()) {
+    int n = i->Rn & 0xe;
+    int m = i->Rm & 0xe;
+    store_fpr_f64(n, load_fpr_f64(n) * load_fpr_f64(m));
+  } else {
+    store_fpr_f32(i->Rn, load_fpr_f32(i->Rn) * load_fpr_f32(i->Rm));
+  }
+}
+
+// FNEG FRn PR=0 1111nnnn01001101
+// FNEG DRn PR=1 1111nnn001001101
+INTERPRETER(FNEG) {
+  if (double_pr()) {
+    int n = i->Rn & 0xe;
+    store_fpr_f64(n, -load_fpr_f64(n));
+  } else {
+    store_fpr_f32(i->Rn, -load_fpr_f32(i->Rn));
+  }
+}
+
+// FSQRT FRn PR=0 1111nnnn01101101
+// FSQRT DRn PR=1 1111nnnn01101101
+INTERPRETER(FSQRT) {
+  if (double_pr()) {
+    int n = i->Rn & 0xe;
+    store_fpr_f64(n, sqrt(load_fpr_f64(n)));
+  } else {
+    store_fpr_f32(i->Rn, sqrtf(load_fpr_f32(i->Rn)));
+  }
+}
+
+// FSUB FRm,FRn PR=0 1111nnnnmmmm0001
+// FSUB DRm,DRn PR=1 1111nnn0mmm00001
+INTERPRETER(FSUB) {
+  if (double_pr()) {
+    int n = i->Rn & 0xe;
+    int m = i->Rm & 0xe;
+    store_fpr_f64(n, load_fpr_f64(n) - load_fpr_f64(m));
+  } else {
+    store_fpr_f32(i->Rn, load_fpr_f32(i->Rn) - load_fpr_f32(i->Rm));
+  }
+}
+
+// FTRC FRm,FPUL PR=0 1111mmmm00111101
+// FTRC DRm,FPUL PR=1 1111mmm000111101
+INTERPRETER(FTRC) {
+  if (double_pr()) {
+    ctx->fpul = sh4_interp_ftrc_f64(load_fpr_f64(i->Rm & 0xe));
+  } else {
+    ctx->fpul = sh4_interp_ftrc_f32(load_fpr_f32(i->Rm));
+  }
+}
+
+// FCNVDS DRm,FPUL PR=1 1111mmm010111101
+INTERPRETER(FCNVDS) {
+  CHECK(double_pr());
+
+  ctx->fpul = sh4_interp_i32((float)load_fpr_f64(i->Rm & 0xe));
+}
+
+// FCNVSD FPUL, DRn PR=1 1111nnn010101101
+INTERPRETER(FCNVSD) {
+  CHECK(double_pr());
+
+  store_fpr_f64(i->Rn & 0xe, (double)sh4_interp_f32(ctx->fpul));
+}
+
+// LDS     Rm,FPSCR
+INTERPRETER(LDSFPSCR) {
+  store_fpscr(ctx->r[i->Rm]);
+}
+
+// LDS     Rm,FPUL
+INTERPRETER(LDSFPUL) {
+  ctx->fpul = ctx->r[i->Rm];
+}
+
+// LDS.L   @Rm+,FPSCR
+INTERPRETER(LDSMFPSCR) {
+  uint32_t addr = ctx->r[i->Rm];
+  store_fpscr(read32(addr));
+  ctx->r[i->Rm] = addr + 4;
+}
+
+// LDS.L   @Rm+,FPUL
+INTERPRETER(LDSMFPUL) {
+  ctx->fpul = read32(ctx->r[i->Rm]);
+  ctx->r[i->Rm] += 4;
+}
+
+// STS     FPSCR,Rn
+INTERPRETER(STSFPSCR) {
+  ctx->r[i->Rn] = load_fpscr();
+}
+
+// STS     FPUL,Rn
+INTERPRETER(STSFPUL) {
+  ctx->r[i->Rn] = ctx->fpul;
+}
+
+// STS.L   FPSCR,@-Rn
+INTERPRETER(STSMFPSCR) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], load_fpscr());
+}
+
+// STS.L   FPUL,@-Rn
+INTERPRETER(STSMFPUL) {
+  ctx->r[i->Rn] -= 4;
+  write32(ctx->r[i->Rn], ctx->fpul);
+}
+
+// FIPR FVm,FVn PR=0 1111nnmm11101101
+INTERPRETER(FIPR) {
+  int m = i->Rm << 2;
+  int n = i->Rn << 2;
+
+  float dp = 0.0f;
+  for (int j = 0; j < 4; j++) {
+    dp += load_fpr_f32(n + j) * load_fpr_f32(m + j);
+  }
+  store_fpr_f32(n + 3, dp);
+}
+
+// FSCA FPUL,DRn PR=0 1111nnn011111101
+INTERPRETER(FSCA) {
+  int n = i->Rn << 1;
+
+  const uint32_t *entry = &ctx->fsca_table[(ctx->fpul & 0xffff) << 1];
+  fpr_i32(n) = entry[0];
+  fpr_i32(n + 1) = entry[1];
+}
+
+// FTRV XMTRX,FVn PR=0 1111nn0111111101
+INTERPRETER(FTRV) {
+  int n = i->Rn << 2;
+
+  float fv[4];
+  for (int j = 0; j < 4; j++) {
+    fv[j] = load_fpr_f32(n + j);
+  }
+
+  // XMTRX is stored column-major, xf0-xf3 being its first column
+  for (int j = 0; j < 4; j++) {
+    float v = 0.0f;
+    for (int k = 0; k < 4; k++) {
+      v += load_xfr_f32(k * 4 + j) * fv[k];
+    }
+    store_fpr_f32(n + j, v);
+  }
+}
+
+// FRCHG 1111101111111101
+INTERPRETER(FRCHG) {
+  store_fpscr(load_fpscr() ^ FR);
+}
+
+// FSCHG 1111001111111101
+INTERPRETER(FSCHG) {
+  store_fpscr(load_fpscr() ^ SZ);
+}
+
+void sh4_interp_block(struct jit_memory_interface *memory_if,
+                      struct sh4_ctx *ctx, uint32_t guest_addr,
+                      uint8_t *guest_ptr) {
+  uint32_t addr = guest_addr;
+
+  // run the same span of instructions sh4_analyze_block would produce for a
+  // compiled block, so the dispatcher sees the same block boundaries for both.
+  // note, static branches are never followed here, superblocks only exist to
+  // give the optimization passes a larger unit to work with
+  while (true) {
+    struct sh4_instr instr = {0};
+    instr.addr = addr;
+    instr.opcode = *(uint16_t *)(guest_ptr + (addr - guest_addr));
+
+    // end the block on an invalid instruction. if it's the first one, let the
+    // context know it was hit, consuming a cycle to ensure progress
+    if (!sh4_disasm(&instr)) {
+      ctx->pc = addr;
+
+      if (addr == guest_addr) {
+        ctx->InvalidInstruction(ctx, addr);
+        ctx->num_cycles--;
+      }
+
+      break;
+    }
+
+    struct sh4_instr delay = {0};
+    int step = 2;
+
+    if (instr.flags & SH4_FLAG_DELAYED) {
+      delay.addr = addr + 2;
+      delay.opcode = *(uint16_t *)(guest_ptr + (delay.addr - guest_addr));
+
+      // instruction must be valid, breakpoints on delay instructions aren't
+      // currently supported
+      CHECK(sh4_disasm(&delay));
+
+      // delay instruction itself should never have a delay instr
+      CHECK(!(delay.flags & SH4_FLAG_DELAYED));
+
+      step = 4;
+    }
+
+    // default to falling through to the next instruction, branches overwrite
+    // this with their destination
+    ctx->pc = addr + step;
+
+    sh4_interp_instr(memory_if, ctx, &instr, &delay);
+
+    ctx->num_cycles -= instr.cycles + delay.cycles;
+    ctx->num_instrs += step >> 1;
+    addr += step;
+
+    // stop at the same points the block analysis does
+    if (instr.flags &
+        (SH4_FLAG_BRANCH | SH4_FLAG_SET_FPSCR | SH4_FLAG_SET_SR)) {
+      break;
+    }
+  }
+}
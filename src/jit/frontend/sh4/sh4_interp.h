@@ -0,0 +1,13 @@
+#ifndef SH4_INTERP_H
+#define SH4_INTERP_H
+
+#include <stdint.h>
+
+struct jit_memory_interface;
+struct sh4_ctx;
+
+void sh4_interp_block(struct jit_memory_interface *memory_if,
+                      struct sh4_ctx *ctx, uint32_t guest_addr,
+                      uint8_t *guest_ptr);
+
+#endif
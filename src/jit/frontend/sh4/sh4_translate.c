@@ -10,7 +10,7 @@
 //
 // fsca estimate lookup table
 //
-static uint32_t s_fsca_table[0x20000] = {
+const uint32_t sh4_fsca_table[0x20000] = {
 #include "jit/frontend/sh4/sh4_fsca.inc"
 };
 
@@ -77,26 +77,39 @@ static emit_cb emit_callbacks[NUM_SH4_OPS] = {
     ir_store_context(ir, offsetof(struct sh4_ctx, xf[tmp]), v); \
   } while (0)
 
-#define load_sr() ir_load_context(ir, offsetof(struct sh4_ctx, sr), VALUE_I32)
+// the full sr value, with the T bit merged in from sr_t. see the notes in
+// sh4_context.h
+#define load_sr()                                                        \
+  ir_or(ir, ir_and(ir, ir_load_context(ir, offsetof(struct sh4_ctx, sr), \
+                                       VALUE_I32),                       \
+                   ir_alloc_i32(ir, ~T)),                                \
+        load_t())
 
 #define store_sr(v)                                                          \
   do {                                                                       \
-    CHECK_EQ(v->type, VALUE_I32);                                            \
+    struct ir_value *new_sr = v;                                             \
+    CHECK_EQ(new_sr->type, VALUE_I32);                                       \
     struct ir_value *sr_updated =                                            \
         ir_load_context(ir, offsetof(struct sh4_ctx, SRUpdated), VALUE_I64); \
-    struct ir_value *old_sr = load_sr();                                     \
-    ir_store_context(ir, offsetof(struct sh4_ctx, sr), v);                   \
+    struct ir_value *old_sr =                                                \
+        ir_load_context(ir, offsetof(struct sh4_ctx, sr), VALUE_I32);        \
+    ir_store_context(ir, offsetof(struct sh4_ctx, sr), new_sr);              \
+    ir_store_context(ir, offsetof(struct sh4_ctx, sr_t),                     \
+                     ir_and(ir, new_sr, ir_alloc_i32(ir, T)));               \
     ir_call_external_2(ir, sr_updated, ir_zext(ir, old_sr, VALUE_I64));      \
   } while (0)
 
-#define load_t() ir_and(ir, load_sr(), ir_alloc_i32(ir, T))
-
-#define store_t(v)                                                  \
-  do {                                                              \
-    struct ir_value *sr = load_sr();                                \
-    struct ir_value *sr_t = ir_or(ir, sr, ir_alloc_i32(ir, T));     \
-    struct ir_value *sr_not = ir_and(ir, sr, ir_alloc_i32(ir, ~T)); \
-    store_sr(ir_select(ir, v, sr_t, sr_not));                       \
+#define load_t() ir_load_context(ir, offsetof(struct sh4_ctx, sr_t), VALUE_I32)
+
+// the value stored must be either 0 or 1, comparison results are widened
+#define store_t(v)                                               \
+  do {                                                           \
+    struct ir_value *new_t = v;                                  \
+    if (new_t->type == VALUE_I8) {                               \
+      new_t = ir_zext(ir, new_t, VALUE_I32);                     \
+    }                                                            \
+    CHECK_EQ(new_t->type, VALUE_I32);                            \
+    ir_store_context(ir, offsetof(struct sh4_ctx, sr_t), new_t); \
   } while (0)
 
 #define load_gbr() ir_load_context(ir, offsetof(struct sh4_ctx, gbr), VALUE_I32)
@@ -132,6 +145,33 @@ static emit_cb emit_callbacks[NUM_SH4_OPS] = {
 
 #define emit_delay_instr() sh4_emit_instr(ir, flags, delay, NULL)
 
+// calls and returns are reported to the profiler's shadow call stack when
+// profiling. the target and return address of a call are packed into the
+// single argument external calls take
+#define profile_call(target, ret_addr)                               \
+  do {                                                               \
+    if (flags & SH4_PROFILE) {                                       \
+      struct ir_value *call_fn =                                     \
+          ir_load_context(ir, offsetof(struct sh4_ctx, ProfileCall), \
+                          VALUE_I64);                                \
+      struct ir_value *target_ret = ir_or(                           \
+          ir, ir_zext(ir, target, VALUE_I64),                        \
+          ir_alloc_i64(ir, (int64_t)((uint64_t)(ret_addr) << 32)));  \
+      ir_call_external_2(ir, call_fn, target_ret);                   \
+    }                                                                \
+  } while (0)
+
+#define profile_return(ret_addr)                                       \
+  do {                                                                 \
+    if (flags & SH4_PROFILE) {                                         \
+      struct ir_value *return_fn =                                     \
+          ir_load_context(ir, offsetof(struct sh4_ctx, ProfileReturn), \
+                          VALUE_I64);                                  \
+      ir_call_external_2(ir, return_fn,                                \
+                         ir_zext(ir, ret_addr, VALUE_I64));            \
+    }                                                                  \
+  } while (0)
+
 static void sh4_invalid_instr(struct ir *ir, uint32_t guest_addr) {
   struct ir_value *invalid_instruction = ir_load_context(
       ir, offsetof(struct sh4_ctx, InvalidInstruction), VALUE_I64);
@@ -145,6 +185,15 @@ static void sh4_emit_instr(struct ir *ir, int flags,
   (emit_callbacks[instr->op])(ir, flags, instr, delay);
 }
 
+static void sh4_emit_literal(struct ir *ir, const struct sh4_instr *i,
+                             const uint8_t *ptr, int size) {
+  // emit a pc-relative load whose literal was read at translation time. the
+  // block is invalidated if the literal is ever written to
+  struct ir_value *v = size == 2 ? ir_alloc_i32(ir, *(int16_t *)ptr)
+                                 : ir_alloc_i32(ir, *(int32_t *)ptr);
+  store_gpr(i->Rn, v);
+}
+
 // MOV     #imm,Rn
 EMITTER(MOVI) {
   struct ir_value *v = ir_alloc_i32(ir, (int32_t)(int8_t)i->imm);
@@ -517,6 +566,7 @@ EMITTER(ADDC) {
   struct ir_value *not_v = ir_not(ir, v);
   struct ir_value *carry = ir_and(ir, or_rnrm, not_v);
   carry = ir_or(ir, and_rnrm, carry);
+  carry = ir_lshri(ir, carry, 31);
   store_t(carry);
 }
 
@@ -649,7 +699,7 @@ EMITTER(DIV0U) {  //
   ir_store_context(ir, offsetof(struct sh4_ctx, sr_qm),
                    ir_alloc_i32(ir, 0x80000000));
 
-  store_sr(ir_and(ir, load_sr(), ir_alloc_i32(ir, ~T)));
+  store_t(ir_alloc_i32(ir, 0));
 }
 
 // code                 cycles  t-bit
@@ -800,7 +850,8 @@ EMITTER(NEGC) {
   struct ir_value *t = load_t();
   struct ir_value *v = ir_sub(ir, ir_neg(ir, rm), t);
   store_gpr(i->Rn, v);
-  struct ir_value *carry = ir_or(ir, t, rm);
+  struct ir_value *carry =
+      ir_cmp_ne(ir, ir_or(ir, t, rm), ir_alloc_i32(ir, 0));
   store_t(carry);
 }
 
@@ -824,6 +875,7 @@ EMITTER(SUBC) {
   struct ir_value *l = ir_and(ir, ir_not(ir, rn), rm);
   struct ir_value *r = ir_and(ir, ir_or(ir, ir_not(ir, rn), rm), v);
   struct ir_value *carry = ir_or(ir, l, r);
+  carry = ir_lshri(ir, carry, 31);
   store_t(carry);
 }
 
@@ -1180,6 +1232,7 @@ EMITTER(BSR) {
   uint32_t ret_addr = i->addr + 4;
   uint32_t dest_addr = ret_addr + disp * 2;
   store_pr(ir_alloc_i32(ir, ret_addr));
+  profile_call(ir_alloc_i32(ir, dest_addr), ret_addr);
   ir_branch(ir, ir_alloc_i32(ir, dest_addr));
 }
 
@@ -1192,6 +1245,7 @@ EMITTER(BSRF) {
   struct ir_value *ret_addr = ir_alloc_i32(ir, i->addr + 4);
   struct ir_value *dest_addr = ir_add(ir, rn, ret_addr);
   store_pr(ret_addr);
+  profile_call(dest_addr, i->addr + 4);
   ir_branch(ir, dest_addr);
 }
 
@@ -1208,6 +1262,7 @@ EMITTER(JSR) {
   emit_delay_instr();
   struct ir_value *ret_addr = ir_alloc_i32(ir, i->addr + 4);
   store_pr(ret_addr);
+  profile_call(dest_addr, i->addr + 4);
   ir_branch(ir, dest_addr);
 }
 
@@ -1215,6 +1270,7 @@ EMITTER(JSR) {
 EMITTER(RTS) {
   struct ir_value *dest_addr = load_pr();
   emit_delay_instr();
+  profile_return(dest_addr);
   ir_branch(ir, dest_addr);
 }
 
@@ -1427,6 +1483,7 @@ EMITTER(RTE) {
       ir_load_context(ir, offsetof(struct sh4_ctx, ssr), VALUE_I32);
   store_sr(ssr);
   emit_delay_instr();
+  profile_return(spc);
   ir_branch(ir, spc);
 }
 
@@ -2130,7 +2187,8 @@ EMITTER(FSCA) {
       ir_load_context(ir, offsetof(struct sh4_ctx, fpul), VALUE_I16);
   fpul = ir_zext(ir, fpul, VALUE_I64);
 
-  struct ir_value *fsca_table = ir_alloc_i64(ir, (int64_t)s_fsca_table);
+  struct ir_value *fsca_table =
+      ir_load_context(ir, offsetof(struct sh4_ctx, fsca_table), VALUE_I64);
   struct ir_value *fsca_offset = ir_shli(ir, fpul, 3);
   struct ir_value *addr = ir_add(ir, fsca_table, fsca_offset);
 
@@ -2176,30 +2234,54 @@ EMITTER(FSCHG) {
   store_fpscr(v);
 }
 
+// emit a static branch which has been merged into the block. the branch
+// itself is dropped, translation continues at its destination
+static void sh4_emit_merged_branch(struct ir *ir, int flags,
+                                   const struct sh4_instr *i,
+                                   const struct sh4_instr *delay) {
+  emit_delay_instr();
+
+  if (i->op == SH4_OP_BSR) {
+    int32_t disp = ((i->disp & 0xfff) << 20) >> 20;
+    uint32_t ret_addr = i->addr + 4;
+    store_pr(ir_alloc_i32(ir, ret_addr));
+    profile_call(ir_alloc_i32(ir, ret_addr + disp * 2), ret_addr);
+  }
+}
+
 void sh4_translate(uint32_t guest_addr, uint8_t *guest_ptr, int size, int flags,
                    struct ir *ir) {
   // PROFILER_RUNTIME("SH4ir::Emit");
-  struct sh4_instr delay_instr;
+  struct sh4_instr delay_instr = {0};
 
-  int i = 0;
+  uint32_t addr = guest_addr;
+  uint32_t end_addr = guest_addr + size;
+  int num_instrs = 0;
   int guest_cycles = 0;
 
-  while (i < size) {
+  while (addr < end_addr) {
     struct sh4_instr instr = {0};
-    instr.addr = guest_addr + i;
-    instr.opcode = *(uint16_t *)(guest_ptr + i);
+    instr.addr = addr;
+    instr.opcode = *(uint16_t *)(guest_ptr + (addr - guest_addr));
 
     if (!sh4_disasm(&instr)) {
       sh4_invalid_instr(ir, instr.addr);
       break;
     }
 
-    i += 2;
+    // mark where the instr's code begins, so the host code can be mapped back
+    // to it once assembled
+    if (flags & SH4_SOURCE_INFO) {
+      ir_source_info(ir, instr.addr);
+    }
+
+    addr += 2;
+    num_instrs++;
     guest_cycles += instr.cycles;
 
     if (instr.flags & SH4_FLAG_DELAYED) {
-      delay_instr.addr = guest_addr + i;
-      delay_instr.opcode = *(uint16_t *)(guest_ptr + i);
+      delay_instr.addr = addr;
+      delay_instr.opcode = *(uint16_t *)(guest_ptr + (addr - guest_addr));
 
       // instruction must be valid, breakpoints on delay instructions aren't
       // currently supported
@@ -2208,10 +2290,30 @@ void sh4_translate(uint32_t guest_addr, uint8_t *guest_ptr, int size, int flags,
       // delay instruction itself should never have a delay instr
       CHECK(!(delay_instr.flags & SH4_FLAG_DELAYED));
 
-      i += 2;
+      addr += 2;
+      num_instrs++;
       guest_cycles += delay_instr.cycles;
     }
 
+    // continue at the destination of static branches merged into the block
+    // by sh4_analyze_block
+    uint32_t dest_addr;
+    if (sh4_analyze_merge_branch(guest_addr, addr, &instr, &delay_instr, flags,
+                                 num_instrs, &dest_addr)) {
+      sh4_emit_merged_branch(ir, flags, &instr, &delay_instr);
+      addr = dest_addr;
+      continue;
+    }
+
+    // fold loads from the literal pool into constants
+    uint32_t lit_addr;
+    int lit_size;
+    if (sh4_analyze_literal(guest_addr, &instr, &lit_addr, &lit_size)) {
+      sh4_emit_literal(ir, &instr, guest_ptr + (lit_addr - guest_addr),
+                       lit_size);
+      continue;
+    }
+
     sh4_emit_instr(ir, flags, &instr, &delay_instr);
   }
 
@@ -2219,9 +2321,12 @@ void sh4_translate(uint32_t guest_addr, uint8_t *guest_ptr, int size, int flags,
       list_last_entry(&ir->instrs, struct ir_instr, it);
 
   // if the block was terminated before a branch instruction, emit a
-  // fallthrough branch to the next pc
-  if (tail_instr->op != OP_BRANCH && tail_instr->op != OP_BRANCH_COND) {
-    ir_branch(ir, ir_alloc_i32(ir, guest_addr + i));
+  // fallthrough branch to the next pc. note, the block may be empty when it
+  // consists of nothing but merged branches with empty delay slots
+  if (!tail_instr ||
+      (tail_instr->op != OP_BRANCH && tail_instr->op != OP_BRANCH_COND)) {
+    ir_branch(ir, ir_alloc_i32(ir, addr));
+    tail_instr = list_last_entry(&ir->instrs, struct ir_instr, it);
   }
 
   // emit block epilog
@@ -2234,8 +2339,9 @@ void sh4_translate(uint32_t guest_addr, uint8_t *guest_ptr, int size, int flags,
   ir_store_context(ir, offsetof(struct sh4_ctx, num_cycles), num_cycles);
 
   // update num instructions
-  struct ir_value *num_instrs =
+  struct ir_value *num_instrs_value =
       ir_load_context(ir, offsetof(struct sh4_ctx, num_instrs), VALUE_I32);
-  num_instrs = ir_add(ir, num_instrs, ir_alloc_i32(ir, size >> 1));
-  ir_store_context(ir, offsetof(struct sh4_ctx, num_instrs), num_instrs);
+  num_instrs_value =
+      ir_add(ir, num_instrs_value, ir_alloc_i32(ir, num_instrs));
+  ir_store_context(ir, offsetof(struct sh4_ctx, num_instrs), num_instrs_value);
 }
@@ -5,6 +5,8 @@
 
 struct ir;
 
+extern const uint32_t sh4_fsca_table[0x20000];
+
 void sh4_translate(uint32_t guest_addr, uint8_t *guest_ptr, int size, int flags,
                    struct ir *ir);
 
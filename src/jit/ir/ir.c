@@ -150,6 +150,10 @@ void ir_set_arg2(struct ir *ir, struct ir_instr *instr, struct ir_value *v) {
   ir_set_arg(ir, instr, 2, v);
 }
 
+void ir_set_arg3(struct ir *ir, struct ir_instr *instr, struct ir_value *v) {
+  ir_set_arg(ir, instr, 3, v);
+}
+
 void ir_replace_use(struct ir_use *use, struct ir_value *other) {
   if (*use->parg) {
     ir_remove_use(*use->parg, use);
@@ -242,6 +246,33 @@ void ir_store_slow(struct ir *ir, struct ir_value *addr, struct ir_value *v) {
   ir_set_arg1(ir, instr, v);
 }
 
+struct ir_value *ir_load_mmio(struct ir *ir, struct ir_value *fn,
+                              struct ir_value *data, struct ir_value *offset,
+                              enum ir_type type) {
+  CHECK(ir_is_constant(fn) && fn->type == VALUE_I64);
+  CHECK(ir_is_constant(data) && data->type == VALUE_I64);
+  CHECK(ir_is_constant(offset) && offset->type == VALUE_I32);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_LOAD_MMIO, type);
+  ir_set_arg0(ir, instr, fn);
+  ir_set_arg1(ir, instr, data);
+  ir_set_arg2(ir, instr, offset);
+  return instr->result;
+}
+
+void ir_store_mmio(struct ir *ir, struct ir_value *fn, struct ir_value *data,
+                   struct ir_value *offset, struct ir_value *v) {
+  CHECK(ir_is_constant(fn) && fn->type == VALUE_I64);
+  CHECK(ir_is_constant(data) && data->type == VALUE_I64);
+  CHECK(ir_is_constant(offset) && offset->type == VALUE_I32);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_STORE_MMIO, VALUE_V);
+  ir_set_arg0(ir, instr, fn);
+  ir_set_arg1(ir, instr, data);
+  ir_set_arg2(ir, instr, offset);
+  ir_set_arg3(ir, instr, v);
+}
+
 struct ir_value *ir_load_context(struct ir *ir, size_t offset,
                                  enum ir_type type) {
   struct ir_instr *instr = ir_append_instr(ir, OP_LOAD_CONTEXT, type);
@@ -537,6 +568,17 @@ struct ir_value *ir_fmul(struct ir *ir, struct ir_value *a,
   return instr->result;
 }
 
+struct ir_value *ir_fmadd(struct ir *ir, struct ir_value *a, struct ir_value *b,
+                          struct ir_value *c) {
+  CHECK(ir_is_float(a->type) && a->type == b->type && a->type == c->type);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_FMADD, a->type);
+  ir_set_arg0(ir, instr, a);
+  ir_set_arg1(ir, instr, b);
+  ir_set_arg2(ir, instr, c);
+  return instr->result;
+}
+
 struct ir_value *ir_fdiv(struct ir *ir, struct ir_value *a,
                          struct ir_value *b) {
   CHECK(ir_is_float(a->type) && a->type == b->type);
@@ -612,6 +654,20 @@ struct ir_value *ir_vmul(struct ir *ir, struct ir_value *a, struct ir_value *b,
   return instr->result;
 }
 
+struct ir_value *ir_vfmadd(struct ir *ir, struct ir_value *a,
+                           struct ir_value *b, struct ir_value *c,
+                           enum ir_type el_type) {
+  CHECK(ir_is_vector(a->type) && ir_is_vector(b->type) &&
+        ir_is_vector(c->type));
+  CHECK_EQ(el_type, VALUE_F32);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_VFMADD, a->type);
+  ir_set_arg0(ir, instr, a);
+  ir_set_arg1(ir, instr, b);
+  ir_set_arg2(ir, instr, c);
+  return instr->result;
+}
+
 struct ir_value *ir_and(struct ir *ir, struct ir_value *a, struct ir_value *b) {
   CHECK(is_is_int(a->type) && a->type == b->type);
 
@@ -737,3 +793,8 @@ void ir_call_external_2(struct ir *ir, struct ir_value *addr,
   ir_set_arg0(ir, instr, addr);
   ir_set_arg1(ir, instr, arg0);
 }
+
+void ir_source_info(struct ir *ir, uint32_t addr) {
+  struct ir_instr *instr = ir_append_instr(ir, OP_SOURCE_INFO, VALUE_V);
+  ir_set_arg0(ir, instr, ir_alloc_i32(ir, addr));
+}
@@ -80,7 +80,7 @@ struct ir_value {
   intptr_t tag;
 };
 
-#define MAX_INSTR_ARGS 3
+#define MAX_INSTR_ARGS 4
 
 struct ir_instr {
   enum ir_op op;
@@ -176,6 +176,42 @@ static inline bool ir_is_vector(enum ir_type type) {
 int ir_read(FILE *input, struct ir *ir);
 void ir_write(struct ir *ir, FILE *output);
 
+// compact binary encoding of the IR which, unlike the text format, preserves
+// register assignments and the size of the locals area so that it can be
+// assembled directly. ir_write_binary returns the number of bytes written, or
+// 0 if the output buffer was too small
+#define IR_BINARY_CONSTANT 0x80
+
+int ir_read_binary(const uint8_t *data, int size, struct ir *ir);
+int ir_write_binary(struct ir *ir, uint8_t *data, int size);
+
+// binary IR files hold a sequence of blocks, each stored as a versioned header,
+// followed by the guest code the block was translated from and its IR in the
+// binary encoding. blocks are self-contained, so files can be appended to and
+// concatenated. ir_read detects these files, reading the first block from them
+#define IR_FILE_MAGIC 0x46524952
+#define IR_FILE_VERSION 1
+
+struct ir_file_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_ops;
+  uint32_t guest_addr;
+  uint32_t guest_flags;
+  uint32_t guest_size;
+  uint32_t ir_size;
+};
+
+bool ir_file_is_binary(FILE *input);
+
+// reads the next block from a binary IR file, returning 0 at the end of the
+// file or if the block is malformed. the guest code is copied to guest when it
+// is non-NULL and large enough, and skipped otherwise
+int ir_read_file(FILE *input, struct ir *ir, struct ir_file_header *header,
+                 uint8_t *guest, int guest_capacity);
+int ir_write_file(struct ir *ir, uint32_t guest_addr, const uint8_t *guest,
+                  int guest_size, int guest_flags, FILE *output);
+
 struct ir_instr *ir_append_instr(struct ir *ir, enum ir_op op,
                                  enum ir_type result_type);
 void ir_remove_instr(struct ir *ir, struct ir_instr *instr);
@@ -193,6 +229,7 @@ void ir_set_arg(struct ir *ir, struct ir_instr *instr, int n,
 void ir_set_arg0(struct ir *ir, struct ir_instr *instr, struct ir_value *v);
 void ir_set_arg1(struct ir *ir, struct ir_instr *instr, struct ir_value *v);
 void ir_set_arg2(struct ir *ir, struct ir_instr *instr, struct ir_value *v);
+void ir_set_arg3(struct ir *ir, struct ir_instr *instr, struct ir_value *v);
 
 void ir_replace_use(struct ir_use *use, struct ir_value *other);
 void ir_replace_uses(struct ir_value *v, struct ir_value *other);
@@ -214,6 +251,14 @@ struct ir_value *ir_load_slow(struct ir *ir, struct ir_value *addr,
                               enum ir_type type);
 void ir_store_slow(struct ir *ir, struct ir_value *addr, struct ir_value *v);
 
+// direct calls to the handler of a memory mapped i/o region, fn(data, offset)
+// for loads and fn(data, offset, v) for stores
+struct ir_value *ir_load_mmio(struct ir *ir, struct ir_value *fn,
+                              struct ir_value *data, struct ir_value *offset,
+                              enum ir_type type);
+void ir_store_mmio(struct ir *ir, struct ir_value *fn, struct ir_value *data,
+                   struct ir_value *offset, struct ir_value *v);
+
 // context operations
 struct ir_value *ir_load_context(struct ir *ir, size_t offset,
                                  enum ir_type type);
@@ -288,6 +333,9 @@ struct ir_value *ir_abs(struct ir *ir, struct ir_value *a);
 struct ir_value *ir_fadd(struct ir *ir, struct ir_value *a, struct ir_value *b);
 struct ir_value *ir_fsub(struct ir *ir, struct ir_value *a, struct ir_value *b);
 struct ir_value *ir_fmul(struct ir *ir, struct ir_value *a, struct ir_value *b);
+// a * b + c, rounded once
+struct ir_value *ir_fmadd(struct ir *ir, struct ir_value *a, struct ir_value *b,
+                          struct ir_value *c);
 struct ir_value *ir_fdiv(struct ir *ir, struct ir_value *a, struct ir_value *b);
 struct ir_value *ir_fneg(struct ir *ir, struct ir_value *a);
 struct ir_value *ir_fabs(struct ir *ir, struct ir_value *a);
@@ -301,6 +349,10 @@ struct ir_value *ir_vdot(struct ir *ir, struct ir_value *a, struct ir_value *b,
                          enum ir_type el_type);
 struct ir_value *ir_vmul(struct ir *ir, struct ir_value *a, struct ir_value *b,
                          enum ir_type el_type);
+// a * b + c for each element, rounded once
+struct ir_value *ir_vfmadd(struct ir *ir, struct ir_value *a,
+                           struct ir_value *b, struct ir_value *c,
+                           enum ir_type el_type);
 
 // bitwise operations
 struct ir_value *ir_and(struct ir *ir, struct ir_value *a, struct ir_value *b);
@@ -326,4 +378,7 @@ void ir_call_external_1(struct ir *ir, struct ir_value *addr);
 void ir_call_external_2(struct ir *ir, struct ir_value *addr,
                         struct ir_value *arg0);
 
+// debug info
+void ir_source_info(struct ir *ir, uint32_t addr);
+
 #endif
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "jit/ir/ir_cache.h"
+#include "core/assert.h"
+#include "core/list.h"
+#include "core/log.h"
+#include "core/string.h"
+#include "jit/ir/ir.h"
+
+// bump whenever a change is made which affects the IR produced for a block,
+// e.g. a change to the frontend or optimization passes
+#define IR_CACHE_VERSION 6
+#define IR_CACHE_MAGIC 0x43524952
+
+#define IR_CACHE_BUCKET_BITS 16
+#define NUM_IR_CACHE_BUCKETS (1 << IR_CACHE_BUCKET_BITS)
+#define IR_CACHE_BUCKET(addr) (((addr) >> 1) & (NUM_IR_CACHE_BUCKETS - 1))
+
+struct ir_cache_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_ops;
+  uint32_t reserved;
+  uint64_t signature;
+};
+
+// each block is stored as a record, followed by its IR in the binary format
+struct ir_cache_record {
+  uint32_t guest_addr;
+  uint32_t flags;
+  uint32_t guest_size;
+  uint32_t ir_size;
+  uint64_t hash;
+};
+
+struct ir_cache_entry {
+  struct ir_cache_record record;
+  long offset;
+  struct list_node it;
+};
+
+struct ir_cache {
+  FILE *file;
+  long end;
+  int num_entries;
+  struct list buckets[NUM_IR_CACHE_BUCKETS];
+  uint8_t buffer[1024 * 1024];
+};
+
+static uint64_t ir_cache_hash(const uint8_t *data, int size) {
+  // 64-bit fnv-1a
+  uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+  for (int i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= UINT64_C(0x100000001b3);
+  }
+
+  return hash;
+}
+
+static void ir_cache_reset_ir(struct ir *ir) {
+  uint8_t *buffer = ir->buffer;
+  int capacity = ir->capacity;
+
+  memset(ir, 0, sizeof(*ir));
+  ir->buffer = buffer;
+  ir->capacity = capacity;
+}
+
+static void ir_cache_add_entry(struct ir_cache *cache,
+                               const struct ir_cache_record *record,
+                               long offset) {
+  struct ir_cache_entry *entry = calloc(1, sizeof(struct ir_cache_entry));
+  entry->record = *record;
+  entry->offset = offset;
+
+  list_add(&cache->buckets[IR_CACHE_BUCKET(record->guest_addr)], &entry->it);
+
+  cache->num_entries++;
+}
+
+static void ir_cache_load_index(struct ir_cache *cache) {
+  if (fseek(cache->file, 0, SEEK_END)) {
+    return;
+  }
+
+  long file_size = ftell(cache->file);
+
+  // read in each record's header, leaving the IR on disk until it's needed.
+  // a partially written record at the end of the file (e.g. from a crash) is
+  // ignored, and overwritten by the next insert
+  while (!fseek(cache->file, cache->end, SEEK_SET)) {
+    struct ir_cache_record record;
+
+    if (fread(&record, sizeof(record), 1, cache->file) != 1) {
+      break;
+    }
+
+    long offset = cache->end + (long)sizeof(record);
+
+    if (record.ir_size > sizeof(cache->buffer) ||
+        offset + (long)record.ir_size > file_size) {
+      break;
+    }
+
+    ir_cache_add_entry(cache, &record, offset);
+
+    cache->end = offset + record.ir_size;
+  }
+}
+
+bool ir_cache_lookup(struct ir_cache *cache, uint32_t guest_addr,
+                     const uint8_t *guest_ptr, int flags, int *size,
+                     struct ir *ir) {
+  struct list *bucket = &cache->buckets[IR_CACHE_BUCKET(guest_addr)];
+
+  list_for_each_entry(entry, bucket, struct ir_cache_entry, it) {
+    const struct ir_cache_record *record = &entry->record;
+
+    if (record->guest_addr != guest_addr || record->flags != (uint32_t)flags) {
+      continue;
+    }
+
+    // make sure the guest code hasn't changed since the block was cached
+    if (ir_cache_hash(guest_ptr, record->guest_size) != record->hash) {
+      continue;
+    }
+
+    if (fseek(cache->file, entry->offset, SEEK_SET) ||
+        fread(cache->buffer, record->ir_size, 1, cache->file) != 1) {
+      return false;
+    }
+
+    if (!ir_read_binary(cache->buffer, record->ir_size, ir)) {
+      LOG_WARNING("Failed to read cached IR for 0x%08x", guest_addr);
+      ir_cache_reset_ir(ir);
+      return false;
+    }
+
+    *size = record->guest_size;
+
+    return true;
+  }
+
+  return false;
+}
+
+void ir_cache_insert(struct ir_cache *cache, uint32_t guest_addr,
+                     const uint8_t *guest_ptr, int flags, int size,
+                     struct ir *ir) {
+  int ir_size = ir_write_binary(ir, cache->buffer, sizeof(cache->buffer));
+
+  if (!ir_size) {
+    return;
+  }
+
+  struct ir_cache_record record = {guest_addr, (uint32_t)flags, (uint32_t)size,
+                                   (uint32_t)ir_size,
+                                   ir_cache_hash(guest_ptr, size)};
+  long offset = cache->end + (long)sizeof(record);
+
+  if (fseek(cache->file, cache->end, SEEK_SET) ||
+      fwrite(&record, sizeof(record), 1, cache->file) != 1 ||
+      fwrite(cache->buffer, ir_size, 1, cache->file) != 1) {
+    LOG_WARNING("Failed to write cached IR for 0x%08x", guest_addr);
+    return;
+  }
+
+  ir_cache_add_entry(cache, &record, offset);
+
+  cache->end = offset + ir_size;
+}
+
+struct ir_cache *ir_cache_create(const char *filename, uint64_t signature) {
+  struct ir_cache *cache = calloc(1, sizeof(struct ir_cache));
+  struct ir_cache_header expected = {IR_CACHE_MAGIC, IR_CACHE_VERSION, NUM_OPS,
+                                     0, signature};
+
+  // open the existing cache, discarding it if it was written by a different
+  // version of the compiler
+  cache->file = fopen(filename, "r+b");
+
+  if (cache->file) {
+    struct ir_cache_header header;
+
+    if (fread(&header, sizeof(header), 1, cache->file) != 1 ||
+        memcmp(&header, &expected, sizeof(header))) {
+      LOG_INFO("Discarding out of date IR cache %s", filename);
+      fclose(cache->file);
+      cache->file = NULL;
+    }
+  }
+
+  if (!cache->file) {
+    cache->file = fopen(filename, "w+b");
+
+    if (!cache->file ||
+        fwrite(&expected, sizeof(expected), 1, cache->file) != 1) {
+      LOG_WARNING("Failed to create IR cache %s", filename);
+      ir_cache_destroy(cache);
+      return NULL;
+    }
+  }
+
+  cache->end = sizeof(expected);
+
+  ir_cache_load_index(cache);
+
+  LOG_INFO("Loaded %d blocks from IR cache %s", cache->num_entries, filename);
+
+  return cache;
+}
+
+void ir_cache_destroy(struct ir_cache *cache) {
+  for (int i = 0; i < NUM_IR_CACHE_BUCKETS; i++) {
+    list_for_each_entry_safe(entry, &cache->buckets[i], struct ir_cache_entry,
+                             it) {
+      free(entry);
+    }
+  }
+
+  if (cache->file) {
+    fclose(cache->file);
+  }
+
+  free(cache);
+}
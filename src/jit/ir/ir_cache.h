@@ -0,0 +1,23 @@
+#ifndef IR_CACHE_H
+#define IR_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct ir;
+struct ir_cache;
+
+// persistent cache of optimized, register allocated IR. blocks are keyed by
+// their guest address and compile flags, and are only returned when a hash of
+// the guest code they were translated from matches the code at the address
+struct ir_cache *ir_cache_create(const char *filename, uint64_t signature);
+void ir_cache_destroy(struct ir_cache *cache);
+
+bool ir_cache_lookup(struct ir_cache *cache, uint32_t guest_addr,
+                     const uint8_t *guest_ptr, int flags, int *size,
+                     struct ir *ir);
+void ir_cache_insert(struct ir_cache *cache, uint32_t guest_addr,
+                     const uint8_t *guest_ptr, int flags, int size,
+                     struct ir *ir);
+
+#endif
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include "jit/ir/ir.h"
 #include "core/string.h"
 
@@ -329,6 +330,11 @@ int ir_parse_instr(struct ir_parser *p, struct ir *ir) {
 }
 
 int ir_read(FILE *input, struct ir *ir) {
+  if (ir_file_is_binary(input)) {
+    struct ir_file_header header;
+    return ir_read_file(input, ir, &header, NULL, 0);
+  }
+
   struct ir_parser p = {0};
   p.input = input;
 
@@ -346,3 +352,177 @@ int ir_read(FILE *input, struct ir *ir) {
 
   return 1;
 }
+
+struct ir_binary_reader {
+  const uint8_t *data;
+  int size;
+  int used;
+  bool overflow;
+};
+
+static void ir_read_bytes(struct ir_binary_reader *r, void *ptr, int size) {
+  if (r->used + size > r->size) {
+    r->overflow = true;
+    memset(ptr, 0, size);
+    return;
+  }
+
+  memcpy(ptr, r->data + r->used, size);
+  r->used += size;
+}
+
+static uint8_t ir_read_u8(struct ir_binary_reader *r) {
+  uint8_t v;
+  ir_read_bytes(r, &v, sizeof(v));
+  return v;
+}
+
+static uint16_t ir_read_u16(struct ir_binary_reader *r) {
+  uint16_t v;
+  ir_read_bytes(r, &v, sizeof(v));
+  return v;
+}
+
+static uint32_t ir_read_u32(struct ir_binary_reader *r) {
+  uint32_t v;
+  ir_read_bytes(r, &v, sizeof(v));
+  return v;
+}
+
+static int ir_read_binary_value(struct ir_binary_reader *r, struct ir *ir,
+                                struct ir_value **values, int num_values,
+                                struct ir_value **value) {
+  uint8_t desc = ir_read_u8(r);
+  enum ir_type type = (enum ir_type)(desc & ~IR_BINARY_CONSTANT);
+
+  if (type == VALUE_V) {
+    *value = NULL;
+    return 1;
+  }
+
+  if (type >= VALUE_NUM) {
+    return 0;
+  }
+
+  if (desc & IR_BINARY_CONSTANT) {
+    if (type == VALUE_V128) {
+      return 0;
+    }
+
+    int64_t c = 0;
+    ir_read_bytes(r, &c, ir_type_size(type));
+
+    *value = ir_alloc_i64(ir, c);
+    (*value)->type = type;
+    return 1;
+  }
+
+  int index = ir_read_u16(r);
+
+  if (index >= num_values || !values[index] || values[index]->type != type) {
+    return 0;
+  }
+
+  *value = values[index];
+  return 1;
+}
+
+int ir_read_binary(const uint8_t *data, int size, struct ir *ir) {
+  struct ir_binary_reader r = {data, size, 0, false};
+
+  int num_instrs = (int)ir_read_u32(&r);
+  int locals_size = (int)ir_read_u32(&r);
+
+  if (r.overflow || num_instrs > size) {
+    return 0;
+  }
+
+  // results of each instruction, indexed by the instruction's position
+  struct ir_value **values = calloc(num_instrs, sizeof(struct ir_value *));
+  int res = 1;
+
+  for (int i = 0; i < num_instrs && res; i++) {
+    enum ir_op op = (enum ir_op)ir_read_u8(&r);
+    enum ir_type type = (enum ir_type)ir_read_u8(&r);
+    int8_t reg = (int8_t)ir_read_u8(&r);
+
+    struct ir_value *arg[MAX_INSTR_ARGS] = {0};
+
+    for (int j = 0; j < MAX_INSTR_ARGS && res; j++) {
+      res = ir_read_binary_value(&r, ir, values, i, &arg[j]);
+    }
+
+    if (!res || r.overflow || op >= NUM_OPS || type >= VALUE_NUM) {
+      res = 0;
+      break;
+    }
+
+    struct ir_instr *instr = ir_append_instr(ir, op, type);
+
+    for (int j = 0; j < MAX_INSTR_ARGS; j++) {
+      if (arg[j]) {
+        ir_set_arg(ir, instr, j, arg[j]);
+      }
+    }
+
+    if (instr->result) {
+      instr->result->reg = reg;
+    }
+
+    values[i] = instr->result;
+  }
+
+  free(values);
+
+  // note, the locals themselves aren't serialized, only the space they need
+  ir->locals_size = locals_size;
+
+  return res && !r.overflow;
+}
+
+bool ir_file_is_binary(FILE *input) {
+  uint32_t magic = 0;
+  long pos = ftell(input);
+  size_t n = fread(&magic, sizeof(magic), 1, input);
+
+  if (fseek(input, pos, SEEK_SET)) {
+    return false;
+  }
+
+  return n == 1 && magic == IR_FILE_MAGIC;
+}
+
+int ir_read_file(FILE *input, struct ir *ir, struct ir_file_header *header,
+                 uint8_t *guest, int guest_capacity) {
+  if (fread(header, sizeof(*header), 1, input) != 1) {
+    return 0;
+  }
+
+  if (header->magic != IR_FILE_MAGIC || header->version != IR_FILE_VERSION ||
+      header->num_ops != NUM_OPS) {
+    LOG_WARNING("Unsupported IR file version %u", header->version);
+    return 0;
+  }
+
+  // the binary encoding is more compact than the IR it's decoded to, so a
+  // block larger than the IR's buffer can't be valid
+  if (header->ir_size > (uint32_t)ir->capacity) {
+    return 0;
+  }
+
+  if (guest && header->guest_size <= (uint32_t)guest_capacity) {
+    if (header->guest_size &&
+        fread(guest, header->guest_size, 1, input) != 1) {
+      return 0;
+    }
+  } else if (fseek(input, header->guest_size, SEEK_CUR)) {
+    return 0;
+  }
+
+  uint8_t *data = malloc(header->ir_size);
+  int res = fread(data, header->ir_size, 1, input) == 1 &&
+            ir_read_binary(data, header->ir_size, ir);
+  free(data);
+
+  return res;
+}
@@ -1,4 +1,5 @@
 #include <inttypes.h>
+#include <stdlib.h>
 #include "jit/ir/ir.h"
 #include "core/string.h"
 
@@ -133,3 +134,104 @@ void ir_write(struct ir *ir, FILE *output) {
     ir_write_instr(instr, output);
   }
 }
+
+struct ir_binary_writer {
+  uint8_t *data;
+  int size;
+  int used;
+  bool overflow;
+};
+
+static void ir_write_bytes(struct ir_binary_writer *w, const void *ptr,
+                           int size) {
+  if (w->used + size > w->size) {
+    w->overflow = true;
+    return;
+  }
+
+  memcpy(w->data + w->used, ptr, size);
+  w->used += size;
+}
+
+static void ir_write_u8(struct ir_binary_writer *w, uint8_t v) {
+  ir_write_bytes(w, &v, sizeof(v));
+}
+
+static void ir_write_u16(struct ir_binary_writer *w, uint16_t v) {
+  ir_write_bytes(w, &v, sizeof(v));
+}
+
+static void ir_write_u32(struct ir_binary_writer *w, uint32_t v) {
+  ir_write_bytes(w, &v, sizeof(v));
+}
+
+static void ir_write_binary_value(struct ir_binary_writer *w,
+                                  const struct ir_value *value) {
+  if (!value) {
+    ir_write_u8(w, VALUE_V);
+    return;
+  }
+
+  // constants are written inline, while other values are written as the index
+  // of the instruction defining them
+  if (ir_is_constant(value)) {
+    CHECK_NE(value->type, VALUE_V128);
+    ir_write_u8(w, IR_BINARY_CONSTANT | value->type);
+    ir_write_bytes(w, &value->i64, ir_type_size(value->type));
+  } else {
+    CHECK_LT(value->def->tag, 1 << 16);
+    ir_write_u8(w, value->type);
+    ir_write_u16(w, (uint16_t)value->def->tag);
+  }
+}
+
+int ir_write_binary(struct ir *ir, uint8_t *data, int size) {
+  struct ir_binary_writer w = {data, size, 0, false};
+
+  // number each instruction
+  int num_instrs = 0;
+
+  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
+    instr->tag = num_instrs++;
+  }
+
+  ir_write_u32(&w, num_instrs);
+  ir_write_u32(&w, ir->locals_size);
+
+  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
+    const struct ir_value *result = instr->result;
+
+    ir_write_u8(&w, instr->op);
+    ir_write_u8(&w, result ? result->type : VALUE_V);
+    ir_write_u8(&w, result ? (uint8_t)result->reg : (uint8_t)NO_REGISTER);
+
+    for (int i = 0; i < MAX_INSTR_ARGS; i++) {
+      ir_write_binary_value(&w, instr->arg[i]);
+    }
+  }
+
+  return w.overflow ? 0 : w.used;
+}
+
+int ir_write_file(struct ir *ir, uint32_t guest_addr, const uint8_t *guest,
+                  int guest_size, int guest_flags, FILE *output) {
+  // each instruction and constant in the binary encoding is smaller than its
+  // in-memory representation, so the IR's footprint bounds the output
+  int capacity = ir->used + 64;
+  uint8_t *data = malloc(capacity);
+  int ir_size = ir_write_binary(ir, data, capacity);
+
+  struct ir_file_header header = {
+      IR_FILE_MAGIC,        IR_FILE_VERSION,       NUM_OPS,
+      guest_addr,           (uint32_t)guest_flags, (uint32_t)guest_size,
+      (uint32_t)ir_size};
+
+  int res = ir_size &&
+            fwrite(&header, sizeof(header), 1, output) == 1 &&
+            (!guest_size || fwrite(guest, guest_size, 1, output) == 1) &&
+            fwrite(data, ir_size, 1, output) == 1;
+
+  free(data);
+
+  return res;
+}
@@ -1,286 +1,486 @@
-#include <type_traits>
-#include <unordered_map>
+#include <math.h>
 #include "jit/ir/passes/constant_propagation_pass.h"
+#include "jit/ir/ir.h"
+#include "jit/ir/passes/pass_stat.h"
+
+DEFINE_STAT(num_folded, "Number of instructions folded to constants");
+DEFINE_STAT(num_simplified, "Number of instructions algebraically simplified");
+DEFINE_STAT(num_branches_folded, "Number of conditional branches folded");
+
+// helpers for reading constant arguments
+static int64_t cprop_sext_constant(const struct ir_value *v) {
+  switch (v->type) {
+    case VALUE_I8:
+      return v->i8;
+    case VALUE_I16:
+      return v->i16;
+    case VALUE_I32:
+      return v->i32;
+    case VALUE_I64:
+      return v->i64;
+    default:
+      LOG_FATAL("Unexpected value type");
+      break;
+  }
+}
 
-typedef void (*FoldFn)(IRBuilder &, Instr *i);
-
-// specify which arguments must be constant in order for fold operation to run
-enum {
-  ARG0_CNST = 0x1,
-  ARG1_CNST = 0x2,
-  ARG2_CNST = 0x4,
-};
-
-// fold callbacks for each operaton
-std::unordered_map<int, FoldFn> fold_cbs;
-int fold_masks[NUM_OPS];
-
-// OP_SELECT and OP_BRANCH_COND are the only instructions using arg2, and
-// arg2's type always matches arg1's. because of this, arg2 isn't considered
-// when generating the lookup table
-#define CALLBACK_IDX(op, r, a0, a1)                                        \
-  ((op)*VALUE_NUM * VALUE_NUM * VALUE_NUM) + ((r)*VALUE_NUM * VALUE_NUM) + \
-      ((a0)*VALUE_NUM) + (a1)
-
-// declare a templated callback for an IR operation. note, declaring a
-// callback does not actually register it. callbacks must be registered
-// for a particular signature with REGISTER_FOLD
-#define FOLD(op, mask)                                  \
-  static struct _##op##_init {                          \
-    _##op##_init() {                                    \
-      fold_masks[OP_##op] = mask;                       \
-    }                                                   \
-  } op##_init;                                          \
-  template <typename R = struct ir_valueInfo<VALUE_V>,  \
-            typename A0 = struct ir_valueInfo<VALUE_V>, \
-            typename A1 = struct ir_valueInfo<VALUE_V>> \
-  void Handle##op(struct ir *ir, Instr *instr)
-
-// registers a fold callback for the specified signature
-#define REGISTER_FOLD(op, r, a0, a1)                                       \
-  static struct _cpp_##op##_##r##_##a0##_##a1##_init {                     \
-    _cpp_##op##_##r##_##a0##_##a1##_init() {                               \
-      fold_cbs[CALLBACK_IDX(OP_##op, VALUE_##r, VALUE_##a0, VALUE_##a1)] = \
-          &Handle##op<struct ir_valueInfo<VALUE_##r>,                      \
-                      struct ir_valueInfo<VALUE_##a0>,                     \
-                      struct ir_valueInfo<VALUE_##a1>>;                    \
-    }                                                                      \
-  } cpp_##op##_##r##_##a0##_##a1##_init
-
-// common helpers for fold functions
-#define ARG0() (instr->arg[0]->*A0::fn)()
-#define ARG1() (instr->arg[1]->*A1::fn)()
-#define ARG2() (instr->arg[2]->*A1::fn)()
-#define ARG0_UNSIGNED() static_cast<typename A0::unsigned_type>(ARG0())
-#define ARG1_UNSIGNED() static_cast<typename A1::unsigned_type>(ARG1())
-#define ARG2_UNSIGNED() static_cast<typename A1::unsigned_type>(ARG2())
-#define RESULT(expr)                                                           \
-  ir_replace_uses(instr, ir_alloc_constant(                                    \
-                             ir, static_cast<typename R::signed_type>(expr))); \
-  ir_remove_instr(instr)
-
-static FoldFn GetFoldFn(Instr *instr) {
-  auto it = fold_cbs.find(
-      CALLBACK_IDX(instr->op, instr->type,
-                   instr->arg[0] ? (int)instr->arg[0]->type : VALUE_V,
-                   instr->arg[1] ? (int)instr->arg[1]->type : VALUE_V));
-  if (it == fold_cbs.end()) {
-    return nullptr;
+static double cprop_float_constant(const struct ir_value *v) {
+  switch (v->type) {
+    case VALUE_F32:
+      return v->f32;
+    case VALUE_F64:
+      return v->f64;
+    default:
+      LOG_FATAL("Unexpected value type");
+      break;
   }
-  return it->second;
 }
 
-static int GetFoldMask(Instr *instr) {
-  return fold_masks[instr->op];
+static bool cprop_is_int_constant(const struct ir_value *v, int64_t c) {
+  return ir_is_constant(v) && is_is_int(v->type) &&
+         cprop_sext_constant(v) == c;
 }
 
-static int GetConstantSig(Instr *instr) {
-  int cnst_sig = 0;
+// helpers for allocating constant results, truncating the value to the size
+// of the type
+static struct ir_value *cprop_alloc_int(struct ir *ir, enum ir_type type,
+                                        uint64_t c) {
+  switch (type) {
+    case VALUE_I8:
+      return ir_alloc_i8(ir, (int8_t)c);
+    case VALUE_I16:
+      return ir_alloc_i16(ir, (int16_t)c);
+    case VALUE_I32:
+      return ir_alloc_i32(ir, (int32_t)c);
+    case VALUE_I64:
+      return ir_alloc_i64(ir, (int64_t)c);
+    default:
+      LOG_FATAL("Unexpected value type");
+      break;
+  }
+}
 
-  if (instr->arg[0] && ir_is_constant(instr->arg[0])) {
-    cnst_sig |= ARG0_CNST;
+static struct ir_value *cprop_alloc_float(struct ir *ir, enum ir_type type,
+                                          double c) {
+  switch (type) {
+    case VALUE_F32:
+      return ir_alloc_f32(ir, (float)c);
+    case VALUE_F64:
+      return ir_alloc_f64(ir, c);
+    default:
+      LOG_FATAL("Unexpected value type");
+      break;
   }
+}
 
-  if (instr->arg[1] && ir_is_constant(instr->arg[1])) {
-    cnst_sig |= ARG1_CNST;
+static bool cprop_compare(enum ir_cmp cmp, int64_t a, int64_t b, uint64_t ua,
+                          uint64_t ub) {
+  switch (cmp) {
+    case CMP_EQ:
+      return a == b;
+    case CMP_NE:
+      return a != b;
+    case CMP_SGE:
+      return a >= b;
+    case CMP_SGT:
+      return a > b;
+    case CMP_UGE:
+      return ua >= ub;
+    case CMP_UGT:
+      return ua > ub;
+    case CMP_SLE:
+      return a <= b;
+    case CMP_SLT:
+      return a < b;
+    case CMP_ULE:
+      return ua <= ub;
+    case CMP_ULT:
+      return ua < ub;
+    default:
+      LOG_FATAL("Unexpected comparison type");
+      break;
   }
+}
 
-  if (instr->arg[2] && ir_is_constant(instr->arg[2])) {
-    cnst_sig |= ARG2_CNST;
+static bool cprop_fcompare(enum ir_cmp cmp, double a, double b) {
+  switch (cmp) {
+    case CMP_EQ:
+      return a == b;
+    case CMP_NE:
+      return a != b;
+    case CMP_SGE:
+      return a >= b;
+    case CMP_SGT:
+      return a > b;
+    case CMP_SLE:
+      return a <= b;
+    case CMP_SLT:
+      return a < b;
+    default:
+      LOG_FATAL("Unexpected comparison type");
+      break;
   }
+}
 
-  return cnst_sig;
+// shifts are performed the same as the x64 backend, with the shift amount
+// masked to the size of the operand
+static int cprop_shift_mask(enum ir_type type) {
+  return type == VALUE_I64 ? 63 : 31;
 }
 
-void ConstantPropagationPass::Run(struct ir *ir) {
-  list_for_each_entry_safe(instr, &ir->instrs, struct ir_instr, it) {
-    int fold_mask = GetFoldMask(instr);
-    int cnst_sig = GetConstantSig(instr);
-    if (!fold_mask || (cnst_sig & fold_mask) != fold_mask) {
-      continue;
+// ASHD / LSHD shift left for positive shift amounts, and right otherwise
+static uint32_t cprop_shd(uint32_t v, int32_t n, bool arithmetic) {
+  if (n >= 0) {
+    return v << (n & 0x1f);
+  }
+
+  if (!(n & 0x1f)) {
+    return arithmetic ? (uint32_t)((int32_t)v >> 31) : 0;
+  }
+
+  int shift = -n & 0x1f;
+  return arithmetic ? (uint32_t)((int32_t)v >> shift) : v >> shift;
+}
+
+// try to fold an instruction whose arguments are all constant, returning the
+// constant result or NULL if it can't be folded
+static struct ir_value *cprop_fold(struct ir *ir, struct ir_instr *instr) {
+  struct ir_value *a = instr->arg[0];
+  struct ir_value *b = instr->arg[1];
+  enum ir_type type = instr->result->type;
+
+  switch (instr->op) {
+    case OP_FTOI: {
+      double v = cprop_float_constant(a);
+      // out of range conversions are left to the backend
+      double limit = type == VALUE_I64 ? 9223372036854775808.0 : 2147483648.0;
+      if (!(v > -limit && v < limit)) {
+        return NULL;
+      }
+      return cprop_alloc_int(ir, type, (uint64_t)(int64_t)v);
     }
 
-    FoldFn fold = GetFoldFn(instr);
-    if (!fold) {
-      continue;
+    case OP_ITOF:
+      return cprop_alloc_float(ir, type, (double)cprop_sext_constant(a));
+
+    case OP_TRUNC:
+    case OP_ZEXT:
+      return cprop_alloc_int(ir, type, ir_zext_constant(a));
+
+    case OP_SEXT:
+      return cprop_alloc_int(ir, type, (uint64_t)cprop_sext_constant(a));
+
+    case OP_FTRUNC:
+    case OP_FEXT:
+      return cprop_alloc_float(ir, type, cprop_float_constant(a));
+
+    case OP_CMP: {
+      enum ir_cmp cmp = (enum ir_cmp)instr->arg[2]->i32;
+      return ir_alloc_i8(
+          ir, cprop_compare(cmp, cprop_sext_constant(a), cprop_sext_constant(b),
+                            ir_zext_constant(a), ir_zext_constant(b)));
+    }
+
+    case OP_FCMP: {
+      double fa = cprop_float_constant(a);
+      double fb = cprop_float_constant(b);
+      // unordered comparisons set flags differently on the host than in C
+      if (isnan(fa) || isnan(fb)) {
+        return NULL;
+      }
+      enum ir_cmp cmp = (enum ir_cmp)instr->arg[2]->i32;
+      return ir_alloc_i8(ir, cprop_fcompare(cmp, fa, fb));
+    }
+
+    case OP_ADD:
+      return cprop_alloc_int(ir, type, ir_zext_constant(a) + ir_zext_constant(b));
+
+    case OP_SUB:
+      return cprop_alloc_int(ir, type, ir_zext_constant(a) - ir_zext_constant(b));
+
+    case OP_SMUL:
+    case OP_UMUL:
+      // the low bits of the product are the same for signed and unsigned
+      return cprop_alloc_int(ir, type, ir_zext_constant(a) * ir_zext_constant(b));
+
+    case OP_DIV: {
+      int64_t n = cprop_sext_constant(a);
+      int64_t d = cprop_sext_constant(b);
+      if (!d || (d == -1 && n == INT64_MIN)) {
+        return NULL;
+      }
+      return cprop_alloc_int(ir, type, (uint64_t)(n / d));
+    }
+
+    case OP_NEG:
+      return cprop_alloc_int(ir, type, 0 - ir_zext_constant(a));
+
+    case OP_ABS: {
+      int64_t v = cprop_sext_constant(a);
+      return cprop_alloc_int(ir, type, v < 0 ? 0 - (uint64_t)v : (uint64_t)v);
+    }
+
+    case OP_FADD:
+      return cprop_alloc_float(ir, type, cprop_float_constant(a) +
+                                             cprop_float_constant(b));
+
+    case OP_FSUB:
+      return cprop_alloc_float(ir, type, cprop_float_constant(a) -
+                                             cprop_float_constant(b));
+
+    case OP_FMUL:
+      return cprop_alloc_float(ir, type, cprop_float_constant(a) *
+                                             cprop_float_constant(b));
+
+    case OP_FDIV:
+      return cprop_alloc_float(ir, type, cprop_float_constant(a) /
+                                             cprop_float_constant(b));
+
+    case OP_FNEG:
+      return cprop_alloc_float(ir, type, -cprop_float_constant(a));
+
+    case OP_FABS:
+      return cprop_alloc_float(ir, type, fabs(cprop_float_constant(a)));
+
+    case OP_SQRT:
+      return cprop_alloc_float(ir, type, sqrt(cprop_float_constant(a)));
+
+    case OP_AND:
+      return cprop_alloc_int(ir, type, ir_zext_constant(a) & ir_zext_constant(b));
+
+    case OP_OR:
+      return cprop_alloc_int(ir, type, ir_zext_constant(a) | ir_zext_constant(b));
+
+    case OP_XOR:
+      return cprop_alloc_int(ir, type, ir_zext_constant(a) ^ ir_zext_constant(b));
+
+    case OP_NOT:
+      return cprop_alloc_int(ir, type, ~ir_zext_constant(a));
+
+    case OP_SHL: {
+      int n = b->i32 & cprop_shift_mask(type);
+      return cprop_alloc_int(ir, type, ir_zext_constant(a) << n);
     }
 
-    fold(builder, instr);
+    case OP_ASHR: {
+      int n = b->i32 & cprop_shift_mask(type);
+      return cprop_alloc_int(ir, type, (uint64_t)(cprop_sext_constant(a) >> n));
+    }
+
+    case OP_LSHR: {
+      int n = b->i32 & cprop_shift_mask(type);
+      return cprop_alloc_int(ir, type, ir_zext_constant(a) >> n);
+    }
+
+    case OP_ASHD:
+      return cprop_alloc_int(ir, type, cprop_shd(a->i32, b->i32, true));
+
+    case OP_LSHD:
+      return cprop_alloc_int(ir, type, cprop_shd(a->i32, b->i32, false));
+
+    // memory and context accesses, calls and vector operations (which have
+    // no constant form) can't be folded. SELECT and branches are simplified
+    // as soon as their condition is constant. fused multiply-adds are only
+    // formed after propagation, and never from constant operands
+    case OP_LOAD_HOST:
+    case OP_STORE_HOST:
+    case OP_LOAD_FAST:
+    case OP_STORE_FAST:
+    case OP_LOAD_SLOW:
+    case OP_STORE_SLOW:
+    case OP_LOAD_CONTEXT:
+    case OP_STORE_CONTEXT:
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL:
+    case OP_SELECT:
+    case OP_VBROADCAST:
+    case OP_VADD:
+    case OP_VDOT:
+    case OP_VMUL:
+    case OP_FMADD:
+    case OP_VFMADD:
+    case OP_BRANCH:
+    case OP_BRANCH_COND:
+    case OP_CALL_EXTERNAL:
+    default:
+      return NULL;
   }
 }
 
-FOLD(SELECT, ARG0_CNST) {
-  ir_replace_uses(instr, ARG0() ? instr->arg[1] : instr->arg[2]);
-  ir_remove_instr(ir, instr);
-}
-REGISTER_FOLD(SELECT, I8, I8, I8);
-REGISTER_FOLD(SELECT, I16, I16, I16);
-REGISTER_FOLD(SELECT, I32, I32, I32);
-REGISTER_FOLD(SELECT, I64, I64, I64);
+// try to simplify an instruction with an algebraic identity, returning the
+// value equivalent to its result or NULL if there isn't one
+static struct ir_value *cprop_simplify(struct ir *ir, struct ir_instr *instr) {
+  struct ir_value *a = instr->arg[0];
+  struct ir_value *b = instr->arg[1];
+  enum ir_type type = instr->result->type;
+
+  switch (instr->op) {
+    case OP_SELECT: {
+      struct ir_value *cond = instr->arg[2];
+      if (ir_is_constant(cond)) {
+        return ir_zext_constant(cond) ? a : b;
+      }
+      if (a == b) {
+        return a;
+      }
+      return NULL;
+    }
 
-FOLD(EQ, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() == ARG1());
-}
-REGISTER_FOLD(EQ, I8, I8, I8);
-REGISTER_FOLD(EQ, I8, I16, I16);
-REGISTER_FOLD(EQ, I8, I32, I32);
-REGISTER_FOLD(EQ, I8, I64, I64);
-REGISTER_FOLD(EQ, I8, F32, F32);
-REGISTER_FOLD(EQ, I8, F64, F64);
-
-FOLD(NE, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() != ARG1());
-}
-REGISTER_FOLD(NE, I8, I8, I8);
-REGISTER_FOLD(NE, I8, I16, I16);
-REGISTER_FOLD(NE, I8, I32, I32);
-REGISTER_FOLD(NE, I8, I64, I64);
-REGISTER_FOLD(NE, I8, F32, F32);
-REGISTER_FOLD(NE, I8, F64, F64);
-
-FOLD(SGE, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() >= ARG1());
-}
-REGISTER_FOLD(SGE, I8, I8, I8);
-REGISTER_FOLD(SGE, I8, I16, I16);
-REGISTER_FOLD(SGE, I8, I32, I32);
-REGISTER_FOLD(SGE, I8, I64, I64);
-REGISTER_FOLD(SGE, I8, F32, F32);
-REGISTER_FOLD(SGE, I8, F64, F64);
-
-FOLD(SGT, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() > ARG1());
-}
-REGISTER_FOLD(SGT, I8, I8, I8);
-REGISTER_FOLD(SGT, I8, I16, I16);
-REGISTER_FOLD(SGT, I8, I32, I32);
-REGISTER_FOLD(SGT, I8, I64, I64);
-REGISTER_FOLD(SGT, I8, F32, F32);
-REGISTER_FOLD(SGT, I8, F64, F64);
-
-// IR_OP(UGE)
-// IR_OP(UGT)
-
-FOLD(SLE, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() <= ARG1());
-}
-REGISTER_FOLD(SLE, I8, I8, I8);
-REGISTER_FOLD(SLE, I8, I16, I16);
-REGISTER_FOLD(SLE, I8, I32, I32);
-REGISTER_FOLD(SLE, I8, I64, I64);
-REGISTER_FOLD(SLE, I8, F32, F32);
-REGISTER_FOLD(SLE, I8, F64, F64);
-
-FOLD(SLT, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() < ARG1());
-}
-REGISTER_FOLD(SLT, I8, I8, I8);
-REGISTER_FOLD(SLT, I8, I16, I16);
-REGISTER_FOLD(SLT, I8, I32, I32);
-REGISTER_FOLD(SLT, I8, I64, I64);
-REGISTER_FOLD(SLT, I8, F32, F32);
-REGISTER_FOLD(SLT, I8, F64, F64);
-
-// IR_OP(ULE)
-// IR_OP(ULT)
-
-FOLD(ADD, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() + ARG1());
-}
-REGISTER_FOLD(ADD, I8, I8, I8);
-REGISTER_FOLD(ADD, I16, I16, I16);
-REGISTER_FOLD(ADD, I32, I32, I32);
-REGISTER_FOLD(ADD, I64, I64, I64);
-REGISTER_FOLD(ADD, F32, F32, F32);
-REGISTER_FOLD(ADD, F64, F64, F64);
-
-FOLD(SUB, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() - ARG1());
-}
-REGISTER_FOLD(SUB, I8, I8, I8);
-REGISTER_FOLD(SUB, I16, I16, I16);
-REGISTER_FOLD(SUB, I32, I32, I32);
-REGISTER_FOLD(SUB, I64, I64, I64);
-REGISTER_FOLD(SUB, F32, F32, F32);
-REGISTER_FOLD(SUB, F64, F64, F64);
-
-FOLD(SMUL, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() * ARG1());
-}
-REGISTER_FOLD(SMUL, I8, I8, I8);
-REGISTER_FOLD(SMUL, I16, I16, I16);
-REGISTER_FOLD(SMUL, I32, I32, I32);
-REGISTER_FOLD(SMUL, I64, I64, I64);
-REGISTER_FOLD(SMUL, F32, F32, F32);
-REGISTER_FOLD(SMUL, F64, F64, F64);
-
-FOLD(UMUL, ARG0_CNST | ARG1_CNST) {
-  auto lhs = ARG0_UNSIGNED();
-  auto rhs = ARG1_UNSIGNED();
-  RESULT(lhs * rhs);
-}
-REGISTER_FOLD(UMUL, I8, I8, I8);
-REGISTER_FOLD(UMUL, I16, I16, I16);
-REGISTER_FOLD(UMUL, I32, I32, I32);
-REGISTER_FOLD(UMUL, I64, I64, I64);
-
-// IR_OP(DIV)
-// IR_OP(NEG)
-// IR_OP(SQRT)
-// IR_OP(ABS)
-// IR_OP(SIN)
-// IR_OP(COS)
-
-FOLD(AND, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() & ARG1());
+    case OP_ADD:
+    case OP_OR:
+    case OP_XOR:
+      // x + 0, x | 0, x ^ 0
+      if (cprop_is_int_constant(b, 0)) {
+        return a;
+      }
+      if (cprop_is_int_constant(a, 0)) {
+        return b;
+      }
+      return NULL;
+
+    case OP_SUB:
+      // x - 0
+      if (cprop_is_int_constant(b, 0)) {
+        return a;
+      }
+      return NULL;
+
+    case OP_AND:
+      // x & ~0, x & 0
+      if (cprop_is_int_constant(b, -1)) {
+        return a;
+      }
+      if (cprop_is_int_constant(a, -1)) {
+        return b;
+      }
+      if (cprop_is_int_constant(a, 0) || cprop_is_int_constant(b, 0)) {
+        return cprop_alloc_int(ir, type, 0);
+      }
+      return NULL;
+
+    case OP_SMUL:
+    case OP_UMUL:
+      // x * 1, x * 0
+      if (cprop_is_int_constant(b, 1)) {
+        return a;
+      }
+      if (cprop_is_int_constant(a, 1)) {
+        return b;
+      }
+      if (cprop_is_int_constant(a, 0) || cprop_is_int_constant(b, 0)) {
+        return cprop_alloc_int(ir, type, 0);
+      }
+      return NULL;
+
+    case OP_SHL:
+    case OP_ASHR:
+    case OP_LSHR:
+      // shifts by 0
+      if (ir_is_constant(b) && !(b->i32 & cprop_shift_mask(type))) {
+        return a;
+      }
+      return NULL;
+
+    case OP_ASHD:
+    case OP_LSHD:
+      // a shift amount of 0 shifts left by 0
+      if (cprop_is_int_constant(b, 0)) {
+        return a;
+      }
+      return NULL;
+
+    default:
+      return NULL;
+  }
 }
-REGISTER_FOLD(AND, I8, I8, I8);
-REGISTER_FOLD(AND, I16, I16, I16);
-REGISTER_FOLD(AND, I32, I32, I32);
-REGISTER_FOLD(AND, I64, I64, I64);
 
-FOLD(OR, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() | ARG1());
-}
-REGISTER_FOLD(OR, I8, I8, I8);
-REGISTER_FOLD(OR, I16, I16, I16);
-REGISTER_FOLD(OR, I32, I32, I32);
-REGISTER_FOLD(OR, I64, I64, I64);
+static bool cprop_args_constant(const struct ir_instr *instr) {
+  // note, the comparison type of CMP and FCMP is always constant, and isn't
+  // considered here
+  int num_args = (instr->op == OP_CMP || instr->op == OP_FCMP) ? 2 : 3;
 
-FOLD(XOR, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() ^ ARG1());
-}
-REGISTER_FOLD(XOR, I8, I8, I8);
-REGISTER_FOLD(XOR, I16, I16, I16);
-REGISTER_FOLD(XOR, I32, I32, I32);
-REGISTER_FOLD(XOR, I64, I64, I64);
+  for (int i = 0; i < num_args; i++) {
+    if (instr->arg[i] && !ir_is_constant(instr->arg[i])) {
+      return false;
+    }
+  }
 
-FOLD(NOT, ARG0_CNST) {
-  RESULT(~ARG0());
+  return instr->arg[0] != NULL;
 }
-REGISTER_FOLD(NOT, I8, I8, V);
-REGISTER_FOLD(NOT, I16, I16, V);
-REGISTER_FOLD(NOT, I32, I32, V);
-REGISTER_FOLD(NOT, I64, I64, V);
 
-FOLD(SHL, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0() << ARG1());
+// move constant arguments of commutative operations to the right-hand side,
+// where the backend can encode them as an immediate
+static void cprop_canonicalize(struct ir *ir, struct ir_instr *instr) {
+  switch (instr->op) {
+    case OP_ADD:
+    case OP_SMUL:
+    case OP_UMUL:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+      break;
+    default:
+      return;
+  }
+
+  struct ir_value *a = instr->arg[0];
+  struct ir_value *b = instr->arg[1];
+
+  if (ir_is_constant(a) && !ir_is_constant(b)) {
+    ir_set_arg0(ir, instr, b);
+    ir_set_arg1(ir, instr, a);
+  }
 }
-REGISTER_FOLD(SHL, I8, I8, I32);
-REGISTER_FOLD(SHL, I16, I16, I32);
-REGISTER_FOLD(SHL, I32, I32, I32);
-REGISTER_FOLD(SHL, I64, I64, I32);
 
-// IR_OP(ASHR)
+void cprop_run(struct ir *ir) {
+  list_for_each_entry_safe(instr, &ir->instrs, struct ir_instr, it) {
+    // replace conditional branches on a constant with a direct branch to the
+    // taken destination
+    if (instr->op == OP_BRANCH_COND) {
+      if (!ir_is_constant(instr->arg[0])) {
+        continue;
+      }
+
+      struct ir_value *dest =
+          ir_zext_constant(instr->arg[0]) ? instr->arg[1] : instr->arg[2];
+
+      instr->op = OP_BRANCH;
+      ir_set_arg0(ir, instr, dest);
+      ir_set_arg1(ir, instr, NULL);
+      ir_set_arg2(ir, instr, NULL);
+
+      STAT_num_branches_folded++;
+      continue;
+    }
+
+    if (!instr->result) {
+      continue;
+    }
+
+    struct ir_value *replacement = NULL;
 
-FOLD(LSHR, ARG0_CNST | ARG1_CNST) {
-  RESULT(ARG0_UNSIGNED() >> ARG1());
+    if (cprop_args_constant(instr)) {
+      replacement = cprop_fold(ir, instr);
+
+      if (replacement) {
+        STAT_num_folded++;
+      }
+    }
+
+    if (!replacement) {
+      replacement = cprop_simplify(ir, instr);
+
+      if (replacement) {
+        STAT_num_simplified++;
+      }
+    }
+
+    if (!replacement) {
+      cprop_canonicalize(ir, instr);
+      continue;
+    }
+
+    ir_replace_uses(instr->result, replacement);
+    ir_remove_instr(ir, instr);
+  }
 }
-REGISTER_FOLD(LSHR, I8, I8, I32);
-REGISTER_FOLD(LSHR, I16, I16, I32);
-REGISTER_FOLD(LSHR, I32, I32, I32);
-REGISTER_FOLD(LSHR, I64, I64, I32);
-
-// IR_OP(BRANCH)
-// IR_OP(BRANCH_COND)
-// IR_OP(CALL_EXTERNAL)
@@ -0,0 +1,83 @@
+#include "jit/ir/passes/fused_multiply_add_pass.h"
+#include "jit/ir/ir.h"
+#include "jit/ir/passes/pass_stat.h"
+
+DEFINE_STAT(num_fmadd, "Number of multiply-adds fused");
+DEFINE_STAT(num_vfmadd, "Number of vector multiply-adds fused");
+
+const char *fma_name = "fma";
+
+static bool fma_has_one_use(struct ir_value *v) {
+  return !list_empty(&v->uses) &&
+         list_first_entry(&v->uses, struct ir_use, it) ==
+             list_last_entry(&v->uses, struct ir_use, it);
+}
+
+// find the multiply producing argument n of an add, if it can be folded into
+// it. the product can't be needed by anything else, and none of the operands
+// can be constant, so the backend has a free temporary to fall back to a
+// separate multiply and add with on hosts without fma
+static struct ir_instr *fma_find_mul(struct ir_instr *add, int n,
+                                     enum ir_op mul_op) {
+  struct ir_value *product = add->arg[n];
+  struct ir_value *addend = add->arg[n ^ 1];
+  struct ir_instr *mul = product->def;
+
+  if (!mul || mul->op != mul_op || !fma_has_one_use(product)) {
+    return NULL;
+  }
+
+  if (ir_is_constant(mul->arg[0]) || ir_is_constant(mul->arg[1]) ||
+      ir_is_constant(addend)) {
+    return NULL;
+  }
+
+  return mul;
+}
+
+void fma_run(struct ir *ir) {
+  list_for_each_entry_safe(instr, &ir->instrs, struct ir_instr, it) {
+    enum ir_op mul_op, fused_op;
+
+    if (instr->op == OP_FADD) {
+      mul_op = OP_FMUL;
+      fused_op = OP_FMADD;
+    } else if (instr->op == OP_VADD) {
+      mul_op = OP_VMUL;
+      fused_op = OP_VFMADD;
+    } else {
+      continue;
+    }
+
+    // prefer folding the second argument, so a chain of adds (e.g. FTRV's)
+    // keeps accumulating into the first one in its original order
+    int n = 1;
+    struct ir_instr *mul = fma_find_mul(instr, n, mul_op);
+
+    if (!mul) {
+      n = 0;
+      mul = fma_find_mul(instr, n, mul_op);
+    }
+
+    if (!mul) {
+      continue;
+    }
+
+    // rewrite the add in place, it's already positioned after all of the
+    // multiply's operands
+    struct ir_value *addend = instr->arg[n ^ 1];
+
+    instr->op = fused_op;
+    ir_set_arg0(ir, instr, mul->arg[0]);
+    ir_set_arg1(ir, instr, mul->arg[1]);
+    ir_set_arg2(ir, instr, addend);
+
+    ir_remove_instr(ir, mul);
+
+    if (fused_op == OP_FMADD) {
+      STAT_num_fmadd++;
+    } else {
+      STAT_num_vfmadd++;
+    }
+  }
+}
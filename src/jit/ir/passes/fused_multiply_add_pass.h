@@ -0,0 +1,8 @@
+#ifndef FUSED_MULTIPLY_ADD_PASS_H
+#define FUSED_MULTIPLY_ADD_PASS_H
+
+struct ir;
+
+void fma_run(struct ir *ir);
+
+#endif
@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include "jit/ir/passes/pass_manager.h"
+#include "core/log.h"
+#include "core/math.h"
+#include "core/string.h"
+#include "jit/ir/ir.h"
+#include "jit/ir/passes/constant_propagation_pass.h"
+#include "jit/ir/passes/conversion_elimination_pass.h"
+#include "jit/ir/passes/dead_code_elimination_pass.h"
+#include "jit/ir/passes/fused_multiply_add_pass.h"
+#include "jit/ir/passes/load_store_elimination_pass.h"
+#include "jit/ir/passes/register_allocation_pass.h"
+#include "sys/time.h"
+
+DEFINE_OPTION_STRING(jit_passes, "lse,cprop,fma,dce,ra",
+                     "Comma-separated list of IR passes to run, in order "
+                     "(lse, cprop, cve, fma, dce, ra)");
+DEFINE_OPTION_STRING(jit_print_after, "",
+                     "Comma-separated list of IR passes to print the IR after, "
+                     "or all");
+DEFINE_OPTION_BOOL(jit_verify_ir, true,
+                   "Verify the IR after each pass (debug builds only)");
+
+static void pass_lse(struct ir *ir, const struct jit_register *registers,
+                     int num_registers) {
+  lse_run(ir);
+}
+
+static void pass_cprop(struct ir *ir, const struct jit_register *registers,
+                       int num_registers) {
+  cprop_run(ir);
+}
+
+static void pass_cve(struct ir *ir, const struct jit_register *registers,
+                     int num_registers) {
+  cve_run(ir);
+}
+
+static void pass_fma(struct ir *ir, const struct jit_register *registers,
+                     int num_registers) {
+  fma_run(ir);
+}
+
+static void pass_dce(struct ir *ir, const struct jit_register *registers,
+                     int num_registers) {
+  dce_run(ir);
+}
+
+static void pass_ra(struct ir *ir, const struct jit_register *registers,
+                    int num_registers) {
+  ra_run(ir, registers, num_registers);
+}
+
+static const struct pass_info pass_infos[] = {
+    {"lse", "Load / store elimination", &pass_lse},
+    {"cprop", "Constant propagation", &pass_cprop},
+    {"cve", "Conversion elimination", &pass_cve},
+    {"fma", "Fused multiply-add", &pass_fma},
+    {"dce", "Dead code elimination", &pass_dce},
+    {"ra", "Register allocation", &pass_ra},
+};
+
+static const struct pass_info *pass_manager_find_info(const char *name) {
+  int num_infos = (int)(sizeof(pass_infos) / sizeof(pass_infos[0]));
+
+  for (int i = 0; i < num_infos; i++) {
+    if (!strcmp(pass_infos[i].name, name)) {
+      return &pass_infos[i];
+    }
+  }
+
+  return NULL;
+}
+
+#ifndef NDEBUG
+
+// set of the instrs visited so far while verifying, keyed by address
+struct pass_instr_set {
+  const struct ir_instr **entries;
+  int mask;
+};
+
+static uint32_t pass_instr_set_slot(const struct pass_instr_set *set,
+                                    const struct ir_instr *instr) {
+  uint64_t key = (uint64_t)(uintptr_t)instr;
+  return (uint32_t)((key * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & set->mask;
+}
+
+static bool pass_instr_set_has(const struct pass_instr_set *set,
+                               const struct ir_instr *instr) {
+  uint32_t i = pass_instr_set_slot(set, instr);
+
+  while (set->entries[i]) {
+    if (set->entries[i] == instr) {
+      return true;
+    }
+    i = (i + 1) & set->mask;
+  }
+
+  return false;
+}
+
+static void pass_instr_set_add(struct pass_instr_set *set,
+                               const struct ir_instr *instr) {
+  uint32_t i = pass_instr_set_slot(set, instr);
+
+  while (set->entries[i]) {
+    i = (i + 1) & set->mask;
+  }
+
+  set->entries[i] = instr;
+}
+
+static bool pass_manager_has_use(const struct ir_value *v,
+                                 const struct ir_use *use) {
+  list_for_each_entry(it, &v->uses, struct ir_use, it) {
+    if (it == use) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// checks that each value is defined before it's used, and that the use lists
+// linking values to the instrs using them are consistent. returns the index of
+// the first malformed instr, or -1 if the IR is valid
+static int pass_manager_verify(struct ir *ir, const char **error) {
+  int num_instrs = 0;
+  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
+    ((void)instr);
+    num_instrs++;
+  }
+
+  int capacity = 16;
+  while (capacity < num_instrs * 2) {
+    capacity *= 2;
+  }
+
+  struct pass_instr_set seen;
+  seen.entries = calloc(capacity, sizeof(seen.entries[0]));
+  seen.mask = capacity - 1;
+
+  int index = 0;
+  int invalid = -1;
+
+  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
+    for (int i = 0; i < MAX_INSTR_ARGS && invalid < 0; i++) {
+      struct ir_value *arg = instr->arg[i];
+
+      if (!arg) {
+        continue;
+      }
+
+      const struct ir_use *use = &instr->used[i];
+
+      if (use->instr != instr || use->parg != &instr->arg[i] ||
+          !pass_manager_has_use(arg, use)) {
+        *error = "argument missing from its value's uses";
+        invalid = index;
+      } else if (arg->def && !pass_instr_set_has(&seen, arg->def)) {
+        *error = "argument used before it's defined";
+        invalid = index;
+      }
+    }
+
+    if (invalid < 0 && instr->result) {
+      if (instr->result->def != instr) {
+        *error = "result not defined by its instr";
+        invalid = index;
+      }
+
+      list_for_each_entry(use, &instr->result->uses, struct ir_use, it) {
+        if (*use->parg != instr->result) {
+          *error = "result has a stale use";
+          invalid = index;
+        }
+      }
+    }
+
+    if (invalid >= 0) {
+      break;
+    }
+
+    pass_instr_set_add(&seen, instr);
+    index++;
+  }
+
+  free(seen.entries);
+
+  return invalid;
+}
+
+#endif
+
+static void pass_manager_print(struct ir *ir, const char *name) {
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("IR after %s", name);
+  LOG_INFO("===-----------------------------------------------------===");
+  ir_write(ir, stdout);
+  LOG_INFO("");
+}
+
+void pass_manager_run(struct pass_manager *pm, struct ir *ir) {
+  for (int i = 0; i < pm->num_passes; i++) {
+    struct pass_manager_pass *pass = &pm->passes[i];
+
+    int64_t begin = time_nanoseconds();
+    pass->info->run(ir, pm->registers, pm->num_registers);
+    jit_histogram_add(&pass->times, time_nanoseconds() - begin);
+
+    if (pass->print_after) {
+      pass_manager_print(ir, pass->info->name);
+    }
+
+#ifndef NDEBUG
+    if (pm->verify) {
+      const char *error = NULL;
+      int invalid = pass_manager_verify(ir, &error);
+
+      if (invalid >= 0) {
+        pass_manager_print(ir, pass->info->name);
+        LOG_FATAL("Invalid IR after %s, instr %d: %s", pass->info->name,
+                  invalid, error);
+      }
+    }
+#endif
+  }
+}
+
+uint32_t pass_manager_hash(const struct pass_manager *pm) {
+  // 32-bit fnv-1a over the pass names, each followed by a separator
+  uint32_t hash = 0x811c9dc5;
+
+  for (int i = 0; i < pm->num_passes; i++) {
+    for (const char *c = pm->passes[i].info->name; *c; c++) {
+      hash = (hash ^ (uint8_t)*c) * 0x01000193;
+    }
+    hash = (hash ^ ',') * 0x01000193;
+  }
+
+  return hash;
+}
+
+bool pass_manager_remove(struct pass_manager *pm, const char *name) {
+  int n = 0;
+
+  for (int i = 0; i < pm->num_passes; i++) {
+    if (!strcmp(pm->passes[i].info->name, name)) {
+      continue;
+    }
+    pm->passes[n++] = pm->passes[i];
+  }
+
+  bool removed = n != pm->num_passes;
+  pm->num_passes = n;
+  return removed;
+}
+
+bool pass_manager_run_last(struct pass_manager *pm, const char *name) {
+  int num_found = 0;
+  bool print_after = false;
+
+  for (int i = 0; i < pm->num_passes; i++) {
+    if (!strcmp(pm->passes[i].info->name, name)) {
+      print_after |= pm->passes[i].print_after;
+      num_found++;
+    }
+  }
+
+  if (num_found == 1 &&
+      !strcmp(pm->passes[pm->num_passes - 1].info->name, name)) {
+    return true;
+  }
+
+  pass_manager_remove(pm, name);
+
+  if (pm->num_passes == MAX_PASSES) {
+    LOG_WARNING("Too many passes, ignoring %s",
+                pm->passes[MAX_PASSES - 1].info->name);
+    pm->num_passes--;
+  }
+
+  struct pass_manager_pass *pass = &pm->passes[pm->num_passes++];
+  memset(pass, 0, sizeof(*pass));
+  pass->info = pass_manager_find_info(name);
+  pass->print_after = print_after;
+  CHECK_NOTNULL(pass->info);
+
+  return false;
+}
+
+// copies the next name from a comma-separated list, returning the rest of the
+// list, or NULL once it's exhausted
+static const char *pass_manager_next_name(const char *list, char *name,
+                                          int size) {
+  if (!*list) {
+    return NULL;
+  }
+
+  const char *end = strchr(list, ',');
+  int len = end ? (int)(end - list) : (int)strlen(list);
+  len = MIN(len, size - 1);
+  memcpy(name, list, len);
+  name[len] = 0;
+
+  return end ? end + 1 : list + strlen(list);
+}
+
+static bool pass_manager_list_has(const char *list, const char *name) {
+  char it[64];
+
+  while ((list = pass_manager_next_name(list, it, sizeof(it)))) {
+    if (!strcmp(it, "all") || !strcmp(it, name)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void pass_manager_destroy(struct pass_manager *pm) {
+  free(pm);
+}
+
+struct pass_manager *pass_manager_create(const char *passes,
+                                         const char *print_after,
+                                         const struct jit_register *registers,
+                                         int num_registers) {
+  struct pass_manager *pm = calloc(1, sizeof(struct pass_manager));
+  pm->registers = registers;
+  pm->num_registers = num_registers;
+  pm->verify = OPTION_jit_verify_ir;
+
+  char name[64];
+
+  while ((passes = pass_manager_next_name(passes, name, sizeof(name)))) {
+    if (!*name) {
+      continue;
+    }
+
+    const struct pass_info *info = pass_manager_find_info(name);
+
+    if (!info) {
+      LOG_WARNING("Unknown pass %s", name);
+    } else if (pm->num_passes == MAX_PASSES) {
+      LOG_WARNING("Too many passes, ignoring %s", name);
+    } else {
+      struct pass_manager_pass *pass = &pm->passes[pm->num_passes++];
+      pass->info = info;
+      pass->print_after = pass_manager_list_has(print_after, name);
+    }
+  }
+
+  return pm;
+}
@@ -0,0 +1,65 @@
+#ifndef PASS_MANAGER_H
+#define PASS_MANAGER_H
+
+#include <stdbool.h>
+#include "core/option.h"
+#include "jit/jit_stats.h"
+
+DECLARE_OPTION_STRING(jit_passes);
+DECLARE_OPTION_STRING(jit_print_after);
+DECLARE_OPTION_BOOL(jit_verify_ir);
+
+struct ir;
+struct jit_register;
+
+#define MAX_PASSES 32
+
+struct pass_info {
+  const char *name;
+  const char *desc;
+  void (*run)(struct ir *ir, const struct jit_register *registers,
+              int num_registers);
+};
+
+struct pass_manager_pass {
+  const struct pass_info *info;
+  bool print_after;
+  struct jit_histogram times;
+};
+
+// runs an ordered list of passes over the IR, timing each of them. in debug
+// builds, the IR can also be verified after each pass, catching a pass which
+// leaves it malformed before a later pass or the backend trips over it
+struct pass_manager {
+  const struct jit_register *registers;
+  int num_registers;
+  bool verify;
+
+  struct pass_manager_pass passes[MAX_PASSES];
+  int num_passes;
+};
+
+// passes is a comma-separated list of pass names, e.g. "lse,cprop,dce,ra".
+// print_after is a list of the same form naming the passes to print the IR
+// after, or "all" to print it after each of them
+struct pass_manager *pass_manager_create(const char *passes,
+                                         const char *print_after,
+                                         const struct jit_register *registers,
+                                         int num_registers);
+void pass_manager_destroy(struct pass_manager *pm);
+
+// removes each instance of a pass from the list, returning false if there were
+// none
+bool pass_manager_remove(struct pass_manager *pm, const char *name);
+
+// makes sure a pass is run exactly once, after each of the others, moving or
+// appending it as needed. returns false if the list had to be changed. used
+// for register allocation, which the backend depends on having run last
+bool pass_manager_run_last(struct pass_manager *pm, const char *name);
+
+// hash of the passes being run, identifying IR optimized by them
+uint32_t pass_manager_hash(const struct pass_manager *pm);
+
+void pass_manager_run(struct pass_manager *pm, struct ir *ir);
+
+#endif
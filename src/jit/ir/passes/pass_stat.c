@@ -13,18 +13,31 @@ void pass_stat_unregister(struct pass_stat *stat) {
   list_remove(&s_stats, &stat->it);
 }
 
-void pass_stat_print_all() {
-  LOG_INFO("===-----------------------------------------------------===");
-  LOG_INFO("Pass stats");
-  LOG_INFO("===-----------------------------------------------------===");
-
+static int pass_stat_desc_width() {
   int w = 0;
   list_for_each_entry(stat, &s_stats, struct pass_stat, it) {
     int l = (int)strlen(stat->desc);
     w = MAX(l, w);
   }
+  return w;
+}
+
+void pass_stat_write(FILE *output) {
+  int w = pass_stat_desc_width();
+
+  list_for_each_entry(stat, &s_stats, struct pass_stat, it) {
+    fprintf(output, "%-*s  %d\n", w, stat->desc, *stat->n);
+  }
+}
+
+void pass_stat_print_all() {
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("Pass stats");
+  LOG_INFO("===-----------------------------------------------------===");
+
+  int w = pass_stat_desc_width();
 
   list_for_each_entry(stat, &s_stats, struct pass_stat, it) {
-    LOG_INFO("%-*s  %d", w, stat->desc, stat->n);
+    LOG_INFO("%-*s  %d", w, stat->desc, *stat->n);
   }
 }
@@ -1,6 +1,7 @@
 #ifndef PASS_STATS_H
 #define PASS_STATS_H
 
+#include <stdio.h>
 #include "core/constructor.h"
 #include "core/list.h"
 
@@ -24,5 +25,6 @@ struct pass_stat {
 void pass_stat_register(struct pass_stat *stat);
 void pass_stat_unregister(struct pass_stat *stat);
 void pass_stat_print_all();
+void pass_stat_write(FILE *output);
 
 #endif
@@ -5,6 +5,7 @@
 #include "jit/ir/passes/pass_stat.h"
 
 DEFINE_STAT(num_spills, "Number of registers spilled");
+DEFINE_STAT(num_splits, "Number of intervals split around calls");
 
 #define MAX_REGISTERS 32
 
@@ -37,6 +38,10 @@ struct ra {
 
   // intervals, keyed by register
   struct interval intervals[MAX_REGISTERS];
+
+  // the next instruction which calls out of the generated code, at or after
+  // the instruction currently being allocated
+  struct ir_instr *next_call;
 };
 
 static int ra_get_ordinal(const struct ir_instr *i) {
@@ -47,11 +52,30 @@ static void ra_set_ordinal(struct ir_instr *i, int ordinal) {
   i->tag = (intptr_t)ordinal;
 }
 
-static int ra_pop_register(struct register_set *set) {
-  if (!set->num_free_regs) {
-    return NO_REGISTER;
+static bool ra_is_caller_saved(struct ra *ra, int reg) {
+  return ra->registers[reg].flags & JIT_CALLER_SAVED;
+}
+
+static int use_cmp(const struct list_node *a_it, const struct list_node *b_it) {
+  struct ir_use *a = list_entry(a_it, struct ir_use, it);
+  struct ir_use *b = list_entry(b_it, struct ir_use, it);
+  return ra_get_ordinal(a->instr) - ra_get_ordinal(b->instr);
+}
+
+static int ra_pop_register(struct ra *ra, struct register_set *set,
+                           bool caller_saved) {
+  for (int i = set->num_free_regs - 1; i >= 0; i--) {
+    int reg = set->free_regs[i];
+
+    if (ra_is_caller_saved(ra, reg) != caller_saved) {
+      continue;
+    }
+
+    set->free_regs[i] = set->free_regs[--set->num_free_regs];
+    return reg;
   }
-  return set->free_regs[--set->num_free_regs];
+
+  return NO_REGISTER;
 }
 
 static void ra_push_register(struct register_set *set, int reg) {
@@ -120,8 +144,110 @@ static struct register_set *ra_get_register_set(struct ra *ra,
   LOG_FATAL("Unexpected value type");
 }
 
+// ops which call out of the generated code, clobbering any caller saved
+// registers. note, fastmem accesses may be patched by the backend into calls
+// to the slow path, but in that case it's responsible for preserving them
+static bool ra_is_call(const struct ir_instr *instr) {
+  switch (instr->op) {
+    case OP_LOAD_SLOW:
+    case OP_STORE_SLOW:
+    case OP_LOAD_MMIO:
+    case OP_STORE_MMIO:
+    case OP_CALL_EXTERNAL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static struct ir_instr *ra_find_call(struct ir_instr *instr) {
+  while (instr && !ra_is_call(instr)) {
+    instr = list_next_entry(instr, struct ir_instr, it);
+  }
+  return instr;
+}
+
+// find the first call made while the result of instr is live. a call using
+// the value as an argument doesn't count, as the value is consumed before the
+// call is made
+static struct ir_instr *ra_crossed_call(struct ra *ra,
+                                        struct ir_instr *instr) {
+  while (ra->next_call &&
+         ra_get_ordinal(ra->next_call) <= ra_get_ordinal(instr)) {
+    ra->next_call =
+        ra_find_call(list_next_entry(ra->next_call, struct ir_instr, it));
+  }
+
+  struct ir_use *end = list_last_entry(&instr->result->uses, struct ir_use, it);
+
+  if (!end || !ra->next_call ||
+      ra_get_ordinal(ra->next_call) >= ra_get_ordinal(end->instr)) {
+    return NULL;
+  }
+
+  return ra->next_call;
+}
+
+// split the result of instr around a call, so that it can be allocated a
+// caller saved register. the value is stored to the stack immediately after
+// its definition, and filled back from the stack before its first use after
+// the call. the filled value is allocated a register of its own once reached
+static void ra_split_interval(struct ra *ra, struct ir *ir,
+                              struct ir_instr *instr, struct ir_instr *call) {
+  struct ir_instr *insert_point = ir->current_instr;
+  struct ir_value *result = instr->result;
+
+  // find the first use after the call
+  struct ir_use *next_use = NULL;
+
+  list_for_each_entry(use, &result->uses, struct ir_use, it) {
+    if (ra_get_ordinal(use->instr) > ra_get_ordinal(call)) {
+      next_use = use;
+      break;
+    }
+  }
+
+  CHECK_NOTNULL(next_use);
+
+  struct ir_local *local = ir_alloc_local(ir, result->type);
+
+  // insert load before the next use
+  ir->current_instr = list_prev_entry(next_use->instr, struct ir_instr, it);
+  struct ir_value *load_value = ir_load_local(ir, local);
+  struct ir_instr *load_instr = load_value->def;
+
+  int load_ordinal =
+      ra_get_ordinal(list_prev_entry(load_instr, struct ir_instr, it)) + 1;
+  CHECK_LT(load_ordinal,
+           ra_get_ordinal(list_next_entry(load_instr, struct ir_instr, it)));
+  ra_set_ordinal(load_instr, load_ordinal);
+
+  // update the uses from the next use on to use the filled value
+  while (next_use) {
+    struct ir_use *next_next_use = list_next_entry(next_use, struct ir_use, it);
+    ir_replace_use(next_use, load_value);
+    next_use = next_next_use;
+  }
+
+  // insert store after the definition. the store is given the definition's
+  // ordinal, leaving the gap after it for any loads inserted later on
+  ir->current_instr = instr;
+  ir_store_local(ir, local, result);
+
+  struct ir_instr *store_instr = list_next_entry(instr, struct ir_instr, it);
+  ra_set_ordinal(store_instr, ra_get_ordinal(instr));
+
+  // the store was appended to the end of the use list, resort it
+  list_sort(&result->uses, &use_cmp);
+
+  ir->current_instr = insert_point;
+
+  STAT_num_splits++;
+}
+
 static int ra_alloc_blocked_register(struct ra *ra, struct ir *ir,
-                                     struct ir_instr *instr) {
+                                     struct ir_instr *instr,
+                                     struct ir_instr *call) {
   struct ir_instr *insert_point = ir->current_instr;
   struct register_set *set = ra_get_register_set(ra, instr->result->type);
 
@@ -187,6 +313,12 @@ static int ra_alloc_blocked_register(struct ra *ra, struct ir *ir,
   // since the interval that this store belongs to has now expired, there's no
   // need to assign an ordinal to it
 
+  // the register may not be preserved across calls made while the new value
+  // is live
+  if (call && ra_is_caller_saved(ra, interval->reg)) {
+    ra_split_interval(ra, ir, instr, call);
+  }
+
   // reuse the old interval
   interval->instr = instr;
   interval->reused = NULL;
@@ -203,15 +335,29 @@ static int ra_alloc_blocked_register(struct ra *ra, struct ir *ir,
   return interval->reg;
 }
 
-static int ra_alloc_free_register(struct ra *ra, struct ir_instr *instr) {
+static int ra_alloc_free_register(struct ra *ra, struct ir *ir,
+                                  struct ir_instr *instr,
+                                  struct ir_instr *call) {
   struct register_set *set = ra_get_register_set(ra, instr->result->type);
 
-  // get the first free register for this value type
-  int reg = ra_pop_register(set);
+  // get the first free register for this value type. values live across a
+  // call prefer callee saved registers, while all others prefer caller saved
+  // registers, leaving the callee saved registers for those that need them
+  bool caller_saved = !call;
+  int reg = ra_pop_register(ra, set, caller_saved);
+  if (reg == NO_REGISTER) {
+    reg = ra_pop_register(ra, set, !caller_saved);
+  }
   if (reg == NO_REGISTER) {
     return NO_REGISTER;
   }
 
+  // if a value live across a call ended up with a caller saved register,
+  // split it around the call instead of spilling another value
+  if (call && ra_is_caller_saved(ra, reg)) {
+    ra_split_interval(ra, ir, instr, call);
+  }
+
   // add interval
   struct interval *interval = &ra->intervals[reg];
   interval->instr = instr;
@@ -231,7 +377,8 @@ static int ra_alloc_free_register(struct ra *ra, struct ir_instr *instr) {
 // TODO could reorder arguments for communicative binary ops and do this
 // with the second argument as well
 static int ra_reuse_arg_register(struct ra *ra, struct ir *ir,
-                                 struct ir_instr *instr) {
+                                 struct ir_instr *instr,
+                                 struct ir_instr *call) {
   if (!instr->arg[0]) {
     return NO_REGISTER;
   }
@@ -247,6 +394,12 @@ static int ra_reuse_arg_register(struct ra *ra, struct ir *ir,
     return NO_REGISTER;
   }
 
+  // if the result is live across a call, don't reuse a register which won't
+  // be preserved by it
+  if (call && ra_is_caller_saved(ra, prefered)) {
+    return NO_REGISTER;
+  }
+
   // if the argument's register is used after this instruction, it's not
   // trivial to reuse
   struct interval *interval = &ra->intervals[prefered];
@@ -315,12 +468,6 @@ static void ra_expire_intervals(struct ra *ra, struct ir_instr *instr) {
   ra_expire_set(ra, &ra->vector_registers, instr);
 }
 
-static int use_cmp(const struct list_node *a_it, const struct list_node *b_it) {
-  struct ir_use *a = list_entry(a_it, struct ir_use, it);
-  struct ir_use *b = list_entry(b_it, struct ir_use, it);
-  return ra_get_ordinal(a->instr) - ra_get_ordinal(b->instr);
-}
-
 static void ra_assign_ordinals(struct ir *ir) {
   // assign each instruction an ordinal. these ordinals are used to describe
   // the live range of a particular value
@@ -364,6 +511,9 @@ void ra_run(struct ir *ir, const struct jit_register *registers,
 
   ra_assign_ordinals(ir);
 
+  ra.next_call =
+      ra_find_call(list_first_entry(&ir->instrs, struct ir_instr, it));
+
   list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
     struct ir_value *result = instr->result;
 
@@ -380,14 +530,17 @@ void ra_run(struct ir *ir, const struct jit_register *registers,
     // expire any old intervals, freeing up the registers they claimed
     ra_expire_intervals(&ra, instr);
 
+    // find the first call made while the result is live, if any
+    struct ir_instr *call = ra_crossed_call(&ra, instr);
+
     // first, try and reuse the register of one of the incoming arguments
-    int reg = ra_reuse_arg_register(&ra, ir, instr);
+    int reg = ra_reuse_arg_register(&ra, ir, instr, call);
     if (reg == NO_REGISTER) {
       // else, allocate a new register for the result
-      reg = ra_alloc_free_register(&ra, instr);
+      reg = ra_alloc_free_register(&ra, ir, instr, call);
       if (reg == NO_REGISTER) {
         // if a register couldn't be allocated, spill a register and try again
-        reg = ra_alloc_blocked_register(&ra, ir, instr);
+        reg = ra_alloc_blocked_register(&ra, ir, instr, call);
       }
     }
 
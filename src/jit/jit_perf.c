@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit/jit_perf.h"
+#include "core/log.h"
+#include "sys/time.h"
+
+#if PLATFORM_LINUX
+
+#include <elf.h>
+#include <inttypes.h>
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// jitdump format, as described by jitdump-specification.txt in the linux tree's
+// perf documentation. records are timestamped with CLOCK_MONOTONIC, which is
+// what time_nanoseconds uses, so the recording must be made with perf record
+// -k mono for perf inject to match them up with its samples
+#define JITDUMP_MAGIC 0x4a695444
+#define JITDUMP_VERSION 1
+
+enum {
+  JIT_CODE_LOAD = 0,
+  JIT_CODE_DEBUG_INFO = 2,
+};
+
+struct jitdump_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct jitdump_prefix {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+// followed by the null-terminated name of the code, and the code itself
+struct jitdump_code_load {
+  struct jitdump_prefix prefix;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+};
+
+// followed by nr_entry entries, each of which is followed by the
+// null-terminated name of its source file
+struct jitdump_debug_info {
+  struct jitdump_prefix prefix;
+  uint64_t code_addr;
+  uint64_t nr_entry;
+};
+
+struct jitdump_debug_entry {
+  uint64_t addr;
+  int32_t lineno;
+  int32_t discrim;
+};
+
+struct jit_perf {
+  FILE *map;
+  FILE *dump;
+  void *dump_marker;
+  size_t dump_marker_size;
+  uint32_t pid;
+  uint64_t code_index;
+};
+
+static void jit_perf_write_map(struct jit_perf *perf, const char *name,
+                               const uint8_t *host_addr, int host_size) {
+  fprintf(perf->map, "%" PRIxPTR " %x %s\n", (uintptr_t)host_addr, host_size,
+          name);
+  fflush(perf->map);
+}
+
+static void jit_perf_write_dump(struct jit_perf *perf, const char *name,
+                                const uint8_t *host_addr, int host_size,
+                                const struct jit_perf_line *lines,
+                                int num_lines) {
+  uint64_t timestamp = (uint64_t)time_nanoseconds();
+  uint32_t name_size = (uint32_t)strlen(name) + 1;
+
+  // perf expects the line info for a block of code to precede its load
+  if (num_lines) {
+    struct jitdump_debug_info info;
+    info.prefix.id = JIT_CODE_DEBUG_INFO;
+    info.prefix.total_size =
+        sizeof(info) +
+        num_lines * (sizeof(struct jitdump_debug_entry) + name_size);
+    info.prefix.timestamp = timestamp;
+    info.code_addr = (uint64_t)(uintptr_t)host_addr;
+    info.nr_entry = num_lines;
+    fwrite(&info, sizeof(info), 1, perf->dump);
+
+    for (int i = 0; i < num_lines; i++) {
+      struct jitdump_debug_entry entry;
+      entry.addr = (uint64_t)(uintptr_t)lines[i].host_addr;
+      entry.lineno = lines[i].line;
+      entry.discrim = 0;
+      fwrite(&entry, sizeof(entry), 1, perf->dump);
+      fwrite(name, name_size, 1, perf->dump);
+    }
+  }
+
+  struct jitdump_code_load load;
+  load.prefix.id = JIT_CODE_LOAD;
+  load.prefix.total_size = sizeof(load) + name_size + host_size;
+  load.prefix.timestamp = timestamp;
+  load.pid = perf->pid;
+  load.tid = (uint32_t)syscall(SYS_gettid);
+  load.vma = (uint64_t)(uintptr_t)host_addr;
+  load.code_addr = (uint64_t)(uintptr_t)host_addr;
+  load.code_size = host_size;
+  load.code_index = perf->code_index++;
+  fwrite(&load, sizeof(load), 1, perf->dump);
+  fwrite(name, name_size, 1, perf->dump);
+  fwrite(host_addr, host_size, 1, perf->dump);
+  fflush(perf->dump);
+}
+
+static bool jit_perf_open_dump(struct jit_perf *perf, const char *filename) {
+  perf->dump = fopen(filename, "w+b");
+
+  if (!perf->dump) {
+    return false;
+  }
+
+  struct jitdump_header header = {0};
+  header.magic = JITDUMP_MAGIC;
+  header.version = JITDUMP_VERSION;
+  header.total_size = sizeof(header);
+  header.elf_mach = EM_X86_64;
+  header.pid = perf->pid;
+  header.timestamp = (uint64_t)time_nanoseconds();
+
+  if (fwrite(&header, sizeof(header), 1, perf->dump) != 1 ||
+      fflush(perf->dump)) {
+    return false;
+  }
+
+  // perf record finds the dump through an executable mapping of it made by
+  // the process, which it sees as a regular mmap event
+  perf->dump_marker_size = (size_t)sysconf(_SC_PAGESIZE);
+  perf->dump_marker = mmap(NULL, perf->dump_marker_size, PROT_READ | PROT_EXEC,
+                           MAP_PRIVATE, fileno(perf->dump), 0);
+
+  if (perf->dump_marker == MAP_FAILED) {
+    perf->dump_marker = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+void jit_perf_add_code(struct jit_perf *perf, const char *name,
+                       const uint8_t *host_addr, int host_size,
+                       const struct jit_perf_line *lines, int num_lines) {
+  if (perf->map) {
+    jit_perf_write_map(perf, name, host_addr, host_size);
+  }
+
+  if (perf->dump) {
+    jit_perf_write_dump(perf, name, host_addr, host_size, lines, num_lines);
+  }
+}
+
+void jit_perf_destroy(struct jit_perf *perf) {
+  if (perf->dump_marker) {
+    munmap(perf->dump_marker, perf->dump_marker_size);
+  }
+
+  if (perf->dump) {
+    fclose(perf->dump);
+  }
+
+  if (perf->map) {
+    fclose(perf->map);
+  }
+
+  free(perf);
+}
+
+struct jit_perf *jit_perf_create(bool map, bool dump) {
+  struct jit_perf *perf = calloc(1, sizeof(struct jit_perf));
+  perf->pid = (uint32_t)getpid();
+
+  char filename[PATH_MAX];
+
+  if (map) {
+    snprintf(filename, sizeof(filename), "/tmp/perf-%u.map", perf->pid);
+    perf->map = fopen(filename, "w");
+
+    if (!perf->map) {
+      LOG_WARNING("Failed to create perf map %s", filename);
+      jit_perf_destroy(perf);
+      return NULL;
+    }
+  }
+
+  if (dump) {
+    snprintf(filename, sizeof(filename), "/tmp/jit-%u.dump", perf->pid);
+
+    if (!jit_perf_open_dump(perf, filename)) {
+      LOG_WARNING("Failed to create jitdump %s", filename);
+      jit_perf_destroy(perf);
+      return NULL;
+    }
+  }
+
+  return perf;
+}
+
+#else
+
+void jit_perf_add_code(struct jit_perf *perf, const char *name,
+                       const uint8_t *host_addr, int host_size,
+                       const struct jit_perf_line *lines, int num_lines) {}
+
+void jit_perf_destroy(struct jit_perf *perf) {}
+
+struct jit_perf *jit_perf_create(bool map, bool dump) {
+  LOG_WARNING("Exporting code to perf is only supported on Linux");
+  return NULL;
+}
+
+#endif
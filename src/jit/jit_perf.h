@@ -0,0 +1,29 @@
+#ifndef JIT_PERF_H
+#define JIT_PERF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct jit_perf;
+
+// attributes the code starting at host_addr, up until the next line's
+// host_addr, to a line of the code's source. for guest code, the line is the
+// address of the guest instruction the host code was translated from
+struct jit_perf_line {
+  const uint8_t *host_addr;
+  int line;
+};
+
+// exports compiled code to linux perf, which otherwise can't symbolize samples
+// taken in it. the perf map at /tmp/perf-<pid>.map has a "start size name"
+// line for each block of code, and is read by perf report directly. the
+// jitdump at /tmp/jit-<pid>.dump has the code bytes themselves along with
+// their line info, and is merged into a recording with perf inject
+struct jit_perf *jit_perf_create(bool map, bool dump);
+void jit_perf_destroy(struct jit_perf *perf);
+
+void jit_perf_add_code(struct jit_perf *perf, const char *name,
+                       const uint8_t *host_addr, int host_size,
+                       const struct jit_perf_line *lines, int num_lines);
+
+#endif
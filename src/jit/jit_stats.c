@@ -0,0 +1,72 @@
+#include <inttypes.h>
+#include <string.h>
+#include "jit/jit_stats.h"
+#include "core/math.h"
+
+static int jit_histogram_bucket(int64_t ns) {
+  if (ns <= 0) {
+    return 0;
+  }
+
+  int bucket = 64 - clz64((uint64_t)ns);
+  return MIN(bucket, JIT_HISTOGRAM_BUCKETS - 1);
+}
+
+static int64_t jit_histogram_bucket_limit(int bucket) {
+  return (INT64_C(1) << bucket) - 1;
+}
+
+void jit_histogram_write(const struct jit_histogram *hist, const char *name,
+                         FILE *output) {
+  fprintf(output,
+          "%-16s %8" PRId64 " %10.1f %10.1f %10.1f %10.1f %12.1f\n", name,
+          hist->count, jit_histogram_mean(hist) / 1000.0,
+          jit_histogram_percentile(hist, 50) / 1000.0,
+          jit_histogram_percentile(hist, 99) / 1000.0, hist->max / 1000.0,
+          hist->total / 1000.0);
+
+  for (int i = 0; i < JIT_HISTOGRAM_BUCKETS; i++) {
+    if (!hist->buckets[i]) {
+      continue;
+    }
+
+    fprintf(output, "  <= %10.1f us %8" PRId64 "\n",
+            jit_histogram_bucket_limit(i) / 1000.0, hist->buckets[i]);
+  }
+}
+
+int64_t jit_histogram_percentile(const struct jit_histogram *hist,
+                                 int percentile) {
+  if (!hist->count) {
+    return 0;
+  }
+
+  // the rank of the percentile, rounded up
+  int64_t rank = (hist->count * percentile + 99) / 100;
+  int64_t seen = 0;
+
+  for (int i = 0; i < JIT_HISTOGRAM_BUCKETS - 1; i++) {
+    seen += hist->buckets[i];
+
+    if (seen >= MAX(rank, 1)) {
+      return MIN(jit_histogram_bucket_limit(i), hist->max);
+    }
+  }
+
+  return hist->max;
+}
+
+int64_t jit_histogram_mean(const struct jit_histogram *hist) {
+  return hist->count ? hist->total / hist->count : 0;
+}
+
+void jit_histogram_reset(struct jit_histogram *hist) {
+  memset(hist, 0, sizeof(*hist));
+}
+
+void jit_histogram_add(struct jit_histogram *hist, int64_t ns) {
+  hist->count++;
+  hist->total += ns;
+  hist->max = MAX(hist->max, ns);
+  hist->buckets[jit_histogram_bucket(ns)]++;
+}
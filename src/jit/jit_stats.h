@@ -0,0 +1,33 @@
+#ifndef JIT_STATS_H
+#define JIT_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// latencies are bucketed by powers of two, bucket n counting those in the range
+// [2^(n-1), 2^n) nanoseconds. the last bucket catches anything over ~1s
+#define JIT_HISTOGRAM_BUCKETS 31
+
+struct jit_histogram {
+  int64_t count;
+  int64_t total;
+  int64_t max;
+  int64_t buckets[JIT_HISTOGRAM_BUCKETS];
+};
+
+void jit_histogram_add(struct jit_histogram *hist, int64_t ns);
+void jit_histogram_reset(struct jit_histogram *hist);
+
+int64_t jit_histogram_mean(const struct jit_histogram *hist);
+
+// returns the upper bound of the bucket containing the given percentile, as
+// the latencies themselves aren't kept
+int64_t jit_histogram_percentile(const struct jit_histogram *hist,
+                                 int percentile);
+
+// writes a one line summary of the histogram, followed by a line for each
+// non-empty bucket
+void jit_histogram_write(const struct jit_histogram *hist, const char *name,
+                         FILE *output);
+
+#endif
@@ -6,7 +6,7 @@
 #include "core/math.h"
 #include "sys/exception_handler.h"
 
-#define MAX_WATCHES 1024
+#define MAX_WATCHES 65536
 
 struct memory_watch {
   enum memory_watch_type type;
@@ -71,6 +71,10 @@ static bool watcher_handle_exception(void *ctx, struct exception *ex) {
       CHECK(protect_pages((void *)aligned_begin, aligned_size, ACC_READWRITE));
 
       interval_tree_remove(&s_watcher->tree, n);
+
+      // return the watch to the free list
+      list_remove(&s_watcher->live_watches, &watch->list_it);
+      list_add(&s_watcher->free_watches, &watch->list_it);
     }
 
     n = next;
@@ -89,6 +93,14 @@ struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
     watcher_create();
   }
 
+  // allocate new access watch
+  struct memory_watch *watch =
+      list_first_entry(&s_watcher->free_watches, struct memory_watch, list_it);
+
+  if (!watch) {
+    return NULL;
+  }
+
   // page align the range to be watched
   size_t page_size = get_page_size();
   uintptr_t aligned_begin = align_down((uintptr_t)ptr, page_size);
@@ -98,10 +110,6 @@ struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
   // disable writing to the pages
   CHECK(protect_pages((void *)aligned_begin, aligned_size, ACC_READONLY));
 
-  // allocate new access watch
-  struct memory_watch *watch =
-      list_first_entry(&s_watcher->free_watches, struct memory_watch, list_it);
-  CHECK_NOTNULL(watch);
   watch->type = WATCH_SINGLE_WRITE;
   watch->cb = cb;
   watch->data = data;
@@ -122,6 +130,13 @@ struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
 }
 
 void remove_memory_watch(struct memory_watch *watch) {
+  if (watch->type == WATCH_SINGLE_WRITE) {
+    // restore page permissions
+    uintptr_t aligned_begin = watch->tree_it.low;
+    size_t aligned_size = (watch->tree_it.high - watch->tree_it.low) + 1;
+    CHECK(protect_pages((void *)aligned_begin, aligned_size, ACC_READWRITE));
+  }
+
   // remove from interval tree
   interval_tree_remove(&s_watcher->tree, &watch->tree_it);
 
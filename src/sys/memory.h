@@ -13,6 +13,7 @@ enum page_access {
   ACC_NONE,
   ACC_READONLY,
   ACC_READWRITE,
+  ACC_READEXEC,
   ACC_READWRITEEXEC,
 };
 
@@ -30,8 +31,10 @@ typedef void *shmem_handle_t;
 
 shmem_handle_t create_shared_memory(const char *filename, size_t size,
                                     enum page_access access);
-bool map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
-                       size_t size, enum page_access access);
+// maps the object at start, or wherever the system sees fit if start is NULL.
+// returns the address it was mapped to, or NULL on failure
+void *map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
+                        size_t size, enum page_access access);
 bool unmap_shared_memory(shmem_handle_t handle, void *start, size_t size);
 bool destroy_shared_memory(shmem_handle_t handle);
 
@@ -25,6 +25,7 @@ static mode_t access_to_mode_flags(enum page_access access) {
     case ACC_READONLY:
       return S_IREAD;
     case ACC_READWRITE:
+    case ACC_READWRITEEXEC:
       return S_IREAD | S_IWRITE;
     default:
       return 0;
@@ -36,6 +37,7 @@ static int access_to_open_flags(enum page_access access) {
     case ACC_READONLY:
       return O_RDONLY;
     case ACC_READWRITE:
+    case ACC_READWRITEEXEC:
       return O_RDWR;
     default:
       return 0;
@@ -48,6 +50,8 @@ static int access_to_protect_flags(enum page_access access) {
       return PROT_READ;
     case ACC_READWRITE:
       return PROT_READ | PROT_WRITE;
+    case ACC_READEXEC:
+      return PROT_READ | PROT_EXEC;
     case ACC_READWRITEEXEC:
       return PROT_READ | PROT_WRITE | PROT_EXEC;
     default:
@@ -119,6 +123,21 @@ shmem_handle_t create_shared_memory(const char *filename, size_t size,
   struct shmem *shmem = list_first_entry(&s_free_shmem, struct shmem, free_it);
   CHECK_NOTNULL(shmem);
 
+#if PLATFORM_LINUX
+  // prefer an anonymous memfd, which isn't left behind in /dev/shm if the
+  // process dies, and isn't subject to /dev/shm being mounted noexec
+  int handle = memfd_create(filename, MFD_CLOEXEC);
+  if (handle == -1) {
+    return NULL;
+  }
+
+  // resize it
+  int res = ftruncate(handle, size);
+  if (res == -1) {
+    close(handle);
+    return NULL;
+  }
+#else
   // make sure the shared memory object doesn't already exist
   shm_unlink(filename);
 
@@ -136,6 +155,7 @@ shmem_handle_t create_shared_memory(const char *filename, size_t size,
     shm_unlink(filename);
     return NULL;
   }
+#endif
 
   // update entry, remove from free list
   strncpy(shmem->filename, filename, sizeof(shmem->filename));
@@ -145,17 +165,17 @@ shmem_handle_t create_shared_memory(const char *filename, size_t size,
   return (shmem_handle_t)shmem;
 }
 
-bool map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
-                       size_t size, enum page_access access) {
+void *map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
+                        size_t size, enum page_access access) {
   init_shared_memory_entries();
 
   struct shmem *shmem = (struct shmem *)handle;
 
   int prot = access_to_protect_flags(access);
-  void *ptr =
-      mmap(start, size, prot, MAP_SHARED | MAP_FIXED, shmem->handle, offset);
+  int flags = MAP_SHARED | (start ? MAP_FIXED : 0);
+  void *ptr = mmap(start, size, prot, flags, shmem->handle, offset);
 
-  return ptr != MAP_FAILED;
+  return ptr != MAP_FAILED ? ptr : NULL;
 }
 
 bool unmap_shared_memory(shmem_handle_t handle, void *start, size_t size) {
@@ -168,7 +188,11 @@ bool destroy_shared_memory(shmem_handle_t handle) {
   struct shmem *shmem = (struct shmem *)handle;
 
   int res1 = close(shmem->handle);
+#if PLATFORM_LINUX
+  int res2 = 0;
+#else
   int res2 = shm_unlink(shmem->filename);
+#endif
 
   // add back to free list
   list_add(&s_free_shmem, &shmem->free_it);
@@ -7,6 +7,8 @@ static DWORD access_to_file_flags(enum page_access access) {
       return FILE_MAP_READ;
     case ACC_READWRITE:
       return FILE_MAP_READ | FILE_MAP_WRITE;
+    case ACC_READEXEC:
+      return FILE_MAP_READ | FILE_MAP_EXECUTE;
     default:
       return 0;
   }
@@ -18,6 +20,8 @@ static DWORD access_to_protection_flags(enum page_access access) {
       return PAGE_READONLY;
     case ACC_READWRITE:
       return PAGE_READWRITE;
+    case ACC_READEXEC:
+      return PAGE_EXECUTE_READ;
     case ACC_READWRITEEXEC:
       return PAGE_EXECUTE_READWRITE;
     default:
@@ -59,12 +63,12 @@ shmem_handle_t create_shared_memory(const char *filename, size_t size,
                            (DWORD)(size >> 32), (DWORD)(size), filename);
 }
 
-bool map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
-                       size_t size, enum page_access access) {
+void *map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
+                        size_t size, enum page_access access) {
   DWORD file_flags = access_to_file_flags(access);
   void *ptr = MapViewOfFileEx(handle, file_flags, (DWORD)(offset >> 32),
                               (DWORD)offset, size, start);
-  return ptr == start;
+  return !start || ptr == start ? ptr : NULL;
 }
 
 bool unmap_shared_memory(shmem_handle_t handle, void *start, size_t size) {
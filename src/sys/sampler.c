@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include "sys/sampler.h"
+#include "core/log.h"
+
+#if PLATFORM_LINUX
+
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// older versions of glibc don't define this
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+struct sampler {
+  timer_t timer;
+  sampler_cb cb;
+  void *data;
+};
+
+static void sampler_handler(int signo, siginfo_t *info, void *ctx) {
+  ucontext_t *uctx = ctx;
+  struct sampler *sampler = info->si_value.sival_ptr;
+
+  sampler->cb(sampler->data, (uintptr_t)uctx->uc_mcontext.gregs[REG_RIP]);
+}
+
+struct sampler *sampler_create(int interval_us, sampler_cb cb, void *data) {
+  struct sampler *sampler = calloc(1, sizeof(struct sampler));
+  sampler->cb = cb;
+  sampler->data = data;
+
+  struct sigaction sa;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_sigaction = &sampler_handler;
+
+  if (sigaction(SIGPROF, &sa, NULL) != 0) {
+    free(sampler);
+    return NULL;
+  }
+
+  // the timer counts the cpu time of the calling thread alone, and signals it
+  // directly rather than whichever thread the kernel picks
+  struct sigevent sev = {0};
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGPROF;
+  sev.sigev_value.sival_ptr = sampler;
+  sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &sampler->timer) != 0) {
+    signal(SIGPROF, SIG_IGN);
+    free(sampler);
+    return NULL;
+  }
+
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = interval_us / 1000000;
+  spec.it_interval.tv_nsec = (interval_us % 1000000) * 1000;
+  spec.it_value = spec.it_interval;
+  timer_settime(sampler->timer, 0, &spec, NULL);
+
+  return sampler;
+}
+
+void sampler_destroy(struct sampler *sampler) {
+  timer_delete(sampler->timer);
+
+  // a signal generated before the timer was deleted may still be pending, make
+  // sure it's discarded instead of being handled with the freed sampler
+  signal(SIGPROF, SIG_IGN);
+
+  free(sampler);
+}
+
+#else
+
+struct sampler *sampler_create(int interval_us, sampler_cb cb, void *data) {
+  LOG_WARNING("Sampling is only supported on Linux");
+  return NULL;
+}
+
+void sampler_destroy(struct sampler *sampler) {}
+
+#endif
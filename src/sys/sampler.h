@@ -0,0 +1,16 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+
+struct sampler;
+
+typedef void (*sampler_cb)(void *data, uintptr_t pc);
+
+// periodically interrupts the calling thread, once per interval_us of cpu time
+// it consumes, passing the address it was interrupted at to cb. cb is called
+// from a signal handler on the thread itself, so it must be async signal safe
+struct sampler *sampler_create(int interval_us, sampler_cb cb, void *data);
+void sampler_destroy(struct sampler *sampler);
+
+#endif
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "jit/ir/ir.h"
+#include "jit/ir/passes/constant_propagation_pass.h"
+}
+
+static uint8_t ir_buffer[1024 * 1024];
+static char scratch_buffer[1024 * 1024];
+
+static void run_cprop(const char *input_str, const char *output_str) {
+  struct ir ir = {};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  FILE *input = tmpfile();
+  fwrite(input_str, 1, strlen(input_str), input);
+  rewind(input);
+  bool res = ir_read(input, &ir);
+  fclose(input);
+  ASSERT_TRUE(res);
+
+  cprop_run(&ir);
+
+  memset(scratch_buffer, 0, sizeof(scratch_buffer));
+  FILE *output = tmpfile();
+  ir_write(&ir, output);
+  rewind(output);
+  size_t n = fread(&scratch_buffer, 1, sizeof(scratch_buffer), output);
+  fclose(output);
+  ASSERT_NE(n, 0u);
+
+  ASSERT_STREQ(scratch_buffer, output_str);
+}
+
+TEST(ConstantPropagationPassTest, Fold) {
+  static const char input_str[] =
+      "i32 %0 = add i32 0x2, i32 0x3\n"
+      "i32 %1 = shl i32 %0, i32 0x4\n"
+      "i64 %2 = zext i32 %1\n"
+      "store_context i32 0x10, i64 %2\n"
+      "i32 %3 = lshd i32 0x80000000, i32 0xffffffe0\n"
+      "store_context i32 0x14, i32 %3\n"
+      "i8 %4 = cmp i32 %1, i32 0x50, i32 0x0\n"
+      "i32 %5 = load_context i32 0x20\n"
+      "i32 %6 = select i32 %5, i32 0x7, i8 %4\n"
+      "store_context i32 0x24, i32 %6\n"
+      "branch_cond i8 %4, i32 0x8c000100, i32 0x8c000200\n";
+
+  static const char output_str[] =
+      "store_context i32 0x10, i64 0x50\n"
+      "store_context i32 0x14, i32 0x0\n"
+      "i32 %0 = load_context i32 0x20\n"
+      "store_context i32 0x24, i32 %0\n"
+      "branch i32 0x8c000100\n";
+
+  run_cprop(input_str, output_str);
+}
+
+TEST(ConstantPropagationPassTest, Simplify) {
+  static const char input_str[] =
+      "i32 %0 = load_context i32 0x10\n"
+      "i32 %1 = add i32 %0, i32 0x0\n"
+      "i32 %2 = and i32 %1, i32 0xffffffff\n"
+      "i32 %3 = lshr i32 %2, i32 0x0\n"
+      "i32 %4 = or i32 0x0, i32 %3\n"
+      "store_context i32 0x14, i32 %4\n"
+      "i32 %5 = and i32 0x3, i32 %0\n"
+      "store_context i32 0x18, i32 %5\n"
+      "i32 %6 = smul i32 %0, i32 0x0\n"
+      "store_context i32 0x1c, i32 %6\n";
+
+  static const char output_str[] =
+      "i32 %0 = load_context i32 0x10\n"
+      "store_context i32 0x14, i32 %0\n"
+      "i32 %1 = and i32 %0, i32 0x3\n"
+      "store_context i32 0x18, i32 %1\n"
+      "store_context i32 0x1c, i32 0x0\n";
+
+  run_cprop(input_str, output_str);
+}
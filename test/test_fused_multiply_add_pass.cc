@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "jit/ir/ir.h"
+#include "jit/ir/passes/fused_multiply_add_pass.h"
+}
+
+static uint8_t ir_buffer[1024 * 1024];
+static char scratch_buffer[1024 * 1024];
+
+static void run_fma(const char *input_str, const char *output_str) {
+  struct ir ir = {};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  FILE *input = tmpfile();
+  fwrite(input_str, 1, strlen(input_str), input);
+  rewind(input);
+  bool res = ir_read(input, &ir);
+  fclose(input);
+  ASSERT_TRUE(res);
+
+  fma_run(&ir);
+
+  FILE *output = tmpfile();
+  ir_write(&ir, output);
+  rewind(output);
+  size_t n = fread(&scratch_buffer, 1, sizeof(scratch_buffer), output);
+  fclose(output);
+  ASSERT_NE(n, 0u);
+  scratch_buffer[n] = 0;
+
+  ASSERT_STREQ(scratch_buffer, output_str);
+}
+
+TEST(FusedMultiplyAddPassTest, Scalar) {
+  // FMAC FR0,FR2,FR1
+  static const char input_str[] =
+      "f32 %0 = load_context i32 0x4c\n"
+      "f32 %1 = load_context i32 0x48\n"
+      "f32 %2 = load_context i32 0x44\n"
+      "f32 %3 = fmul f32 %1, f32 %2\n"
+      "f32 %4 = fadd f32 %3, f32 %0\n"
+      "store_context i32 0x4c, f32 %4\n";
+
+  static const char output_str[] =
+      "f32 %0 = load_context i32 0x4c\n"
+      "f32 %1 = load_context i32 0x48\n"
+      "f32 %2 = load_context i32 0x44\n"
+      "f32 %3 = fmadd f32 %1, f32 %2, f32 %0\n"
+      "store_context i32 0x4c, f32 %3\n";
+
+  run_fma(input_str, output_str);
+}
+
+TEST(FusedMultiplyAddPassTest, Vector) {
+  // the first two products of FTRV, the second product is folded so the
+  // first keeps accumulating in order
+  static const char input_str[] =
+      "v128 %0 = load_context i32 0x80\n"
+      "f32 %1 = load_context i32 0x40\n"
+      "v128 %2 = vbroadcast f32 %1\n"
+      "v128 %3 = vmul v128 %0, v128 %2\n"
+      "v128 %4 = load_context i32 0x90\n"
+      "f32 %5 = load_context i32 0x44\n"
+      "v128 %6 = vbroadcast f32 %5\n"
+      "v128 %7 = vmul v128 %4, v128 %6\n"
+      "v128 %8 = vadd v128 %3, v128 %7\n"
+      "store_context i32 0x40, v128 %8\n";
+
+  static const char output_str[] =
+      "v128 %0 = load_context i32 0x80\n"
+      "f32 %1 = load_context i32 0x40\n"
+      "v128 %2 = vbroadcast f32 %1\n"
+      "v128 %3 = vmul v128 %0, v128 %2\n"
+      "v128 %4 = load_context i32 0x90\n"
+      "f32 %5 = load_context i32 0x44\n"
+      "v128 %6 = vbroadcast f32 %5\n"
+      "v128 %7 = vfmadd v128 %4, v128 %6, v128 %3\n"
+      "store_context i32 0x40, v128 %7\n";
+
+  run_fma(input_str, output_str);
+}
+
+TEST(FusedMultiplyAddPassTest, Unfusable) {
+  // the product is used elsewhere, and the addend is constant
+  static const char input_str[] =
+      "f32 %0 = load_context i32 0x40\n"
+      "f32 %1 = load_context i32 0x44\n"
+      "f32 %2 = fmul f32 %0, f32 %1\n"
+      "f32 %3 = fadd f32 %2, f32 %0\n"
+      "store_context i32 0x48, f32 %2\n"
+      "store_context i32 0x4c, f32 %3\n"
+      "f32 %4 = fmul f32 %0, f32 %1\n"
+      "f32 %5 = fadd f32 %4, f32 0x3f800000\n"
+      "store_context i32 0x50, f32 %5\n";
+
+  run_fma(input_str, input_str);
+}
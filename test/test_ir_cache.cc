@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "jit/ir/ir.h"
+#include "jit/ir/ir_cache.h"
+}
+
+static const char cache_filename[] = "test_ir_cache.bin";
+
+static uint8_t ir_buffer[1024 * 1024];
+static uint8_t binary_buffer[1024 * 1024];
+static char scratch_buffer[1024 * 1024];
+
+static const char input_str[] =
+    "i32 %0 = load_context i32 0xbc\n"
+    "i32 %1 = load_slow i32 %0\n"
+    "i8 %2 = load_context i32 0xc0\n"
+    "i16 %3 = load_context i32 0xc4\n"
+    "i64 %4 = zext i32 %1\n"
+    "i64 %5 = add i64 %4, i64 0x123456789\n"
+    "f32 %6 = load_context i32 0xc8\n"
+    "f32 %7 = fadd f32 %6, f32 0x3f800000\n"
+    "f64 %8 = fext f32 %7\n"
+    "f64 %9 = fmul f64 %8, f64 0x4000000000000000\n"
+    "v128 %10 = load_context i32 0xd0\n"
+    "f32 %11 = vdot v128 %10, v128 %10\n"
+    "store_context i32 0xd0, f32 %11\n"
+    "store_context i32 0xd8, f64 %9\n"
+    "store_context i32 0xe0, i8 0x7f\n"
+    "store_context i32 0xe4, i16 0x1234\n"
+    "store_context i32 0xe8, i64 %5\n"
+    "branch_cond i8 %2, i32 0x8c000010, i32 0x8c000020\n";
+
+static void read_ir(const char *str, struct ir *ir) {
+  *ir = {};
+  ir->buffer = ir_buffer;
+  ir->capacity = sizeof(ir_buffer);
+
+  FILE *input = tmpfile();
+  fwrite(str, 1, strlen(str), input);
+  rewind(input);
+  bool res = ir_read(input, ir);
+  fclose(input);
+  ASSERT_TRUE(res);
+}
+
+static void write_ir(struct ir *ir) {
+  memset(scratch_buffer, 0, sizeof(scratch_buffer));
+
+  FILE *output = tmpfile();
+  ir_write(ir, output);
+  rewind(output);
+  size_t n = fread(&scratch_buffer, 1, sizeof(scratch_buffer), output);
+  fclose(output);
+  ASSERT_NE(n, 0u);
+}
+
+TEST(IRCacheTest, BinaryRoundTrip) {
+  struct ir ir;
+  read_ir(input_str, &ir);
+
+  // assign some registers which need to be preserved
+  int next_reg = 0;
+  list_for_each_entry(instr, &ir.instrs, struct ir_instr, it) {
+    if (instr->result) {
+      instr->result->reg = next_reg++ % 8;
+    }
+  }
+  ir.locals_size = 24;
+
+  int size = ir_write_binary(&ir, binary_buffer, sizeof(binary_buffer));
+  ASSERT_NE(size, 0);
+  ASSERT_EQ(0, ir_write_binary(&ir, binary_buffer, size - 1));
+
+  struct ir copy = {};
+  copy.buffer = ir_buffer;
+  copy.capacity = sizeof(ir_buffer);
+  ASSERT_TRUE(ir_read_binary(binary_buffer, size, &copy));
+  ASSERT_FALSE(ir_read_binary(binary_buffer, size - 1, &copy));
+
+  copy = {};
+  copy.buffer = ir_buffer + ir.used;
+  copy.capacity = sizeof(ir_buffer) - ir.used;
+  ASSERT_TRUE(ir_read_binary(binary_buffer, size, &copy));
+
+  ASSERT_EQ(24, copy.locals_size);
+
+  next_reg = 0;
+  list_for_each_entry(instr, &copy.instrs, struct ir_instr, it) {
+    if (instr->result) {
+      ASSERT_EQ(next_reg++ % 8, instr->result->reg);
+    }
+  }
+
+  write_ir(&copy);
+  ASSERT_STREQ(input_str, scratch_buffer);
+}
+
+TEST(IRCacheTest, Lookup) {
+  uint8_t guest_code[16] = {0x01, 0xe0, 0x0b, 0x00, 0x09, 0x00};
+  uint32_t guest_addr = 0x8c010000;
+  int guest_size = 6;
+  int size = 0;
+
+  remove(cache_filename);
+
+  struct ir_cache *cache = ir_cache_create(cache_filename, 1);
+  ASSERT_NE(nullptr, cache);
+
+  struct ir ir;
+  read_ir(input_str, &ir);
+  ASSERT_FALSE(ir_cache_lookup(cache, guest_addr, guest_code, 0, &size, &ir));
+  ir_cache_insert(cache, guest_addr, guest_code, 0, guest_size, &ir);
+  ir_cache_destroy(cache);
+
+  // blocks should persist between runs
+  cache = ir_cache_create(cache_filename, 1);
+  ASSERT_NE(nullptr, cache);
+
+  ir = {};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+  ASSERT_TRUE(ir_cache_lookup(cache, guest_addr, guest_code, 0, &size, &ir));
+  ASSERT_EQ(guest_size, size);
+  write_ir(&ir);
+  ASSERT_STREQ(input_str, scratch_buffer);
+
+  // but only be returned for the same flags and guest code
+  ASSERT_FALSE(ir_cache_lookup(cache, guest_addr, guest_code, 1, &size, &ir));
+  ASSERT_FALSE(
+      ir_cache_lookup(cache, guest_addr + 2, guest_code, 0, &size, &ir));
+
+  guest_code[0] = 0x02;
+  ASSERT_FALSE(ir_cache_lookup(cache, guest_addr, guest_code, 0, &size, &ir));
+  ir_cache_destroy(cache);
+
+  // and the cache should be discarded when the signature changes, including
+  // its upper half
+  guest_code[0] = 0x01;
+  cache = ir_cache_create(cache_filename, 2);
+  ASSERT_NE(nullptr, cache);
+  ASSERT_FALSE(ir_cache_lookup(cache, guest_addr, guest_code, 0, &size, &ir));
+  read_ir(input_str, &ir);
+  ir_cache_insert(cache, guest_addr, guest_code, 0, guest_size, &ir);
+  ir_cache_destroy(cache);
+
+  cache = ir_cache_create(cache_filename, 2 | (UINT64_C(1) << 40));
+  ASSERT_NE(nullptr, cache);
+  ASSERT_FALSE(ir_cache_lookup(cache, guest_addr, guest_code, 0, &size, &ir));
+  ir_cache_destroy(cache);
+
+  remove(cache_filename);
+}
+
+TEST(IRCacheTest, BinaryFile) {
+  const uint8_t guest_code[6] = {0x01, 0xe0, 0x0b, 0x00, 0x09, 0x00};
+
+  struct ir ir;
+  read_ir(input_str, &ir);
+
+  // write the same block twice, the second time without any guest code
+  FILE *file = tmpfile();
+  ASSERT_TRUE(ir_write_file(&ir, 0x8c010000, guest_code, 6, 3, file));
+  ASSERT_TRUE(ir_write_file(&ir, 0x8c010020, NULL, 0, 0, file));
+  rewind(file);
+
+  ASSERT_TRUE(ir_file_is_binary(file));
+
+  // ir_read reads the first block, leaving the file where it was
+  struct ir copy = {};
+  copy.buffer = ir_buffer + ir.used;
+  copy.capacity = sizeof(ir_buffer) - ir.used;
+  ASSERT_TRUE(ir_read(file, &copy));
+  write_ir(&copy);
+  ASSERT_STREQ(input_str, scratch_buffer);
+  rewind(file);
+
+  struct ir_file_header header;
+  uint8_t guest[16] = {0};
+
+  copy = {};
+  copy.buffer = ir_buffer + ir.used;
+  copy.capacity = sizeof(ir_buffer) - ir.used;
+  ASSERT_TRUE(ir_read_file(file, &copy, &header, guest, sizeof(guest)));
+  ASSERT_EQ(0x8c010000u, header.guest_addr);
+  ASSERT_EQ(3u, header.guest_flags);
+  ASSERT_EQ(6u, header.guest_size);
+  ASSERT_EQ(0, memcmp(guest, guest_code, sizeof(guest_code)));
+
+  copy = {};
+  copy.buffer = ir_buffer + ir.used;
+  copy.capacity = sizeof(ir_buffer) - ir.used;
+  ASSERT_TRUE(ir_read_file(file, &copy, &header, NULL, 0));
+  ASSERT_EQ(0x8c010020u, header.guest_addr);
+  write_ir(&copy);
+  ASSERT_STREQ(input_str, scratch_buffer);
+
+  // the end of the file is reached after the last block
+  ASSERT_FALSE(ir_read_file(file, &copy, &header, NULL, 0));
+  fclose(file);
+
+  // text files aren't mistaken for binary ones
+  file = tmpfile();
+  fwrite(input_str, 1, strlen(input_str), file);
+  rewind(file);
+  ASSERT_FALSE(ir_file_is_binary(file));
+  ASSERT_EQ(0, ftell(file));
+  fclose(file);
+}
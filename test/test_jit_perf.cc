@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+extern "C" {
+#include "jit/jit_perf.h"
+}
+
+#if PLATFORM_LINUX
+
+static uint8_t file_buffer[4096];
+
+static int read_file(const char *fmt) {
+  char filename[64];
+  snprintf(filename, sizeof(filename), fmt, (unsigned)getpid());
+
+  FILE *file = fopen(filename, "rb");
+  if (!file) {
+    return -1;
+  }
+  int size = (int)fread(file_buffer, 1, sizeof(file_buffer), file);
+  fclose(file);
+  remove(filename);
+  return size;
+}
+
+template <typename T>
+static T read_value(int *offset) {
+  T value;
+  memcpy(&value, file_buffer + *offset, sizeof(value));
+  *offset += sizeof(value);
+  return value;
+}
+
+TEST(JitPerfTest, Export) {
+  static const uint8_t code[] = {0x48, 0x89, 0xc8, 0x48, 0x01, 0xd0, 0xc3};
+  struct jit_perf_line lines[] = {{code, 0x0c010000}, {code + 3, 0x0c010002}};
+
+  struct jit_perf *perf = jit_perf_create(true, true);
+  ASSERT_NE(nullptr, perf);
+  jit_perf_add_code(perf, "sh4_0x8c010000", code, sizeof(code), lines, 2);
+  jit_perf_add_code(perf, "sh4_0x8c010010", code + 3, 4, NULL, 0);
+  jit_perf_destroy(perf);
+
+  // the map should have a line per block
+  char expected[128];
+  snprintf(expected, sizeof(expected),
+           "%" PRIxPTR " 7 sh4_0x8c010000\n%" PRIxPTR " 4 sh4_0x8c010010\n",
+           (uintptr_t)code, (uintptr_t)(code + 3));
+  int size = read_file("/tmp/perf-%u.map");
+  ASSERT_EQ((int)strlen(expected), size);
+  ASSERT_EQ(0, memcmp(expected, file_buffer, size));
+
+  // and the dump a load record per block, preceded by its line info
+  size = read_file("/tmp/jit-%u.dump");
+  ASSERT_GT(size, 40);
+  int offset = 0;
+  ASSERT_EQ(0x4a695444u, read_value<uint32_t>(&offset));
+  ASSERT_EQ(1u, read_value<uint32_t>(&offset));
+  ASSERT_EQ(40u, read_value<uint32_t>(&offset));
+  offset = 40;
+
+  static const uint32_t expected_ids[] = {2, 0, 0};
+  const uint8_t *expected_addrs[] = {code, code, code + 3};
+  for (int n = 0; n < 3; n++) {
+    uint32_t id = expected_ids[n];
+    int start = offset;
+    ASSERT_EQ(id, read_value<uint32_t>(&offset));
+    uint32_t total_size = read_value<uint32_t>(&offset);
+    read_value<uint64_t>(&offset);
+
+    if (id == 2) {
+      ASSERT_EQ((uintptr_t)code, read_value<uint64_t>(&offset));
+      ASSERT_EQ(2u, read_value<uint64_t>(&offset));
+
+      for (int i = 0; i < 2; i++) {
+        ASSERT_EQ((uintptr_t)lines[i].host_addr,
+                  read_value<uint64_t>(&offset));
+        ASSERT_EQ(lines[i].line, read_value<int32_t>(&offset));
+        read_value<int32_t>(&offset);
+        ASSERT_STREQ("sh4_0x8c010000", (const char *)file_buffer + offset);
+        offset += sizeof("sh4_0x8c010000");
+      }
+    } else {
+      ASSERT_EQ((uint32_t)getpid(), read_value<uint32_t>(&offset));
+      read_value<uint32_t>(&offset);
+      ASSERT_EQ((uintptr_t)expected_addrs[n], read_value<uint64_t>(&offset));
+      ASSERT_EQ((uintptr_t)expected_addrs[n], read_value<uint64_t>(&offset));
+      uint64_t code_size = read_value<uint64_t>(&offset);
+      ASSERT_EQ((uint64_t)(n - 1), read_value<uint64_t>(&offset));
+      const char *name = (const char *)file_buffer + offset;
+      offset += (int)strlen(name) + 1;
+      ASSERT_EQ(0, memcmp(expected_addrs[n], file_buffer + offset, code_size));
+      offset += (int)code_size;
+    }
+
+    ASSERT_EQ(start + (int)total_size, offset);
+  }
+
+  ASSERT_EQ(size, offset);
+}
+
+#endif
@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "jit/jit_stats.h"
+}
+
+TEST(JitStatsTest, Histogram) {
+  struct jit_histogram hist = {};
+
+  ASSERT_EQ(0, jit_histogram_mean(&hist));
+  ASSERT_EQ(0, jit_histogram_percentile(&hist, 99));
+
+  // 90 fast compiles and 10 slow ones
+  for (int i = 0; i < 90; i++) {
+    jit_histogram_add(&hist, 3000);
+  }
+  for (int i = 0; i < 10; i++) {
+    jit_histogram_add(&hist, 100000);
+  }
+
+  ASSERT_EQ(100, hist.count);
+  ASSERT_EQ(100000, hist.max);
+  ASSERT_EQ((90 * 3000 + 10 * 100000) / 100, jit_histogram_mean(&hist));
+
+  // percentiles are reported as the upper bound of their bucket, clamped to
+  // the largest latency seen
+  ASSERT_EQ(4095, jit_histogram_percentile(&hist, 50));
+  ASSERT_EQ(4095, jit_histogram_percentile(&hist, 90));
+  ASSERT_EQ(100000, jit_histogram_percentile(&hist, 99));
+
+  // latencies past the last bucket are still counted
+  jit_histogram_add(&hist, INT64_C(1) << 40);
+  ASSERT_EQ(1, hist.buckets[JIT_HISTOGRAM_BUCKETS - 1]);
+  ASSERT_EQ(INT64_C(1) << 40, jit_histogram_percentile(&hist, 100));
+
+  jit_histogram_reset(&hist);
+  ASSERT_EQ(0, hist.count);
+}
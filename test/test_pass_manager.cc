@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "jit/backend/x64/x64_backend.h"
+#include "jit/ir/ir.h"
+#include "jit/ir/passes/pass_manager.h"
+}
+
+static uint8_t ir_buffer[1024 * 1024];
+static char scratch_buffer[1024 * 1024];
+
+TEST(PassManagerTest, Parse) {
+  struct pass_manager *pm = pass_manager_create("lse,bogus,,dce", "dce",
+                                                x64_registers,
+                                                x64_num_registers);
+
+  // unknown and empty names are skipped
+  ASSERT_EQ(2, pm->num_passes);
+  ASSERT_STREQ("lse", pm->passes[0].info->name);
+  ASSERT_FALSE(pm->passes[0].print_after);
+  ASSERT_STREQ("dce", pm->passes[1].info->name);
+  ASSERT_TRUE(pm->passes[1].print_after);
+
+  pass_manager_destroy(pm);
+
+  pm = pass_manager_create("cprop,dce", "all", x64_registers,
+                           x64_num_registers);
+  ASSERT_TRUE(pm->passes[0].print_after);
+  ASSERT_TRUE(pm->passes[1].print_after);
+  pass_manager_destroy(pm);
+}
+
+TEST(PassManagerTest, RemoveAndHash) {
+  struct pass_manager *a = pass_manager_create("lse,cprop,fma,dce,ra", "",
+                                               x64_registers,
+                                               x64_num_registers);
+  struct pass_manager *b = pass_manager_create("lse,cprop,dce,ra", "",
+                                               x64_registers,
+                                               x64_num_registers);
+
+  ASSERT_NE(pass_manager_hash(a), pass_manager_hash(b));
+
+  ASSERT_TRUE(pass_manager_remove(a, "fma"));
+  ASSERT_FALSE(pass_manager_remove(a, "fma"));
+  ASSERT_EQ(4, a->num_passes);
+  ASSERT_EQ(pass_manager_hash(a), pass_manager_hash(b));
+
+  pass_manager_destroy(a);
+  pass_manager_destroy(b);
+}
+
+TEST(PassManagerTest, RunLast) {
+  struct pass_manager *pm = pass_manager_create("lse,cprop,dce,ra", "",
+                                                x64_registers,
+                                                x64_num_registers);
+  ASSERT_TRUE(pass_manager_run_last(pm, "ra"));
+  ASSERT_EQ(4, pm->num_passes);
+  pass_manager_destroy(pm);
+
+  // passes after register allocation would invalidate its assignments
+  pm = pass_manager_create("lse,ra,cprop,ra", "ra", x64_registers,
+                           x64_num_registers);
+  ASSERT_FALSE(pass_manager_run_last(pm, "ra"));
+  ASSERT_EQ(3, pm->num_passes);
+  ASSERT_STREQ("cprop", pm->passes[1].info->name);
+  ASSERT_STREQ("ra", pm->passes[2].info->name);
+  ASSERT_TRUE(pm->passes[2].print_after);
+  pass_manager_destroy(pm);
+
+  // and the backend can't assemble IR without it
+  pm = pass_manager_create("lse,dce", "", x64_registers, x64_num_registers);
+  ASSERT_FALSE(pass_manager_run_last(pm, "ra"));
+  ASSERT_EQ(3, pm->num_passes);
+  ASSERT_STREQ("ra", pm->passes[2].info->name);
+  pass_manager_destroy(pm);
+}
+
+TEST(PassManagerTest, Run) {
+  static const char input_str[] =
+      "i32 %0 = load_context i32 0x20\n"
+      "i32 %1 = add i32 0x1, i32 0x2\n"
+      "i32 %2 = add i32 %0, i32 %1\n"
+      "store_context i32 0x20, i32 %2\n";
+
+  static const char output_str[] =
+      "i32 %0 = load_context i32 0x20\n"
+      "i32 %1 = add i32 %0, i32 0x3\n"
+      "store_context i32 0x20, i32 %1\n";
+
+  struct ir ir = {};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  FILE *input = tmpfile();
+  fwrite(input_str, 1, sizeof(input_str) - 1, input);
+  rewind(input);
+  bool res = ir_read(input, &ir);
+  fclose(input);
+  ASSERT_TRUE(res);
+
+  struct pass_manager *pm =
+      pass_manager_create("cprop,dce", "", x64_registers, x64_num_registers);
+  pass_manager_run(pm, &ir);
+
+  // each pass is timed on every run
+  ASSERT_EQ(1, pm->passes[0].times.count);
+  ASSERT_EQ(1, pm->passes[1].times.count);
+
+  pass_manager_destroy(pm);
+
+  FILE *output = tmpfile();
+  ir_write(&ir, output);
+  rewind(output);
+  size_t n = fread(&scratch_buffer, 1, sizeof(scratch_buffer), output);
+  fclose(output);
+  ASSERT_NE(n, 0u);
+
+  ASSERT_STREQ(scratch_buffer, output_str);
+}
@@ -9,6 +9,8 @@ extern "C" {
 #include "hw/memory.h"
 #include "hw/scheduler.h"
 #include "hw/sh4/sh4.h"
+#include "hw/sh4/sh4_code_cache.h"
+#include "jit/frontend/sh4/sh4_analyze.h"
 #include "sys/exception_handler.h"
 }
 
@@ -84,7 +86,18 @@ static struct sh4_test_reg sh4_test_regs[] = {
 int sh4_num_test_regs =
     static_cast<int>(sizeof(sh4_test_regs) / sizeof(sh4_test_regs[0]));
 
-static void run_sh4_test(const struct sh4_test &test) {
+// run each test with every block compiled on first use, as well as with
+// every block interpreted (until it's run more than the maximum threshold),
+// and with blocks compiled as superblocks through static branches. looping
+// tests are also run with a low threshold, promoting their blocks from the
+// interpreter to the jit partway through
+static void run_sh4_test(const struct sh4_test &test, int jit_threshold,
+                         int superblock_instrs) {
+  int old_jit_threshold = OPTION_jit_threshold;
+  int old_superblock_instrs = OPTION_superblock_instrs;
+  OPTION_jit_threshold = jit_threshold;
+  OPTION_superblock_instrs = superblock_instrs;
+
   struct dreamcast *dc = dc_create(nullptr);
   CHECK_NOTNULL(dc);
 
@@ -135,11 +148,14 @@ static void run_sh4_test(const struct sh4_test &test) {
     uint32_t actual = *reinterpret_cast<const uint32_t *>(
         reinterpret_cast<const uint8_t *>(&dc->sh4->ctx) + reg.offset);
 
-    ASSERT_EQ(expected, actual) << reg.name << " expected: 0x" << std::hex
+    EXPECT_EQ(expected, actual) << reg.name << " expected: 0x" << std::hex
                                 << expected << ", actual 0x" << actual;
   }
 
   dc_destroy(dc);
+
+  OPTION_jit_threshold = old_jit_threshold;
+  OPTION_superblock_instrs = old_superblock_instrs;
 }
 
 // clang-format off
@@ -149,9 +165,9 @@ static void run_sh4_test(const struct sh4_test &test) {
                      xf1, xf2, xf3, xf4, xf5, xf6, xf7, xf8, xf9, xf10, xf11, \
                      xf12, xf13, xf14, xf15)                                  \
   sh4_ctx {                                                                   \
-    nullptr, nullptr, nullptr, nullptr, nullptr,                              \
-    0, 0,                                                                     \
-    0, 0, 0, 0, fpscr,                                                        \
+    nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,   \
+    0, 0, 0,                                                                  \
+    0, 0, 0, 0, 0, fpscr,                                                     \
     0, 0, 0,                                                                  \
     0, 0, 0,                                                                  \
     0, 0, 0,                                                                  \
@@ -187,9 +203,28 @@ static void run_sh4_test(const struct sh4_test &test) {
   };                                                                                                                                                                     \
   TEST(sh4_x64, name) {                                                                                                                                                  \
     exception_handler_install();                                                                                                                                         \
-    run_sh4_test(test_##name);                                                                                                                                           \
+    run_sh4_test(test_##name, 0, 0);                                                                                                                                     \
+    exception_handler_uninstall();                                                                                                                                       \
+  }                                                                                                                                                                      \
+  TEST(sh4_superblock, name) {                                                                                                                                           \
+    exception_handler_install();                                                                                                                                         \
+    run_sh4_test(test_##name, 0, 256);                                                                                                                                   \
+    exception_handler_uninstall();                                                                                                                                       \
+  }                                                                                                                                                                      \
+  TEST(sh4_interp, name) {                                                                                                                                               \
+    exception_handler_install();                                                                                                                                         \
+    run_sh4_test(test_##name, INT_MAX, 0);                                                                                                                               \
     exception_handler_uninstall();                                                                                                                                       \
   }
 #include "test_sh4.inc"
 #undef TEST_SH4
+
+#define TEST_SH4_PROMOTE(name)             \
+  TEST(sh4_promote, name) {                \
+    exception_handler_install();           \
+    run_sh4_test(test_##name, 2, 0);       \
+    exception_handler_uninstall();         \
+  }
+TEST_SH4_PROMOTE(test_dt)
+#undef TEST_SH4_PROMOTE
 // clang-format on
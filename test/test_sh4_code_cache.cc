@@ -0,0 +1,475 @@
+#include <gtest/gtest.h>
+#include <inttypes.h>
+#include <vector>
+
+extern "C" {
+#include "core/core.h"
+#include "core/log.h"
+#include "core/rb_tree.h"
+#include "hw/dreamcast.h"
+#include "hw/memory.h"
+#include "hw/sh4/sh4.h"
+#include "hw/sh4/sh4_code_cache.h"
+#include "sys/exception_handler.h"
+#include "sys/time.h"
+}
+
+static const int NUM_BLOCKS = 100000;
+static const int NUM_LOOKUPS = 1000000;
+
+// the rb_tree based maps previously used by the code cache, used as a
+// reference for both correctness and performance
+struct tree_block {
+  struct sh4_block *block;
+  struct rb_node it;
+  struct rb_node rit;
+};
+
+static int tree_block_cmp(const struct rb_node *rb_lhs,
+                          const struct rb_node *rb_rhs) {
+  const struct tree_block *lhs =
+      container_of(rb_lhs, const struct tree_block, it);
+  const struct tree_block *rhs =
+      container_of(rb_rhs, const struct tree_block, it);
+
+  return (int)((int64_t)lhs->block->guest_addr -
+               (int64_t)rhs->block->guest_addr);
+}
+
+static int tree_reverse_block_cmp(const struct rb_node *rb_lhs,
+                                  const struct rb_node *rb_rhs) {
+  const struct tree_block *lhs =
+      container_of(rb_lhs, const struct tree_block, rit);
+  const struct tree_block *rhs =
+      container_of(rb_rhs, const struct tree_block, rit);
+
+  return (int)(lhs->block->host_addr - rhs->block->host_addr);
+}
+
+static struct rb_callbacks tree_block_cb = {
+    &tree_block_cmp, NULL, NULL,
+};
+
+static struct rb_callbacks tree_reverse_block_cb = {
+    &tree_reverse_block_cmp, NULL, NULL,
+};
+
+static struct sh4_block *tree_lookup(struct rb_tree *t, uint32_t guest_addr) {
+  struct sh4_block search_block = {};
+  search_block.guest_addr = guest_addr;
+  struct tree_block search = {};
+  search.block = &search_block;
+
+  struct rb_node *it = rb_upper_bound(t, &search.it, &tree_block_cb);
+
+  if (it == rb_first(t)) {
+    return NULL;
+  }
+
+  it = it ? rb_prev(it) : rb_last(t);
+
+  struct sh4_block *block = container_of(it, struct tree_block, it)->block;
+
+  if (guest_addr - block->guest_addr >= (uint32_t)block->guest_size) {
+    return NULL;
+  }
+
+  return block;
+}
+
+static struct sh4_block *tree_lookup_reverse(struct rb_tree *t,
+                                             const uint8_t *host_addr) {
+  struct sh4_block search_block = {};
+  search_block.host_addr = host_addr;
+  struct tree_block search = {};
+  search.block = &search_block;
+
+  struct rb_node *rit = rb_upper_bound(t, &search.rit, &tree_reverse_block_cb);
+
+  if (rit == rb_first(t)) {
+    return NULL;
+  }
+
+  rit = rit ? rb_prev(rit) : rb_last(t);
+
+  struct sh4_block *block = container_of(rit, struct tree_block, rit)->block;
+
+  if ((uintptr_t)(host_addr - block->host_addr) >=
+      (uintptr_t)block->host_size) {
+    return NULL;
+  }
+
+  return block;
+}
+
+class BlockMapTest : public ::testing::Test {
+ public:
+  BlockMapTest()
+      : map(reinterpret_cast<struct sh4_block_map *>(
+            calloc(1, sizeof(struct sh4_block_map)))),
+        blocks(NUM_BLOCKS),
+        tree_blocks(NUM_BLOCKS),
+        tree(),
+        reverse_tree(),
+        seed(1) {
+    // generate contiguous blocks of guest and host code, similar to what is
+    // produced while running a game
+    uint32_t guest_addr = 0x8c010000;
+    uintptr_t host_addr = 0x10000000;
+
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+      struct sh4_block *block = &blocks[i];
+      block->guest_addr = guest_addr;
+      block->guest_size = 2 * (1 + next() % 32);
+      block->host_addr = reinterpret_cast<const uint8_t *>(host_addr);
+      block->host_size = 16 + next() % 256;
+
+      guest_addr += block->guest_size;
+      host_addr += block->host_size;
+
+      sh4_block_map_insert(map, block);
+
+      tree_blocks[i].block = block;
+      rb_insert(&tree, &tree_blocks[i].it, &tree_block_cb);
+      rb_insert(&reverse_tree, &tree_blocks[i].rit, &tree_reverse_block_cb);
+    }
+
+    guest_end = guest_addr;
+    host_end = host_addr;
+  }
+
+  ~BlockMapTest() {
+    free(map);
+  }
+
+  uint32_t next() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+  }
+
+  uint32_t random_guest_addr() {
+    return 0x8c010000 + (next() % (guest_end - 0x8c010000));
+  }
+
+  const uint8_t *random_host_addr() {
+    uintptr_t host_addr = 0x10000000 + (next() % (host_end - 0x10000000));
+    return reinterpret_cast<const uint8_t *>(host_addr);
+  }
+
+  struct sh4_block_map *map;
+  std::vector<struct sh4_block> blocks;
+  std::vector<struct tree_block> tree_blocks;
+  struct rb_tree tree;
+  struct rb_tree reverse_tree;
+  uint32_t guest_end;
+  uintptr_t host_end;
+  uint32_t seed;
+};
+
+TEST_F(BlockMapTest, Lookup) {
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    struct sh4_block *block = &blocks[i];
+
+    ASSERT_EQ(block, sh4_block_map_find(map, block->guest_addr));
+    ASSERT_EQ(nullptr, sh4_block_map_find(map, block->guest_addr + 1));
+  }
+
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    uint32_t guest_addr = random_guest_addr();
+    ASSERT_EQ(tree_lookup(&tree, guest_addr),
+              sh4_block_map_lookup(map, guest_addr));
+
+    const uint8_t *host_addr = random_host_addr();
+    ASSERT_EQ(tree_lookup_reverse(&reverse_tree, host_addr),
+              sh4_block_map_lookup_reverse(map, host_addr));
+  }
+
+  ASSERT_EQ(nullptr, sh4_block_map_lookup(map, 0x8c000000));
+  ASSERT_EQ(nullptr, sh4_block_map_lookup(map, guest_end));
+}
+
+TEST_F(BlockMapTest, Remove) {
+  // remove every other block, and make sure lookups inside of them fail
+  for (int i = 0; i < NUM_BLOCKS; i += 2) {
+    sh4_block_map_remove(map, &blocks[i]);
+  }
+
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    struct sh4_block *block = &blocks[i];
+    struct sh4_block *expected = (i % 2) ? block : nullptr;
+
+    ASSERT_EQ(expected, sh4_block_map_find(map, block->guest_addr));
+    ASSERT_EQ(expected, sh4_block_map_lookup(
+                            map, block->guest_addr + block->guest_size - 1));
+    ASSERT_EQ(expected, sh4_block_map_lookup_reverse(map, block->host_addr));
+  }
+}
+
+// timing comparison only, run manually with --gtest_also_run_disabled_tests
+TEST_F(BlockMapTest, DISABLED_Benchmark) {
+  std::vector<uint32_t> guest_addrs(NUM_LOOKUPS);
+  std::vector<const uint8_t *> host_addrs(NUM_LOOKUPS);
+
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    guest_addrs[i] = random_guest_addr();
+    host_addrs[i] = random_host_addr();
+  }
+
+  // accumulate the results so the lookups can't be optimized out
+  uintptr_t sum = 0;
+
+  int64_t start = time_nanoseconds();
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    sum += (uintptr_t)tree_lookup(&tree, guest_addrs[i]);
+  }
+  int64_t tree_guest_ns = time_nanoseconds() - start;
+
+  start = time_nanoseconds();
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    sum += (uintptr_t)sh4_block_map_lookup(map, guest_addrs[i]);
+  }
+  int64_t map_guest_ns = time_nanoseconds() - start;
+
+  start = time_nanoseconds();
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    sum += (uintptr_t)tree_lookup_reverse(&reverse_tree, host_addrs[i]);
+  }
+  int64_t tree_host_ns = time_nanoseconds() - start;
+
+  start = time_nanoseconds();
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    sum += (uintptr_t)sh4_block_map_lookup_reverse(map, host_addrs[i]);
+  }
+  int64_t map_host_ns = time_nanoseconds() - start;
+
+  LOG_INFO("%d blocks, %d lookups (checksum 0x%" PRIxPTR ")", NUM_BLOCKS,
+           NUM_LOOKUPS, sum);
+  LOG_INFO("guest lookup:   rb_tree %.1f ns, bucket map %.1f ns",
+           tree_guest_ns / (double)NUM_LOOKUPS,
+           map_guest_ns / (double)NUM_LOOKUPS);
+  LOG_INFO("reverse lookup: rb_tree %.1f ns, bucket map %.1f ns",
+           tree_host_ns / (double)NUM_LOOKUPS,
+           map_host_ns / (double)NUM_LOOKUPS);
+}
+
+static uint32_t run_until_return(struct dreamcast *dc, uint32_t pc) {
+  dc->sh4->ctx.pr = 0;
+  sh4_set_pc(dc->sh4, pc);
+
+  while (dc->sh4->ctx.pc) {
+    dc_tick(dc, 1);
+  }
+
+  return dc->sh4->ctx.r[0];
+}
+
+TEST(CodeCacheTest, WriteInvalidatesPage) {
+  exception_handler_install();
+
+  // compile blocks the first time they're run, only compiled code is watched
+  int old_jit_threshold = OPTION_jit_threshold;
+  OPTION_jit_threshold = 0;
+
+  struct dreamcast *dc = dc_create(nullptr);
+  CHECK_NOTNULL(dc);
+
+  struct address_space *space = dc->sh4->base.memory->space;
+  struct sh4_code_page *page =
+      &dc->sh4->code_cache->pages[CODE_PAGE(0x8c010000)];
+
+  // mov #1, r0; rts; nop
+  as_write16(space, 0x8c010100, 0xe001);
+  as_write16(space, 0x8c010102, 0x000b);
+  as_write16(space, 0x8c010104, 0x0009);
+  EXPECT_EQ(1u, run_until_return(dc, 0x8c010100));
+
+  // overwrite the immediate through a different mirror than the code was
+  // compiled from
+  as_write16(space, 0x0c010100, 0xe002);
+  EXPECT_EQ(2u, run_until_return(dc, 0x8c010100));
+  EXPECT_EQ(1, page->num_writes);
+  EXPECT_EQ(1, page->num_invalidations);
+
+  // mov.w r2, @r1; rts; nop, overwriting the immediate from compiled code
+  as_write16(space, 0x8c010000, 0x2121);
+  as_write16(space, 0x8c010002, 0x000b);
+  as_write16(space, 0x8c010004, 0x0009);
+  EXPECT_EQ(2, page->num_writes);
+
+  dc->sh4->ctx.r[1] = 0xac010100;
+  dc->sh4->ctx.r[2] = 0xe003;
+  run_until_return(dc, 0x8c010000);
+  EXPECT_EQ(3u, run_until_return(dc, 0x8c010100));
+  EXPECT_EQ(3, page->num_writes);
+
+  dc_destroy(dc);
+
+  OPTION_jit_threshold = old_jit_threshold;
+
+  exception_handler_uninstall();
+}
+
+TEST(CodeCacheTest, WriteResetsRunCount) {
+  exception_handler_install();
+
+  // interpret blocks twice before compiling them
+  int old_jit_threshold = OPTION_jit_threshold;
+  OPTION_jit_threshold = 2;
+
+  struct dreamcast *dc = dc_create(nullptr);
+  CHECK_NOTNULL(dc);
+
+  struct address_space *space = dc->sh4->base.memory->space;
+  struct sh4_cache *cache = dc->sh4->code_cache;
+
+  // mov #1, r0; rts; nop
+  as_write16(space, 0x8c010100, 0xe001);
+  as_write16(space, 0x8c010102, 0x000b);
+  as_write16(space, 0x8c010104, 0x0009);
+
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(1u, run_until_return(dc, 0x8c010100));
+  }
+  EXPECT_EQ(1, cache->num_interpreted);
+  EXPECT_EQ(1, cache->num_promoted);
+  EXPECT_EQ(0, cache->num_compiled);
+
+  EXPECT_EQ(1u, run_until_return(dc, 0x8c010100));
+  EXPECT_EQ(1, cache->num_compiled);
+
+  // the write invalidates the compiled block, and its code starts out cold
+  // again, being interpreted until it reaches the threshold once more
+  as_write16(space, 0x8c010100, 0xe002);
+  EXPECT_EQ(1, cache->num_invalidated);
+
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(2u, run_until_return(dc, 0x8c010100));
+  }
+  EXPECT_EQ(2, cache->num_interpreted);
+  EXPECT_EQ(2, cache->num_promoted);
+  EXPECT_EQ(1, cache->num_compiled);
+
+  EXPECT_EQ(2u, run_until_return(dc, 0x8c010100));
+  EXPECT_EQ(2, cache->num_compiled);
+
+  dc_destroy(dc);
+
+  OPTION_jit_threshold = old_jit_threshold;
+
+  exception_handler_uninstall();
+}
+
+static r32_cb pteh_read32;
+
+// forwards to the original handler, clobbering each register the calling
+// convention allows it to. compiled handlers may or may not touch them
+static uint32_t clobber_read32(void *data, uint32_t addr) {
+#if defined(__GNUC__) && defined(__x86_64__)
+  asm volatile(
+      "xor %%r8d, %%r8d\n"
+      "xor %%r9d, %%r9d\n"
+      "xor %%r10d, %%r10d\n"
+      "xor %%r11d, %%r11d\n"
+      "pxor %%xmm0, %%xmm0\n"
+      "pxor %%xmm1, %%xmm1\n"
+      "pxor %%xmm2, %%xmm2\n"
+      "pxor %%xmm3, %%xmm3\n"
+      "pxor %%xmm4, %%xmm4\n"
+      "pxor %%xmm5, %%xmm5\n"
+#if !PLATFORM_WINDOWS
+      "pxor %%xmm6, %%xmm6\n"
+      "pxor %%xmm7, %%xmm7\n"
+      "pxor %%xmm8, %%xmm8\n"
+      "pxor %%xmm9, %%xmm9\n"
+      "pxor %%xmm10, %%xmm10\n"
+      "pxor %%xmm11, %%xmm11\n"
+      "pxor %%xmm12, %%xmm12\n"
+      "pxor %%xmm13, %%xmm13\n"
+      "pxor %%xmm14, %%xmm14\n"
+      "pxor %%xmm15, %%xmm15\n"
+#endif
+      :
+      :
+      : "r8", "r9", "r10", "r11", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",
+        "xmm5"
+#if !PLATFORM_WINDOWS
+        ,
+        "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13",
+        "xmm14", "xmm15"
+#endif
+      );
+#endif
+
+  return pteh_read32(data, addr);
+}
+
+TEST(CodeCacheTest, MMIOPreservesLiveRegisters) {
+  exception_handler_install();
+
+  int old_jit_threshold = OPTION_jit_threshold;
+  OPTION_jit_threshold = 0;
+
+  struct dreamcast *dc = dc_create(nullptr);
+  CHECK_NOTNULL(dc);
+
+  struct address_space *space = dc->sh4->base.memory->space;
+
+  // keep a number of values live across a read of PTEH, whose address is
+  // loaded from the literal pool and resolved to a direct call to the
+  // register's handler at compile time
+  static const uint16_t code[] = {
+      0xd406,  // mov.l @(0x1c, pc), r4
+      0xf010,  // fadd fr1, fr0
+      0xf230,  // fadd fr3, fr2
+      0xf450,  // fadd fr5, fr4
+      0xf670,  // fadd fr7, fr6
+      0x356c,  // add r6, r5
+      0x378c,  // add r8, r7
+      0x6042,  // mov.l @r4, r0
+      0xf020,  // fadd fr2, fr0
+      0xf460,  // fadd fr6, fr4
+      0xf040,  // fadd fr4, fr0
+      0x357c,  // add r7, r5
+      0x000b,  // rts
+      0x0009,  // nop
+  };
+
+  for (int i = 0; i < (int)(sizeof(code) / sizeof(code[0])); i++) {
+    as_write16(space, 0x8c010200 + i * 2, code[i]);
+  }
+  as_write32(space, 0x8c01021c, 0xff000000);
+  as_write32(space, 0xff000000, 0x1234);
+
+  uint8_t *ptr;
+  struct physical_region *physical_region;
+  uint32_t physical_offset;
+  struct mmio_region *mmio_region;
+  uint32_t mmio_offset;
+  as_lookup(space, 0xff000000, &ptr, &physical_region, &physical_offset,
+            &mmio_region, &mmio_offset);
+  ASSERT_NE(nullptr, mmio_region);
+
+  pteh_read32 = mmio_region->read32;
+  mmio_region->read32 = &clobber_read32;
+
+  for (int i = 0; i < 8; i++) {
+    float f = (float)(i + 1);
+    memcpy(&dc->sh4->ctx.fr[i ^ 1], &f, sizeof(f));
+    dc->sh4->ctx.r[i + 1] = i + 1;
+  }
+
+  EXPECT_EQ(0x1234u, run_until_return(dc, 0x8c010200));
+
+  float fr0;
+  memcpy(&fr0, &dc->sh4->ctx.fr[1], sizeof(fr0));
+  EXPECT_EQ(36.0f, fr0);
+  EXPECT_EQ(5u + 6u + 7u + 8u, dc->sh4->ctx.r[5]);
+
+  mmio_region->read32 = pteh_read32;
+
+  dc_destroy(dc);
+
+  OPTION_jit_threshold = old_jit_threshold;
+
+  exception_handler_uninstall();
+}
@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+#include <set>
+#include <string>
+
+extern "C" {
+#include "hw/sh4/sh4_profiler.h"
+}
+
+// host addresses with the upper bit set are treated as compiled code, with the
+// guest address in the lower 32 bits
+#define COMPILED(guest_addr) ((uintptr_t)1 << 40 | (guest_addr))
+
+static bool resolve(void *data, uintptr_t host_pc, uint32_t *guest_pc) {
+  if (!(host_pc & COMPILED(0))) {
+    return false;
+  }
+
+  *guest_pc = (uint32_t)host_pc;
+  return true;
+}
+
+static std::string read_file(const char *filename) {
+  std::string contents;
+  FILE *file = fopen(filename, "r");
+
+  if (!file) {
+    return contents;
+  }
+
+  char buffer[256];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file))) {
+    contents.append(buffer, n);
+  }
+
+  fclose(file);
+  remove(filename);
+
+  return contents;
+}
+
+TEST(Sh4ProfilerTest, Stacks) {
+  const char *symbols = "/tmp/test_sh4_profiler.sym";
+  const char *report = "/tmp/test_sh4_profiler.txt";
+  const char *folded = "/tmp/test_sh4_profiler.folded";
+
+  // symbols match any mirror of the address they're given for
+  FILE *file = fopen(symbols, "w");
+  ASSERT_NE(nullptr, file);
+  fprintf(file, "8c010000 main\n0c020000 update\n");
+  fclose(file);
+
+  struct sh4_profiler *prof = sh4_profiler_create(symbols);
+  remove(symbols);
+
+  sh4_profiler_call(prof, 0x8c010000, 0x8c000010);
+  sh4_profiler_sample(prof, COMPILED(0x8c010004));
+  sh4_profiler_call(prof, 0x8c020000, 0x8c010010);
+  sh4_profiler_sample(prof, COMPILED(0x8c020008));
+  sh4_profiler_sample(prof, COMPILED(0x8c020008));
+  sh4_profiler_sample(prof, 0x1234);
+
+  // returns which don't match a call are ignored
+  sh4_profiler_return(prof, 0x8c0000f0);
+  sh4_profiler_return(prof, 0x8c010010);
+  sh4_profiler_sample(prof, COMPILED(0x8c010006));
+
+  sh4_profiler_flush(prof, &resolve, NULL);
+  ASSERT_TRUE(sh4_profiler_write(prof, report, folded));
+  sh4_profiler_destroy(prof);
+
+  std::string report_contents = read_file(report);
+  ASSERT_NE(std::string::npos,
+            report_contents.find("# 5 samples, 4 in compiled code, 0 dropped"));
+  ASSERT_NE(std::string::npos, report_contents.find("0x8c020008  update+0x8"));
+
+  // stacks are written in no particular order
+  std::set<std::string> lines;
+  std::string folded_contents = read_file(folded);
+  size_t start = 0, end;
+  while ((end = folded_contents.find('\n', start)) != std::string::npos) {
+    lines.insert(folded_contents.substr(start, end - start));
+    start = end + 1;
+  }
+
+  std::set<std::string> expected = {"main 2", "main;update 2",
+                                    "main;update;[host] 1"};
+  ASSERT_EQ(expected, lines);
+}
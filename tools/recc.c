@@ -1,25 +1,59 @@
 #include "core/log.h"
+#include "core/math.h"
 #include "core/option.h"
+#include "jit/backend/backend.h"
 #include "jit/backend/x64/x64_backend.h"
 #include "jit/frontend/sh4/sh4_frontend.h"
 #include "jit/ir/ir.h"
-#include "jit/ir/passes/conversion_elimination_pass.h"
-#include "jit/ir/passes/dead_code_elimination_pass.h"
-#include "jit/ir/passes/load_store_elimination_pass.h"
+#include "jit/ir/passes/pass_manager.h"
 #include "jit/ir/passes/pass_stat.h"
-#include "jit/ir/passes/register_allocation_pass.h"
+#include "jit/jit_stats.h"
 #include "sys/filesystem.h"
+#include "sys/time.h"
 
 DEFINE_OPTION_BOOL(help, false, "Show help");
-DEFINE_OPTION_STRING(pass, "lse,cve,dce,ra",
-                     "Comma-separated list of passes to run");
-DEFINE_OPTION_BOOL(print_after_all, true, "Print IR after each pass");
 DEFINE_OPTION_BOOL(stats, true, "Display pass stats");
+DEFINE_OPTION_INT(bench, 0,
+                  "Compile the input this many times, reporting the time taken "
+                  "by each pass and the backend instead of the IR");
+DEFINE_OPTION_STRING(bench_json, "",
+                     "File to also write the benchmark results to, as JSON");
 
+DEFINE_STAT(num_blocks, "Number of blocks processed");
 DEFINE_STAT(num_instrs, "Total number of instructions");
 DEFINE_STAT(num_instrs_removed, "Number of instructions removed");
+DEFINE_STAT(num_constant_loads,
+            "Number of guest loads from constant addresses, e.g. literal pool "
+            "loads which weren't folded by the frontend");
+
+#define BENCH_CODE_SIZE (32 * 1024 * 1024)
+#define BENCH_CODE_REGIONS 8
+
+typedef void (*block_cb)(void *, struct ir *);
+
+// each block is kept in the binary encoding while benchmarking, and decoded
+// again for every run as the passes modify it in place
+struct bench_block {
+  uint8_t *data;
+  int size;
+};
+
+struct bench {
+  struct bench_block *blocks;
+  int num_blocks;
+  int max_blocks;
+  int64_t num_instrs;
+
+  struct jit_histogram decode_times;
+  struct jit_histogram assemble_times;
+  struct jit_histogram total_times;
+  int64_t emitted_bytes;
+  int peak_arena;
+};
 
 static uint8_t ir_buffer[1024 * 1024];
+static uint8_t binary_buffer[1024 * 1024];
+static int64_t read_time;
 
 static int get_num_instrs(const struct ir *ir) {
   int n = 0;
@@ -32,68 +66,253 @@ static int get_num_instrs(const struct ir *ir) {
   return n;
 }
 
-static void process_file(const char *filename, bool disable_ir_dump) {
-  struct ir ir = {0};
-  ir.buffer = ir_buffer;
-  ir.capacity = sizeof(ir_buffer);
+static int get_num_constant_loads(const struct ir *ir) {
+  int n = 0;
 
-  // read in the input ir
-  FILE *input = fopen(filename, "r");
-  CHECK(input);
-  int r = ir_read(input, &ir);
-  fclose(input);
-  CHECK(r);
+  list_for_each_entry(instr, &ir->instrs, struct ir_instr, it) {
+    if ((instr->op == OP_LOAD_FAST || instr->op == OP_LOAD_SLOW) &&
+        ir_is_constant(instr->arg[0])) {
+      n++;
+    }
+  }
+
+  return n;
+}
 
-  int num_instrs_before = get_num_instrs(&ir);
+static void reset_ir(struct ir *ir) {
+  memset(ir, 0, sizeof(*ir));
+  ir->buffer = ir_buffer;
+  ir->capacity = sizeof(ir_buffer);
+}
 
-  // run optimization passes
-  char passes[MAX_OPTION_LENGTH];
-  strncpy(passes, OPTION_pass, sizeof(passes));
-
-  char *name = strtok(passes, ",");
-  while (name) {
-    if (!strcmp(name, "lse")) {
-      lse_run(&ir);
-    } else if (!strcmp(name, "cve")) {
-      cve_run(&ir);
-    } else if (!strcmp(name, "dce")) {
-      dce_run(&ir);
-    } else if (!strcmp(name, "ra")) {
-      ra_run(&ir, x64_registers, x64_num_registers);
-    } else {
-      LOG_WARNING("Unknown pass %s", name);
-    }
+static void bench_add_block(void *data, struct ir *ir) {
+  struct bench *bench = data;
+
+  int size = ir_write_binary(ir, binary_buffer, sizeof(binary_buffer));
+  CHECK(size);
+
+  if (bench->num_blocks == bench->max_blocks) {
+    bench->max_blocks = MAX(bench->max_blocks * 2, 1024);
+    bench->blocks = realloc(bench->blocks,
+                            bench->max_blocks * sizeof(struct bench_block));
+  }
+
+  struct bench_block *block = &bench->blocks[bench->num_blocks++];
+  block->data = malloc(size);
+  block->size = size;
+  memcpy(block->data, binary_buffer, size);
+
+  bench->num_instrs += get_num_instrs(ir);
+}
+
+static void bench_run(struct bench *bench, struct pass_manager *pm,
+                      struct jit_backend *backend, int iterations) {
+  int region = 0;
+
+  for (int i = 0; i < iterations; i++) {
+    for (int j = 0; j < bench->num_blocks; j++) {
+      struct bench_block *block = &bench->blocks[j];
+      struct ir ir;
+      reset_ir(&ir);
+
+      int64_t begin = time_nanoseconds();
+      int res = ir_read_binary(block->data, block->size, &ir);
+      CHECK(res);
+      int64_t decoded = time_nanoseconds();
 
-    // print IR after each pass if requested
-    if (!disable_ir_dump && OPTION_print_after_all) {
-      LOG_INFO("===-----------------------------------------------------===");
-      LOG_INFO("IR after %s", name);
-      LOG_INFO("===-----------------------------------------------------===");
-      ir_write(&ir, stdout);
-      LOG_INFO("");
+      pass_manager_run(pm, &ir);
+      int64_t optimized = time_nanoseconds();
+
+      // move on to the next region once the current one fills up, the same
+      // as the code cache does
+      int size = 0;
+      struct jit_exit exits[MAX_BLOCK_EXITS];
+      int num_exits = 0;
+      const uint8_t *code =
+          backend->assemble_code(backend, &ir, &size, exits, &num_exits);
+
+      if (!code) {
+        region = (region + 1) % backend->num_regions;
+        backend->begin_region(backend, region);
+        code = backend->assemble_code(backend, &ir, &size, exits, &num_exits);
+        CHECK_NOTNULL(code);
+      }
+
+      int64_t end = time_nanoseconds();
+
+      jit_histogram_add(&bench->decode_times, decoded - begin);
+      jit_histogram_add(&bench->assemble_times, end - optimized);
+      jit_histogram_add(&bench->total_times, end - begin);
+
+      if (!i) {
+        bench->emitted_bytes += size;
+      }
+      bench->peak_arena = MAX(bench->peak_arena, ir.used);
     }
+  }
+}
+
+static void bench_print_stage(struct bench *bench, const char *name,
+                              const struct jit_histogram *hist,
+                              int iterations) {
+  double instrs_per_sec =
+      hist->total ? bench->num_instrs * iterations * 1e9 / hist->total : 0.0;
+
+  LOG_INFO("%-10s %12.1f %12.1f %12.1f %14.0f", name,
+           (double)jit_histogram_mean(hist),
+           (double)jit_histogram_percentile(hist, 99), (double)hist->max,
+           instrs_per_sec);
+}
+
+static void bench_write_stage(struct bench *bench, const char *name,
+                              const struct jit_histogram *hist,
+                              int iterations, bool last, FILE *output) {
+  double instrs_per_sec =
+      hist->total ? bench->num_instrs * iterations * 1e9 / hist->total : 0.0;
 
-    name = strtok(NULL, ",");
+  fprintf(output,
+          "    {\"name\": \"%s\", \"ns_per_block\": %.1f, \"p99_ns\": %.1f, "
+          "\"max_ns\": %.1f, \"instrs_per_sec\": %.0f}%s\n",
+          name, (double)jit_histogram_mean(hist),
+          (double)jit_histogram_percentile(hist, 99), (double)hist->max,
+          instrs_per_sec, last ? "" : ",");
+}
+
+static void bench_report(struct bench *bench, struct pass_manager *pm,
+                         int iterations) {
+  LOG_INFO("Benchmarked %d blocks, %d instrs, %d iterations",
+           bench->num_blocks, (int)bench->num_instrs, iterations);
+  LOG_INFO("%-10s %12s %12s %12s %14s", "stage", "ns/block", "p99 ns",
+           "max ns", "instrs/sec");
+
+  bench_print_stage(bench, "decode", &bench->decode_times, iterations);
+  for (int i = 0; i < pm->num_passes; i++) {
+    bench_print_stage(bench, pm->passes[i].info->name, &pm->passes[i].times,
+                      iterations);
   }
+  bench_print_stage(bench, "assemble", &bench->assemble_times, iterations);
+  bench_print_stage(bench, "total", &bench->total_times, iterations);
+
+  LOG_INFO("Emitted %d bytes of host code, %.1f per block",
+           (int)bench->emitted_bytes,
+           bench->emitted_bytes / (double)MAX(bench->num_blocks, 1));
+  LOG_INFO("Peak IR arena usage %d bytes", bench->peak_arena);
+
+  if (!*OPTION_bench_json) {
+    return;
+  }
+
+  FILE *output = fopen(OPTION_bench_json, "w");
+
+  if (!output) {
+    LOG_WARNING("Failed to open %s", OPTION_bench_json);
+    return;
+  }
+
+  fprintf(output, "{\n");
+  fprintf(output, "  \"blocks\": %d,\n", bench->num_blocks);
+  fprintf(output, "  \"instrs\": %d,\n", (int)bench->num_instrs);
+  fprintf(output, "  \"iterations\": %d,\n", iterations);
+  fprintf(output, "  \"passes\": \"%s\",\n", OPTION_jit_passes);
+  fprintf(output, "  \"emitted_bytes\": %d,\n", (int)bench->emitted_bytes);
+  fprintf(output, "  \"peak_arena_bytes\": %d,\n", bench->peak_arena);
+  fprintf(output, "  \"stages\": [\n");
+
+  bench_write_stage(bench, "decode", &bench->decode_times, iterations, false,
+                    output);
+  for (int i = 0; i < pm->num_passes; i++) {
+    bench_write_stage(bench, pm->passes[i].info->name, &pm->passes[i].times,
+                      iterations, false, output);
+  }
+  bench_write_stage(bench, "assemble", &bench->assemble_times, iterations,
+                    false, output);
+  bench_write_stage(bench, "total", &bench->total_times, iterations, true,
+                    output);
+
+  fprintf(output, "  ]\n");
+  fprintf(output, "}\n");
+  fclose(output);
 
-  int num_instrs_after = get_num_instrs(&ir);
+  LOG_INFO("Wrote benchmark results to %s", OPTION_bench_json);
+}
 
-  // print out the final IR
-  if (!disable_ir_dump && !OPTION_print_after_all) {
-    ir_write(&ir, stdout);
+static void bench_destroy(struct bench *bench) {
+  for (int i = 0; i < bench->num_blocks; i++) {
+    free(bench->blocks[i].data);
   }
 
+  free(bench->blocks);
+}
+
+static void process_ir(void *data, struct ir *ir) {
+  struct pass_manager *pm = data;
+
+  int num_instrs_before = get_num_instrs(ir);
+  STAT_num_constant_loads += get_num_constant_loads(ir);
+
+  // run optimization passes
+  pass_manager_run(pm, ir);
+
+  int num_instrs_after = get_num_instrs(ir);
+
+  STAT_num_blocks++;
   STAT_num_instrs += num_instrs_before;
   STAT_num_instrs_removed += num_instrs_before - num_instrs_after;
 }
 
-static void process_dir(const char *path) {
+static void print_ir(void *data, struct ir *ir) {
+  process_ir(data, ir);
+
+  // print out the final IR if it wasn't printed after the passes
+  if (!*OPTION_jit_print_after) {
+    ir_write(ir, stdout);
+  }
+}
+
+static void read_file(const char *filename, block_cb cb, void *data) {
+  struct ir ir;
+  reset_ir(&ir);
+
+  FILE *input = fopen(filename, "rb");
+  CHECK(input);
+
+  // a text file holds a single block, while a binary file such as a corpus
+  // captured with --ir_corpus holds any number of them
+  if (!ir_file_is_binary(input)) {
+    int64_t begin = time_nanoseconds();
+    int r = ir_read(input, &ir);
+    read_time += time_nanoseconds() - begin;
+    CHECK(r);
+
+    cb(data, &ir);
+  } else {
+    struct ir_file_header header;
+
+    while (1) {
+      int64_t begin = time_nanoseconds();
+      int r = ir_read_file(input, &ir, &header, NULL, 0);
+      read_time += time_nanoseconds() - begin;
+
+      if (!r) {
+        break;
+      }
+
+      cb(data, &ir);
+
+      reset_ir(&ir);
+    }
+  }
+
+  fclose(input);
+}
+
+static void read_dir(const char *path, block_cb cb, void *data) {
   DIR *dir = opendir(path);
 
   if (dir) {
-    struct dirent *ent = readdir(dir);
+    struct dirent *ent;
 
-    while (ent) {
+    while ((ent = readdir(dir))) {
       if (!(ent->d_type & DT_REG)) {
         continue;
       }
@@ -104,13 +323,54 @@ static void process_dir(const char *path) {
 
       LOG_INFO("processing %s", filename);
 
-      process_file(filename, true);
+      read_file(filename, cb, data);
     }
 
     closedir(dir);
   }
 }
 
+static void read_path(const char *path, block_cb cb, void *data) {
+  if (fs_isfile(path)) {
+    read_file(path, cb, data);
+  } else {
+    read_dir(path, cb, data);
+  }
+}
+
+static int bench_main(const char *path) {
+  // the input is loaded up front, so the time taken to read it from disk
+  // isn't included in the results
+  struct bench bench = {0};
+  read_path(path, &bench_add_block, &bench);
+
+  // the generated code is never run, so the backend doesn't need a guest to
+  // dispatch to or memory to access
+  struct jit_memory_interface memory_if = {0};
+  struct jit_guest guest = {0};
+  struct jit_backend *backend = x64_backend_create(
+      &memory_if, &guest, BENCH_CODE_SIZE, BENCH_CODE_REGIONS, "auto");
+
+  // verifying the IR between passes would skew the total compile time
+  struct pass_manager *pm =
+      pass_manager_create(OPTION_jit_passes, "", backend->registers,
+                          backend->num_registers);
+  pm->verify = false;
+
+  if (!pass_manager_run_last(pm, "ra")) {
+    LOG_WARNING("jit_passes must end with ra, running it last");
+  }
+
+  bench_run(&bench, pm, backend, OPTION_bench);
+  bench_report(&bench, pm, OPTION_bench);
+
+  pass_manager_destroy(pm);
+  x64_backend_destroy(backend);
+  bench_destroy(&bench);
+
+  return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv) {
   options_parse(&argc, &argv);
 
@@ -121,15 +381,33 @@ int main(int argc, char **argv) {
 
   const char *path = argv[1];
 
-  if (fs_isfile(path)) {
-    process_file(path, false);
-  } else {
-    process_dir(path);
+  if (OPTION_bench > 0) {
+    return bench_main(path);
   }
 
+  // the IR isn't dumped when processing an entire directory
+  bool is_file = fs_isfile(path);
+  const char *print_after = is_file ? OPTION_jit_print_after : "";
+  struct pass_manager *pm = pass_manager_create(
+      OPTION_jit_passes, print_after, x64_registers, x64_num_registers);
+
+  read_path(path, is_file ? &print_ir : &process_ir, pm);
+
   if (OPTION_stats) {
     pass_stat_print_all();
+
+    LOG_INFO("Read %d blocks in %.1f us", STAT_num_blocks,
+             read_time / 1000.0);
+
+    for (int i = 0; i < pm->num_passes; i++) {
+      struct pass_manager_pass *pass = &pm->passes[i];
+
+      LOG_INFO("%s: %.1f us total, %.1f us max", pass->info->desc,
+               pass->times.total / 1000.0, pass->times.max / 1000.0);
+    }
   }
 
+  pass_manager_destroy(pm);
+
   return EXIT_SUCCESS;
 }